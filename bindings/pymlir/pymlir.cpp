@@ -25,6 +25,7 @@
 #include "mlir/Transforms/Passes.h"
 #include "tpu_mlir/Dialect/Top/IR/TopOps.h"
 #include "tpu_mlir/Dialect/Tpu/IR/TpuOps.h"
+#include "tpu_mlir/Support/MixPrecision.h"
 #include "tpu_mlir/Support/ModuleInterpreter.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/IR/IRBuilder.h"
@@ -142,6 +143,28 @@ public:
 
   void clear_hooks() { interpreter_->clear_hooks(); }
 
+  void set_calibration_table(std::string filename) {
+    interpreter_->set_calibration_table(filename);
+  }
+  void set_quant_mode(std::string mode) { interpreter_->set_quant_mode(mode); }
+  void set_op_quant_mode(std::string name, std::string mode) {
+    interpreter_->set_op_quant_mode(name, mode);
+  }
+  void clear_quant_mode() { interpreter_->clear_quant_mode(); }
+
+  void decode_init(std::vector<std::string> past,
+                   std::vector<std::string> present, int64_t axis) {
+    interpreter_->decode_init(past, present, axis);
+  }
+  void decode_step() {
+    if (interpreter_->decode_full()) {
+      throw std::runtime_error("kv caches are full, decode_reset first");
+    }
+    interpreter_->decode_step();
+  }
+  void decode_reset() { interpreter_->decode_reset(); }
+  int64_t decode_position() { return interpreter_->decode_position(); }
+
   static void set_mem_mode(std::string mem_mode) {
     py_module::gmem_mode_str_ = mem_mode;
   }
@@ -220,6 +243,14 @@ public:
 
   void invoke_from(const std::string name) { interpreter_->invoke_from(name); }
 
+  py::array invoke_to(const std::string name) {
+    auto tensor = interpreter_->invoke_to(name);
+    auto shape = interpreter_->getTensorShape(name);
+    return getPyArray(std::move(tensor), shape);
+  }
+
+  ModuleInterpreter &interpreter() { return *interpreter_; }
+
 public:
   py::list all_tensor_names;
   py::list all_weight_names;
@@ -237,6 +268,52 @@ private:
 
 void set_mem_mode(std::string mem_mode) { py_module::set_mem_mode(mem_mode); }
 
+class py_mix_searcher {
+public:
+  py_mix_searcher(py_module &ref, py_module &quant)
+      : searcher_(checked(ref), checked(quant)) {}
+
+  void run(std::vector<py::array_t<float, py::array::c_style |
+                                              py::array::forcecast>>
+               inputs) {
+    std::vector<const float *> data;
+    std::vector<size_t> sizes;
+    for (auto &in : inputs) {
+      data.push_back(in.data());
+      sizes.push_back(in.size());
+    }
+    searcher_.run(data, sizes);
+  }
+
+  void set_compare_layers(std::vector<std::string> names,
+                          std::vector<float> rates) {
+    searcher_.set_compare_layers(names, rates);
+  }
+  std::vector<std::pair<std::string, double>> layer_cos() {
+    return searcher_.layer_cos();
+  }
+  double outputs_loss(std::string type) {
+    return searcher_.outputs_loss(type);
+  }
+  std::vector<std::string> search(double min_cos, int64_t max_num,
+                                  std::vector<std::string> candidates) {
+    return searcher_.search(min_cos, max_num, candidates);
+  }
+  int64_t num_sample() { return searcher_.num_sample(); }
+
+private:
+  static ModuleInterpreter &checked(py_module &module) {
+    auto &interpreter = module.interpreter();
+    if (interpreter.get_mem_mode() ==
+        ModuleInterpreter::mem_mode_t::ALL_TENSOR_IN_REUSED_MEM) {
+      throw std::runtime_error(
+          "mix_searcher needs modules loaded after set_mem_mode(\"value_mem\")");
+    }
+    return interpreter;
+  }
+  MixPrecSearcher searcher_;
+};
+
 void debug_only(std::vector<std::string> debug_types) {
   llvm::DebugFlag = true;
   std::vector<const char *> c_debug;
@@ -282,15 +359,37 @@ PYBIND11_MODULE(pymlir, m) {
       .def("invoke_at", &py_module::invoke_at, "invote at specified layer")
       .def("backward_weight_at", &py_module::backward_weight_at, "invoke the backward weight function of conv op")
       .def("invoke_from", &py_module::invoke_from, "invote from specified layer to the end")
+      .def("invoke_to", &py_module::invoke_to, "invoke the layers specified layer depends on")
       .def("get_tensor_qinfo", &py_module::format_tensor_qinfo, "get simple quant info of tensor")
       .def("before_invoke", &py_module::before_invoke, "add a before hook")
       .def("after_invoke", &py_module::after_invoke, "add a before hook")
       .def("clear_hooks", &py_module::clear_hooks, "clear hooks")
+      .def("set_calibration_table", &py_module::set_calibration_table, "thresholds of virtual lowering")
+      .def("set_quant_mode", &py_module::set_quant_mode, "fake quant all ops of top mlir")
+      .def("set_op_quant_mode", &py_module::set_op_quant_mode, "fake quant one op of top mlir")
+      .def("clear_quant_mode", &py_module::clear_quant_mode, "run top mlir in float again")
+      .def("decode_init", &py_module::decode_init, py::arg("past"),
+           py::arg("present"), py::arg("axis") = 1,
+           "keep kv caches in the interpreter for incremental decode")
+      .def("decode_step", &py_module::decode_step,
+           "invoke one step and append present into the kv caches")
+      .def("decode_reset", &py_module::decode_reset, "empty the kv caches")
+      .def_property_readonly("decode_position", &py_module::decode_position)
       .def_readonly("input_names", &py_module::input_names)
       .def_readonly("output_names", &py_module::output_names)
       .def_readonly("all_tensor_names", &py_module::all_tensor_names)
       .def_readonly("all_weight_names", &py_module::all_weight_names)
       .def_readonly_static("version", &py_module::version);
+  py::class_<py_mix_searcher>(m, "mix_searcher", "search mix precision layers")
+      .def(py::init<py_module &, py_module &>(), py::keep_alive<1, 2>(), py::keep_alive<1, 3>())
+      .def("run", &py_mix_searcher::run, "co-execute both modules on one sample")
+      .def("set_compare_layers", &py_mix_searcher::set_compare_layers,
+           py::arg("names"), py::arg("rates") = std::vector<float>())
+      .def("layer_cos", &py_mix_searcher::layer_cos, "average cos of each layer")
+      .def("outputs_loss", &py_mix_searcher::outputs_loss, py::arg("type") = "cos")
+      .def("search", &py_mix_searcher::search, py::arg("min_cos"), py::arg("max_num"),
+           py::arg("candidates") = std::vector<std::string>())
+      .def("num_sample", &py_mix_searcher::num_sample);
 
   // clang-format on
 }
@@ -1,51 +1,258 @@
-#include<stdlib.h>
-#include<stdio.h>
-#include<assert.h>
-
-typedef long int intptr_t;
-// Define Memref Descriptor
-typedef struct MemrefDescriptor {
-    float* allocated;
-    float* aligned;
-    intptr_t offset;
-    intptr_t sizes[4];
-    intptr_t strides[4];
-}Memref;
-
-// C interface of model
-// input: arg1  output: arg0
-void _mlir_ciface_model(Memref* arg0, Memref* arg1);
-
-int main(int argc, char** argv){
-    Memref* arg0 = (Memref*)malloc(sizeof(Memref));
-    Memref* arg1 = (Memref*)malloc(sizeof(Memref));
-
-    FILE* data_in = fopen("data_for_capi.txt","r");
-    
-    fscanf(data_in, "%ld", &arg1->sizes[0]);
-    fscanf(data_in, "%ld", &arg1->sizes[1]);
-    fscanf(data_in, "%ld", &arg1->sizes[2]);
-    fscanf(data_in, "%ld", &arg1->sizes[3]);
-
-    intptr_t in_size;
-    fscanf(data_in, "%ld", &in_size);
-    arg1->aligned = (float*)malloc(sizeof(float) * in_size);
-    for(int i = 0; i < in_size; i++){
-        float a;
-        fscanf(data_in, "%f", &a);
-        arg1->aligned[i] = a;
-    }
-    fclose(data_in);
+//===----------------------------------------------------------------------===//
+//
+// Copyright (C) 2022 Sophgo Technologies Inc.  All rights reserved.
+//
+// TPU-MLIR is licensed under the 2-Clause BSD License except for the
+// third-party components.
+//
+//===----------------------------------------------------------------------===//
 
-    _mlir_ciface_model(arg0, arg1);
+#define _POSIX_C_SOURCE 200112L
+#include "runtime_cpu.h"
 
-    char name[100] = "inference_result.txt";
-    FILE* data_out = fopen(name, "w");
-    assert(argc == 2);    //> a.out out_size
-    intptr_t out_size = atol(argv[1]);
-    for(int i = 0; i < out_size; i++) {
-        fprintf(data_out, "%f\n", arg0->aligned[i]);
-    }
-    fclose(data_out);
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void tpu_cpu_memref_wrap(tpu_cpu_memref_t *m, float *data, int rank,
+                         const int64_t *shape) {
+  memset(m, 0, sizeof(*m));
+  m->allocated = data;
+  m->aligned = data;
+  m->offset = 0;
+  intptr_t stride = 1;
+  for (int i = rank - 1; i >= 0; i--) {
+    m->dims[i] = shape[i];
+    m->dims[rank + i] = stride;
+    stride *= shape[i];
+  }
+}
+
+int64_t tpu_cpu_memref_numel(const tpu_cpu_memref_t *m, int rank) {
+  int64_t numel = 1;
+  for (int i = 0; i < rank; i++) {
+    numel *= m->dims[i];
+  }
+  return numel;
+}
+
+// The entry is a C function taking `n` descriptor pointers.
+typedef void *P;
+#define P1 P
+#define P2 P1, P
+#define P3 P2, P
+#define P4 P3, P
+#define P5 P4, P
+#define P6 P5, P
+#define P7 P6, P
+#define P8 P7, P
+#define P9 P8, P
+#define P10 P9, P
+#define P11 P10, P
+#define P12 P11, P
+#define P13 P12, P
+#define P14 P13, P
+#define P15 P14, P
+#define P16 P15, P
+#define A1 a[0]
+#define A2 A1, a[1]
+#define A3 A2, a[2]
+#define A4 A3, a[3]
+#define A5 A4, a[4]
+#define A6 A5, a[5]
+#define A7 A6, a[6]
+#define A8 A7, a[7]
+#define A9 A8, a[8]
+#define A10 A9, a[9]
+#define A11 A10, a[10]
+#define A12 A11, a[11]
+#define A13 A12, a[12]
+#define A14 A13, a[13]
+#define A15 A14, a[14]
+#define A16 A15, a[15]
+#define CALL_CASE(n)                                                           \
+  case n:                                                                      \
+    ((void (*)(P##n))entry)(A##n);                                             \
     return 0;
-}
\ No newline at end of file
+
+static int call_entry(tpu_cpu_entry_t entry, void **a, int n) {
+  switch (n) {
+    CALL_CASE(1)
+    CALL_CASE(2)
+    CALL_CASE(3)
+    CALL_CASE(4)
+    CALL_CASE(5)
+    CALL_CASE(6)
+    CALL_CASE(7)
+    CALL_CASE(8)
+    CALL_CASE(9)
+    CALL_CASE(10)
+    CALL_CASE(11)
+    CALL_CASE(12)
+    CALL_CASE(13)
+    CALL_CASE(14)
+    CALL_CASE(15)
+    CALL_CASE(16)
+  default:
+    fprintf(stderr, "tpu_cpu: %d tensors exceed %d\n", n, TPU_CPU_MAX_ARGS);
+    return -1;
+  }
+}
+
+int tpu_cpu_run(tpu_cpu_entry_t entry, tpu_cpu_memref_t **inputs,
+                int num_inputs, tpu_cpu_memref_t **outputs, int num_outputs) {
+  void *args[TPU_CPU_MAX_ARGS];
+  int n = num_inputs + num_outputs;
+  if (n > TPU_CPU_MAX_ARGS) {
+    fprintf(stderr, "tpu_cpu: %d tensors exceed %d\n", n, TPU_CPU_MAX_ARGS);
+    return -1;
+  }
+  for (int i = 0; i < num_inputs; i++) {
+    args[i] = inputs[i];
+  }
+  for (int i = 0; i < num_outputs; i++) {
+    args[num_inputs + i] = outputs[i];
+  }
+  return call_entry(entry, args, n);
+}
+
+int tpu_cpu_run_returned(tpu_cpu_entry_t entry, tpu_cpu_memref_t **inputs,
+                         int num_inputs, tpu_cpu_memref_t *output,
+                         int output_rank) {
+  void *args[TPU_CPU_MAX_ARGS];
+  tpu_cpu_memref_t result;
+  if (num_inputs + 1 > TPU_CPU_MAX_ARGS) {
+    fprintf(stderr, "tpu_cpu: %d tensors exceed %d\n", num_inputs + 1,
+            TPU_CPU_MAX_ARGS);
+    return -1;
+  }
+  memset(&result, 0, sizeof(result));
+  args[0] = &result;
+  for (int i = 0; i < num_inputs; i++) {
+    args[i + 1] = inputs[i];
+  }
+  int ret = call_entry(entry, args, num_inputs + 1);
+  if (ret != 0) {
+    return ret;
+  }
+  int64_t numel = tpu_cpu_memref_numel(output, output_rank);
+  memcpy(output->aligned + output->offset, result.aligned + result.offset,
+         numel * sizeof(float));
+  free(result.allocated);
+  return 0;
+}
+
+#ifndef TPU_CPU_NO_MAIN
+
+void _mlir_ciface_model(void);
+
+static float *alloc_data(int64_t numel) {
+  void *ptr = NULL;
+  if (posix_memalign(&ptr, 64, numel * sizeof(float) + 64) != 0) {
+    return NULL;
+  }
+  return (float *)ptr;
+}
+
+// a.out <input.bin> <output.bin> <out_shape>...
+// input.bin: int64 num, then per input: int64 rank, int64 shape[rank],
+// float data[]. output.bin: raw float data of all outputs.
+int main(int argc, char **argv) {
+  if (argc < 4) {
+    fprintf(stderr, "usage: %s input.bin output.bin 1x3x224x224 ...\n",
+            argv[0]);
+    return 1;
+  }
+  FILE *fin = fopen(argv[1], "rb");
+  if (!fin) {
+    fprintf(stderr, "can't open %s\n", argv[1]);
+    return 1;
+  }
+  int64_t num_inputs = 0;
+  int num_outputs = argc - 3;
+  tpu_cpu_memref_t ins[TPU_CPU_MAX_ARGS], outs[TPU_CPU_MAX_ARGS];
+  tpu_cpu_memref_t *in_ptrs[TPU_CPU_MAX_ARGS], *out_ptrs[TPU_CPU_MAX_ARGS];
+  int out_ranks[TPU_CPU_MAX_ARGS];
+  if (fread(&num_inputs, sizeof(int64_t), 1, fin) != 1 ||
+      num_inputs + num_outputs > TPU_CPU_MAX_ARGS) {
+    fprintf(stderr, "bad input file %s\n", argv[1]);
+    return 1;
+  }
+  for (int i = 0; i < num_inputs; i++) {
+    int64_t rank = 0, shape[TPU_CPU_MAX_RANK];
+    if (fread(&rank, sizeof(int64_t), 1, fin) != 1 || rank < 0 ||
+        rank > TPU_CPU_MAX_RANK ||
+        fread(shape, sizeof(int64_t), rank, fin) != (size_t)rank) {
+      fprintf(stderr, "bad input file %s\n", argv[1]);
+      return 1;
+    }
+    int64_t numel = 1;
+    for (int d = 0; d < rank; d++) {
+      numel *= shape[d];
+    }
+    float *data = alloc_data(numel);
+    if (!data || fread(data, sizeof(float), numel, fin) != (size_t)numel) {
+      fprintf(stderr, "bad input file %s\n", argv[1]);
+      return 1;
+    }
+    tpu_cpu_memref_wrap(&ins[i], data, (int)rank, shape);
+    in_ptrs[i] = &ins[i];
+  }
+  fclose(fin);
+
+  for (int i = 0; i < num_outputs; i++) {
+    int64_t shape[TPU_CPU_MAX_RANK];
+    int rank = 0;
+    char *p = argv[3 + i];
+    while (*p && rank < TPU_CPU_MAX_RANK) {
+      shape[rank++] = strtol(p, &p, 10);
+      if (*p == 'x') {
+        p++;
+      }
+    }
+    int64_t numel = 1;
+    for (int d = 0; d < rank; d++) {
+      numel *= shape[d];
+    }
+    float *data = alloc_data(numel);
+    if (!data) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+    }
+    tpu_cpu_memref_wrap(&outs[i], data, rank, shape);
+    out_ptrs[i] = &outs[i];
+    out_ranks[i] = rank;
+  }
+
+  tpu_cpu_entry_t entry = (tpu_cpu_entry_t)_mlir_ciface_model;
+#ifdef TPU_CPU_RESULT_RETURNED
+  int ret = num_outputs == 1
+                ? tpu_cpu_run_returned(entry, in_ptrs, (int)num_inputs,
+                                       out_ptrs[0], out_ranks[0])
+                : -1;
+#else
+  int ret = tpu_cpu_run(entry, in_ptrs, (int)num_inputs, out_ptrs, num_outputs);
+#endif
+  if (ret != 0) {
+    fprintf(stderr, "model run failed\n");
+    return 1;
+  }
+
+  FILE *fout = fopen(argv[2], "wb");
+  if (!fout) {
+    fprintf(stderr, "can't open %s\n", argv[2]);
+    return 1;
+  }
+  for (int i = 0; i < num_outputs; i++) {
+    fwrite(outs[i].aligned, sizeof(float),
+           tpu_cpu_memref_numel(&outs[i], out_ranks[i]), fout);
+    free(outs[i].allocated);
+  }
+  fclose(fout);
+  for (int i = 0; i < num_inputs; i++) {
+    free(ins[i].allocated);
+  }
+  return 0;
+}
+
+#endif // TPU_CPU_NO_MAIN
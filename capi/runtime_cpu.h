@@ -0,0 +1,61 @@
+//===----------------------------------------------------------------------===//
+//
+// Copyright (C) 2022 Sophgo Technologies Inc.  All rights reserved.
+//
+// TPU-MLIR is licensed under the 2-Clause BSD License except for the
+// third-party components.
+//
+//===----------------------------------------------------------------------===//
+//
+// C API of models compiled for the cpu target. The compiled object exports
+// `_mlir_ciface_model`, which takes one memref descriptor per tensor.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef TPU_MLIR_RUNTIME_CPU_H
+#define TPU_MLIR_RUNTIME_CPU_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TPU_CPU_MAX_RANK 8
+#define TPU_CPU_MAX_ARGS 16
+
+// Layout compatible with the memref descriptor of any rank up to
+// TPU_CPU_MAX_RANK: sizes are dims[0, rank), strides are dims[rank, 2 * rank).
+typedef struct {
+  float *allocated;
+  float *aligned;
+  intptr_t offset;
+  intptr_t dims[2 * TPU_CPU_MAX_RANK];
+} tpu_cpu_memref_t;
+
+typedef void (*tpu_cpu_entry_t)(void);
+
+// Describe caller owned contiguous data. Nothing is copied or allocated.
+void tpu_cpu_memref_wrap(tpu_cpu_memref_t *m, float *data, int rank,
+                         const int64_t *shape);
+
+int64_t tpu_cpu_memref_numel(const tpu_cpu_memref_t *m, int rank);
+
+// Run a model built with results as out params (the linalg lowering):
+// `entry(inputs..., outputs...)`, results are written into `outputs` in place.
+// Return 0 on success.
+int tpu_cpu_run(tpu_cpu_entry_t entry, tpu_cpu_memref_t **inputs,
+                int num_inputs, tpu_cpu_memref_t **outputs, int num_outputs);
+
+// Run a model that returns its single result (the tosa lowering):
+// `entry(result, inputs...)`. The result is copied into `output` and the
+// buffer allocated by the model is released. Return 0 on success.
+int tpu_cpu_run_returned(tpu_cpu_entry_t entry, tpu_cpu_memref_t **inputs,
+                         int num_inputs, tpu_cpu_memref_t *output,
+                         int output_rank);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TPU_MLIR_RUNTIME_CPU_H
@@ -12,6 +12,7 @@
 #include "mlir/Dialect/Linalg/IR/Linalg.h"
 #include "tpu-mlir/Dialect/SG2260/IR/StructuredOpsInterfaces.h"
 #include "tpu-mlir/Transforms/StructuredTransform.h"
+#include <map>
 
 namespace tpu_mlir {
 using namespace mlir;
@@ -38,5 +39,60 @@ public:
 private:
   void getCycle(Transforms &transforms, SmallVector<int64_t> shape,
                 SmallVector<int64_t> &cycles, int64_t cycle);
+  int64_t getLeafCycle(ArrayRef<int64_t> shape);
+};
+
+// Resources of one SG2260 core seen by the tiling search.
+struct SG2260Resource {
+  int64_t npuNum = 64;
+  int64_t euNum = 32;
+  int64_t lmemBytes = 1 << 18; // per lane
+  int64_t dmaBytesPerCycle = 64;
+  int64_t issueCycles = 16; // fixed cost of one instruction
+  // the widest tensor extent encodable by the TIU shape fields
+  int64_t maxTileExtent;
+  SG2260Resource();
+};
+
+struct ISelChoice {
+  StringRef instruction;
+  // tile size of each loop, 0 keeps the loop whole
+  SmallVector<int64_t> tileSizes;
+  // recompute the elementwise producer inside the tile loops
+  bool fuseProducer = false;
+  int64_t computeCycle = 0;
+  int64_t dmaCycle = 0;
+  int64_t cycle = 0;
+
+  void dump(raw_ostream &os) const;
+};
+
+// Enumerate the SG2260 instructions, tile sizes and fusion choices of a
+// linalg op, and cost each of them with TransformBenefit.
+class CostModelSearch {
+public:
+  CostModelSearch(MLIRContext *context, int64_t depth = 3,
+                  SG2260Resource resource = SG2260Resource());
+
+  // All feasible choices sorted by estimated cycles.
+  SmallVector<ISelChoice> enumerate(linalg::LinalgOp op);
+  std::optional<ISelChoice> select(linalg::LinalgOp op);
+
+private:
+  struct Match {
+    StringRef instruction;
+    sg2260::TPUISATraits traits;
+    Transforms *transforms;
+    // window loops unrolled before matching, in descending order
+    SmallVector<int64_t> unrolled;
+  };
+  SmallVector<Match> getMatches(linalg::LinalgOp op);
+  int64_t getComputeCycle(const Match &match, ArrayRef<int64_t> tile);
+
+  MLIRContext *context;
+  int64_t depth;
+  SG2260Resource resource;
+  // solved transforms of each (pattern, instruction)
+  std::map<std::string, std::unique_ptr<Transforms>> cache;
 };
 } // namespace tpu_mlir
@@ -16,6 +16,11 @@
 namespace tpu_mlir {
 using namespace mlir;
 
+// tile sizes consumed by TileAndFuseGreedily
+constexpr StringLiteral kLinalgTilingMarker = "__linalg_tiling__";
+// tile the marked op without fusing its producers
+constexpr StringLiteral kLinalgNoFuseMarker = "__linalg_no_fuse__";
+
 void registerDepencyDialect(DialectRegistry &registry);
 
 void registerCodegenInterfaces(DialectRegistry &registry);
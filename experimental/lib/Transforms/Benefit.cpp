@@ -8,7 +8,10 @@
 //===----------------------------------------------------------------------===//
 
 #include "tpu-mlir/Transforms/Benefit.h"
+#include "mlir/Dialect/Arith/IR/Arith.h"
 #include "mlir/IR/BuiltinTypes.h"
+#include "mlir/IR/TypeUtilities.h"
+#include "tpu-mlir/Dialect/SG2260/IR/SG2260.h"
 #include "tpu-mlir/Dialect/SG2260/IR/StructuredOpsInterfaces.h"
 #include "tpu-mlir/Transforms/StructuredTransform.h"
 #include "llvm/ADT/TypeSwitch.h"
@@ -41,7 +44,10 @@ AffineMap mapShape(linalg::LinalgOp op) {
 SmallVector<int64_t> TransformBenefit::getCycle(Transforms &transforms,
                                                 SmallVector<int64_t> shape) {
   SmallVector<int64_t> cycles;
-  if (transforms.isRoot())
+  if (transforms.isRoot() && transforms.empty())
+    // the source is the target already
+    cycles.push_back(getLeafCycle(shape));
+  else if (transforms.isRoot())
     for (auto &ts : transforms.getChildren())
       getCycle(ts, shape, cycles, 1);
   else
@@ -83,11 +89,7 @@ void TransformBenefit::getCycle(Transforms &transforms,
              llvm::dbgs() << "\n";);
 
   if (transforms.empty()) {
-    auto acceleration = target.getAccelerateMap().getResults();
-    for (auto [dim, accExpr] : llvm::zip(new_shape, acceleration)) {
-      auto acc = cast<AffineConstantExpr>(accExpr).getValue();
-      cycle *= (dim + acc - 1) / acc;
-    }
+    cycle *= getLeafCycle(new_shape);
     LLVM_DEBUG(llvm::dbgs() << "End: " << cycle << "\n\n";);
     return cycles.push_back(cycle);
   }
@@ -97,4 +99,332 @@ void TransformBenefit::getCycle(Transforms &transforms,
   }
 }
 
+int64_t TransformBenefit::getLeafCycle(ArrayRef<int64_t> shape) {
+  int64_t cycle = 1;
+  auto acceleration = target.getAccelerateMap().getResults();
+  for (auto [dim, accExpr] : llvm::zip(shape, acceleration)) {
+    auto acc = cast<AffineConstantExpr>(accExpr).getValue();
+    cycle *= (dim + acc - 1) / acc;
+  }
+  return cycle;
+}
+
+SG2260Resource::SG2260Resource() {
+  // every tile extent has to fit the TIU shape fields
+  CONVRegDef conv{};
+  conv.res0_c -= 1;
+  MM2RegDef mm{};
+  mm.res0_c -= 1;
+  maxTileExtent = std::min<int64_t>(conv.res0_c, mm.res0_c);
+}
+
+void ISelChoice::dump(raw_ostream &os) const {
+  os << instruction << " tile=[";
+  interleaveComma(tileSizes, os);
+  os << "] fuse=" << fuseProducer << " compute=" << computeCycle
+     << " dma=" << dmaCycle << " cycle=" << cycle << "\n";
+}
+
+// The arithmetic an instruction has to provide for `op`.
+static std::optional<sg2260::ArithType> getArithType(linalg::LinalgOp op) {
+  using sg2260::ArithType;
+  if (isa<linalg::MatmulOp, linalg::BatchMatmulOp,
+          linalg::ConvolutionOpInterface>(op.getOperation()))
+    return ArithType::add;
+  auto &body = op->getRegion(0).front();
+  if (body.getOperations().size() != 2)
+    return std::nullopt;
+  return llvm::TypeSwitch<Operation *, std::optional<ArithType>>(&body.front())
+      .Case<arith::AddFOp, arith::AddIOp>([](auto) { return ArithType::add; })
+      .Case<arith::SubFOp, arith::SubIOp>([](auto) { return ArithType::sub; })
+      .Case<arith::MulFOp, arith::MulIOp>([](auto) { return ArithType::mul; })
+      .Case<arith::MaxFOp, arith::MaxSIOp>([](auto) { return ArithType::max; })
+      .Case<arith::MinFOp, arith::MinSIOp>([](auto) { return ArithType::min; })
+      .Case<arith::AndIOp>([](auto) { return ArithType::AND; })
+      .Case<arith::OrIOp>([](auto) { return ArithType::OR; })
+      .Case<arith::XOrIOp>([](auto) { return ArithType::XOR; })
+      .Default([](Operation *) { return std::nullopt; });
+}
+
+static std::string getPatternKey(StringRef instruction,
+                                 const ComputePattern &pattern) {
+  std::string key;
+  llvm::raw_string_ostream os(key);
+  os << instruction;
+  for (auto map : pattern.indexingMaps)
+    os << map;
+  for (auto iterator : pattern.iteratorTypes)
+    os << (iterator == utils::IteratorType::parallel ? "P" : "R");
+  return os.str();
+}
+
+// Elements of the operand touched by one tile.
+static int64_t getFootprint(AffineMap map, ArrayRef<int64_t> tile,
+                            ArrayRef<int64_t> shape) {
+  SmallVector<AffineExpr> last;
+  for (auto size : tile)
+    last.push_back(getAffineConstantExpr(size - 1, map.getContext()));
+  int64_t elems = 1;
+  for (auto [expr, dim] : llvm::zip(map.getResults(), shape)) {
+    int64_t extent = dim;
+    if (auto c = dyn_cast<AffineConstantExpr>(expr.replaceDims(last)))
+      extent = std::min(dim, c.getValue() + 1);
+    elems *= extent;
+  }
+  return elems;
+}
+
+static int64_t getElementBytes(Value value) {
+  auto type = getElementTypeOrSelf(value.getType());
+  if (!type.isIntOrFloat())
+    return 4;
+  return std::max<int64_t>(1, type.getIntOrFloatBitWidth() / 8);
+}
+
+static int64_t ceilDiv(int64_t a, int64_t b) { return (a + b - 1) / b; }
+
+CostModelSearch::CostModelSearch(MLIRContext *context, int64_t depth,
+                                 SG2260Resource resource)
+    : context(context), depth(depth), resource(resource) {}
+
+SmallVector<CostModelSearch::Match>
+CostModelSearch::getMatches(linalg::LinalgOp op) {
+  SmallVector<Match> matches;
+  auto arithType = getArithType(op);
+  if (!arithType)
+    return matches;
+  ComputePattern source{op.getIndexingMapsArray(),
+                        op.getIteratorTypesArray()};
+  if (source.indexingMaps.empty() ||
+      source.indexingMaps[0].getNumSymbols() != 0)
+    return matches;
+
+  // Window loops (kh, kw) only show up inside sum expressions. Unroll them
+  // up front to keep the solver shallow.
+  SmallVector<int64_t> unrolled;
+  for (int64_t i = source.iteratorTypes.size() - 1; i >= 0; --i) {
+    if (source.iteratorTypes[i] != utils::IteratorType::reduction)
+      continue;
+    bool used = false, isWindow = true;
+    for (auto map : source.indexingMaps)
+      for (auto expr : map.getResults()) {
+        if (!expr.isFunctionOfDim(i))
+          continue;
+        used = true;
+        isWindow &= !isa<AffineDimExpr>(expr);
+      }
+    if (!used || !isWindow)
+      continue;
+    auto dim = cast<AffineDimExpr>(getAffineDimExpr(i, context));
+    if (auto out = Unroll(dim).run(source)) {
+      source = *out;
+      unrolled.push_back(i);
+    }
+  }
+
+  // Binary instructions may take the inputs in either order; the output
+  // layout is then fixed by a permutation.
+  SmallVector<ComputePattern> sources{source};
+  if (source.indexingMaps.size() == 3) {
+    auto swapped = source;
+    std::swap(swapped.indexingMaps[0], swapped.indexingMaps[1]);
+    sources.push_back(swapped);
+  }
+
+  for (auto &[name, traits] : sg2260::registerTraits(context)) {
+    if (traits.getArithType() != *arithType)
+      continue;
+    ComputePattern target{
+        llvm::to_vector(traits.getIndexingMaps()
+                            .getAsValueRange<AffineMapAttr, AffineMap>()),
+        llvm::to_vector(llvm::map_range(
+            traits.getIteratorTypes(), [](Attribute attr) {
+              return cast<sg2260::IteratorTypeAttr>(attr).getValue();
+            }))};
+    if (target.indexingMaps.size() != source.indexingMaps.size())
+      continue;
+    for (auto &pattern : sources) {
+      auto key = getPatternKey(name, pattern);
+      if (!cache.count(key)) {
+        if (pattern == target) {
+          cache[key] = std::make_unique<Transforms>();
+        } else {
+          auto solver = Solver(target, depth);
+          auto transforms = solver.solve(pattern);
+          cache[key] = transforms.empty()
+                           ? nullptr
+                           : std::make_unique<Transforms>(std::move(transforms));
+        }
+      }
+      if (auto *transforms = cache[key].get()) {
+        matches.push_back({name, traits, transforms, unrolled});
+        break;
+      }
+    }
+  }
+  return matches;
+}
+
+int64_t CostModelSearch::getComputeCycle(const Match &match,
+                                         ArrayRef<int64_t> tile) {
+  auto shape = llvm::to_vector(tile);
+  int64_t repeat = 1;
+  for (auto pos : match.unrolled) {
+    repeat *= shape[pos];
+    shape.erase(shape.begin() + pos);
+  }
+  auto cycles = TransformBenefit(match.traits).getCycle(*match.transforms,
+                                                        shape);
+  if (cycles.empty())
+    return std::numeric_limits<int64_t>::max();
+  return repeat * *std::min_element(cycles.begin(), cycles.end());
+}
+
+SmallVector<ISelChoice> CostModelSearch::enumerate(linalg::LinalgOp op) {
+  constexpr size_t kMaxCandidates = 6;
+  SmallVector<ISelChoice> choices;
+  auto ranges = op.getStaticLoopRanges();
+  if (llvm::any_of(ranges, ShapedType::isDynamic))
+    return choices;
+  auto matches = getMatches(op);
+  if (matches.empty())
+    return choices;
+
+  // reductions stay whole, parallel loops are halved a few times
+  SmallVector<SmallVector<int64_t>> candidates;
+  for (auto [range, iterator] :
+       llvm::zip(ranges, op.getIteratorTypesArray())) {
+    SmallVector<int64_t> sizes{range};
+    if (iterator == utils::IteratorType::parallel)
+      for (int64_t size = ceilDiv(range, 2);
+           size < sizes.back() && sizes.size() < kMaxCandidates;
+           size = ceilDiv(size, 2))
+        sizes.push_back(size);
+    candidates.push_back(sizes);
+  }
+
+  // an elementwise producer with one use can be recomputed in each tile
+  // instead of round-tripping its result through global memory
+  OpOperand *fusable = nullptr;
+  int64_t producerElems = 0, producerInBytes = 0, producerOutBytes = 0;
+  for (auto *opOperand : op.getDpsInputOperands()) {
+    auto producer = opOperand->get().getDefiningOp<linalg::LinalgOp>();
+    if (!producer || isa<linalg::FillOp>(producer.getOperation()) ||
+        !producer->hasOneUse() ||
+        producer.getNumLoops() != producer.getNumParallelLoops())
+      continue;
+    auto producerRanges = producer.getStaticLoopRanges();
+    if (llvm::any_of(producerRanges, ShapedType::isDynamic))
+      continue;
+    fusable = opOperand;
+    producerElems = 1;
+    for (auto range : producerRanges)
+      producerElems *= range;
+    for (auto *input : producer.getDpsInputOperands())
+      producerInBytes += getElementBytes(input->get()) *
+                         getFootprint(producer.getMatchingIndexingMap(input),
+                                      producerRanges, producer.getShape(input));
+    producerOutBytes = producerElems * getElementBytes(opOperand->get());
+    break;
+  }
+
+  const int64_t lanes = resource.npuNum * resource.euNum;
+  const int64_t lmemBytes = resource.npuNum * resource.lmemBytes;
+  SmallVector<size_t> index(ranges.size(), 0);
+  while (true) {
+    SmallVector<int64_t> tile;
+    for (auto [sizes, i] : llvm::zip(candidates, index))
+      tile.push_back(sizes[i]);
+
+    if (llvm::all_of(tile, [&](int64_t size) {
+          return size <= resource.maxTileExtent;
+        })) {
+      int64_t numTiles = 1;
+      for (auto [range, size] : llvm::zip(ranges, tile))
+        numTiles *= ceilDiv(range, size);
+      int64_t tileBytes = 0, fusedBytes = 0;
+      for (auto &opOperand : op->getOpOperands()) {
+        auto bytes =
+            getElementBytes(opOperand.get()) *
+            getFootprint(op.getMatchingIndexingMap(&opOperand), tile,
+                         op.getShape(&opOperand));
+        tileBytes += bytes;
+        if (&opOperand == fusable)
+          fusedBytes = bytes;
+      }
+      SmallVector<int64_t> tileSizes;
+      for (auto [range, size] : llvm::zip(ranges, tile))
+        tileSizes.push_back(size == range ? 0 : size);
+
+      auto addChoice = [&](const Match &match, bool fuse) {
+        int64_t bytes = tileBytes, extraCompute = 0, extraDma = 0;
+        if (fuse) {
+          // read the producer inputs in place of its result, and keep both
+          // in local memory
+          auto inBytes = ceilDiv(fusedBytes * producerInBytes,
+                                 std::max<int64_t>(producerOutBytes, 1));
+          bytes += inBytes - fusedBytes;
+          extraCompute = numTiles * (ceilDiv(fusedBytes, lanes) +
+                                     resource.issueCycles);
+          if (2 * (tileBytes + inBytes) > lmemBytes)
+            return;
+        } else {
+          if (2 * tileBytes > lmemBytes)
+            return;
+          if (fusable) {
+            extraCompute = ceilDiv(producerElems, lanes) + resource.issueCycles;
+            extraDma = ceilDiv(producerInBytes + producerOutBytes,
+                               resource.dmaBytesPerCycle);
+          }
+        }
+        auto cycle = getComputeCycle(match, tile);
+        if (cycle == std::numeric_limits<int64_t>::max())
+          return;
+        ISelChoice choice;
+        choice.instruction = match.instruction;
+        choice.tileSizes = tileSizes;
+        choice.fuseProducer = fuse;
+        choice.computeCycle =
+            numTiles * (cycle + resource.issueCycles) + extraCompute;
+        choice.dmaCycle =
+            numTiles * ceilDiv(bytes, resource.dmaBytesPerCycle) + extraDma;
+        // double buffered: transfers overlap the computation except for the
+        // first tile
+        choice.cycle = std::max(choice.computeCycle, choice.dmaCycle) +
+                       ceilDiv(bytes, resource.dmaBytesPerCycle);
+        choices.push_back(choice);
+      };
+      for (auto &match : matches) {
+        addChoice(match, false);
+        if (fusable)
+          addChoice(match, true);
+      }
+    }
+
+    // next tile combination
+    size_t dim = 0;
+    for (; dim < index.size(); ++dim) {
+      if (++index[dim] < candidates[dim].size())
+        break;
+      index[dim] = 0;
+    }
+    if (dim == index.size())
+      break;
+  }
+
+  llvm::stable_sort(choices, [](const ISelChoice &a, const ISelChoice &b) {
+    return a.cycle < b.cycle;
+  });
+  return choices;
+}
+
+std::optional<ISelChoice> CostModelSearch::select(linalg::LinalgOp op) {
+  auto choices = enumerate(op);
+  if (choices.empty())
+    return std::nullopt;
+  LLVM_DEBUG(llvm::dbgs() << choices.size() << " choices, best: ";
+             choices.front().dump(llvm::dbgs()););
+  return choices.front();
+}
+
 } // namespace tpu_mlir
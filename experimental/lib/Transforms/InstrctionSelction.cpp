@@ -15,7 +15,11 @@
 #include "mlir/Pass/Pass.h"
 #include "mlir/Transforms/GreedyPatternRewriteDriver.h"
 #include "tpu-mlir/Dialect/SG2260/IR/SG2260.h"
+#include "tpu-mlir/Transforms/Benefit.h"
 #include "tpu-mlir/Transforms/Passes.h"
+#include <llvm/Support/Debug.h>
+
+#define DEBUG_TYPE "isel"
 
 using namespace mlir;
 
@@ -40,12 +44,39 @@ class InstrctionSelctionqPass
     registry.insert<linalg::LinalgDialect, tensor::TensorDialect,
                     sg2260::SG2260Dialect>();
   }
+  // Annotate each linalg op with the cheapest SG2260 instruction, tile sizes
+  // and fusion choice; TileAndFuseGreedily consumes the tiling marker.
   void runOnOperation() override {
-    printSG2260StructureOp(getOperation());
-    getOperation().walk([](linalg::LinalgOp op) {
-      op.getIndexingMaps().dump();
-      llvm::outs() << "\n";
+    LLVM_DEBUG(printSG2260StructureOp(getOperation()));
+    auto context = &getContext();
+    Builder builder(context);
+    CostModelSearch search(context);
+    SmallVector<linalg::LinalgOp> ops;
+    getOperation().walk([&](linalg::LinalgOp op) {
+      if (!isa<linalg::FillOp>(op.getOperation()))
+        ops.push_back(op);
     });
+    // consumers first, so producers recomputed in their tiles stay unmarked
+    DenseSet<Operation *> fused;
+    for (auto op : llvm::reverse(ops)) {
+      auto choice = search.select(op);
+      if (!choice)
+        continue;
+      op->setAttr("sg2260.isel", builder.getStringAttr(choice->instruction));
+      op->setAttr("sg2260.cycle", builder.getI64IntegerAttr(choice->cycle));
+      if (fused.contains(op) || op->hasAttr(kLinalgTilingMarker) ||
+          llvm::all_of(choice->tileSizes, [](int64_t s) { return s == 0; }))
+        continue;
+      op->setAttr(kLinalgTilingMarker,
+                  builder.getDenseI64ArrayAttr(choice->tileSizes));
+      if (!choice->fuseProducer) {
+        op->setAttr(kLinalgNoFuseMarker, builder.getUnitAttr());
+        continue;
+      }
+      for (auto *opOperand : op.getDpsInputOperands())
+        if (auto producer = opOperand->get().getDefiningOp<linalg::LinalgOp>())
+          fused.insert(producer);
+    }
   }
 };
 
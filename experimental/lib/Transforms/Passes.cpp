@@ -11,6 +11,7 @@
 #include "mlir/Dialect/Affine/IR/AffineOps.h"
 #include "mlir/Dialect/Linalg/IR/Linalg.h"
 #include "mlir/Dialect/Linalg/Transforms/TilingInterfaceImpl.h"
+#include "mlir/Dialect/Math/IR/Math.h"
 #include "mlir/Dialect/MemRef/IR/MemRef.h"
 #include "mlir/Dialect/SCF/IR/SCF.h"
 #include "mlir/Dialect/Tensor/IR/Tensor.h"
@@ -30,6 +31,7 @@ void registerDepencyDialect(DialectRegistry &registry) {
                   scf::SCFDialect,
                   tensor::TensorDialect,
                   arith::ArithDialect,
+                  math::MathDialect,
                   sg2260::SG2260Dialect
                   >();
   // clang-format on
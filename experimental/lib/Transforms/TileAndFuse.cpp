@@ -22,8 +22,6 @@
 namespace tpu_mlir {
 using namespace mlir;
 
-const StringLiteral kLinalgTilingMarker = "__linalg_tiling__";
-
 struct TileConsumerAndFuseProducersGreedilyUsingSCFForOp
     : public OpInterfaceRewritePattern<TilingInterface> {
   TileConsumerAndFuseProducersGreedilyUsingSCFForOp(MLIRContext *context,
@@ -44,6 +42,22 @@ struct TileConsumerAndFuseProducersGreedilyUsingSCFForOp
       return failure();
     }
 
+    if (op->hasAttr(kLinalgNoFuseMarker)) {
+      scf::SCFTilingOptions tilingOptions;
+      tilingOptions.setTileSizes(attr.asArrayRef());
+      FailureOr<scf::SCFTilingResult> tilingResult =
+          scf::tileUsingSCFForOp(rewriter, op, tilingOptions);
+      if (failed(tilingResult)) {
+        return failure();
+      }
+      rewriter.replaceOp(op, tilingResult->replacements);
+      for (auto *tiledOp : tilingResult->tiledOps) {
+        tiledOp->removeAttr(kLinalgTilingMarker);
+        tiledOp->removeAttr(kLinalgNoFuseMarker);
+      }
+      return success();
+    }
+
     scf::SCFTileAndFuseOptions tileAndFuseOptions;
     tileAndFuseOptions.tilingOptions.setTileSizes(attr.asArrayRef());
 
@@ -69,6 +83,33 @@ struct TileConsumerAndFuseProducersGreedilyUsingSCFForOp
   }
 };
 
+// A fusion root is a linalg op whose result is not consumed by another
+// linalg op; tiling it pulls its whole producer chain into the tile loops.
+// Only static parallel loops larger than `tileSize` are tiled, reductions
+// are kept whole.
+static void markFusionRoots(func::FuncOp func, int64_t tileSize) {
+  Builder builder(func.getContext());
+  func.walk([&](linalg::LinalgOp op) {
+    if (op->hasAttr(kLinalgTilingMarker) || !op.hasTensorSemantics())
+      return;
+    if (llvm::any_of(op->getUsers(),
+                     [](Operation *user) { return isa<linalg::LinalgOp>(user); }))
+      return;
+    SmallVector<int64_t> tileSizes;
+    bool hasTile = false;
+    for (auto [iterator, range] : llvm::zip(op.getIteratorTypesArray(),
+                                            op.getStaticLoopRanges())) {
+      bool tile = iterator == utils::IteratorType::parallel &&
+                  !ShapedType::isDynamic(range) && range > tileSize;
+      tileSizes.push_back(tile ? tileSize : 0);
+      hasTile |= tile;
+    }
+    if (hasTile)
+      op->setAttr(kLinalgTilingMarker,
+                  builder.getDenseI64ArrayAttr(tileSizes));
+  });
+}
+
 class TileAndFuseGreedily
     : public TileAndFuseGreedilyBase<TileAndFuseGreedily> {
   void getDependentDialects(DialectRegistry &registry) const override {
@@ -80,6 +121,8 @@ class TileAndFuseGreedily
   }
   void runOnOperation() override {
     MLIRContext *context = &getContext();
+    if (tileSize > 0)
+      markFusionRoots(getOperation(), tileSize);
 
     RewritePatternSet tilingPatterns(context);
     tilingPatterns.add<TileConsumerAndFuseProducersGreedilyUsingSCFForOp>(
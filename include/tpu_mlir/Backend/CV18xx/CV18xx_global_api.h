@@ -13,6 +13,9 @@
 
 namespace tpu_mlir {
 namespace backend {
+// Conv tiling plans are shared by same-shaped convs of one codegen session
+void cvi_backend_tg_conv_clear_plans();
+
 void cvi_backend_tg_fixed_conv_kernel(
     uint32_t layer_id, gaddr_t ga_ifmap, gaddr_t ga_ofmap, gaddr_t ga_weight,
     gaddr_t ga_bias, int input_n, int input_c, int input_h, int input_w,
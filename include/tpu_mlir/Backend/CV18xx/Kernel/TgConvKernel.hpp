@@ -1034,6 +1034,18 @@ public:
   void getCost(CostModel &cost);
   bool isBetterCost(CostModel &from, CostModel &to);
   TilePolicy getReuseWgtOrActByCost();
+  void getTilePolicyCost(TilePolicy policy, CostModel &cost);
+
+  // Tiling decision of one conv, reused by convs with the same parameters.
+  struct TilePlan {
+    TilePolicy policy;
+    TileInfo tile_info;
+    bool use_double_buffer;
+  };
+
+  std::vector<int64_t> getTilePlanKey();
+  void searchTilePolicy();
+  TilePlan planTile();
 
   // Arguments from dialect
   Conv_ARGS args;
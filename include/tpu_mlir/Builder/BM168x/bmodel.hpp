@@ -14,6 +14,8 @@
 #include <fstream>
 #include <map>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 #include "tpu_mlir/Builder/BM168x/bmodel_generated.h"
 
@@ -62,7 +64,14 @@ public:
   ModelGen(uint32_t reserved_size = 0x1000000);
   virtual ~ModelGen();
   flatbuffers::FlatBufferBuilder &Builder();
-  Binary WriteBinary(size_t size, uint8_t *data);
+  Binary WriteBinary(size_t size, const uint8_t *data);
+  // hash is from HashBinary, so that it can be computed in parallel
+  Binary WriteBinary(size_t size, const uint8_t *data, size_t hash);
+  static size_t HashBinary(size_t size, const uint8_t *data);
+  // add binary without copy, data is written by Save, so it must be valid
+  // until then. binaries by WriteBinary should be written before. Equal
+  // contents share one binary, whatever their source.
+  Binary WriteBinaryRef(size_t size, const uint8_t *data);
 
   // add model elements
   void AddChip(const std::string &arch_name);
@@ -107,6 +116,14 @@ private:
   flatbuffers::FlatBufferBuilder builder_;
   std::vector<uint8_t> binary_;
   std::vector<Binary> binary_vector_;
+  // hash of data to index of binary_vector_, for deduplication
+  std::unordered_multimap<size_t, size_t> binary_index_;
+  // binaries referenced by WriteBinaryRef, placed after binary_
+  std::vector<std::pair<Binary, const uint8_t *>> binary_ref_;
+  std::map<std::pair<const uint8_t *, size_t>, Binary> binary_ref_map_;
+  // hash of data to index of binary_ref_, for deduplication by content
+  std::unordered_multimap<size_t, size_t> binary_ref_index_;
+  uint64_t binary_ref_size_;
   std::vector<NET_INFO_T> net_vector_;
   std::vector<flatbuffers::Offset<bmodel::Net>> nets_;
   uint64_t max_neuron_size_;
@@ -128,6 +145,9 @@ public:
   void read_binary(const bmodel::Binary *binary, uint64_t offset,
                    uint8_t *buffer, uint64_t size);
 
+  // pointer to binary data without copy, NULL if the bmodel is not in memory
+  const uint8_t *binary_data(const bmodel::Binary *binary) const;
+
   // model buffer data for parse
   const void *data() const;
 
@@ -146,6 +166,8 @@ private:
   uint32_t binary_offset_;
   std::ifstream file_;         // bmodel in file
   const void *bmodel_pointer_; // bmodel in buffer
+  void *mmap_addr_;            // bmodel file mapped as buffer
+  size_t mmap_size_;
 };
 
 } // namespace bmodel
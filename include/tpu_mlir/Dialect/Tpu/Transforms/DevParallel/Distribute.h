@@ -172,6 +172,11 @@ static DevEndMode getEndMode(tpu::DevEndOp op) {
 // split module to multi modules for devices
 // ===================================
 void distributeModules(ModuleOp module, int64_t num_device);
+// cut the whole net into num_device pipeline stages, stage i on device i;
+// each stage runs the whole batch, there is no micro-batching
+LogicalResult distributePipeline(ModuleOp module, int64_t num_device);
+// replicate the whole net to num_device devices, each runs part of the batch
+LogicalResult distributeBatch(ModuleOp module, int64_t num_device);
 
 } // namespace tpu
 } // namespace tpu_mlir
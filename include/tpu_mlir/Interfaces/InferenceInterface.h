@@ -16,6 +16,22 @@ struct InferenceParameter {
   std::vector<float *> inputs;
   std::vector<float *> outputs;
   void *handle = nullptr;
+  // Scratch of one inference, `workspace_size` floats requested by init. The
+  // interpreter points `workspace` to an arena shared by all the ops, so
+  // nothing in it lives longer than the call.
+  int64_t workspace_size = 0;
+  float *workspace = nullptr;
+  // the workspace, or a buffer of this parameter if the caller bound none
+  float *get_workspace() {
+    if (workspace == nullptr && workspace_size > 0) {
+      own_workspace.resize(workspace_size);
+      workspace = own_workspace.data();
+    }
+    return workspace;
+  }
+
+private:
+  std::vector<float> own_workspace;
 };
 
 } // namespace tpu_mlir
@@ -0,0 +1,58 @@
+//===----------------------------------------------------------------------===//
+//
+// Copyright (C) 2022 Sophgo Technologies Inc.  All rights reserved.
+//
+// TPU-MLIR is licensed under the 2-Clause BSD License except for the
+// third-party components.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace tpu_mlir {
+
+// y[M, N] = x[M, K] * w + bias. w is stored as [N, K] if w_transpose, else as
+// [K, N], and quantized per stored row, or per group_size values of a row.
+// int4 packs two values in one byte, the lower nibble first.
+typedef struct {
+  int64_t M;
+  int64_t K;
+  int64_t N;
+  int64_t bits;       // 4 or 8
+  bool sign;          // int8 values are signed, int4 ones are unsigned
+  bool w_transpose;
+  int64_t group_size; // 0 for per channel
+} a16_matmul_attr_t;
+
+// Low bit weight matmul of A16MatMul. The weight is kept packed, with its
+// scales and zero points, and each thread dequantizes one [K, N] tile at a
+// time into its slice of a workspace of workspace_size() floats, where it is
+// used by all the rows of x. Without a workspace, it is allocated once and
+// kept.
+class A16MatMulFunc {
+public:
+  // `weight` holds one byte value per float, `zp` can be null
+  A16MatMulFunc(const a16_matmul_attr_t &attr, const float *weight,
+                const float *scale, const float *zp);
+  int64_t workspace_size() const { return ws_size * threads; }
+  // `bias` can be null
+  void run(const float *input, const float *bias, float *output,
+           float *scratch = nullptr);
+
+private:
+  void dequant_tile(int64_t k0, int64_t kb, int64_t n0, int64_t nb, float *w);
+  void dequant_row(int64_t r, int64_t c0, int64_t cb, float *w,
+                   int64_t stride) const;
+  float *get_workspace(float *scratch);
+  a16_matmul_attr_t attr;
+  int64_t rows, cols; // of the stored weight, in values
+  std::vector<uint8_t> packed;
+  std::vector<float> scale, zp;
+  int threads;
+  int64_t ws_size; // floats per thread
+  std::vector<float> workspace;
+};
+
+} // namespace tpu_mlir
@@ -0,0 +1,77 @@
+//===----------------------------------------------------------------------===//
+//
+// Copyright (C) 2022 Sophgo Technologies Inc.  All rights reserved.
+//
+// TPU-MLIR is licensed under the 2-Clause BSD License except for the
+// third-party components.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace tpu_mlir {
+
+// type = {0:fp32, 1:fp16, 2:bf16, 3:int8}, as the dtype of Attention
+typedef enum {
+  ATTN_F32 = 0,
+  ATTN_F16 = 1,
+  ATTN_BF16 = 2,
+  ATTN_INT8 = 3,
+} attention_mode_t;
+
+// q and o are [batch, M_q, q_heads, d], k and v are [batch, M_k, kv_heads, d]
+typedef struct {
+  int64_t batch;
+  int64_t q_heads;
+  int64_t kv_heads; // q_heads / kv_heads query heads share one, for GQA/MQA
+  int64_t M_q;
+  int64_t M_k;
+  int64_t d;
+  // elements between batches of k and v, 0 for dense. A kv cache with room
+  // for L tokens is read in place with L * kv_heads * d.
+  int64_t kv_batch_stride;
+  // elements between batches of the [batch, 1, M_k] additive mask, 0 if the
+  // mask is shared
+  int64_t mask_batch_stride;
+  // query i sees keys [0, M_k - M_q + i], the new tokens are the last M_q
+  bool causal;
+  // on q * k in float modes, the scale of the probabilities in int8 mode
+  float scale;
+  attention_mode_t mode;
+  // int8 mode: requant of q * k and of p * v, zero point of the probabilities
+  int64_t s_mul, s_shift, s_zp;
+  int64_t o_mul, o_shift, o_zp;
+  int64_t p_zp;
+} attention_attr_t;
+
+// softmax(q * k^T * scale + mask) * v, tiled over queries and keys so the
+// score matrix is never materialized. The f32 mode keeps an online max and
+// sum. The other modes take the max and sum in a first pass, so that the
+// probabilities are rounded or requantized after normalization, where the
+// lowering does.
+class AttentionFunc {
+public:
+  AttentionFunc(const attention_attr_t &attr);
+  // `table` is the exp table of int8 mode, `mask` can be null
+  void run(const float *q, const float *k, const float *v, const float *mask,
+           const float *table, float *o);
+
+private:
+  void run_online(int64_t b, int64_t h, int64_t q0, int64_t rows,
+                  const float *mask, float *ws);
+  void run_two_pass(int64_t b, int64_t h, int64_t q0, int64_t rows,
+                    const float *mask, const float *table, float *ws);
+  void scores(int64_t b, int64_t h, int64_t q0, int64_t rows, int64_t k0,
+              int64_t cols, const float *mask, float *s);
+  int64_t key_limit(int64_t i) const;
+  attention_attr_t attr;
+  int threads;
+  int64_t ws_size; // floats per thread
+  std::vector<float> workspace;
+  const float *p_q, *p_k, *p_v;
+  float *p_o;
+};
+
+} // namespace tpu_mlir
@@ -9,31 +9,34 @@
 
 #pragma once
 #include "oneapi/dnnl/dnnl.hpp"
+#include "tpu_mlir/Support/AttentionFunc.h"
 using namespace dnnl;
 namespace tpu_mlir {
 class Attention {
 public:
   Attention();
 
+  // `d` is the size of one head, q/k/v are projected to head * d
   void setup(float *input, float *keys, float *values,
              float *queries_weight, float *queries_bias, float *keys_weight,
              float *keys_bias, float *values_weight, float *values_bias,
              float *out_weight, float *out_bias, float *musk, float *table,
              float *output, int64_t *quant_param,
              int64_t batch, int64_t M_q, int64_t M_k, int64_t N_q, int64_t N_k,
-             int64_t d, float scale, bool add_result, int dtype=0);
+             int64_t d, float scale, bool add_result, int dtype=0,
+             int64_t head=1);
   void run();
   void deinit();
 
 private:
-  void *matmulq = nullptr, *matmulk = nullptr, *matmulv = nullptr, *matmul0 = nullptr;
-  void *binary = nullptr, *softmax = nullptr, *matmul1 = nullptr, *matmul_out = nullptr;
+  void *matmulq = nullptr, *matmulk = nullptr, *matmulv = nullptr;
+  void *matmul_out = nullptr;
+  AttentionFunc *core = nullptr;
 
-  std::shared_ptr<std::vector<float>> q_data, k_data, v_data, data_0, data_binary, data_softmax, data_1, data_out;
-  float *p_queries, *p_keys, *p_values, *p_mat0, *p_binary, *p_softmax, *p_mat1, *p_mat1_out, *p_output, *p_table, *p_musk;
-  int64_t num_elem, num_elem_out, dtype_, M_k_, M_q_, batch_;
-  int64_t q_mul, q_sft, q_zp, k_mul, k_sft, k_zp, v_mul, v_sft, v_zp, m0_mul, m0_sft, m0_zp, m1_mul, m1_sft, m1_zp, s_zp;
-  float scale_;
+  std::shared_ptr<std::vector<float>> q_data, k_data, v_data, data_1, data_out;
+  float *p_queries, *p_keys, *p_values, *p_mat1, *p_mat1_out, *p_output, *p_table, *p_musk;
+  int64_t num_elem_out, dtype_;
+  int64_t q_mul, q_sft, q_zp, k_mul, k_sft, k_zp, v_mul, v_sft, v_zp;
   bool add_result_;
 };
 } // namespace tpu_mlir
@@ -20,7 +20,10 @@ public:
   void filter_init(float *weight, conv_attr_t &attr);
   void setup(float *input, float *weight, float *bias, float *output,
              conv_attr_t attr);
-  void run();
+  // floats of scratch that run takes, for a dilated or padded input
+  static int64_t workspace_size(const conv_attr_t &attr);
+  // without a workspace, the scratch is allocated once and kept
+  void run(float *workspace = nullptr);
 
   void diff_filter_init(memory::dims &filter_shape);
   void diff_bias_init(memory::dims &bias_shape);
@@ -42,6 +45,7 @@ private:
   float *p_input, *p_weight;
   float *origin_input, *origin_weight;
   std::shared_ptr<std::vector<float>> input_after_pad, weight_after_zp;
+  int64_t padded_size;
   conv_attr_t _attr;
 
   bool backw_init;
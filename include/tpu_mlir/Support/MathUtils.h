@@ -235,6 +235,11 @@ template <typename T>
 void function_permute(T *from, T *to, const std::vector<int64_t> &shape,
                       const std::vector<int64_t> &order);
 
+// the inputs already lie one after another in `output`, as the reused-mem
+// interpreter places the inputs of a concat whose outer dims are 1
+bool is_concat_in_place(const std::vector<float *> &inputs,
+                        const float *output, mlir::ValueRange values);
+
 // compare
 bool compare(float lhs, float rhs, llvm::StringRef mode);
 
@@ -314,6 +319,103 @@ void get_stride(const std::vector<int64_t> &shape,
 int getBcastIndex(int out_index, std::vector<int64_t> &output_shape,
                   std::vector<int64_t> &input_shape);
 
+// Broadcast of several inputs to one output, resolved once at init. Adjacent
+// output dims are merged while every input keeps the same broadcast pattern,
+// so the innermost merged dim is contiguous in the output, and in each input
+// either contiguous (step 1) or a single repeated element (step 0).
+struct bcast_plan_t {
+  int64_t rows;                  // product of the outer merged dims
+  int64_t inner;                 // size of the innermost merged dim
+  int64_t block;                 // inner elements per parallel unit
+  std::vector<int64_t> outer_shape;
+  std::vector<std::vector<int64_t>> outer_stride; // per input, 0 if broadcast
+  std::vector<int> inner_step;                    // per input, 0 or 1
+};
+
+// shapes of lower rank are expanded by leading 1s
+bcast_plan_t make_bcast_plan(const std::vector<int64_t> &out_shape,
+                             const std::vector<std::vector<int64_t>> &in_shapes);
+
+// call `f(out_offset, in_offsets, len)` for each contiguous run of the output
+template <int N, typename F>
+void bcast_walk(const bcast_plan_t &plan, F &&f) {
+  const int64_t blocks = (plan.inner + plan.block - 1) / plan.block;
+  const int64_t units = plan.rows * blocks;
+  const int outer_dims = plan.outer_shape.size();
+#pragma omp parallel for schedule(static, omp_schedule(units))
+  for (int64_t u = 0; u < units; ++u) {
+    int64_t row = u / blocks;
+    int64_t begin = (u % blocks) * plan.block;
+    int64_t len = std::min(plan.block, plan.inner - begin);
+    int64_t offset[N];
+    for (int k = 0; k < N; ++k) {
+      offset[k] = begin * plan.inner_step[k];
+    }
+    int64_t rem = row;
+    for (int d = outer_dims - 1; d >= 0 && rem; --d) {
+      int64_t idx = rem % plan.outer_shape[d];
+      rem /= plan.outer_shape[d];
+      for (int k = 0; k < N; ++k) {
+        offset[k] += idx * plan.outer_stride[k][d];
+      }
+    }
+    f(row * plan.inner + begin, offset, len);
+  }
+}
+
+// `f(step)` with the inner step as a compile time constant
+template <typename F> void bcast_step_dispatch(int step, F &&f) {
+  if (step) {
+    f(std::integral_constant<int, 1>());
+  } else {
+    f(std::integral_constant<int, 0>());
+  }
+}
+
+// out[i] = op(a[i'], b[i']), with the inner loop specialized on the broadcast
+// pattern (full, row, column or scalar) of each input
+template <typename T, typename A, typename B, typename Op>
+void bcast_for_each(const bcast_plan_t &plan, T *out, const A *a, const B *b,
+                    Op op) {
+  bcast_step_dispatch(plan.inner_step[0], [&](auto sa) {
+    bcast_step_dispatch(plan.inner_step[1], [&](auto sb) {
+      constexpr int SA = decltype(sa)::value, SB = decltype(sb)::value;
+      bcast_walk<2>(plan, [&](int64_t o, const int64_t *in, int64_t len) {
+        T *po = out + o;
+        const A *pa = a + in[0];
+        const B *pb = b + in[1];
+#pragma omp simd
+        for (int64_t j = 0; j < len; ++j) {
+          po[j] = op(pa[j * SA], pb[j * SB]);
+        }
+      });
+    });
+  });
+}
+
+template <typename T, typename A, typename B, typename C, typename Op>
+void bcast_for_each(const bcast_plan_t &plan, T *out, const A *a, const B *b,
+                    const C *c, Op op) {
+  bcast_step_dispatch(plan.inner_step[0], [&](auto sa) {
+    bcast_step_dispatch(plan.inner_step[1], [&](auto sb) {
+      bcast_step_dispatch(plan.inner_step[2], [&](auto sc) {
+        constexpr int SA = decltype(sa)::value, SB = decltype(sb)::value,
+                      SC = decltype(sc)::value;
+        bcast_walk<3>(plan, [&](int64_t o, const int64_t *in, int64_t len) {
+          T *po = out + o;
+          const A *pa = a + in[0];
+          const B *pb = b + in[1];
+          const C *pc = c + in[2];
+#pragma omp simd
+          for (int64_t j = 0; j < len; ++j) {
+            po[j] = op(pa[j * SA], pb[j * SB], pc[j * SC]);
+          }
+        });
+      });
+    });
+  });
+}
+
 void set_auto_pad(llvm::StringRef mode, const std::vector<int64_t> &input_shape,
                   const std::vector<int64_t> &kernel_shape,
                   const std::vector<int64_t> &strides,
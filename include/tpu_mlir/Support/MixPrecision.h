@@ -0,0 +1,57 @@
+//===----------------------------------------------------------------------===//
+//
+// Copyright (C) 2022 Sophgo Technologies Inc.  All rights reserved.
+//
+// TPU-MLIR is licensed under the 2-Clause BSD License except for the
+// third-party components.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+#include "tpu_mlir/Support/ModuleInterpreter.h"
+
+namespace tpu_mlir {
+
+// cosine similarity mapped to [0, 1] as utils.misc.cos_sim, 0.5 for zeros
+double cos_sim(const float *a, const float *b, int64_t num);
+// SQNR in dB of `dequant` against `raw`, +inf when there is no noise
+double sqnr(const float *raw, const float *dequant, int64_t num);
+
+// Co-execute a float module and a quantized module of the same net on the
+// same inputs, and accumulate the similarity of each tensor they share.
+// Tensors are compared in interpreter memory, nothing is copied out, so
+// neither module can keep its activations in reused memory.
+class MixPrecSearcher {
+public:
+  MixPrecSearcher(ModuleInterpreter &ref, ModuleInterpreter &quant);
+  // layers of the net loss, output names if not set
+  void set_compare_layers(const std::vector<std::string> &names,
+                          const std::vector<float> &rates);
+  // run one sample, `inputs` follows the input names of the modules
+  void run(const std::vector<const float *> &inputs,
+           const std::vector<size_t> &sizes);
+  int64_t num_sample() const { return samples; }
+  // average cos of each layer, in program order of the quantized module
+  std::vector<std::pair<std::string, double>> layer_cos() const;
+  // average loss of the compare layers, `type` is "cos" or "sqnr"
+  double outputs_loss(const std::string &type = "cos") const;
+  // layers with average cos below `min_cos`, worst first, at most `max_num`,
+  // only from `candidates` if given
+  std::vector<std::string>
+  search(double min_cos, int64_t max_num,
+         const std::vector<std::string> &candidates = {}) const;
+
+private:
+  ModuleInterpreter &ref;
+  ModuleInterpreter &quant;
+  std::vector<std::string> layers;
+  std::vector<double> cos_sum;
+  std::vector<std::string> compare_ref;
+  std::vector<std::string> compare_quant;
+  std::vector<float> compare_rates;
+  double cos_loss_sum;
+  double sqnr_loss_sum;
+  int64_t samples;
+};
+
+} // namespace tpu_mlir
@@ -64,6 +64,9 @@ int64_t getCoreNum();
 void setCoreNum(int64_t core_num = 1);
 int64_t getDeviceNum();
 void setDeviceNum(int64_t device_num = 1);
+// each device runs the whole net on part of the batch
+bool isBatchParallel();
+void setBatchParallel(bool batch_parallel = true);
 
 Chip getChip();
 void setChip(Chip chip);
@@ -22,6 +22,7 @@
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <unordered_map>
 
 #define DEBUG_TYPE "interpreter"
 using namespace mlir;
@@ -52,6 +53,8 @@ public:
   void invoke_to_disk(const std::string &filename, bool express_type = true);
   void fake_quant_weight();
   std::shared_ptr<std::vector<float>> invoke_at(std::string name);
+  // recompute the ops `op_name` depends on whose inputs changed
+  std::shared_ptr<std::vector<float>> invoke_to(const std::string &op_name);
   void invoke_from(const std::string op_name);
   void backward_weight_at(std::string name, const void *dst_grd,
                           const int dst_grd_len, const void *weight_grd,
@@ -62,14 +65,39 @@ public:
 
   std::shared_ptr<std::vector<float>> getTensor(const std::string &name,
                                                 bool express_type = false);
+  // view of the tensor in interpreter memory, valid until the next invoke
+  bool getTensorView(const std::string &name, const float *&data,
+                     size_t &size);
   bool getTensorQuantInfo(const std::string name, std::string &dtype,
                           float &scale, int &zp);
   llvm::ArrayRef<int64_t> getTensorShape(const std::string &name);
   bool is_no_mem_op(Operation *op);
   // void add_before_forward(CallBack* hook);
   void clear_hooks();
+  // Virtual lowering of a TOP_F32 module: the results of each op are fake
+  // quantized by its mode (F32, INT8, F16, BF16 or F8E4M3) after inference,
+  // to score a qtable without lowering. INT8 also fake quantizes the filter
+  // of Conv and MatMul. Thresholds are from the calibration table, or else
+  // from the calibrated types of the module.
+  void set_calibration_table(const std::string &filename);
+  void set_quant_mode(const std::string &mode); // mode of all ops
+  void set_op_quant_mode(const std::string &op_name, const std::string &mode);
+  void clear_quant_mode();
+  // Incremental decode. Each `past` input is a kv cache with a fixed capacity
+  // along `axis`, kept by the interpreter between steps. Its paired `present`
+  // tensor holds the new tokens, or the whole cache with the new tokens last.
+  // decode_step writes them into the cache in place at the current position,
+  // so only the other inputs are set by setTensor. Slot i of a cache holds
+  // token i, a step that does not fit is an error. Needs ALL_TENSOR_IN_MEM.
+  void decode_init(const std::vector<std::string> &past,
+                   const std::vector<std::string> &present, int64_t axis);
+  void decode_step(bool express_type = true);
+  void decode_reset(); // empty caches, back to position 0
+  int64_t decode_position() const { return kv_position; }
+  bool decode_full() const; // the tokens of the next step do not fit
 
 private:
+  enum class fake_quant_t { NONE, INT8, F16, BF16, F8E4M3 };
   void allocate_part_tensor_in_mem();
   void allocate_all_tensor_in_mem();
   void allocate_all_tensor_in_disk();
@@ -81,8 +109,21 @@ private:
   void value_to_disk(const std::string &filename, const std::string &name,
                      std::vector<float> &data, bool express_type = true);
   void collect_tensor(Value v);
-  void call_before_hook(std::string layer_name);
-  void call_after_hook(std::string layer_name);
+  void allocate_workspace();
+  void bind_workspace(InferenceParameter &p);
+  void build_plan();
+  void invoke_plan(bool express_type = true);
+  void run_plan(size_t begin, size_t end, bool with_input, bool show_bar,
+                bool only_dirty = false);
+  void run_step(int64_t idx, bool has_hooks);
+  void mark_tensor_dirty(const std::string &name);
+  void express_all_in_mem();
+  fake_quant_t parse_quant_mode(const std::string &mode);
+  double quant_threshold(Value v, fake_quant_t mode);
+  void resolve_fake_quant();
+  void fake_quant_step(int64_t idx);
+  void call_before_hook(const std::string &layer_name);
+  void call_after_hook(const std::string &layer_name);
 
 public:
   std::vector<std::string> input_names;
@@ -93,6 +134,7 @@ public:
   std::vector<std::shared_ptr<tpu_mlir::CallBack>> before_hooks;
   std::vector<std::shared_ptr<tpu_mlir::CallBack>> after_hooks;
   void set_mem_mode(std::string mem_mmode);
+  mem_mode_t get_mem_mode() const { return mem_mode; }
 
 private:
   ModuleOp module;
@@ -103,7 +145,47 @@ private:
   std::map<std::string, std::shared_ptr<InferenceParameter>> inference_map;
   std::map<std::string, std::shared_ptr<std::vector<float>>> mem_map;
   // std::vector<float> gMem;
+  std::vector<float> workspace; // scratch of inference shared by all ops
   std::map<std::string, std::pair<uint64_t, uint32_t>> activation_offset;
+  // precompiled plan of the flat module, built once by allocate_resources
+  struct plan_step_t {
+    InferenceInterface infer; // null for InputOp, only hooks are called
+    InferenceParameter *param;
+    std::string name;
+    std::vector<int64_t> producers; // steps defining the operands
+    std::vector<int64_t> users;     // later steps reading the results
+    fake_quant_t quant;
+    std::vector<float> quant_scale; // for each result, 0 to keep float
+  };
+  bool plan_valid;
+  // keep activations across invoke_to/invoke_from, off for reused mem
+  bool plan_memo;
+  std::vector<plan_step_t> plan;
+  std::vector<uint8_t> plan_dirty;
+  std::vector<int64_t> tensor_producer; // by id of all_tensor_names
+  std::unordered_map<const std::vector<float> *, std::vector<int64_t>>
+      buffer_readers;
+  // virtual lowering
+  fake_quant_t default_quant;
+  bool fake_quant_ready;
+  std::map<std::string, fake_quant_t> op_quant;
+  std::map<std::string, double> cali_th;
+  std::map<std::string, double> cali_th_f8;
+  std::map<std::string, std::vector<float>> weight_backup;
+  std::unordered_map<std::string, int64_t> plan_index; // op name -> step
+  std::unordered_map<std::string, int64_t> tensor_ids; // all_tensor_names
+  // incremental decode, caches are [outer, capacity, inner]
+  struct kv_cache_t {
+    std::string past;
+    std::string present;
+    int64_t outer;
+    int64_t inner;
+    int64_t capacity;
+    int64_t present_len; // along the axis
+    int64_t new_len;     // the last new_len of present are new tokens
+  };
+  std::vector<kv_cache_t> kv_caches;
+  int64_t kv_position;
 };
 
 } // namespace tpu_mlir
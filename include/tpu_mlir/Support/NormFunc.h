@@ -0,0 +1,63 @@
+//===----------------------------------------------------------------------===//
+//
+// Copyright (C) 2022 Sophgo Technologies Inc.  All rights reserved.
+//
+// TPU-MLIR is licensed under the 2-Clause BSD License except for the
+// third-party components.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace tpu_mlir {
+
+// rounding of the results, as the storage type of the output
+typedef enum {
+  ROUND_NONE,
+  ROUND_F16,
+  ROUND_BF16,
+} norm_round_t;
+
+// Softmax along `channel` of [outer, channel, inner] float data. Rows are
+// processed in parallel, each thread with its own slice of a workspace of
+// workspace_size() floats. Without one, it is allocated once and kept.
+class SoftmaxFunc {
+public:
+  SoftmaxFunc(int64_t outer, int64_t channel, int64_t inner, float scale,
+              bool log, norm_round_t round);
+  int64_t workspace_size() const { return ws_size * threads; }
+  // exp((x - max) * scale), a contiguous row is read once with the max and
+  // the sum kept per block, then the blocks are rescaled to the row max
+  void run(const float *input, float *output, float *scratch = nullptr);
+  // cv18xx bf16: exp by the slope table, then reciprocal (or log) of the sum
+  // by the mantissa table, same steps as the hardware
+  void run_bf16_lut(const float *input, float *output, float *exp_table,
+                    float *exp_slope, float *mantissa_exp,
+                    float *mantissa_table, float *scratch = nullptr);
+
+private:
+  void run_row(const float *x, float *y, float *ws);
+  void run_strided(const float *x, float *y, int64_t len, float *ws);
+  void round(float *y, int64_t len);
+  float *get_workspace(float *scratch);
+  int64_t outer, channel, inner;
+  int64_t block; // inner elements per parallel unit
+  float scale;
+  bool log;
+  norm_round_t round_mode;
+  int threads;
+  int64_t ws_size; // floats per thread
+  std::vector<float> workspace;
+};
+
+// y = (x - mean) / sqrt(var + eps) * weight + bias over `num` elements, mean
+// and var are taken in one pass. `weight` and `bias` can be null.
+void layer_norm_f32(const float *x, float *y, const float *weight,
+                    const float *bias, int64_t num, float eps);
+// y = x / sqrt(mean(x^2) + eps) * gamma, `gamma` can be null
+void rms_norm_f32(const float *x, float *y, const float *gamma, int64_t num,
+                  float eps);
+
+} // namespace tpu_mlir
@@ -78,6 +78,11 @@ public:
   std::unique_ptr<std::vector<T>>
   readTensor(llvm::StringRef name, RankedTensorType &type, uint32_t store_mode);
 
+  /// get the bytes of a tensor as stored in file, without copying them
+  /// return failure() if the name is not found or it is in column major
+  LogicalResult peekTensorBytes(llvm::StringRef name,
+                                llvm::ArrayRef<uint8_t> &bytes);
+
   /// delete a tensor from file
   /// if the name is not found, return failure()
   LogicalResult deleteTensor(const llvm::StringRef name);
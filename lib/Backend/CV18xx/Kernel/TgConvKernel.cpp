@@ -8,9 +8,12 @@
 //===----------------------------------------------------------------------===//
 
 #include "tpu_mlir/Backend/CV18xx/Kernel/TgConvKernel.hpp"
+#include "tpu_mlir/Backend/CV18xx/CV18xx_global_api.h"
 #include "tpu_mlir/Backend/CV18xx/CV18xx_local_api.h"
 #include "tpu_mlir/Support/MathUtils.h"
 #include "tpu_mlir/Support/TPUCompressUtil.h"
+#include <map>
+#include <mutex>
 
 #define DEBUG_TYPE "cvi_backend_conv_kernel"
 
@@ -2105,9 +2108,68 @@ bool Conv::determineTileSize(bool useDoubleBuffer, bool favor_dma) {
     scaleLutSize =
         CV18xx::lmem_tensor_to_size(shape, args.input_fmt, /*eu_align=*/1);
   }
+  // Local memory usage of one tile. Every term only grows with the step
+  // sizes, so a candidate that does not fit dominates all larger ones.
+  struct LmemUsage {
+    uint32_t ifmap_size;
+    uint32_t ofmap_size;
+    uint32_t weight_size;
+    uint32_t coeff_size;
+    uint32_t total_needed;
+  };
+  auto getLmemUsage = [&](int32_t n_step, int32_t oc_step, int32_t oh_step,
+                          int32_t ow_step, int32_t ih_step, int32_t iw_step) {
+    LmemUsage usage = {0};
+
+    if (do_chl_quan) {
+      uint32_t pc_bias_size = CV18xx::chan_quan_param_size(args.do_bias);
+      cvk_tl_shape_t coeff_shape =
+          CV18xx::tl_shape_t4(1, oc_step, 1, pc_bias_size);
+      usage.coeff_size += CV18xx::lmem_tensor_to_size(coeff_shape, args.tiu_fmt,
+                                                      /*eu_align=*/0);
+    } else if (do_bias) {
+      // 16 bit
+      cvk_tl_shape_t coeff_shape_i16 = CV18xx::tl_shape_t4(2, oc_step, 1, 1);
+      usage.coeff_size += CV18xx::lmem_tensor_to_size(
+          coeff_shape_i16, args.tiu_fmt, /*eu_align=*/0);
+    }
+    if (args.do_quant) {
+      auto coeff_shape = CV18xx::tl_shape_t4(1, oc_step, 1, 1);
+      usage.coeff_size +=
+          2 * CV18xx::lmem_tensor_to_size(coeff_shape, args.tiu_fmt,
+                                          /*eu_align=*/0);
+    }
+
+    usage.weight_size = CV18xx::lmem_tensor_to_size(
+        CV18xx::tl_shape_t4(ic_step, oc_step, kh, kw), args.tiu_fmt,
+        /*eu_align=*/0);
+    usage.ofmap_size = CV18xx::lmem_tensor_to_size(
+        CV18xx::tl_shape_t4(n_step, oc_step, oh_step, ow_step), args.tiu_fmt,
+        /*eu_align=*/1);
+    usage.ifmap_size = CV18xx::lmem_tensor_to_size(
+        CV18xx::tl_shape_t4(n_step, ic_step, ih_step, iw_step), args.tiu_fmt,
+        /*eu_align=*/1);
+
+    // Leaky relu need tl_neg, tl_relu.
+    // tl_relu, tl_neg are not from tmda and not final output.
+    // One copy is enough.
+    uint32_t extra_size = scaleLutSize;
+    if (do_activation && activation_arg && activation_arg[0] != 0.0f) {
+      extra_size += 2 * usage.ofmap_size; // tl_relu + tl_neg
+    }
+
+    usage.total_needed = (usage.ifmap_size + usage.ofmap_size +
+                          usage.weight_size + usage.coeff_size) *
+                             bufferMultiplier +
+                         extra_size;
+    return usage;
+  };
+
   int32_t max_oh = std::min(oh, MAX_HEIGHT);
   int32_t max_ow = std::min(ow, MAX_WIDTH);
   int32_t min_ow = std::min((int)kw, max_ow);
+  // Smallest oc step of the oc split below
+  int32_t min_oc_step = std::min(npu_num, oc);
   // Split ow
   for (int32_t ow_step = max_ow; ow_step >= min_ow; --ow_step) {
     int32_t iw_step =
@@ -2136,137 +2198,101 @@ bool Conv::determineTileSize(bool useDoubleBuffer, bool favor_dma) {
                                      1 + insert_height());
       ih_step = std::min(ih_step, ih);
 
-      if (h_after_ins_pad(ih_step) <= MAX_HEIGHT) {
+      // Skip the oc/n split if even the smallest tile of this oh_step does
+      // not fit.
+      if (h_after_ins_pad(ih_step) <= MAX_HEIGHT &&
+          getLmemUsage(1, min_oc_step, oh_step, ow_step, ih_step, iw_step)
+                  .total_needed <= CV18xx::LMEM_BYTES) {
 
         // Split oc
         for (int32_t slice_oc = 0; slice_oc < num_oc_step; ++slice_oc) {
           // Downward, align lanes
           //   E.g. oc = 48, oc_step: 48, 32
-          int32_t npu_num = static_cast<int32_t>(CV18xx::NPU_NUM);
           int32_t oc_step = std::min((num_oc_step - slice_oc) * npu_num, oc);
           if (args.do_quant) {
             oc_step = std::min(oc_step, npu_num);
           }
 
-          // We may need to put EU-alignment info in one place
-          cvk_tl_shape_t coeff_shape_i16 =
-              CV18xx::tl_shape_t4(2, oc_step, 1, 1);
-
-          uint32_t coeff_oc_step_size = 0;
-
-          if (do_chl_quan) {
-            uint32_t pc_bias_size = CV18xx::chan_quan_param_size(args.do_bias);
-            cvk_tl_shape_t coeff_shape =
-                CV18xx::tl_shape_t4(1, oc_step, 1, pc_bias_size);
-            coeff_oc_step_size +=
-                CV18xx::lmem_tensor_to_size(coeff_shape, args.tiu_fmt,
-                                            /*eu_align=*/0);
-          } else if (do_bias) {
-            // 16 bit
-            coeff_oc_step_size += CV18xx::lmem_tensor_to_size(
-                coeff_shape_i16, args.tiu_fmt, /*eu_align=*/0);
-          }
-          if (args.do_quant) {
-            auto coeff_shape = CV18xx::tl_shape_t4(1, oc_step, 1, 1);
-            coeff_oc_step_size +=
-                2 * CV18xx::lmem_tensor_to_size(coeff_shape, args.tiu_fmt,
-                                                /*eu_align=*/0);
+          // Dma policy does not depend on n_step.
+          tile_info.oc_step = oc_step;
+          tile_info.oh_step = oh_step;
+          tile_info.ow_step = ow_step;
+          tile_info.favor_dma = favor_dma;
+          if (!checkDmaPolicy(tile_info) ||
+              getLmemUsage(1, oc_step, oh_step, ow_step, ih_step, iw_step)
+                      .total_needed > CV18xx::LMEM_BYTES) {
+            continue;
           }
 
-          // Add weight size
-          uint32_t weight_size = CV18xx::lmem_tensor_to_size(
-              CV18xx::tl_shape_t4(ic_step, oc_step, kh, kw), args.tiu_fmt,
-              /*eu_align=*/0);
-
-          // split n
-          for (tile_info.n = 1; tile_info.n <= n; ++tile_info.n) {
-            int32_t n_step = ceiling_func(n, tile_info.n);
-
-            uint32_t ofmap_size = CV18xx::lmem_tensor_to_size(
-                CV18xx::tl_shape_t4(n_step, oc_step, oh_step, ow_step),
-                args.tiu_fmt,
-                /*eu_align=*/1);
-
-            uint32_t ifmap_size = CV18xx::lmem_tensor_to_size(
-                CV18xx::tl_shape_t4(n_step, ic_step, ih_step, iw_step),
-                args.tiu_fmt,
-                /*eu_align=*/1);
-
-            // Leaky relu need tl_neg, tl_relu.
-            // tl_relu, tl_neg are not from tmda and not final output.
-            // One copy is enough.
-            uint32_t extra_size = scaleLutSize;
-            if (do_activation && activation_arg && activation_arg[0] != 0.0f) {
-              extra_size += 2 * ofmap_size; // tl_relu + tl_neg
-            }
-
-            uint32_t total_needed =
-                (ifmap_size + ofmap_size + weight_size + coeff_oc_step_size) *
-                    bufferMultiplier +
-                extra_size;
+          // Split n
+          // Find the fewest n slices that fit, n_step = ceil(n / slices)
+          // shrinks as slices grows.
+          int32_t lo = 1, hi = n;
+          while (lo < hi) {
+            int32_t mid = lo + (hi - lo) / 2;
+            if (getLmemUsage(ceiling_func(n, mid), oc_step, oh_step, ow_step,
+                             ih_step, iw_step)
+                    .total_needed <= CV18xx::LMEM_BYTES)
+              hi = mid;
+            else
+              lo = mid + 1;
+          }
+          tile_info.n = lo;
+          int32_t n_step = ceiling_func(n, tile_info.n);
+          LmemUsage usage =
+              getLmemUsage(n_step, oc_step, oh_step, ow_step, ih_step, iw_step);
+          uint32_t total_needed = usage.total_needed;
 
-            tile_info.n_step = n_step;
-            tile_info.oc_step = oc_step;
-            tile_info.oh_step = oh_step;
-            tile_info.ow_step = ow_step;
-            tile_info.ih_step = ih_step;
-            tile_info.iw_step = iw_step;
-            tile_info.ic_step = ic_step;
-            tile_info.total_needed = total_needed;
-            tile_info.favor_dma = favor_dma;
-
-            if (total_needed <= CV18xx::LMEM_BYTES &&
-                checkDmaPolicy(tile_info)) {
-              uint32_t total_size =
-                  ic * ih * iw + oc * ic * kh * kw + oc * oh * ow;
-              uint32_t ut = (total_needed * 100) / CV18xx::LMEM_BYTES;
-              bool is_tiled =
-                  ((oc != oc_step) || (oh != oh_step)) ? true : false;
-              const char *ut_msg =
-                  (ut < 70 && is_tiled && !favor_dma) ? " => NG" : "";
-
-              LLVM_DEBUG(llvm::errs() << llvm::format(
-                             "  Conv::determineTileSize\n    "
-                             "layer_id %d\n    "
-                             "groups %d, ifmap (%d, %d, %d, %d), ofmap(%d, %d, "
-                             "%d, %d)\n    "
-                             "kernel (%d, %d), pad (top=%d, bot=%d, left=%d, "
-                             "right=%d)\n    "
-                             "stride (%d, %d), dilation (%d, %d)\n    "
-                             "useDoubleBuffer %d\n",
-                             args.layer_id, groups, input_n, input_c, input_h,
-                             input_w, input_n, oc, oh, ow, kh, kw, pad_top,
-                             pad_bottom, pad_left, pad_right, stride_h,
-                             stride_w, dilation_h, dilation_w,
-                             useDoubleBuffer));
-              LLVM_DEBUG(
-                  llvm::errs() << llvm::format(
-                      "    Tile (n_step=%d, oc_step=%d, oh_step=%d, ow_step=%d"
-                      ", ih_step=%d, iw_step=%d, ic_step=%d)\n    "
-                      "inputSize %d, outputSize %d, weightSize %d"
-                      ", biasSize %d, totalSizePerLane %d/%d"
-                      ", totalSize %d/%d(%d), %d/%d(%d)%s\n    "
-                      "ifmap shape (%d, %d, %d, %d)\n    "
-                      "weight shape (%d, %d, %d, %d)\n    "
-                      "ofmap shape (%d, %d, %d, %d)\n    "
-                      "useDoubleBuffer %d, favor_dma %d\n",
-                      n_step, oc_step, oh_step, ow_step, ih_step, iw_step,
-                      ic_step, ifmap_size * bufferMultiplier,
-                      ofmap_size * bufferMultiplier,
-                      weight_size * bufferMultiplier,
-                      coeff_oc_step_size * bufferMultiplier, total_needed,
-                      CV18xx::LMEM_BYTES, total_needed * CV18xx::NPU_NUM,
-                      CV18xx::LMEM_BYTES * CV18xx::NPU_NUM,
-                      (total_needed * 100) / CV18xx::LMEM_BYTES, total_needed,
-                      total_size, (total_needed * 100) / total_size, ut_msg,
-                      n_step, ic_step, ih_step, iw_step, oc_step, ic_step, kh,
-                      kw, n_step, oc_step, oh_step, ow_step, useDoubleBuffer,
-                      favor_dma));
-              return true;
-            }
+          tile_info.n_step = n_step;
+          tile_info.ih_step = ih_step;
+          tile_info.iw_step = iw_step;
+          tile_info.ic_step = ic_step;
+          tile_info.total_needed = total_needed;
 
-          } // for (tile_info.n = 1; tile_info.n < n; ++tile_info.n)
-        }   // for (int32_t slice_oc = 0; slice_oc < num_oc_step; ++slice_oc)
+          uint32_t total_size = ic * ih * iw + oc * ic * kh * kw + oc * oh * ow;
+          uint32_t ut = (total_needed * 100) / CV18xx::LMEM_BYTES;
+          bool is_tiled = ((oc != oc_step) || (oh != oh_step)) ? true : false;
+          const char *ut_msg =
+              (ut < 70 && is_tiled && !favor_dma) ? " => NG" : "";
+
+          LLVM_DEBUG(llvm::errs() << llvm::format(
+                         "  Conv::determineTileSize\n    "
+                         "layer_id %d\n    "
+                         "groups %d, ifmap (%d, %d, %d, %d), ofmap(%d, %d, "
+                         "%d, %d)\n    "
+                         "kernel (%d, %d), pad (top=%d, bot=%d, left=%d, "
+                         "right=%d)\n    "
+                         "stride (%d, %d), dilation (%d, %d)\n    "
+                         "useDoubleBuffer %d\n",
+                         args.layer_id, groups, input_n, input_c, input_h,
+                         input_w, input_n, oc, oh, ow, kh, kw, pad_top,
+                         pad_bottom, pad_left, pad_right, stride_h, stride_w,
+                         dilation_h, dilation_w, useDoubleBuffer));
+          LLVM_DEBUG(
+              llvm::errs() << llvm::format(
+                  "    Tile (n_step=%d, oc_step=%d, oh_step=%d, ow_step=%d"
+                  ", ih_step=%d, iw_step=%d, ic_step=%d)\n    "
+                  "inputSize %d, outputSize %d, weightSize %d"
+                  ", biasSize %d, totalSizePerLane %d/%d"
+                  ", totalSize %d/%d(%d), %d/%d(%d)%s\n    "
+                  "ifmap shape (%d, %d, %d, %d)\n    "
+                  "weight shape (%d, %d, %d, %d)\n    "
+                  "ofmap shape (%d, %d, %d, %d)\n    "
+                  "useDoubleBuffer %d, favor_dma %d\n",
+                  n_step, oc_step, oh_step, ow_step, ih_step, iw_step, ic_step,
+                  usage.ifmap_size * bufferMultiplier,
+                  usage.ofmap_size * bufferMultiplier,
+                  usage.weight_size * bufferMultiplier,
+                  usage.coeff_size * bufferMultiplier, total_needed,
+                  CV18xx::LMEM_BYTES, total_needed * CV18xx::NPU_NUM,
+                  CV18xx::LMEM_BYTES * CV18xx::NPU_NUM,
+                  (total_needed * 100) / CV18xx::LMEM_BYTES, total_needed,
+                  total_size, (total_needed * 100) / total_size, ut_msg,
+                  n_step, ic_step, ih_step, iw_step, oc_step, ic_step, kh, kw,
+                  n_step, oc_step, oh_step, ow_step, useDoubleBuffer,
+                  favor_dma));
+          return true;
+        } // for (int32_t slice_oc = 0; slice_oc < num_oc_step; ++slice_oc)
       }
       if (ow_step < max_ow) {
         // When the width tiling is used, there is no need to do height tiling.
@@ -3529,6 +3555,121 @@ Conv::TilePolicy Conv::getReuseWgtOrActByCost() {
   return policy;
 }
 
+// Cost of the given policy with the current tile_info.
+void Conv::getTilePolicyCost(TilePolicy policy, CostModel &cost) {
+  cost = {0};
+  switch (policy) {
+  case NoTilePolicyType:
+    convNoTile();
+    break;
+
+  case SingleBufferPolicyType:
+  case SingleBufferPs32PolicyType:
+    convNaive();
+    break;
+
+  case ReuseWeightPolicyType:
+    convReuseWeight();
+    break;
+
+  case ReuseActivationPolicyType:
+    convReuseActivation();
+    break;
+
+  default:
+    return;
+  }
+
+  getCost(cost);
+  cmdQueue.clear();
+}
+
+// Everything the tiling search depends on. Global addresses and layer id
+// do not affect the tiling.
+std::vector<int64_t> Conv::getTilePlanKey() {
+  bool do_leaky_relu = args.do_activation && args.activation_arg &&
+                       args.activation_arg[0] != 0.0f;
+  return {args.input_n,
+          args.input_c,
+          args.input_h,
+          args.input_w,
+          args.groups,
+          args.output_c,
+          args.kh,
+          args.kw,
+          args.dilation_h,
+          args.dilation_w,
+          args.pad_top,
+          args.pad_bottom,
+          args.pad_left,
+          args.pad_right,
+          args.insert_h,
+          args.insert_w,
+          args.stride_h,
+          args.stride_w,
+          args.do_bias,
+          args.do_activation,
+          do_leaky_relu,
+          args.do_quant,
+          args.do_chl_quan,
+          args.do_scale_lut,
+          args.ps32_output,
+          args.input_fmt,
+          args.output_fmt,
+          args.tiu_fmt,
+          (int64_t)module::getChip(),
+          CV18xx::NPU_NUM,
+          CV18xx::LMEM_BYTES,
+          CV18xx::tiu_eu_num(args.tiu_fmt)};
+}
+
+// Plans of the current codegen session, see cvi_backend_tg_conv_clear_plans.
+static std::mutex tile_plan_mutex;
+static std::map<std::vector<int64_t>, Conv::TilePlan> tile_plan_cache;
+
+void cvi_backend_tg_conv_clear_plans() {
+  std::lock_guard<std::mutex> lock(tile_plan_mutex);
+  tile_plan_cache.clear();
+}
+
+// Same-shaped convs show up many times in a net, search the tiling once.
+Conv::TilePlan Conv::planTile() {
+  auto key = getTilePlanKey();
+  {
+    std::lock_guard<std::mutex> lock(tile_plan_mutex);
+    auto it = tile_plan_cache.find(key);
+    if (it != tile_plan_cache.end()) {
+      LLVM_DEBUG(llvm::dbgs() << "  planTile: layer_id " << args.layer_id
+                              << " reuse policy " << it->second.policy
+                              << "\n");
+      return it->second;
+    }
+  }
+
+  searchTilePolicy();
+
+  TilePlan plan;
+  plan.policy = tilePolicy;
+  plan.tile_info = tile_info;
+  plan.use_double_buffer = use_double_buffer;
+  LLVM_DEBUG({
+    CostModel cost;
+    getTilePolicyCost(tilePolicy, cost);
+    showCost(cost);
+  });
+
+  std::lock_guard<std::mutex> lock(tile_plan_mutex);
+  tile_plan_cache.emplace(std::move(key), plan);
+  return plan;
+}
+
+void Conv::determineTilePolicy() {
+  TilePlan plan = planTile();
+  tilePolicy = plan.policy;
+  tile_info = plan.tile_info;
+  use_double_buffer = plan.use_double_buffer;
+}
+
 // Priority:
 //   1. No tiling
 //   2. Reuse weight w/ double buffer
@@ -3536,7 +3677,7 @@ Conv::TilePolicy Conv::getReuseWgtOrActByCost() {
 //   4. Tile w/ single buffer
 //   5. Tile+ps32 w/ single buffer
 //
-void Conv::determineTilePolicy() {
+void Conv::searchTilePolicy() {
   if (canNoTile()) {
     // No tiling should be the best condition
     tilePolicy = NoTilePolicyType;
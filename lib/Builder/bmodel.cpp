@@ -8,7 +8,13 @@
 //===----------------------------------------------------------------------===//
 
 #include "tpu_mlir/Builder/BM168x/bmodel.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
 #include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using bmodel::Binary;
 using bmodel::Model;
@@ -43,6 +49,7 @@ const uint32_t BMODEL_MAGIC = 0xFF55AAEE;
 
 ModelGen::ModelGen(uint32_t reserved_size) {
   binary_.reserve(reserved_size);
+  binary_ref_size_ = 0;
   max_neuron_size_ = 0;
   num_device_ = 0;
 }
@@ -51,9 +58,21 @@ FlatBufferBuilder &ModelGen::Builder() { return builder_; }
 
 ModelGen::~ModelGen() { builder_.Release(); }
 
-Binary ModelGen::WriteBinary(size_t size, uint8_t *data) {
+size_t ModelGen::HashBinary(size_t size, const uint8_t *data) {
+  return std::hash<std::string_view>()(
+      std::string_view((const char *)data, size));
+}
+
+Binary ModelGen::WriteBinary(size_t size, const uint8_t *data) {
+  return WriteBinary(size, data, HashBinary(size, data));
+}
+
+Binary ModelGen::WriteBinary(size_t size, const uint8_t *data, size_t hash) {
   // ASSERT(size != 0 && data != NULL);
-  for (auto &binary : binary_vector_) {
+  ASSERT(binary_ref_.empty());
+  auto range = binary_index_.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    auto &binary = binary_vector_[it->second];
     if (binary.size() != size) {
       continue;
     }
@@ -65,10 +84,44 @@ Binary ModelGen::WriteBinary(size_t size, uint8_t *data) {
   binary_.insert(binary_.end(), size, 0);
   memcpy(binary_.data() + start, data, size);
   Binary new_bin(start, size);
+  binary_index_.emplace(hash, binary_vector_.size());
   binary_vector_.push_back(new_bin);
   return new_bin;
 }
 
+Binary ModelGen::WriteBinaryRef(size_t size, const uint8_t *data) {
+  ASSERT(data != NULL);
+  auto iter = binary_ref_map_.find({data, size});
+  if (iter != binary_ref_map_.end()) {
+    return iter->second;
+  }
+  // same content from another source, written or referenced before
+  auto hash = HashBinary(size, data);
+  auto range = binary_index_.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    auto &binary = binary_vector_[it->second];
+    if (binary.size() == size &&
+        memcmp(data, binary_.data() + binary.start(), size) == 0) {
+      binary_ref_map_[{data, size}] = binary;
+      return binary;
+    }
+  }
+  auto ref_range = binary_ref_index_.equal_range(hash);
+  for (auto it = ref_range.first; it != ref_range.second; ++it) {
+    auto &ref = binary_ref_[it->second];
+    if (ref.first.size() == size && memcmp(data, ref.second, size) == 0) {
+      binary_ref_map_[{data, size}] = ref.first;
+      return ref.first;
+    }
+  }
+  Binary new_bin(binary_.size() + binary_ref_size_, size);
+  binary_ref_index_.emplace(hash, binary_ref_.size());
+  binary_ref_.emplace_back(new_bin, data);
+  binary_ref_map_[{data, size}] = new_bin;
+  binary_ref_size_ += size;
+  return new_bin;
+}
+
 void ModelGen::AddNet(const flatbuffers::Offset<bmodel::Net> &net) {
   nets_.push_back(net);
 }
@@ -289,7 +342,11 @@ size_t ModelGen::Finish() {
   auto version = builder_.CreateString(BMODEL_VERSION);
   auto net = builder_.CreateVector(nets_);
   auto chip = builder_.CreateString(chip_);
+  // SOURCE_DATE_EPOCH pins the build time, for reproducible bmodels
   auto now = time(0);
+  if (auto epoch = getenv("SOURCE_DATE_EPOCH")) {
+    now = (time_t)strtoll(epoch, nullptr, 10);
+  }
   auto time = builder_.CreateString(ctime(&now));
   auto module_name = builder_.CreateString(kernel_module_.file_name);
 
@@ -311,7 +368,8 @@ size_t ModelGen::Finish() {
   builder_.Finish(model);
 
   // return size
-  size_t size = sizeof(MODEL_HEADER_T) + builder_.GetSize() + binary_.size();
+  size_t size = sizeof(MODEL_HEADER_T) + builder_.GetSize() + binary_.size() +
+                binary_ref_size_;
   return size;
 }
 
@@ -319,7 +377,10 @@ uint8_t *ModelGen::GetBufferPointer() { return builder_.GetBufferPointer(); }
 
 void ModelGen::Save(const string &filename) {
   ASSERT(!filename.empty());
-  std::ofstream fout(filename,
+  // referenced binaries may come from the file to be overwritten, so write
+  // to a temporary file and replace it at last
+  string save_name = binary_ref_.empty() ? filename : filename + ".tmp";
+  std::ofstream fout(save_name,
                      std::ios::out | std::ios::trunc | std::ios::binary);
   if (!fout) {
     BMODEL_LOG(FATAL) << "Save file[" << filename << "] failed." << std::endl;
@@ -330,11 +391,19 @@ void ModelGen::Save(const string &filename) {
   header.magic = BMODEL_MAGIC;
   header.header_size = sizeof(header);
   header.flatbuffers_size = builder_.GetSize();
-  header.binary_size = binary_.size();
+  header.binary_size = binary_.size() + binary_ref_size_;
   fout.write((char *)&header, sizeof(header));
   fout.write((char *)builder_.GetBufferPointer(), builder_.GetSize());
   fout.write((char *)binary_.data(), binary_.size());
+  // referenced binaries go from their source to file, without a copy here
+  for (auto &ref : binary_ref_) {
+    fout.write((const char *)ref.second, ref.first.size());
+  }
   fout.close();
+  if (save_name != filename && rename(save_name.c_str(), filename.c_str())) {
+    BMODEL_LOG(FATAL) << "Save file[" << filename << "] failed." << std::endl;
+    exit(-1);
+  }
 }
 
 void ModelGen::Save(void *buffer) {
@@ -344,45 +413,83 @@ void ModelGen::Save(void *buffer) {
   p_header->magic = BMODEL_MAGIC;
   p_header->header_size = sizeof(MODEL_HEADER_T);
   p_header->flatbuffers_size = builder_.GetSize();
-  p_header->binary_size = binary_.size();
+  p_header->binary_size = binary_.size() + binary_ref_size_;
   uint8_t *p_flb = (uint8_t *)buffer + p_header->header_size;
   memcpy(p_flb, builder_.GetBufferPointer(), p_header->flatbuffers_size);
   uint8_t *p_binary = p_flb + p_header->flatbuffers_size;
-  memcpy(p_binary, binary_.data(), p_header->binary_size);
+  memcpy(p_binary, binary_.data(), binary_.size());
+  for (auto &ref : binary_ref_) {
+    memcpy(p_binary + ref.first.start(), ref.second, ref.first.size());
+  }
+}
+
+// bytes the header claims, the 32 bits fields of a broken file must not wrap
+static uint64_t header_total_size(const bmodel::MODEL_HEADER_T &header) {
+  return (uint64_t)header.header_size + header.flatbuffers_size +
+         header.binary_size;
 }
 
 ModelCtx::ModelCtx(const string &filename)
-    : model_gen_(NULL), model_(NULL), bmodel_pointer_(NULL) {
-  // read file
-  file_.open(filename, std::ios::binary | std::ios::in);
-  if (!file_) {
+    : model_gen_(NULL), model_(NULL), model_buffer_(NULL),
+      bmodel_pointer_(NULL), mmap_addr_(NULL), mmap_size_(0) {
+  // map the file if possible, only the pages touched are read then
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
     BMODEL_LOG(FATAL) << "File[" << filename << "] open failed." << std::endl;
     exit(-1);
   }
-  file_.seekg(0, std::ios::end);
-  size_t length = file_.tellg();
+  struct stat st;
+  size_t length = 0;
+  if (fstat(fd, &st) == 0) {
+    length = st.st_size;
+  }
   if (length <= sizeof(header_)) {
     BMODEL_LOG(FATAL) << "File[" << filename << "] is broken ." << std::endl;
     exit(-1);
   }
-  file_.seekg(0, std::ios::beg);
+  // private writable mapping, in case the flatbuffer is mutated in place
+  void *addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr != MAP_FAILED) {
+    mmap_addr_ = addr;
+    mmap_size_ = length;
+    memcpy(&header_, mmap_addr_, sizeof(header_));
+  } else {
+    file_.open(filename, std::ios::binary | std::ios::in);
+    if (!file_) {
+      BMODEL_LOG(FATAL) << "File[" << filename << "] open failed."
+                        << std::endl;
+      exit(-1);
+    }
+    // read header
+    memset(&header_, 0, sizeof(header_));
+    file_.read((char *)&header_, sizeof(header_));
+  }
 
-  // read header and check
-  memset(&header_, 0, sizeof(header_));
-  file_.read((char *)&header_, sizeof(header_));
+  // check header
   if (header_.magic != BMODEL_MAGIC) {
     BMODEL_LOG(FATAL) << "File[" << filename << "] is broken .." << std::endl;
     exit(-1);
   }
-  if (length <
-      header_.header_size + header_.flatbuffers_size + header_.binary_size) {
-    BMODEL_LOG(FATAL) << "File[" << filename << "] is broken ..." << std::endl;
+  // a truncated file would fault on the first access past its end
+  if (header_.header_size < sizeof(header_) ||
+      length < header_total_size(header_)) {
+    BMODEL_LOG(FATAL) << "File[" << filename << "] is truncated, " << length
+                      << " bytes of " << header_total_size(header_) << "."
+                      << std::endl;
     exit(-1);
   }
   binary_offset_ = header_.header_size + header_.flatbuffers_size;
-  model_buffer_ = (void *)malloc(header_.flatbuffers_size);
-  ASSERT(model_buffer_ != NULL);
-  file_.read((char *)model_buffer_, header_.flatbuffers_size);
+  if (mmap_addr_ != NULL) {
+    // parse flatbuffers and access binaries in place
+    model_buffer_ = (uint8_t *)mmap_addr_ + header_.header_size;
+    bmodel_pointer_ = mmap_addr_;
+  } else {
+    model_buffer_ = (void *)malloc(header_.flatbuffers_size);
+    ASSERT(model_buffer_ != NULL);
+    file_.seekg(header_.header_size, std::ios::beg);
+    file_.read((char *)model_buffer_, header_.flatbuffers_size);
+  }
   flatbuffers::Verifier v((uint8_t *)model_buffer_, header_.flatbuffers_size);
   if (!bmodel::VerifyModelBuffer(v)) {
     BMODEL_LOG(FATAL) << "Model file[" << filename << "] is broken."
@@ -405,7 +512,7 @@ ModelCtx::ModelCtx(const string &filename)
 
 ModelCtx::ModelCtx(const void *bmodel_data, size_t size)
     : model_gen_(NULL), model_(NULL), model_buffer_(NULL),
-      bmodel_pointer_(NULL) {
+      bmodel_pointer_(NULL), mmap_addr_(NULL), mmap_size_(0) {
   ASSERT(bmodel_data != NULL);
   if (size <= sizeof(header_)) {
     BMODEL_LOG(FATAL) << "Bmodel data is broken ." << std::endl;
@@ -418,8 +525,8 @@ ModelCtx::ModelCtx(const void *bmodel_data, size_t size)
     BMODEL_LOG(FATAL) << "Bmodel data is broken .." << std::endl;
     exit(-1);
   }
-  if (size <
-      header_.header_size + header_.flatbuffers_size + header_.binary_size) {
+  if (header_.header_size < sizeof(header_) ||
+      size < header_total_size(header_)) {
     BMODEL_LOG(FATAL) << "Bmodel data is broken ..." << std::endl;
     exit(-1);
   }
@@ -456,13 +563,24 @@ ModelCtx::~ModelCtx() {
   if (model_gen_ != NULL) {
     delete model_gen_;
   }
-  if (model_buffer_ != NULL) {
+  if (mmap_addr_ != NULL) {
+    munmap(mmap_addr_, mmap_size_);
+  } else if (model_buffer_ != NULL) {
     free(model_buffer_);
   }
 }
 
 const void *ModelCtx::data() const { return model_buffer_; }
 
+const uint8_t *ModelCtx::binary_data(const Binary *binary) const {
+  ASSERT(binary != NULL);
+  if (bmodel_pointer_ == NULL) {
+    return NULL;
+  }
+  ASSERT(binary->start() + binary->size() <= header_.binary_size);
+  return (const uint8_t *)bmodel_pointer_ + binary_offset_ + binary->start();
+}
+
 const bmodel::MODEL_HEADER_T &ModelCtx::header() const { return header_; }
 
 void ModelCtx::read_binary(const Binary *binary, uint8_t *buffer) {
@@ -565,7 +683,7 @@ bmodel::bmodel_mem_info_t ModelCtx::get_bmodel_mem_info() {
     uint64_t max_neuron_size = 0;
     bool multi_subnet = false;
     for (size_t stage_idx = 0; stage_idx < stage_num; stage_idx++) {
-      auto param = net_params->Get(0);
+      auto param = net_params->Get(stage_idx);
       auto subnets = param->sub_net();
       auto num_subnets = subnets == nullptr ? 0 : subnets->size();
       uint64_t neuron_size = param->ctx_size();
@@ -80,54 +80,46 @@ struct EraseTopInputOp : public OpRewritePattern<top::InputOp> {
   }
 };*/
 
-// struct LowerTopWeightOp : public OpRewritePattern<top::WeightOp> {
-// public:
-//   LowerTopWeightOp(MLIRContext *ctx, bool include_weight)
-//       : OpRewritePattern(ctx), include_weight(include_weight) {}
-
-//   LogicalResult matchAndRewrite(top::WeightOp op,
-//                                 PatternRewriter &rewriter) const override {
-//     assert(op->getNumResults() == 1);
-//     auto outType = change_dataformat(op->getResult(0).getType());
-//     auto has_weight = include_weight;
-//     for (auto user : op.getOutput().getUsers()) {
-//       if (isa<linalg::TransposeOp>(user)) {
-//         has_weight = true;
-//       }
-//     }
-//     if (has_weight) {
-//       auto valptr = op.read_as_float();
-//       auto new_val = change_weight(valptr, op->getResult(0).getType());
-//       auto attr =
-//           DenseElementsAttr::get(outType.cast<RankedTensorType>(),
-//                                  llvm::ArrayRef(new_val, valptr->size()));
-//       rewriter.replaceOpWithNewOp<mlir::linalg::ConstOp>(op, outType, attr);
-//     } else {
-//       // auto out_shape = outType.cast<RankedTensorType>().getShape();
-//       // auto out_ty = RankedTensorType::get(out_shape, rewriter.getF32Type());
-//       // attr = DenseElementsAttr::get(out_ty, llvm::ArrayRef<float>());
-//       auto attr = DenseElementsAttr::get(
-//           RankedTensorType::get({}, rewriter.getI64Type()),
-//           llvm::ArrayRef<int64_t>({0}));
-//       rewriter.replaceOpWithNewOp<mlir::linalg::ConstOp>(op, outType, attr);
-//     }
-//     return success();
-//   }
-
-// private:
-//   bool include_weight;
-// };
-
-// struct EraseTopNoneOp : public OpRewritePattern<top::NoneOp> {
-// public:
-//   using OpRewritePattern<top::NoneOp>::OpRewritePattern;
-
-//   LogicalResult matchAndRewrite(top::NoneOp op,
-//                                 PatternRewriter &rewriter) const override {
-//     rewriter.eraseOp(op);
-//     return success();
-//   }
-// };
+struct LowerTopWeightOp : public OpRewritePattern<top::WeightOp> {
+public:
+  LowerTopWeightOp(MLIRContext *ctx, bool include_weight)
+      : OpRewritePattern(ctx), include_weight(include_weight) {}
+
+  LogicalResult matchAndRewrite(top::WeightOp op,
+                                PatternRewriter &rewriter) const override {
+    auto outType = op.getOutput().getType().cast<RankedTensorType>();
+    if (!outType.getElementType().isF32()) {
+      return failure();
+    }
+    DenseElementsAttr attr;
+    if (include_weight) {
+      auto valptr = op.read_as_float();
+      attr = DenseElementsAttr::get(outType, llvm::ArrayRef<float>(*valptr));
+    } else {
+      // placeholder with the right type, data is bound at deploy time
+      attr = DenseElementsAttr::get(outType, 0.0f);
+    }
+    rewriter.replaceOpWithNewOp<arith::ConstantOp>(op, outType, attr);
+    return success();
+  }
+
+private:
+  bool include_weight;
+};
+
+struct EraseTopNoneOp : public OpRewritePattern<top::NoneOp> {
+public:
+  using OpRewritePattern<top::NoneOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(top::NoneOp op,
+                                PatternRewriter &rewriter) const override {
+    if (!op->use_empty()) {
+      return failure();
+    }
+    rewriter.eraseOp(op);
+    return success();
+  }
+};
 
 struct ConvertTopToLinalg
     : public ::impl::ConvertTopToLinalgBase<ConvertTopToLinalg> {
@@ -152,9 +144,11 @@ public:
     config.maxIterations = 1;
     applyPatternsAndFoldGreedily(module_, std::move(patterns), config);
 
-    // Erase TOP::NoneOp
+    // Lower TOP::WeightOp (including those created by the lowerings above)
+    // and erase TOP::NoneOp, so the result only holds upstream dialects
     patterns.clear();
-    // patterns.add<EraseTopNoneOp>(ctx_);
+    patterns.add<LowerTopWeightOp>(ctx_, includeWeight);
+    patterns.add<EraseTopNoneOp>(ctx_);
     applyPatternsAndFoldGreedily(module_, std::move(patterns));
 
     module::updateModuleTypes();
@@ -57,7 +57,9 @@ LogicalResult top::ConcatOp::inference(InferenceParameter &p) {
     return failure();
   }
   auto concat = (Concat *)p.handle;
-  concat->run();
+  if (!is_concat_in_place(p.inputs, p.outputs[0], getInputs())) {
+    concat->run();
+  }
 
   if (getDoRelu()) {
     auto limit = getReluLimit().convertToDouble();
@@ -8,6 +8,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "tpu_mlir/Support/MathUtils.h"
+#include "tpu_mlir/Support/NormFunc.h"
 
 int64_t top::GroupNormOp::getFLOPs() {
   const bool have_weight = !module::isNone(getWeight());
@@ -43,28 +44,11 @@ LogicalResult top::GroupNormOp::inference(InferenceParameter &p) {
   const float *bias_data = have_bias ? p.inputs[2] : nullptr;
   float *output_data = p.outputs[0];
 
-  std::vector<float> mean_arr(outer_dim, 0);
-  std::vector<float> rstd_arr(outer_dim, 0);
-
 #pragma omp parallel for schedule(static, omp_schedule(outer_dim))
   for (int i = 0; i < outer_dim; ++i) {
-    for (int j = 0; j < inner_dim; ++j) {
-      mean_arr[i] += input_data[i * inner_dim + j];
-    }
-    mean_arr[i] /= inner_dim;
-    for (int j = 0; j < inner_dim; ++j) {
-      const float dij = input_data[i * inner_dim + j] - mean_arr[i];
-      rstd_arr[i] += dij * dij;
-    }
-    rstd_arr[i] /= inner_dim;
-    rstd_arr[i] += eps_;
-    rstd_arr[i] = std::sqrt(rstd_arr[i]);
-    rstd_arr[i] = 1.0f / rstd_arr[i];
-    for (int j = 0; j < inner_dim; ++j) {
-      output_data[i * inner_dim + j] =
-          input_data[i * inner_dim + j] - mean_arr[i];
-      output_data[i * inner_dim + j] *= rstd_arr[i];
-    }
+    layer_norm_f32(input_data + (int64_t)i * inner_dim,
+                   output_data + (int64_t)i * inner_dim, nullptr, nullptr,
+                   inner_dim, eps_);
   }
   inner_dim /= channel_per_group;
   int num_iter = module::getNumElements(getOutput()) / channel;
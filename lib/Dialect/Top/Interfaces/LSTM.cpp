@@ -60,28 +60,26 @@ lstm_attr_t top::LSTMOp::parseParam() {
   return attr;
 }
 
+// torch lays out y as [seq, batch, direction, hidden], computed in the
+// onnx layout and permuted
+static bool need_permute(const lstm_attr_t &attr) {
+  return module::isPlatform(module::Platform::TORCH) && attr.output_y &&
+         attr.batch_size > 1 && attr.num_direction > 1;
+}
+
 LogicalResult top::LSTMOp::init(InferenceParameter &p) {
-  if (!module::isPlatform(module::Platform::TORCH)) {
-    return success();
-  }
   auto attr = parseParam();
-  if (attr.output_y == false || attr.batch_size == 1 ||
-      attr.num_direction == 1) {
-    return success();
+  int64_t state = attr.num_direction * attr.batch_size * attr.hidden_size;
+  // initial h and c, bias, gates of one step, then y before the permute
+  p.workspace_size = 2 * state + attr.num_direction * 8 * attr.hidden_size +
+                     12 * attr.batch_size * attr.hidden_size;
+  if (need_permute(attr)) {
+    p.workspace_size += module::getNumElements(getY());
   }
-  auto num = module::getNumElements(getY());
-  float *buffer = new float[num];
-  p.handle = (void *)buffer;
   return success();
 }
 
-void top::LSTMOp::deinit(InferenceParameter &p) {
-  if (p.handle) {
-    float *buffer = (float *)p.handle;
-    delete[] buffer;
-    p.handle = nullptr;
-  }
-}
+void top::LSTMOp::deinit(InferenceParameter &p) {}
 
 static inline float sigmoid_(float x) {
   // return static_cast<float>(1.f / (1.f + std::exp(-x)));
@@ -91,11 +89,11 @@ static inline float sigmoid_(float x) {
 static inline float tanh_(float x) { return tanh(x); }
 
 static void lstm_compute(InferenceParameter &p, const lstm_attr_t &attr,
-                         float *bias, float *h, float *c, bool forward) {
+                         float *bias, float *h, float *c, float *output,
+                         float *gates, bool forward) {
   //(TODO) num_layers > 1
   // input += seq_length * batch * input_size * num_layer; //(TODO check!)
   float *input = p.inputs[0];
-  float *output = p.handle != nullptr ? (float *)p.handle : p.outputs[0];
   float *x_wi = p.inputs[1];
   float *h_wi = p.inputs[2];
   float *x_bi = bias;
@@ -129,18 +127,19 @@ static void lstm_compute(InferenceParameter &p, const lstm_attr_t &attr,
   float *h_bf = h_bo + attr.hidden_size;
   float *h_bc = h_bf + attr.hidden_size;
 
-  std::vector<float> x_i(attr.batch_size * attr.hidden_size);
-  std::vector<float> x_o(attr.batch_size * attr.hidden_size);
-  std::vector<float> x_f(attr.batch_size * attr.hidden_size);
-  std::vector<float> x_c(attr.batch_size * attr.hidden_size);
-  std::vector<float> h_i(attr.batch_size * attr.hidden_size);
-  std::vector<float> h_o(attr.batch_size * attr.hidden_size);
-  std::vector<float> h_f(attr.batch_size * attr.hidden_size);
-  std::vector<float> h_c(attr.batch_size * attr.hidden_size);
-  std::vector<float> gi(attr.batch_size * attr.hidden_size);
-  std::vector<float> go(attr.batch_size * attr.hidden_size);
-  std::vector<float> gf(attr.batch_size * attr.hidden_size);
-  std::vector<float> gc(attr.batch_size * attr.hidden_size);
+  const int64_t gate_size = attr.batch_size * attr.hidden_size;
+  float *x_i = gates;
+  float *x_o = gates + 1 * gate_size;
+  float *x_f = gates + 2 * gate_size;
+  float *x_c = gates + 3 * gate_size;
+  float *h_i = gates + 4 * gate_size;
+  float *h_o = gates + 5 * gate_size;
+  float *h_f = gates + 6 * gate_size;
+  float *h_c = gates + 7 * gate_size;
+  float *gi = gates + 8 * gate_size;
+  float *go = gates + 9 * gate_size;
+  float *gf = gates + 10 * gate_size;
+  float *gc = gates + 11 * gate_size;
 
   for (int s = 0; s < attr.seq_len; s++) {
     // matrixmul
@@ -151,22 +150,22 @@ static void lstm_compute(InferenceParameter &p, const lstm_attr_t &attr,
     int seq_idx = forward ? s : (attr.seq_len - s - 1);
     float *x = input + seq_idx * attr.batch_size * attr.input_size;
 
-    dnnl_mm(x, x_wi, x_bi, x_i.data(), attr.batch_size, attr.input_size,
+    dnnl_mm(x, x_wi, x_bi, x_i, attr.batch_size, attr.input_size,
             attr.hidden_size, false);
-    dnnl_mm(x, x_wo, x_bo, x_o.data(), attr.batch_size, attr.input_size,
+    dnnl_mm(x, x_wo, x_bo, x_o, attr.batch_size, attr.input_size,
             attr.hidden_size, false);
-    dnnl_mm(x, x_wf, x_bf, x_f.data(), attr.batch_size, attr.input_size,
+    dnnl_mm(x, x_wf, x_bf, x_f, attr.batch_size, attr.input_size,
             attr.hidden_size, false);
-    dnnl_mm(x, x_wc, x_bc, x_c.data(), attr.batch_size, attr.input_size,
+    dnnl_mm(x, x_wc, x_bc, x_c, attr.batch_size, attr.input_size,
             attr.hidden_size, false);
 
-    dnnl_mm(h, h_wi, h_bi, h_i.data(), attr.batch_size, attr.hidden_size,
+    dnnl_mm(h, h_wi, h_bi, h_i, attr.batch_size, attr.hidden_size,
             attr.hidden_size, false);
-    dnnl_mm(h, h_wo, h_bo, h_o.data(), attr.batch_size, attr.hidden_size,
+    dnnl_mm(h, h_wo, h_bo, h_o, attr.batch_size, attr.hidden_size,
             attr.hidden_size, false);
-    dnnl_mm(h, h_wf, h_bf, h_f.data(), attr.batch_size, attr.hidden_size,
+    dnnl_mm(h, h_wf, h_bf, h_f, attr.batch_size, attr.hidden_size,
             attr.hidden_size, false);
-    dnnl_mm(h, h_wc, h_bc, h_c.data(), attr.batch_size, attr.hidden_size,
+    dnnl_mm(h, h_wc, h_bc, h_c, attr.batch_size, attr.hidden_size,
             attr.hidden_size, false);
 
     for (int batch = 0; batch < attr.batch_size; batch++) {
@@ -174,14 +173,14 @@ static void lstm_compute(InferenceParameter &p, const lstm_attr_t &attr,
       if (attr.have_cont) {
         cont = conts[s * attr.batch_size + batch];
       }
-      float *xi = x_i.data() + batch * attr.hidden_size;
-      float *xo = x_o.data() + batch * attr.hidden_size;
-      float *xf = x_f.data() + batch * attr.hidden_size;
-      float *xc = x_c.data() + batch * attr.hidden_size;
-      float *hi = h_i.data() + batch * attr.hidden_size;
-      float *ho = h_o.data() + batch * attr.hidden_size;
-      float *hf = h_f.data() + batch * attr.hidden_size;
-      float *hc = h_c.data() + batch * attr.hidden_size;
+      float *xi = x_i + batch * attr.hidden_size;
+      float *xo = x_o + batch * attr.hidden_size;
+      float *xf = x_f + batch * attr.hidden_size;
+      float *xc = x_c + batch * attr.hidden_size;
+      float *hi = h_i + batch * attr.hidden_size;
+      float *ho = h_o + batch * attr.hidden_size;
+      float *hf = h_f + batch * attr.hidden_size;
+      float *hc = h_c + batch * attr.hidden_size;
       float *cell_state = c + batch * attr.hidden_size;
       float *hidden_state = h + batch * attr.hidden_size;
       if (attr.output_y) {
@@ -214,34 +213,37 @@ static void lstm_compute(InferenceParameter &p, const lstm_attr_t &attr,
 LogicalResult top::LSTMOp::inference(InferenceParameter &p) {
   auto attr = parseParam();
 
-  auto h0_buffer = std::make_shared<std::vector<float>>(
-      attr.num_direction * attr.batch_size * attr.hidden_size, 0.0f);
-  auto initial_h = h0_buffer->data();
+  const int64_t state = attr.num_direction * attr.batch_size * attr.hidden_size;
+  float *initial_h = p.get_workspace();
+  float *initial_c = initial_h + state;
+  float *B = initial_c + state;
+  float *gates = B + attr.num_direction * 8 * attr.hidden_size;
+  float *y_buffer = gates + 12 * attr.batch_size * attr.hidden_size;
   if (attr.have_h0) {
-    memcpy(initial_h, p.inputs[4], h0_buffer->size() * sizeof(float));
+    memcpy(initial_h, p.inputs[4], state * sizeof(float));
+  } else {
+    std::fill(initial_h, initial_h + state, 0.0f);
   }
-
-  auto c0_buffer = std::make_shared<std::vector<float>>(
-      attr.num_direction * attr.batch_size * attr.hidden_size, 0.0f);
-  auto initial_c = c0_buffer->data();
   if (attr.have_c0) {
-    memcpy(initial_c, p.inputs[5], c0_buffer->size() * sizeof(float));
+    memcpy(initial_c, p.inputs[5], state * sizeof(float));
+  } else {
+    std::fill(initial_c, initial_c + state, 0.0f);
   }
-
-  auto bias_buffer = std::make_shared<std::vector<float>>(
-      attr.num_direction * 8 * attr.hidden_size, 0.0f);
-  auto B = bias_buffer->data();
+  const int64_t bias_size = attr.num_direction * 8 * attr.hidden_size;
   if (attr.have_bias) {
-    memcpy(B, p.inputs[3], bias_buffer->size() * sizeof(float));
+    memcpy(B, p.inputs[3], bias_size * sizeof(float));
+  } else {
+    std::fill(B, B + bias_size, 0.0f);
   }
 
-  lstm_compute(p, attr, B, initial_h, initial_c, true);
+  const bool permute = need_permute(attr);
+  float *output = permute ? y_buffer : p.outputs[0];
+  lstm_compute(p, attr, B, initial_h, initial_c, output, gates, true);
   if (attr.num_direction == 2) {
-    lstm_compute(p, attr, B, initial_h, initial_c, false);
+    lstm_compute(p, attr, B, initial_h, initial_c, output, gates, false);
   }
-  if (p.handle) {
-    float *buffer = (float *)p.handle;
-    function_permute(buffer, p.outputs[0],
+  if (permute) {
+    function_permute(y_buffer, p.outputs[0],
                      {1, attr.seq_len, attr.num_direction, attr.batch_size,
                       attr.hidden_size},
                      {0, 1, 3, 2, 4});
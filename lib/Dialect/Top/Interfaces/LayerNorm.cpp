@@ -8,6 +8,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "tpu_mlir/Support/MathUtils.h"
+#include "tpu_mlir/Support/NormFunc.h"
 
 int64_t top::LayerNormOp::getFLOPs() {
   const bool have_weight = !getWeight().getType().isa<NoneType>();
@@ -44,35 +45,11 @@ LogicalResult top::LayerNormOp::inference(InferenceParameter &p) {
   const float *bias_data = have_bias ? p.inputs[2] : nullptr;
   float *output_data = p.outputs[0];
 
-  std::vector<float> mean_arr(outer_dim, 0);
-  std::vector<float> rstd_arr(outer_dim, 0);
-
 #pragma omp parallel for schedule(static, omp_schedule(outer_dim))
   for (int i = 0; i < outer_dim; ++i) {
-    for (int j = 0; j < inner_dim; ++j) {
-      mean_arr[i] += input_data[i * inner_dim + j];
-    }
-    mean_arr[i] /= inner_dim;
-    for (int j = 0; j < inner_dim; ++j) {
-      const float dij = input_data[i * inner_dim + j] - mean_arr[i];
-      rstd_arr[i] += dij * dij;
-    }
-    rstd_arr[i] /= inner_dim;
-    rstd_arr[i] += eps_;
-    rstd_arr[i] = std::sqrt(rstd_arr[i]);
-    rstd_arr[i] = 1.0f / rstd_arr[i];
-
-    for (int j = 0; j < inner_dim; ++j) {
-      output_data[i * inner_dim + j] =
-          input_data[i * inner_dim + j] - mean_arr[i];
-      output_data[i * inner_dim + j] *= rstd_arr[i];
-      if (have_weight) {
-        output_data[i * inner_dim + j] *= weight_data[j];
-      }
-      if (have_bias) {
-        output_data[i * inner_dim + j] += bias_data[j];
-      }
-    }
+    layer_norm_f32(input_data + (int64_t)i * inner_dim,
+                   output_data + (int64_t)i * inner_dim, weight_data,
+                   bias_data, inner_dim, eps_);
   }
   return success();
 }
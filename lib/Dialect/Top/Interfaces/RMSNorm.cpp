@@ -8,6 +8,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "tpu_mlir/Support/MathUtils.h"
+#include "tpu_mlir/Support/NormFunc.h"
 
 int64_t top::RMSNormOp::getFLOPs() {
   return 3 * module::getNumElements(getOutput());
@@ -33,25 +34,11 @@ LogicalResult top::RMSNormOp::inference(InferenceParameter &p) {
   const float *gamma_data = have_gamma ? p.inputs[1] : nullptr;
   float *output_data = p.outputs[0];
 
-  std::vector<float> rms_arr(outer_dim, 0);
-
 #pragma omp parallel for schedule(static, omp_schedule(outer_dim))
   for (int i = 0; i < outer_dim; ++i) {
-    for (int j = 0; j < inner_dim; ++j) {
-      const float dij = input_data[i * inner_dim + j];
-      rms_arr[i] += dij * dij;
-    }
-    rms_arr[i] /= inner_dim;
-    rms_arr[i] += eps;
-    rms_arr[i] = std::sqrt(rms_arr[i]);
-
-    for (int j = 0; j < inner_dim; ++j) {
-      output_data[i * inner_dim + j] =
-          input_data[i * inner_dim + j] / rms_arr[i];
-      if (have_gamma) {
-        output_data[i * inner_dim + j] *= gamma_data[j];
-      }
-    }
+    rms_norm_f32(input_data + (int64_t)i * inner_dim,
+                 output_data + (int64_t)i * inner_dim, gamma_data, inner_dim,
+                 eps);
   }
 
   return success();
@@ -7,7 +7,7 @@
 //
 //===----------------------------------------------------------------------===//
 
-#include "tpu_mlir/Support/Dnnl/Dnnl.h"
+#include "tpu_mlir/Support/A16MatMulFunc.h"
 #include "tpu_mlir/Support/Float16.h"
 #include "tpu_mlir/Support/MathUtils.h"
 
@@ -119,32 +119,31 @@ void weightQuantization(
 }
 
 LogicalResult tpu::A16MatMulOp::init(InferenceParameter &p) {
-  // (MxK), (KxN) matmul
-  if (getWeightBits() == 8) {
-    auto matmul = new MatMul();
-    auto in_shape = getInput().getType().cast<RankedTensorType>().getShape();
-    int64_t M = 1;
-    for (int i = 0; i < in_shape.size() - 1; i++) {
-      M *= in_shape[i];
-    }
-    auto weight_value = getWeight();
-    auto weight_shape =
-        weight_value.getType().cast<RankedTensorType>().getShape();
-
-    auto w_transpose = getWTranspose();
-    int K = w_transpose ? weight_shape[1] : weight_shape[0];
-    int N = w_transpose ? weight_shape[0] : weight_shape[1];
-
-    matmul->setup(p.inputs[0], p.inputs[1], p.inputs[4], p.outputs[0], 1, 1, M,
-                  K, N, false, -1.0, 0, 0, w_transpose, false, false, false);
-    p.handle = (void *)matmul;
+  // (MxK), (KxN) matmul, the weight stays packed and is dequantized by tiles
+  auto in_shape = module::getShape(getInput());
+  auto weight_shape = module::getShape(getWeight());
+  a16_matmul_attr_t attr;
+  attr.M = 1;
+  for (int i = 0; i < in_shape.size() - 1; i++) {
+    attr.M *= in_shape[i];
   }
+  attr.bits = getWeightBits();
+  attr.sign = getSign();
+  attr.w_transpose = getWTranspose();
+  attr.group_size = attr.bits == 4 ? getQGroupSize() : 0;
+  int64_t rows = weight_shape[0];
+  int64_t cols = attr.bits == 4 ? weight_shape[1] * 2 : weight_shape[1];
+  attr.K = attr.w_transpose ? cols : rows;
+  attr.N = attr.w_transpose ? rows : cols;
+  auto matmul = new A16MatMulFunc(attr, p.inputs[1], p.inputs[2], p.inputs[3]);
+  p.handle = (void *)matmul;
+  p.workspace_size = matmul->workspace_size();
   return success();
 }
 
 void tpu::A16MatMulOp::deinit(InferenceParameter &p) {
   if (p.handle != nullptr) {
-    auto matmul = (MatMul *)p.handle;
+    auto matmul = (A16MatMulFunc *)p.handle;
     delete matmul;
     p.handle = nullptr;
   }
@@ -152,72 +151,11 @@ void tpu::A16MatMulOp::deinit(InferenceParameter &p) {
 }
 
 LogicalResult tpu::A16MatMulOp::inference(InferenceParameter &p) {
-  // dequant weight back to f16/ bf16
-  auto scale = p.inputs[2];
-  auto weight_value = getWeight();
-  auto weight_shape =
-      weight_value.getType().cast<RankedTensorType>().getShape();
-  int K = weight_shape[0];
-  int N = weight_shape[1];
-  auto weight = p.inputs[1];
-  if (getWeightBits() == 4) {
-    auto w_transpose = getWTranspose();
-    int q_group_size = module::getQuantGroupSize();
-    auto zp = p.inputs[3];
-    N *= 2;
-    auto in_shape = getInput().getType().cast<RankedTensorType>().getShape();
-    int64_t M = 1;
-    for (int i = 0; i < in_shape.size() - 1; i++) {
-      M *= in_shape[i];
-    }
-    auto new_weight = std::vector<float>(K * N, 0);
-    if (!q_group_size) {
-      for (int i = 0; i < K; i++) {
-        auto offset = i * N;
-        auto zp_i = zp[i];
-        auto scale_i = scale[i];
-        for (int j = 0; j < N; j++) {
-          new_weight[offset + j] =
-              ((int(weight[(offset + j) / 2]) & 0x0F) - zp_i) * scale_i;
-          j++;
-          new_weight[offset + j] =
-              ((int(weight[(offset + j) / 2]) >> 4) - zp_i) * scale_i;
-        }
-      }
-    } else {
-      for (int i = 0; i < K * N; i++) {
-        int quant_idx = i / q_group_size;
-        auto zp_i = zp[quant_idx];
-        auto scale_i = scale[quant_idx];
-        new_weight[i] = ((int(weight[i / 2]) & 0x0F) - zp_i) * scale_i;
-        i++;
-        new_weight[i] = ((int(weight[i / 2]) >> 4) - zp_i) * scale_i;
-      }
-    }
-
-    auto matmul = new MatMul();
-    if (w_transpose) {
-      std::swap(K, N);
-    }
-    matmul->setup(p.inputs[0], new_weight.data(), p.inputs[4], p.outputs[0], 1,
-                  1, M, K, N, false, -1.0, 0, 0, w_transpose, false, false,
-                  false);
-    matmul->run();
-    delete matmul;
-  } else {
-    for (int i = 0; i < K; i++) {
-      auto offset = i * N;
-      for (int j = 0; j < N; j++) {
-        weight[offset + j] = (weight[offset + j]) * scale[i];
-      }
-    }
-    // hand over the rest work to onednn matmul
-    if (p.handle == nullptr) {
-      return failure();
-    }
-    auto matmul = (MatMul *)p.handle;
-    matmul->run();
+  if (p.handle == nullptr) {
+    return failure();
   }
+  auto matmul = (A16MatMulFunc *)p.handle;
+  matmul->run(p.inputs[0], p.inputs[4], p.outputs[0], p.get_workspace());
 
   auto num_elem = module::getNumElements(getOutput());
   if (module::isF16Modes()) {
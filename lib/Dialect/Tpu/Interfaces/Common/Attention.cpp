@@ -23,7 +23,8 @@ LogicalResult tpu::AttentionOp::init(InferenceParameter &p) {
   int M_k = key_shape[1];
   int N_q = in_shape[2];
   int N_k = key_shape[2];
-  int64_t d = queries_shape[queries_shape.size() - 1];
+  int64_t head = getHead();
+  int64_t d = queries_shape[queries_shape.size() - 1] / head;
   auto scale = getScale().convertToDouble();
   int has_bias = getHasBias();
   auto quant_param = module::getI64Array(getQuantParam());
@@ -43,7 +44,7 @@ LogicalResult tpu::AttentionOp::init(InferenceParameter &p) {
                    k_weight, k_bias, v_weight, v_bias, p.inputs[9],
                    o_bias, p.inputs[11], p.inputs[12], p.outputs[0], quant_param->data(),
                    batch, M_q, M_k, N_q, N_k,
-                   d, scale, 0, type);
+                   d, scale, 0, type, head);
   p.handle = (void *)attention;
   return success();
 }
@@ -17,6 +17,10 @@ LogicalResult tpu::ConcatOp::inference(InferenceParameter &p) {
   auto axis_ = getAxis();
   bool is_cv18xx = module::isCV18xx();
   auto nInputs = getInputs().size();
+  if (is_concat_in_place(p.inputs, p.outputs[0], getInputs())) {
+    // placed by the interpreter, requant and relu are never in place
+    return success();
+  }
   // allocate tmp input
   std::vector<float *> tmp_inputs(nInputs);
   for (int i = 0; i < nInputs; ++i) {
@@ -66,9 +66,22 @@ conv_attr_t tpu::Conv2DOp::parseParam() {
   return p;
 }
 
+// input_unfolded, IA_wino, P, wino_res and the padded image of one batch
+static int64_t winograd_workspace_size(const conv_attr_t &attr) {
+  int64_t pih = attr.ih + attr.phb + attr.pht;
+  int64_t piw = attr.iw + attr.pwl + attr.pwr;
+  int64_t row_num = ((pih - 4) / 2 + 1) * ((piw - 4) / 2 + 1);
+  bool need_pad = (attr.phb + attr.pht + attr.pwl + attr.pwr) > 0;
+  return row_num * attr.ic * 16 * 2 + row_num * attr.oc * (16 + 4) +
+         (need_pad ? attr.ic * pih * piw : 0);
+}
+
 LogicalResult tpu::Conv2DOp::init(InferenceParameter &p) {
   auto conv = new Conv();
   p.handle = (void *)conv;
+  auto attr = parseParam();
+  p.workspace_size = attr.use_winograd ? winograd_workspace_size(attr)
+                                       : Conv::workspace_size(attr);
   return success();
 }
 
@@ -137,17 +150,18 @@ LogicalResult tpu::Conv2DOp::inference(InferenceParameter &p) {
     int oh = attr.oh;
     auto gt = p.inputs[1] + (ic * oc * 3 * 3); // b, ic, iw, ih
 
-    float *input_unfolded = new float[row_num * attr.ic * 16];
-    float *P = new float[row_num * attr.oc * 16];
-    float *IA_wino = new float[row_num * attr.ic * 16];
+    float *input_unfolded = p.get_workspace();
+    float *IA_wino = input_unfolded + row_num * attr.ic * 16;
+    float *P = IA_wino + row_num * attr.ic * 16;
+    float *wino_res = P + row_num * attr.oc * 16;
+    float *padded = wino_res + row_num * attr.oc * 4;
 
     bool need_pad = (attr.phb + attr.pht + attr.pwl + attr.pwr) > 0;
 
     float *inputs;
     // for each batch
     for (int bs = 0; bs < n; bs++) {
-      inputs = need_pad ? new float[ic * pih * piw]
-                        : p.inputs[0] + (bs * ic * ih * iw);
+      inputs = need_pad ? padded : p.inputs[0] + (bs * ic * ih * iw);
       if (need_pad) {
         memset(inputs, attr.pad_value,
                sizeof(float) * ic * (ih + attr.pht + attr.phb) *
@@ -221,7 +235,6 @@ LogicalResult tpu::Conv2DOp::inference(InferenceParameter &p) {
 
       // 4.
       // P @ AEQ.transpose(0, 1) -> wino_res
-      float *wino_res = new float[row_num * attr.oc * 4];
       matmul = new MatMul();
       matmul->setup(P, (float *)AEQ, 0, wino_res, 1, 1, row_num * attr.oc, 16,
                     4, false, 0, 0, 0, true, false, false, 0);
@@ -244,20 +257,11 @@ LogicalResult tpu::Conv2DOp::inference(InferenceParameter &p) {
           }
         }
       }
-
       // fold wino_res -> p.outputs[0]
-      delete[] wino_res;
-    }
-    if (need_pad) {
-      delete[] inputs;
     }
-    delete[] P;
-    delete[] IA_wino;
-    delete[] input_unfolded;
-
   } else {
     conv->setup(p.inputs[0], p.inputs[1], p.inputs[2], p.outputs[0], attr);
-    conv->run();
+    conv->run(p.get_workspace());
   }
 
   // requant
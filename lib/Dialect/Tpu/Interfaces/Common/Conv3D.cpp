@@ -68,6 +68,7 @@ LogicalResult tpu::Conv3DOp::init(InferenceParameter &p) {
 
   conv->setup(p.inputs[0], p.inputs[1], p.inputs[2], p.outputs[0], attr);
   p.handle = (void *)conv;
+  p.workspace_size = Conv::workspace_size(attr);
   return success();
 }
 
@@ -84,7 +85,7 @@ LogicalResult tpu::Conv3DOp::inference(InferenceParameter &p) {
     return failure();
   }
   auto conv = (Conv *)p.handle;
-  conv->run();
+  conv->run(p.get_workspace());
   // requant
   auto out_type = module::getStorageType(getOutput());
   auto num_elem = module::getNumElements(getOutput());
@@ -8,29 +8,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "tpu_mlir/Support/LutFunc.h"
-
-static void normlize_f32(const float *input_data, float *output_data,
-                         const float *weight_data, const float *bias_data,
-                         const int inner_dim, const float eps_) {
-  float mean_data = 0;
-  float rstd_data = 0;
-  for (int j = 0; j < inner_dim; ++j) {
-    mean_data += input_data[j];
-  }
-  mean_data /= inner_dim;
-  for (int j = 0; j < inner_dim; ++j) {
-    const float dij = input_data[j] - mean_data;
-    rstd_data += dij * dij;
-  }
-  rstd_data /= inner_dim;
-  rstd_data += eps_;
-  rstd_data = std::sqrt(rstd_data);
-  rstd_data = 1.0f / rstd_data;
-  for (int j = 0; j < inner_dim; ++j) {
-    output_data[j] = input_data[j] - mean_data;
-    output_data[j] *= rstd_data;
-  }
-}
+#include "tpu_mlir/Support/NormFunc.h"
 
 static void normlize_bf16(const float *input_data, float *output_data,
                           const float *weight_data, const float *bias_data,
@@ -99,7 +77,7 @@ LogicalResult tpu::GroupNormOp::inference(InferenceParameter &p) {
       normlize_bf16(input_i, output_i, weight_data, bias_data, table, mtable,
                     inner_dim, eps_);
     } else {
-      normlize_f32(input_i, output_i, weight_data, bias_data, inner_dim, eps_);
+      layer_norm_f32(input_i, output_i, nullptr, nullptr, inner_dim, eps_);
     }
   }
   inner_dim /= channel_per_group;
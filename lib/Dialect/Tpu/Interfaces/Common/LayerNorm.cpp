@@ -9,36 +9,7 @@
 
 
 #include "tpu_mlir/Support/LutFunc.h"
-
-static void normlize_f32(const float *input_data, float *output_data,
-                         float &mean_data, float &rstd_data,
-                         const float *weight_data, const float *bias_data,
-                         const int inner_dim, const float eps_) {
-  for (int j = 0; j < inner_dim; ++j) {
-    mean_data += input_data[j];
-  }
-  mean_data /= inner_dim;
-
-  for (int j = 0; j < inner_dim; ++j) {
-    const float dij = input_data[j] - mean_data;
-    rstd_data += dij * dij;
-  }
-  rstd_data /= inner_dim;
-  rstd_data += eps_;
-  rstd_data = std::sqrt(rstd_data);
-  rstd_data = 1.0f / rstd_data;
-
-  for (int j = 0; j < inner_dim; ++j) {
-    output_data[j] = input_data[j] - mean_data;
-    output_data[j] *= rstd_data;
-    if (weight_data) {
-      output_data[j] *= weight_data[j];
-    }
-    if (bias_data) {
-      output_data[j] += bias_data[j];
-    }
-  }
-}
+#include "tpu_mlir/Support/NormFunc.h"
 
 static void normlize_bf16(const float *input_data, float *output_data,
                           float &mean_data, float &rstd_data,
@@ -108,21 +79,18 @@ LogicalResult tpu::LayerNormOp::inference(InferenceParameter &p) {
   float *mtable = p.inputs[4];
   float *output_data = p.outputs[0];
 
-  std::vector<float> mean_arr(outer_dim, 0);
-  std::vector<float> rstd_arr(outer_dim, 0);
-
 #pragma omp parallel for schedule(static, omp_schedule(outer_dim))
   for (int i = 0; i < outer_dim; ++i) {
-    float _mean_data = 0;
-    float _rstd_data = 0;
     if (is_bf16) {
+      float _mean_data = 0;
+      float _rstd_data = 0;
       normlize_bf16(input_data + i * inner_dim, output_data + i * inner_dim,
                     _mean_data, _rstd_data, weight_data, bias_data, table,
                     mtable, inner_dim, eps_);
     } else {
-      normlize_f32(input_data + i * inner_dim, output_data + i * inner_dim,
-                   _mean_data, _rstd_data, weight_data, bias_data, inner_dim,
-                   eps_);
+      layer_norm_f32(input_data + (int64_t)i * inner_dim,
+                     output_data + (int64_t)i * inner_dim, weight_data,
+                     bias_data, inner_dim, eps_);
     }
   }
   return success();
@@ -11,44 +11,33 @@
 #include "tpu_mlir/Support/MathUtils.h"
 
 LogicalResult tpu::MaskedFillOp::init(InferenceParameter &p) {
+  auto plan = new bcast_plan_t(make_bcast_plan(
+      module::getShape(getOutput()),
+      {module::getShape(getOperand(0)), module::getShape(getOperand(1))}));
+  p.handle = (void *)plan;
   return success();
 }
-void tpu::MaskedFillOp::deinit(InferenceParameter &p) {}
 
-LogicalResult tpu::MaskedFillOp::inference(InferenceParameter &p) {
-  const auto num_element = module::getNumElements(getOutput());
-  const auto in_num_element = module::getNumElements(getOperand(0));
-  const auto brn_num_element = module::getNumElements(getOperand(1));
-  std::vector<int64_t> output_shape = module::getShape(getOutput());
-  std::vector<int64_t> input_shape = module::getShape(getOperand(0));
-  std::vector<int64_t> brn_shape = module::getShape(getOperand(1));
-  bool in_broadcast = false;
-  bool brn_broadcast = false;
-  if (in_num_element != num_element) {
-    assert(input_shape.size() == output_shape.size());
-    in_broadcast = true;
-  }
-  if (brn_num_element != num_element) {
-    assert(brn_shape.size() == output_shape.size());
-    brn_broadcast = true;
+void tpu::MaskedFillOp::deinit(InferenceParameter &p) {
+  if (p.handle != nullptr) {
+    auto plan = (bcast_plan_t *)p.handle;
+    delete plan;
+    p.handle = nullptr;
   }
+}
 
-  const float const_val_ = getConstVal().convertToDouble();
-  const float *in = p.inputs[0];
-  const float *brn = p.inputs[1];
-#pragma omp parallel for schedule(static, omp_schedule(num_element))
-  for (int i = 0; i < num_element; ++i) {
-    int in_index = i;
-    int brn_index = i;
-    if (in_broadcast) {
-      in_index = getBcastIndex(i, output_shape, input_shape);
-    }
-    if (brn_broadcast) {
-      brn_index = getBcastIndex(i, output_shape, brn_shape);
-    }
-    const float tbrn = getInversed() ? const_val_ : brn[brn_index];
-    const float fbrn = getInversed() ? brn[brn_index] : const_val_;
-    p.outputs[0][i] = in[in_index] ? tbrn : fbrn;
+LogicalResult tpu::MaskedFillOp::inference(InferenceParameter &p) {
+  if (p.handle == nullptr) {
+    return failure();
+  }
+  auto plan = (bcast_plan_t *)p.handle;
+  const float const_val = getConstVal().convertToDouble();
+  if (getInversed()) {
+    bcast_for_each(*plan, p.outputs[0], p.inputs[0], p.inputs[1],
+                   [=](float c, float b) { return c ? const_val : b; });
+  } else {
+    bcast_for_each(*plan, p.outputs[0], p.inputs[0], p.inputs[1],
+                   [=](float c, float b) { return c ? b : const_val; });
   }
   return success();
 }
@@ -9,25 +9,7 @@
 
 #include "tpu_mlir/Support/Float16.h"
 #include "tpu_mlir/Support/MathUtils.h"
-
-static void normlize_f32(const float *input_data, float *output_data,
-                         float &rstd_data, const float *gamma_data,
-                         const int inner_dim, const float eps) {
-  for (int j = 0; j < inner_dim; ++j) {
-    const float dij = input_data[j];
-    rstd_data += dij * dij;
-  }
-  rstd_data /= inner_dim;
-  rstd_data += eps;
-  rstd_data = std::sqrt(rstd_data);
-
-  for (int j = 0; j < inner_dim; ++j) {
-    output_data[j] = input_data[j] / rstd_data;
-    if (gamma_data) {
-      output_data[j] *= gamma_data[j];
-    }
-  }
-}
+#include "tpu_mlir/Support/NormFunc.h"
 
 static void normlize_bf16(const float *input_data, float *output_data,
                           float &rstd_data, const float *gamma_data,
@@ -73,17 +55,16 @@ LogicalResult tpu::RMSNormOp::inference(InferenceParameter &p) {
   const float *gamma_data = has_weight ? p.inputs[1] : nullptr;
   float *output_data = p.outputs[0];
 
-  std::vector<float> rms_arr(outer_dim, 0);
-
 #pragma omp parallel for schedule(static, omp_schedule(outer_dim))
   for (int i = 0; i < outer_dim; ++i) {
-    float _rstd_data = 0;
     if (is_bf16) {
+      float _rstd_data = 0;
       normlize_bf16(input_data + i * inner_dim, output_data + i * inner_dim,
                     _rstd_data, gamma_data, inner_dim, eps);
     } else {
-      normlize_f32(input_data + i * inner_dim, output_data + i * inner_dim,
-                   _rstd_data, gamma_data, inner_dim, eps);
+      rms_norm_f32(input_data + (int64_t)i * inner_dim,
+                   output_data + (int64_t)i * inner_dim, gamma_data, inner_dim,
+                   eps);
     }
   }
 
@@ -9,17 +9,50 @@
 
 
 #include "tpu_mlir/Support/LutFunc.h"
+#include "tpu_mlir/Support/NormFunc.h"
 
-LogicalResult tpu::SoftmaxOp::init(InferenceParameter &p) { return success(); }
+LogicalResult tpu::SoftmaxOp::init(InferenceParameter &p) {
+  auto out_type = module::getStorageType(getOutput());
+  if (!out_type.isa<FloatType>()) {
+    return success();
+  }
+  auto axis_ = getAxis();
+  auto input_shape = module::getShape(getInput());
+  int64_t outer_dim = 1;
+  for (int i = 0; i < axis_; i++) {
+    outer_dim *= input_shape[i];
+  }
+  int64_t inner_dim = 1;
+  for (int i = axis_ + 1; i < input_shape.size(); i++) {
+    inner_dim *= input_shape[i];
+  }
+  float scale = 1.0f;
+  if (module::isUniformQuantized(getInput())) {
+    auto qtype = module::getUniformQuantizedType(getInput());
+    scale = qtype.getScale();
+  }
+  auto round = out_type.isBF16()  ? ROUND_BF16
+               : out_type.isF16() ? ROUND_F16
+                                  : ROUND_NONE;
+  auto softmax = new SoftmaxFunc(outer_dim, input_shape[axis_], inner_dim,
+                                 scale, getLog(), round);
+  p.handle = (void *)softmax;
+  p.workspace_size = softmax->workspace_size();
+  return success();
+}
 
-void tpu::SoftmaxOp::deinit(InferenceParameter &p) {}
+void tpu::SoftmaxOp::deinit(InferenceParameter &p) {
+  if (p.handle != nullptr) {
+    auto softmax = (SoftmaxFunc *)p.handle;
+    delete softmax;
+    p.handle = nullptr;
+  }
+}
 
 LogicalResult tpu::SoftmaxOp::inference(InferenceParameter &p) {
   auto axis_ = getAxis();
   auto input_shape = module::getShape(getInput());
   auto out_type = module::getStorageType(getOutput());
-  auto num_elem = module::getNumElements(getOutput());
-  bool is_cv18xx = module::isCV18xx();
 
   int outer_dim = 1;
   for (int i = 0; i < axis_; i++) {
@@ -34,95 +67,16 @@ LogicalResult tpu::SoftmaxOp::inference(InferenceParameter &p) {
   int channel = input_shape[axis_];
   bool has_table = !module::isNone(getTable());
   if (out_type.isa<FloatType>()) {
-    float scale = 1.0f;
-    if (module::isUniformQuantized(getInput())) {
-      auto qtype = module::getUniformQuantizedType(getInput());
-      scale = qtype.getScale();
-    }
-    std::vector<float> max_arr(inner_dim);
-    std::vector<float> sum_arr(inner_dim);
-    std::vector<float> sub_arr(channel * inner_dim);
-
-    const auto bottom_data = p.inputs[0];
-    auto top_data = p.outputs[0];
-
-    for (int i = 0; i < outer_dim; ++i) {
-      // find max value accross channel
-      int c_offset = i * channel * inner_dim;
-      memcpy(max_arr.data(), bottom_data + c_offset, inner_dim * sizeof(float));
-      for (int j = 0; j < channel; ++j, c_offset += inner_dim) {
-        for (int k = 0; k < inner_dim; k++) {
-          if (max_arr[k] < bottom_data[c_offset + k])
-            max_arr[k] = bottom_data[c_offset + k];
-        }
-      }
-      c_offset = i * channel * inner_dim;
-      if (is_cv18xx) {
-        // calculate x - max
-        for (int j = 0; j < channel; ++j, c_offset += inner_dim) {
-          for (int k = 0; k < inner_dim; k++) {
-            auto idx = j * inner_dim + k;
-            sub_arr[idx] = BF16(bottom_data[c_offset + k] - max_arr[k]);
-          }
-        }
-        // e^x
-        std::vector<float> ex_arr(channel * inner_dim);
-        bf16_lut_slope(sub_arr.data(), ex_arr.data(), sub_arr.size(),
-                       p.inputs[1], p.inputs[2], -EXP_BF16_LUT_RANGE, EXP_BF16_LUT_RANGE);
-        // sum of (e^x)
-        float const_val = BF16(BF16(1.0 * channel) / channel);
-        memset(sum_arr.data(), 0, inner_dim * sizeof(float));
-        for (int j = 0; j < channel; ++j) {
-          for (int k = 0; k < inner_dim; k++) {
-            auto idx = j * inner_dim + k;
-            sum_arr[k] += ex_arr[idx] * const_val;
-          }
-        }
-        // convert to bf16
-        BF16(sum_arr.data(), sum_arr.data(), sum_arr.size());
-
-        std::string mehod = getLog() ? "log" : "mantissa";
-        bf16_lut_mantissa(sum_arr.data(), sum_arr.data(), sum_arr.size(),
-                          p.inputs[3], p.inputs[4], mehod);
-
-        c_offset = i * channel * inner_dim;
-        for (int j = 0; j < channel; ++j, c_offset += inner_dim) {
-          for (int k = 0; k < inner_dim; k++) {
-            auto idx = j * inner_dim + k;
-            if (getLog()) {
-              top_data[c_offset + k] = sub_arr[idx] - sum_arr[k];
-            } else {
-              top_data[c_offset + k] = ex_arr[idx] * sum_arr[k];
-            }
-          }
-        }
-      } else {
-        // calculate exp(x)
-        memset(sum_arr.data(), 0, inner_dim * sizeof(float));
-        for (int j = 0; j < channel; ++j, c_offset += inner_dim) {
-          for (int k = 0; k < inner_dim; k++) {
-            sub_arr[j * inner_dim + k] =
-                (bottom_data[c_offset + k] - max_arr[k]) * scale;
-            top_data[c_offset + k] = std::exp(sub_arr[j * inner_dim + k]);
-            sum_arr[k] += top_data[c_offset + k];
-          }
-        }
-
-        c_offset = i * channel * inner_dim;
-        for (int j = 0; j < channel; ++j, c_offset += inner_dim) {
-          for (int k = 0; k < inner_dim; k++) {
-            top_data[c_offset + k] /= sum_arr[k];
-            if (getLog()) {
-              top_data[c_offset + k] = std::log(top_data[c_offset + k]);
-            }
-          }
-        }
-      }
+    if (p.handle == nullptr) {
+      return failure();
     }
-    if (out_type.isBF16()) {
-      BF16(p.outputs[0], p.outputs[0], num_elem);
-    } else if (out_type.isF16()) {
-      F16(p.outputs[0], p.outputs[0], num_elem);
+    auto softmax = (SoftmaxFunc *)p.handle;
+    if (module::isCV18xx()) {
+      softmax->run_bf16_lut(p.inputs[0], p.outputs[0], p.inputs[1],
+                            p.inputs[2], p.inputs[3], p.inputs[4],
+                            p.get_workspace());
+    } else {
+      softmax->run(p.inputs[0], p.outputs[0], p.get_workspace());
     }
   } else if (module::isUniformQuantized(getInput(),
                                         getOutput())) { // for quant softmax
@@ -131,38 +85,38 @@ LogicalResult tpu::SoftmaxOp::inference(InferenceParameter &p) {
     auto o_qtype = module::getUniformQuantizedType(getOutput());
     auto zp = o_qtype.getZeroPoint();
     float scale = o_qtype.getScale();
-    for (int i = 0; i < outer_dim; ++i) {
-      int64_t out_offset = i * inner_dim * channel;
-#pragma omp parallel for schedule(static, omp_schedule(inner_dim))
-      for (int j = 0; j < inner_dim; ++j) {
-        int max_val = p.inputs[0][out_offset + j];
-        for (int c = 1; c < channel; ++c) {
-          max_val = max_val > p.inputs[0][out_offset + c * inner_dim + j]
-                        ? max_val
-                        : p.inputs[0][out_offset + c * inner_dim + j];
-        }
-        float sum = 0.f;
-        for (int c = 0; c < channel; ++c) {
-          auto offset =
-              to_uint8(max_val - p.inputs[0][out_offset + c * inner_dim + j]);
-          sum += exp_table[offset];
-        }
-        for (int c = 0; c < channel; ++c) {
-          auto offset =
-              to_uint8(max_val - p.inputs[0][out_offset + c * inner_dim + j]);
-          float prob_rescaled = exp_table[offset];
-          prob_rescaled = prob_rescaled / (sum * scale);
-          if (out_type.isSignedInteger(8)) {
-            int prob_rnd = static_cast<int32_t>(std::round(prob_rescaled));
-            p.outputs[0][out_offset + c * inner_dim + j] =
-                to_int8(prob_rnd + zp);
-          } else if (out_type.isUnsignedInteger(8)) {
-            int prob_rnd = static_cast<int32_t>(prob_rescaled + 0.5);
-            p.outputs[0][out_offset + c * inner_dim + j] =
-                to_uint8(prob_rnd + zp);
-          } else {
-            llvm_unreachable("not support type");
-          }
+    const int64_t num_iter = (int64_t)outer_dim * inner_dim;
+#pragma omp parallel for schedule(static, omp_schedule(num_iter))
+    for (int64_t u = 0; u < num_iter; ++u) {
+      const int64_t j = u % inner_dim;
+      const int64_t out_offset = u / inner_dim * inner_dim * channel;
+      int max_val = p.inputs[0][out_offset + j];
+      for (int c = 1; c < channel; ++c) {
+        max_val = max_val > p.inputs[0][out_offset + c * inner_dim + j]
+                      ? max_val
+                      : p.inputs[0][out_offset + c * inner_dim + j];
+      }
+      float sum = 0.f;
+      for (int c = 0; c < channel; ++c) {
+        auto offset =
+            to_uint8(max_val - p.inputs[0][out_offset + c * inner_dim + j]);
+        sum += exp_table[offset];
+      }
+      for (int c = 0; c < channel; ++c) {
+        auto offset =
+            to_uint8(max_val - p.inputs[0][out_offset + c * inner_dim + j]);
+        float prob_rescaled = exp_table[offset];
+        prob_rescaled = prob_rescaled / (sum * scale);
+        if (out_type.isSignedInteger(8)) {
+          int prob_rnd = static_cast<int32_t>(std::round(prob_rescaled));
+          p.outputs[0][out_offset + c * inner_dim + j] =
+              to_int8(prob_rnd + zp);
+        } else if (out_type.isUnsignedInteger(8)) {
+          int prob_rnd = static_cast<int32_t>(prob_rescaled + 0.5);
+          p.outputs[0][out_offset + c * inner_dim + j] =
+              to_uint8(prob_rnd + zp);
+        } else {
+          llvm_unreachable("not support type");
         }
       }
     }
@@ -10,6 +10,7 @@
 #include "BMAddressAssign.h"
 #include "tpu_mlir/Backend/BM168x/BM1684X.h"
 #include "tpu_mlir/Support/MathUtils.h"
+#include "llvm/Support/xxhash.h"
 
 using namespace llvm;
 
@@ -38,44 +39,100 @@ bool BMAddressAssign::is_next_subnet_input(Operation *op, int index) {
   return ret;
 }
 
+std::vector<uint64_t>
+BMAddressAssign::hashWeights(std::vector<top::WeightOp> &weights) {
+  // read in batches to bound the memory, hash each batch in parallel
+  const size_t batch_bytes = (size_t)1 << 28;
+  std::vector<uint64_t> hashes(weights.size());
+  size_t begin = 0;
+  while (begin < weights.size()) {
+    std::vector<std::shared_ptr<std::vector<uint8_t>>> data;
+    size_t bytes = 0;
+    while (begin + data.size() < weights.size() && bytes < batch_bytes) {
+      data.push_back(weights[begin + data.size()].read_as_byte());
+      bytes += data.back()->size();
+    }
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int64_t i = 0; i < (int64_t)data.size(); i++) {
+      hashes[begin + i] = llvm::xxHash64(llvm::ArrayRef(*data[i]));
+    }
+    begin += data.size();
+  }
+  return hashes;
+}
+
+bool BMAddressAssign::isSameWeight(top::WeightOp a, top::WeightOp b) {
+  auto a_value = a.getOutput();
+  auto b_value = b.getOutput();
+  if (module::getStorageType(a_value) != module::getStorageType(b_value) ||
+      module::getShape(a_value) != module::getShape(b_value) ||
+      a.getStoreModeAttr() != b.getStoreModeAttr()) {
+    return false;
+  }
+  // hashes can collide, compare the bytes
+  return *a.read_as_byte() == *b.read_as_byte();
+}
+
 void BMAddressAssign::assign(mlir::ModuleOp &m, bool reuse_addr) {
   int64_t alignment = BM168x::ALIGNMENT;
   int64_t start_addr = BM168x::COEFF_START_ADDR;
   Builder builder(m.getContext());
-  // assign weight first
-  auto addr = start_addr;
+  // assign weight first, weights with the same content share one region
+  std::vector<top::WeightOp> weights;
   for (auto func : m.getOps<FuncOp>()) {
-    func.walk([&](top::WeightOp op) {
-      const auto out_value = op.getOutput();
-      auto elm_bits = module::getStorageType(out_value).getIntOrFloatBitWidth();
-      /// consider 4N/2N storage mode
-      /// store_mode, align_num, dtype_size
-      std::map<STORE_MODE_T, std::pair<int64_t, int32_t>> stmode_map = {
-          {STORE_MODE_1N, {1l, elm_bits}},
-          {STORE_MODE_2N, {2l, sizeof(int32_t) * 8}},
-          {STORE_MODE_4N, {4l, sizeof(int32_t) * 8}},
-      };
-      auto stmode = STORE_MODE_1N;
-      if (op.getStoreMode().has_value()) {
-        stmode = llvm::StringSwitch<STORE_MODE_T>(op.getStoreModeAttr())
-                     .Case("1N", STORE_MODE_1N)
-                     .Case("2N", STORE_MODE_2N)
-                     .Case("4N", STORE_MODE_4N)
-                     .Default(STORE_MODE_1N);
-      }
-      assert((stmode == STORE_MODE_1N) ||
-             (stmode == STORE_MODE_2N && elm_bits == 16) ||
-             (stmode == STORE_MODE_4N && elm_bits == 8));
-
-      module::setAddress(out_value, addr);
-      int64_t n, c, h, w;
-      module::getNCHW(out_value, n, c, h, w);
-      int64_t bytes = ceiling_func(n, stmode_map.at(stmode).first) *
-                      stmode_map.at(stmode).second * c * h * w;
-      /// consider int4 storage
-      bytes = ceiling_func(bytes, 8l);
-      addr = align_up(addr + bytes, alignment);
+    func.walk([&](top::WeightOp op) { weights.push_back(op); });
+  }
+  auto hashes = hashWeights(weights);
+  std::unordered_map<uint64_t, std::vector<std::pair<top::WeightOp, int64_t>>>
+      assigned;
+  auto addr = start_addr;
+  for (size_t i = 0; i < weights.size(); i++) {
+    auto op = weights[i];
+    const auto out_value = op.getOutput();
+    auto elm_bits = module::getStorageType(out_value).getIntOrFloatBitWidth();
+    /// consider 4N/2N storage mode
+    /// store_mode, align_num, dtype_size
+    std::map<STORE_MODE_T, std::pair<int64_t, int32_t>> stmode_map = {
+        {STORE_MODE_1N, {1l, elm_bits}},
+        {STORE_MODE_2N, {2l, sizeof(int32_t) * 8}},
+        {STORE_MODE_4N, {4l, sizeof(int32_t) * 8}},
+    };
+    auto stmode = STORE_MODE_1N;
+    if (op.getStoreMode().has_value()) {
+      stmode = llvm::StringSwitch<STORE_MODE_T>(op.getStoreModeAttr())
+                   .Case("1N", STORE_MODE_1N)
+                   .Case("2N", STORE_MODE_2N)
+                   .Case("4N", STORE_MODE_4N)
+                   .Default(STORE_MODE_1N);
+    }
+    assert((stmode == STORE_MODE_1N) ||
+           (stmode == STORE_MODE_2N && elm_bits == 16) ||
+           (stmode == STORE_MODE_4N && elm_bits == 8));
+
+    // weights exposed as activations may be written, keep them private
+    bool shareable = llvm::none_of(op->getUsers(), [](Operation *user) {
+      return isa<tpu::Weight2ActivationOp>(user);
     });
+    if (shareable) {
+      auto &candidates = assigned[hashes[i]];
+      auto it = llvm::find_if(candidates, [&](auto &candidate) {
+        return isSameWeight(candidate.first, op);
+      });
+      if (it != candidates.end()) {
+        module::setAddress(out_value, it->second);
+        continue;
+      }
+      candidates.emplace_back(op, addr);
+    }
+
+    module::setAddress(out_value, addr);
+    int64_t n, c, h, w;
+    module::getNCHW(out_value, n, c, h, w);
+    int64_t bytes = ceiling_func(n, stmode_map.at(stmode).first) *
+                    stmode_map.at(stmode).second * c * h * w;
+    /// consider int4 storage
+    bytes = ceiling_func(bytes, 8l);
+    addr = align_up(addr + bytes, alignment);
   }
   module::setCoeffAddr(m, start_addr);
   module::setCoeffSize(m, addr - start_addr);
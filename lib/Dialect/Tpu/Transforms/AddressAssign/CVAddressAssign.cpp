@@ -16,13 +16,36 @@ using namespace llvm;
 namespace tpu_mlir {
 namespace tpu {
 
-std::string CVAddressAssign::calcMD5(std::vector<uint8_t> &data) {
+std::string CVAddressAssign::calcMD5(ArrayRef<uint8_t> data) {
   auto md5 = llvm::MD5::hash(data);
   SmallString<32> res;
   MD5::stringifyResult(md5, res);
   return std::string(res);
 }
 
+std::vector<std::string>
+CVAddressAssign::hashWeights(std::vector<top::WeightOp> &weights) {
+  // hash the bytes held by the weight file in place, only int4 weights and
+  // column major tensors are read out as a copy first
+  std::vector<ArrayRef<uint8_t>> bytes(weights.size());
+  std::vector<std::shared_ptr<std::vector<uint8_t>>> copies;
+  for (size_t i = 0; i < weights.size(); i++) {
+    auto op = weights[i];
+    auto name = module::getName(op.getOutput());
+    if (module::getStorageType(op.getOutput()).isInteger(4) ||
+        failed(module::weightFile().peekTensorBytes(name, bytes[i]))) {
+      copies.push_back(op.read_as_byte());
+      bytes[i] = *copies.back();
+    }
+  }
+  std::vector<std::string> md5s(weights.size());
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int64_t i = 0; i < (int64_t)weights.size(); i++) {
+    md5s[i] = calcMD5(bytes[i]);
+  }
+  return md5s;
+}
+
 bool CVAddressAssign::loadAddressMapping(
     std::string &mapFileName,
     std::unordered_map<std::string, std::pair<int64_t, int64_t>> &addrMapping) {
@@ -70,6 +93,7 @@ void CVAddressAssign::assign_weight_addr(mlir::ModuleOp &m,
   int64_t start_offset = 0;
   int64_t weight_alignment = 16;
   std::unordered_map<std::string, std::vector<top::WeightOp>> weight_md5_map;
+  std::vector<std::string> md5_order;
   std::unordered_map<std::string, std::pair<int64_t, int64_t>> addrMapping;
   auto flags = std::fstream::out;
   assert(!weight_map_file.empty());
@@ -92,11 +116,10 @@ void CVAddressAssign::assign_weight_addr(mlir::ModuleOp &m,
   auto weightMapFile = std::make_unique<std::fstream>(weight_map_file, flags);
   checkIfFileGood(weight_map_file, weightMapFile);
 
+  std::vector<top::WeightOp> weights;
   for (auto func : m.getOps<FuncOp>()) {
     func.walk([&](top::WeightOp op) {
-      auto weight_data = op.read_as_byte();
-      std::string md5 = calcMD5(*weight_data);
-      weight_md5_map[md5].emplace_back(op);
+      weights.push_back(op);
       // set compress weight
       if (compress_weight && op.getResult().hasOneUse()) {
         auto nextOp = (*op.getResult().getUses().begin()).getOwner();
@@ -107,34 +130,44 @@ void CVAddressAssign::assign_weight_addr(mlir::ModuleOp &m,
       }
     });
   }
+  auto md5s = hashWeights(weights);
+  for (size_t i = 0; i < weights.size(); i++) {
+    auto &ops = weight_md5_map[md5s[i]];
+    if (ops.empty()) {
+      md5_order.push_back(md5s[i]);
+    }
+    ops.emplace_back(weights[i]);
+  }
 
+  // lay out weights in the order they first appear, so the map file is stable
   auto addr = start_offset;
-  for (auto &pair : weight_md5_map) {
+  std::string map_lines;
+  llvm::raw_string_ostream os(map_lines);
+  for (auto &md5 : md5_order) {
+    auto &ops = weight_md5_map[md5];
     int64_t offset = addr;
-    int64_t bytes = module::getBytes(pair.second[0].getOutput());
-    auto iter_redundant = addrMapping.find(pair.first);
+    int64_t bytes = module::getBytes(ops[0].getOutput());
+    auto iter_redundant = addrMapping.find(md5);
     if (iter_redundant != addrMapping.end()) {
       offset = iter_redundant->second.first;
       assert(bytes == iter_redundant->second.second);
     } else {
-      std::string s;
-      llvm::raw_string_ostream os(s);
-      os << module::getName(pair.second[0].getOutput()).str() << ","
-         << llvm::format_hex(offset, 10) << "," << pair.first << "," << bytes
-         << "\n";
-      weightMapFile->write(os.str().c_str(), os.str().size());
+      os << module::getName(ops[0].getOutput()).str() << ","
+         << llvm::format_hex(offset, 10) << "," << md5 << "," << bytes << "\n";
       addr = align_up(addr + bytes, weight_alignment);
     }
-    for (auto &op : pair.second) {
+    for (auto &op : ops) {
       module::setAddress(op.getOutput(), offset + start_addr);
     }
-    if (pair.second.size() > 1 || iter_redundant != addrMapping.end()) {
+    if (ops.size() > 1 || iter_redundant != addrMapping.end()) {
       // redundant weight
-      for (auto &weight_op : pair.second) {
+      for (auto &weight_op : ops) {
         weight_op.removeDoCompressAttr();
       }
     }
   }
+  os.flush();
+  weightMapFile->write(map_lines.data(), map_lines.size());
   module::setCoeffAddr(m, start_addr);
   module::setCoeffSize(m, addr);
 }
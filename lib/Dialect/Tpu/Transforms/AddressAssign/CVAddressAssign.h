@@ -42,7 +42,9 @@ public:
               bool compress_weight, std::string &weight_map_file);
 
 protected:
-  std::string calcMD5(std::vector<uint8_t> &data);
+  std::string calcMD5(llvm::ArrayRef<uint8_t> data);
+
+  std::vector<std::string> hashWeights(std::vector<top::WeightOp> &weights);
 
   bool loadAddressMapping(
       std::string &mapFileName,
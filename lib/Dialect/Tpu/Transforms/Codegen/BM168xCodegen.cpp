@@ -13,8 +13,14 @@
 #include "tpu_mlir/Backend/BM168x/BackendInterfaces.h"
 #include "tpu_mlir/Support/GenericCpuFunc.h"
 #include "tpu_mlir/Support/MathUtils.h"
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/FileSystem.h>
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/SHA256.h>
+#include <fstream>
+#include <unistd.h>
+#include <array>
+#include <set>
 
 #define DEBUG_TYPE "bm_codegen"
 
@@ -49,8 +55,13 @@ static bmodel::Binary CreateBinaryFromFile(bmodel::ModelGen *model_gen,
   return CreateBinaryFromFile(model_gen, fp);
 }
 
-void BMCodegen::init(ModuleOp m, const std::string &filename) {
+void BMCodegen::init(ModuleOp m, const std::string &filename,
+                     const std::string &cache_dir) {
   this->filename = filename;
+  this->cache_dir = cache_dir;
+  if (!cache_dir.empty()) {
+    llvm::sys::fs::create_directories(cache_dir);
+  }
   llvm::raw_null_ostream os;
   AsmState state(m, OpPrintingFlags(), &opToLineCol);
   m->print(os, state);
@@ -61,6 +72,7 @@ void BMCodegen::init(ModuleOp m, const std::string &filename) {
   profile_ctx = ProfileCtx(&opToLineCol, true);
   bm168x = BM168x::instance();
   model_gen = std::make_shared<bmodel::ModelGen>();
+  coeff_mem_cache.clear();
   // add chip name
   model_gen->AddChip(chip);
   model_gen->AddNumDevice(num_device);
@@ -83,6 +95,10 @@ void BMCodegen::init(ModuleOp m, const std::string &filename) {
 void BMCodegen::run(ModuleOp s, bool embed_debug_info) {
   // record the line number of operation in module.
   DynCodegenInit();
+  // profile data is dumped by the backend while generating, no reuse then.
+  // Only flat command groups are cached, not the ones of each core.
+  use_cmd_cache =
+      !cache_dir.empty() && !embed_debug_info && module::getCoreNum() == 1;
   std::vector<top::WeightOp> weights;
   for (auto func : s.getOps<FuncOp>()) {
     func.walk([&](top::WeightOp op) { weights.push_back(op); });
@@ -117,6 +133,11 @@ void BMCodegen::run(ModuleOp s, bool embed_debug_info) {
       (module::isBM1684XFamily() || module::isSG2260Family()) ? 2 : 1;
   bool first_dynamic = false;
 
+  // Subnets are generated one after another: every op codegen writes to the
+  // command buffers of the BM168x singleton, which are global to the backend
+  // library, so there is no per-thread instance to generate subnets or layer
+  // groups concurrently. Only the serialization in CreateCmdGroupVector is
+  // parallel.
   s.walk<WalkOrder::PreOrder>([&](func::FuncOp func) {
     if (func == module::getMainFuncOp(s)) {
       return WalkResult::advance();
@@ -236,9 +257,10 @@ void BMCodegen::run(ModuleOp s, bool embed_debug_info) {
       assert(cascade.device_id >= current_device);
       current_device = cascade.device_id + 1;
     } else {
-      assert(cascade.step == current_step + 1 && cascade.device_id == 0);
+      // a pipeline stage may be the only net of its step
+      assert(cascade.step == current_step + 1);
       current_step++;
-      current_device = 1;
+      current_device = cascade.device_id + 1;
     }
     cascade.main_name = module::getName(module::getModuleOp());
   }
@@ -294,6 +316,9 @@ BMCodegen::CreateTensorVector(const std::vector<Value> &values,
       auto in_iter =
           std::find(input_names->begin(), input_names->end(), ss_name);
       tb.add_index(std::distance(input_names->begin(), in_iter));
+      if (module::isBatchParallel()) {
+        tb.add_offset(devid * module::getBytes(v));
+      }
     } else if (isSpecialOutputTensor(s_name)) {
       tb.add_hidden(4);
       std::string suffix = "_" + std::to_string(devid);
@@ -301,6 +326,9 @@ BMCodegen::CreateTensorVector(const std::vector<Value> &values,
       auto out_iter =
           std::find(output_names->begin(), output_names->end(), ss_name);
       tb.add_index(std::distance(output_names->begin(), out_iter));
+      if (module::isBatchParallel()) {
+        tb.add_offset(devid * module::getBytes(v));
+      }
     } else {
       auto in_iter =
           std::find(input_names->begin(), input_names->end(), s_name);
@@ -372,16 +400,27 @@ BMCodegen::CreateCoeffMem(std::vector<top::WeightOp> &coeffs,
     return 0;
   }
   auto data_u8 = std::make_shared<std::vector<uint8_t>>(coeff_size, 0);
-  uint64_t offset = 0;
+  // weights with the same content share one address, write it once
+  std::set<uint64_t> written;
   for (auto weight : coeffs) {
+    uint64_t offset = module::getAddress(weight.getOutput()) - coeff_addr;
+    if (!written.insert(offset).second) {
+      continue;
+    }
     auto data = weight.read_as_byte();
+    if (offset + data->size() > coeff_size) {
+      llvm::errs() << "Warning: coeff size is not correct\n";
+      continue;
+    }
     memcpy(data_u8->data() + offset, data->data(), data->size());
-    offset += align_up((int64_t)data->size(), BM168x::ALIGNMENT);
-  }
-  if (offset != coeff_size) {
-    llvm::errs() << "Warning: coeff size is not correct\n";
   }
   auto sha256 = llvm::SHA256::hash(llvm::ArrayRef(data_u8->data(), coeff_size));
+  // nets with the same coeff, like the devices of batch parallel, share one
+  auto key = std::make_pair(coeff_addr, sha256);
+  auto it = coeff_mem_cache.find(key);
+  if (it != coeff_mem_cache.end()) {
+    return it->second;
+  }
   auto binary_coeff = model_gen->WriteBinary(coeff_size, data_u8->data());
   auto coeff_sha256 =
       model_gen->Builder().CreateVector(sha256.data(), sha256.size());
@@ -389,7 +428,9 @@ BMCodegen::CreateCoeffMem(std::vector<top::WeightOp> &coeffs,
   cmb.add_address(coeff_addr);
   cmb.add_check_code(coeff_sha256);
   cmb.add_binary_coeff(&binary_coeff);
-  return cmb.Finish();
+  auto coeff_mem = cmb.Finish();
+  coeff_mem_cache[key] = coeff_mem;
+  return coeff_mem;
 }
 
 std::shared_ptr<std::vector<Offset<bmodel::CmdGroup>>>
@@ -397,22 +438,54 @@ BMCodegen::CreateCmdGroupVector() {
   auto cmd_group_v = std::make_shared<std::vector<Offset<bmodel::CmdGroup>>>();
   auto gdma_ptr = (uint8_t *)bm168x->get_inst_data("gdma:0:0");
   auto bdc_ptr = (uint8_t *)bm168x->get_inst_data("tiu:0:0");
-  int bdc_offset = 0, gdma_offset = 0;
-  for (int group_idx = 0; group_idx < bm168x->get_group_number(); group_idx++) {
+  // slices of the command buffers, {num, len, offset}
+  int group_num = bm168x->get_group_number();
+  std::vector<std::array<int64_t, 3>> bdc_v(group_num), gdma_v(group_num);
+  int64_t bdc_offset = 0, gdma_offset = 0;
+  for (int group_idx = 0; group_idx < group_num; group_idx++) {
     auto bdc_num = bm168x->get_inst_number_per_group("tiu:0:0", group_idx);
     auto gdma_num = bm168x->get_inst_number_per_group("gdma:0:0", group_idx);
-    bmodel::Binary binary_bdc;
-    bmodel::Binary binary_gdma;
     auto bdc_len = bm168x->get_bdc_len(bdc_num, group_idx);
+    auto gdma_len = bm168x->get_gdma_len(gdma_num, group_idx);
+    bdc_v[group_idx] = {bdc_num, bdc_len, bdc_offset};
+    gdma_v[group_idx] = {gdma_num, gdma_len, gdma_offset};
     if (bdc_num != 0) {
-      binary_bdc = model_gen->WriteBinary(bdc_len, bdc_ptr + bdc_offset);
       bdc_offset += bdc_len;
     }
-    auto gdma_len = bm168x->get_gdma_len(gdma_num, group_idx);
     if (gdma_num != 0) {
-      binary_gdma = model_gen->WriteBinary(gdma_len, gdma_ptr + gdma_offset);
       gdma_offset += gdma_len;
     }
+  }
+  // hashing for deduplication dominates with many groups, do it in parallel
+  std::vector<size_t> bdc_hash(group_num), gdma_hash(group_num);
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int group_idx = 0; group_idx < group_num; group_idx++) {
+    auto &bdc = bdc_v[group_idx];
+    auto &gdma = gdma_v[group_idx];
+    if (bdc[0] != 0) {
+      bdc_hash[group_idx] =
+          bmodel::ModelGen::HashBinary(bdc[1], bdc_ptr + bdc[2]);
+    }
+    if (gdma[0] != 0) {
+      gdma_hash[group_idx] =
+          bmodel::ModelGen::HashBinary(gdma[1], gdma_ptr + gdma[2]);
+    }
+  }
+  for (int group_idx = 0; group_idx < group_num; group_idx++) {
+    auto bdc_num = bdc_v[group_idx][0];
+    auto bdc_len = bdc_v[group_idx][1];
+    auto gdma_num = gdma_v[group_idx][0];
+    auto gdma_len = gdma_v[group_idx][1];
+    bmodel::Binary binary_bdc;
+    bmodel::Binary binary_gdma;
+    if (bdc_num != 0) {
+      binary_bdc = model_gen->WriteBinary(
+          bdc_len, bdc_ptr + bdc_v[group_idx][2], bdc_hash[group_idx]);
+    }
+    if (gdma_num != 0) {
+      binary_gdma = model_gen->WriteBinary(
+          gdma_len, gdma_ptr + gdma_v[group_idx][2], gdma_hash[group_idx]);
+    }
     bmodel::CmdGroupBuilder cgb(model_gen->Builder());
     cgb.add_bdc_num(bdc_num);
     cgb.add_gdma_num(gdma_num);
@@ -432,6 +505,124 @@ BMCodegen::CreateCmdGroupVector() {
   return std::move(cmd_group_v);
 }
 
+// everything the commands of a subnet depend on: the compiler and backend,
+// the module attributes, ops with their attributes and addressed types, and
+// the content of weights
+std::string BMCodegen::SubnetFingerprint(ModuleOp s, FuncOp func) {
+  llvm::SHA256 hasher;
+  hasher.update(MLIR_VERSION);
+  hasher.update(chip);
+  hasher.update(BM168x::LIB_BACKEND_NAME);
+  hasher.update(std::to_string(module::getCoreNum()));
+  std::string text;
+  llvm::raw_string_ostream os(text);
+  s->getAttrDictionary().print(os);
+  func->print(os, OpPrintingFlags().printGenericOpForm().useLocalScope());
+  os.flush();
+  hasher.update(text);
+  func.walk([&](top::WeightOp op) {
+    auto data = op.read_as_byte();
+    hasher.update(ArrayRef<uint8_t>(data->data(), data->size()));
+  });
+  return toHex(hasher.final(), true);
+}
+
+// cache file: group number, then each group as
+// {bdc_num, gdma_num, bdc_len, gdma_len, bdc data, gdma data}, where the data
+// is there only if its number is not 0
+bool BMCodegen::LoadCmdCache(
+    const std::string &key,
+    std::vector<Offset<bmodel::CmdGroup>> &cmd_group_v) {
+  auto fileOrErr = llvm::MemoryBuffer::getFile(cache_dir + "/" + key + ".cmd");
+  if (!fileOrErr) {
+    return false;
+  }
+  auto ptr = (const uint8_t *)(*fileOrErr)->getBufferStart();
+  auto end = (const uint8_t *)(*fileOrErr)->getBufferEnd();
+  auto read_u32 = [&](uint32_t &value) {
+    if (ptr + sizeof(uint32_t) > end) {
+      return false;
+    }
+    memcpy(&value, ptr, sizeof(uint32_t));
+    ptr += sizeof(uint32_t);
+    return true;
+  };
+  uint32_t group_num = 0;
+  if (!read_u32(group_num)) {
+    return false;
+  }
+  std::vector<Offset<bmodel::CmdGroup>> groups;
+  for (uint32_t i = 0; i < group_num; i++) {
+    uint32_t bdc_num, gdma_num, bdc_len, gdma_len;
+    if (!read_u32(bdc_num) || !read_u32(gdma_num) || !read_u32(bdc_len) ||
+        !read_u32(gdma_len) ||
+        ptr + (bdc_num ? bdc_len : 0) + (gdma_num ? gdma_len : 0) > end) {
+      return false;
+    }
+    bmodel::Binary binary_bdc;
+    bmodel::Binary binary_gdma;
+    if (bdc_num != 0) {
+      binary_bdc = model_gen->WriteBinary(bdc_len, ptr);
+      ptr += bdc_len;
+    }
+    if (gdma_num != 0) {
+      binary_gdma = model_gen->WriteBinary(gdma_len, ptr);
+      ptr += gdma_len;
+    }
+    bmodel::CmdGroupBuilder cgb(model_gen->Builder());
+    cgb.add_bdc_num(bdc_num);
+    cgb.add_gdma_num(gdma_num);
+    cgb.add_bdc_cmd_byte(bdc_len);
+    cgb.add_gdma_cmd_byte(gdma_len);
+    if (bdc_num != 0) {
+      cgb.add_binary_bdc(&binary_bdc);
+    }
+    if (gdma_num != 0) {
+      cgb.add_binary_gdma(&binary_gdma);
+    }
+    groups.push_back(cgb.Finish());
+  }
+  cmd_group_v.insert(cmd_group_v.end(), groups.begin(), groups.end());
+  return true;
+}
+
+void BMCodegen::SaveCmdCache(const std::string &key) {
+  auto gdma_ptr = (char *)bm168x->get_inst_data("gdma:0:0");
+  auto bdc_ptr = (char *)bm168x->get_inst_data("tiu:0:0");
+  // write to a temporary file first, other compilations may share the cache
+  auto filename = cache_dir + "/" + key + ".cmd";
+  auto tmp_name = filename + "." + std::to_string(getpid());
+  std::ofstream ofs(tmp_name, std::ios::binary | std::ios::trunc);
+  if (!ofs) {
+    return;
+  }
+  uint32_t group_num = bm168x->get_group_number();
+  ofs.write((char *)&group_num, sizeof(group_num));
+  int64_t bdc_offset = 0, gdma_offset = 0;
+  for (uint32_t group_idx = 0; group_idx < group_num; group_idx++) {
+    uint32_t bdc_num = bm168x->get_inst_number_per_group("tiu:0:0", group_idx);
+    uint32_t gdma_num =
+        bm168x->get_inst_number_per_group("gdma:0:0", group_idx);
+    uint32_t bdc_len = bm168x->get_bdc_len(bdc_num, group_idx);
+    uint32_t gdma_len = bm168x->get_gdma_len(gdma_num, group_idx);
+    for (auto value : {bdc_num, gdma_num, bdc_len, gdma_len}) {
+      ofs.write((char *)&value, sizeof(value));
+    }
+    if (bdc_num != 0) {
+      ofs.write(bdc_ptr + bdc_offset, bdc_len);
+      bdc_offset += bdc_len;
+    }
+    if (gdma_num != 0) {
+      ofs.write(gdma_ptr + gdma_offset, gdma_len);
+      gdma_offset += gdma_len;
+    }
+  }
+  ofs.close();
+  if (ofs.fail() || llvm::sys::fs::rename(tmp_name, filename)) {
+    llvm::sys::fs::remove(tmp_name);
+  }
+}
+
 std::shared_ptr<std::vector<bmodel::Binary>>
 BMCodegen::CreateCmdVector(const char *engine_name) {
   auto cmd_v = std::make_shared<std::vector<bmodel::Binary>>();
@@ -850,10 +1041,19 @@ void BMCodegen::codegen(Operation *op) {
 }
 
 Offset<bmodel::SubNet> BMCodegen::CreateSubNet(ModuleOp s, func::CallOp call) {
-  bm168x->before_codegen();
   auto func = module::getFuncOp(s, call.getCallee());
-  func.walk([&](Operation *op) { codegen(op); });
-  bm168x->after_codegen(module::getFLOPs());
+  std::string cache_key;
+  std::vector<Offset<bmodel::CmdGroup>> cmd_group_vs;
+  bool cached = false;
+  if (use_cmd_cache) {
+    cache_key = SubnetFingerprint(s, func);
+    cached = LoadCmdCache(cache_key, cmd_group_vs);
+  }
+  if (!cached) {
+    bm168x->before_codegen();
+    func.walk([&](Operation *op) { codegen(op); });
+    bm168x->after_codegen(module::getFLOPs());
+  }
   int subnet_id = func->getAttrOfType<IntegerAttr>("id").getInt();
   LLVM_DEBUG(llvm::dbgs() << "subnet id: '" << subnet_id << "'\n");
   std::vector<Value> inputs;
@@ -900,10 +1100,12 @@ Offset<bmodel::SubNet> BMCodegen::CreateSubNet(ModuleOp s, func::CallOp call) {
   auto &builder = model_gen->Builder();
   auto next_ids = builder.CreateVector(next_id_v);
 
-  std::vector<Offset<bmodel::CmdGroup>> cmd_group_vs;
   std::vector<Offset<bmodel::CoreCommands>> core_commands;
   auto multi_core = dyn_cast<MultiCoreInterface>(bm168x);
-  if (multi_core && multi_core->getCodebuffer().size() > 1) {
+  if (cached) {
+    LLVM_DEBUG(llvm::dbgs() << "reuse commands of subnet '" << func.getName()
+                            << "'\n");
+  } else if (multi_core && multi_core->getCodebuffer().size() > 1) {
     auto code_buffers = multi_core->getCodebuffer();
     for (int i = 0, n = code_buffers.size(); i < n; i++) {
       multi_core->useCore(i);
@@ -948,6 +1150,9 @@ Offset<bmodel::SubNet> BMCodegen::CreateSubNet(ModuleOp s, func::CallOp call) {
       auto cmd_group_v = CreateCmdGroupVector();
       cmd_group_vs.insert(cmd_group_vs.end(), cmd_group_v->begin(),
                           cmd_group_v->end());
+      if (use_cmd_cache) {
+        SaveCmdCache(cache_key);
+      }
     }
   }
 
@@ -11,6 +11,8 @@
 #include "TensorLocation.hpp"
 #include "tpu_mlir/Builder/BM168x/bmodel.hpp"
 #include "tpu_mlir/Dialect/Tpu/Transforms/Codegen/Dynamic/DynamicNetIr.hpp"
+#include <array>
+#include <map>
 
 using namespace llvm;
 
@@ -21,7 +23,8 @@ namespace tpu {
 class BMCodegen {
 public:
   BMCodegen() {}
-  void init(ModuleOp m, const std::string &filename);
+  void init(ModuleOp m, const std::string &filename,
+            const std::string &cache_dir = "");
   void run(ModuleOp s, bool embed_debug_info = false);
   void store();
 
@@ -50,6 +53,10 @@ private:
   CreateSwitchParamVector(vector<int> &output_from, vector<int> &output_branch);
   Offset<bmodel::MergeParam>
   CreateMergeParamVector(vector<vector<int>> &output_from);
+  std::string SubnetFingerprint(ModuleOp s, FuncOp func);
+  bool LoadCmdCache(const std::string &key,
+                    std::vector<Offset<bmodel::CmdGroup>> &cmd_group_v);
+  void SaveCmdCache(const std::string &key);
   void codegen(Operation *op);
   void codegen_for_group(GroupOp gOP, Operation *prev_op, Operation *next_op);
   void codegen_for_overlap_ops(
@@ -72,6 +79,9 @@ private:
   BM168x *bm168x;
   u32 max_cpu_mem_size = 0;
   std::string filename;
+  // commands of unchanged subnets are reused from here, if not empty
+  std::string cache_dir;
+  bool use_cmd_cache = false;
   std::shared_ptr<std::vector<StringRef>> input_names;
   std::shared_ptr<std::vector<StringRef>> output_names;
   std::vector<StringRef> hidden_names;
@@ -81,6 +91,9 @@ private:
   uint32_t current_device = 0;
   std::shared_ptr<bmodel::ModelGen> model_gen;
   std::shared_ptr<std::vector<Offset<bmodel::CmdGroup>>> cmd_group_all;
+  std::map<std::pair<uint64_t, std::array<uint8_t, 32>>,
+           Offset<bmodel::CoeffMem>>
+      coeff_mem_cache;
   TensorLocation tensor_loc;
   ProfileCtx profile_ctx;
   std::unordered_map<std::string, std::vector<bool>> tensor_is_cpu;
@@ -10,6 +10,7 @@
 #include "CV18xxCodegen.hpp"
 #include "mlir/Support/FileUtilities.h"
 #include "tpu_mlir/Backend/CV18xx/CV18xx.h"
+#include "tpu_mlir/Backend/CV18xx/CV18xx_global_api.h"
 #include "tpu_mlir/Dialect/Tpu/Transforms/LayerGroup/SwPipeline.h"
 #include "tpu_mlir/Support/PixelHelper.h"
 #include "llvm/Support/MD5.h"
@@ -82,8 +83,17 @@ static void buildInputsOutputs(flatbuffers::FlatBufferBuilder &fbb,
   fbOutputs = fbb.CreateVector(fbStrVec);
 }
 
-static void genMD5Hash(std::vector<uint8_t> &totalBin, uint8_t *resData) {
-  auto hash = llvm::MD5::hash(totalBin);
+// hash the concatenation of the parts chunk by chunk, without joining them
+static void genMD5Hash(ArrayRef<ArrayRef<uint8_t>> parts, uint8_t *resData) {
+  const size_t chunk_bytes = (size_t)1 << 20;
+  llvm::MD5 hasher;
+  for (auto part : parts) {
+    for (size_t pos = 0; pos < part.size(); pos += chunk_bytes) {
+      hasher.update(part.slice(pos, std::min(chunk_bytes, part.size() - pos)));
+    }
+  }
+  llvm::MD5::MD5Result hash;
+  hasher.final(hash);
   memcpy(resData, hash.data(), 16);
 }
 
@@ -519,6 +529,8 @@ flatbuffers::Offset<Routine> CviTpuRoutine::build() {
 
 CviModelBuilder::CviModelBuilder(ModuleOp &m, std::string &version) : fbb_(1024) {
   int32_t layer_id = 0;
+  // conv tiling plans only live while the routines of this model are built
+  cvi_backend_tg_conv_clear_plans();
   auto chip_ = module::getChip();
   chip = module::stringifyChip(chip_);
   privateGmemSize_ = module::getGmemPrivateSize(m);
@@ -549,6 +561,7 @@ CviModelBuilder::CviModelBuilder(ModuleOp &m, std::string &version) : fbb_(1024)
     }
     nextSubIdx = func->getAttrOfType<DenseI32ArrayAttr>("next_index")[0];
   };
+  cvi_backend_tg_conv_clear_plans();
   module::getInputsOutputs(m, inputs, outputs);
 }
 
@@ -905,21 +918,11 @@ void CviModelBuilder::storeModel(std::string filename) {
   FBModel fbModel = build(); // build
   fbb_.Finish(fbModel);
 
-  std::vector<uint8_t> modelData;
-  modelData.resize(fbb_.GetSize() + binBuffer_.size());
-  uint8_t *dst = modelData.data();
-  uint8_t *src = fbb_.GetBufferPointer();
-  for (uint32_t i = 0; i < fbb_.GetSize(); i++) {
-    *dst++ = *src++;
-  }
-  src = binBuffer_.data();
-  for (uint32_t i = 0; i < binBuffer_.size(); i++) {
-    *dst++ = *src++;
-  }
-  binBuffer_.clear();
+  ArrayRef<uint8_t> body(fbb_.GetBufferPointer(), fbb_.GetSize());
+  ArrayRef<uint8_t> weight(binBuffer_);
 
   CviModelHeader header;
-  genMD5Hash(modelData, (uint8_t *)header.md5);
+  genMD5Hash({body, weight}, (uint8_t *)header.md5);
   std::string magic = u8"CviModel";
   std::string padding = u8"AA";
   memcpy(header.magic, magic.c_str(), 8);
@@ -931,8 +934,10 @@ void CviModelBuilder::storeModel(std::string filename) {
   header.minor = minorVersion_; // defined in cvimodel.fbs
 
   output->os().write(reinterpret_cast<char *>(&header), sizeof(CviModelHeader));
-  output->os().write(reinterpret_cast<char *>(modelData.data()),
-                     modelData.size());
+  output->os().write(reinterpret_cast<const char *>(body.data()), body.size());
+  output->os().write(reinterpret_cast<const char *>(weight.data()),
+                     weight.size());
+  binBuffer_.clear();
   output->keep();
 
   // write debug txt
@@ -11,6 +11,9 @@
 #include "llvm/Support/FormatVariadic.h"
 #include "mlir/Transforms/GreedyPatternRewriteDriver.h"
 #include "CoreParallel/CoreParallel.hpp"
+#include "tpu_mlir/Backend/Arch.h"
+#include "tpu_mlir/Support/MathUtils.h"
+#include <cmath>
 
 using namespace llvm;
 
@@ -118,6 +121,139 @@ std::optional<SmallVector<Type>> getSplitTypes(Attribute valueMap, Value value,
   return outputType;
 };
 
+// The iteration space is [dim0, ..., splitDim, ...]: the dims before splitDim
+// are unrolled one by one and splitDim is cut into slices of at most splitMax,
+// each (unrolled index, slice) pair runs on one core.
+struct SplitPlan {
+  int splitDim;
+  int64_t splitMax;
+  SmallVector<int64_t, 4> iterationShape;
+  int64_t cycle;
+};
+
+// Floating point operations of the whole op, as getFLOPs of the Top ops.
+// Ops without a reduction do about one operation per output element.
+static int64_t getOpFLOPs(Operation *op) {
+  if (auto matmul = dyn_cast<tpu::MatMulOp>(op)) {
+    auto p = matmul.parseParam();
+    return p.batch * p.M * p.N * (2 * p.K + 1);
+  }
+  if (auto conv = dyn_cast<tpu::Conv2DOp>(op)) {
+    auto p = conv.parseParam();
+    return module::getNumElements(conv.getOutput()) *
+           (p.kh * p.kw * p.ic / p.groups * 2 + 1);
+  }
+  return module::getNumElements(op->getResult(0));
+}
+
+// Elements of `value` one core touches when it runs `sliceParallel` of the
+// parallel loops. Dims the map does not index are read whole, so an operand
+// that does not follow the split dim, as the weight of a matmul split on M,
+// is read again by every core.
+static int64_t getSliceElements(Attribute valueMap, Value value,
+                                ArrayRef<int64_t> sliceParallel) {
+  auto vMap = cast<AffineMapAttr>(valueMap).getValue();
+  auto shape = module::getShape(value);
+  int64_t elements = 1;
+  for (auto [i, s] : llvm::enumerate(shape)) {
+    int64_t extent = s;
+    if (i < vMap.getNumResults()) {
+      if (auto dim = dyn_cast<AffineDimExpr>(vMap.getResult(i)))
+        extent = std::min(s, sliceParallel[dim.getPosition()]);
+    }
+    elements *= extent;
+  }
+  return elements;
+}
+
+// Rough cycle of one core running `sliceParallel` of the parallel loops of
+// `op`. TIU does the FLOPs of the slice on NPU lanes along C and on EU-aligned
+// H*W of the result, so slices that waste lanes gain nothing on TIU; GDMA
+// moves the slices of every operand and of the result.
+static int64_t estimateCoreCycle(IndexingMapsInterface op,
+                                 ArrayRef<int64_t> shapeParallel,
+                                 ArrayRef<int64_t> sliceParallel) {
+  // Bytes per cycle of GDMA, read and write together.
+  const int64_t gdma_bytes_per_cycle = 16;
+  auto result = op->getResult(0);
+  auto indexMap = op.getIndexingMaps().getValue();
+  auto dtype_bytes = module::getDtypeSize(result);
+  int64_t npu_num = std::max<int64_t>(backend::Arch::NPU_NUM, 1);
+  int64_t eu_num = std::max<int64_t>(backend::Arch::eu_num(dtype_bytes), 1);
+
+  // view the result slice as (n, c, inner)
+  SmallVector<int64_t> sliceShape(module::getShape(result));
+  for (auto [i, s] : llvm::enumerate(sliceParallel))
+    sliceShape[i] = s;
+  int64_t n = 1, c = 1, inner = 1;
+  for (auto [i, s] : llvm::enumerate(sliceShape)) {
+    if (sliceShape.size() > 1 && i == 0)
+      n = s;
+    else if (sliceShape.size() == 1 || i == 1)
+      c = s;
+    else
+      inner *= s;
+  }
+  double part = 1;
+  for (auto [s, total] : llvm::zip(sliceParallel, shapeParallel))
+    part *= (double)s / total;
+  double flops = getOpFLOPs(op) * part;
+  double lanes = (double)align_up(c, npu_num) * align_up(inner, eu_num) /
+                 (c * inner);
+  int64_t tiu = std::ceil(flops * lanes / (npu_num * eu_num));
+
+  int64_t bytes = 0;
+  for (auto [valueMap, value] : llvm::zip(indexMap, op->getOperands())) {
+    if (module::isNone(value))
+      continue;
+    bytes += getSliceElements(valueMap, value, sliceParallel) *
+             module::getDtypeSize(value);
+  }
+  bytes += n * c * inner * dtype_bytes;
+  int64_t gdma = ceiling_func(bytes, gdma_bytes_per_cycle);
+  return tiu + gdma;
+}
+
+// :load balance:
+// Try every dim as the split dim, as long as the unrolled outer dims do not
+// exceed num_core. Estimate the cycle of the slowest core for each and keep
+// the cheapest plan. On a tie the outer dim wins, it needs fewer ops. No plan
+// if no split beats a single core.
+static std::optional<SplitPlan> getSplitPlan(IndexingMapsInterface op,
+                                             ArrayRef<int64_t> shapeParallel,
+                                             int num_core) {
+  // An empty iteration shape means running on a single core.
+  SplitPlan best = {0, 0, {},
+                    estimateCoreCycle(op, shapeParallel, shapeParallel)};
+  int64_t iterSpace = 1;
+  for (int dim = 0, n = shapeParallel.size(); dim < n; ++dim) {
+    if (iterSpace > num_core)
+      break;
+    // Cut the dim evenly into at most coreK slices, the slowest core gets
+    // splitMax of it.
+    int64_t coreK = std::min<int64_t>(num_core / iterSpace, shapeParallel[dim]);
+    int64_t splitMax = ceiling_func(shapeParallel[dim], coreK);
+    int64_t slices = ceiling_func(shapeParallel[dim], splitMax);
+    if (iterSpace * slices >= 2) {
+      SmallVector<int64_t> sliceParallel(shapeParallel);
+      for (int i = 0; i < dim; i++)
+        sliceParallel[i] = 1;
+      sliceParallel[dim] = splitMax;
+      int64_t cycle = estimateCoreCycle(op, shapeParallel, sliceParallel);
+      if (cycle < best.cycle) {
+        best = {dim, splitMax, {}, cycle};
+        best.iterationShape.append(shapeParallel.begin(),
+                                   shapeParallel.begin() + dim);
+        best.iterationShape.push_back(slices);
+      }
+    }
+    iterSpace *= shapeParallel[dim];
+  }
+  if (best.iterationShape.empty())
+    return std::nullopt;
+  return best;
+}
+
 bool forAll(IndexingMapsInterface op, int num_core = 1) {
   auto indexMap = op.getIndexingMaps();
   if (!indexMap || indexMap.empty())
@@ -139,34 +275,15 @@ bool forAll(IndexingMapsInterface op, int num_core = 1) {
   if (!resultMap.isIdentity())
     return false;
 
-  // :load balance:
-  // shape = [a, b]; other situations can be reduced to this formula.
-  // a * b = a * \sum_{i=1}^n (b_i)
-  // a * n <= num_core
-  // Find the largest n
-  // This implement use the maxSlice as much as possible, but it does not take
-  // the number of NPU into account. #please improve This
   auto shapeParallel =
       module::getShape(op->getResult(0)).slice(0, resultMap.getNumInputs());
 
-  int splitDim = 0, splitMax = 1;
-  SmallVector<int64_t, 4> iterationShape;
-  for (int64_t i = 0, n = shapeParallel.size(), iterSpace = 1; i < n; ++i) {
-    if (iterSpace * shapeParallel[i] >= num_core) {
-      splitDim = i;
-      int coreK = num_core / iterSpace;                  // This is the lower n
-      splitMax = (shapeParallel[i] + coreK - 1) / coreK; // This is max(b_i)
-      auto n = (shapeParallel[i] + splitMax - 1) / splitMax;
-      iterationShape.push_back(n);
-      break;
-    } else {
-      iterationShape.push_back(shapeParallel[i]);
-      iterSpace *= shapeParallel[i];
-    }
-  }
-
-  if (splitDim == 0 && iterationShape[0] == 1)
+  auto plan = getSplitPlan(op, shapeParallel, num_core);
+  if (!plan)
     return false;
+  int splitDim = plan->splitDim;
+  int splitMax = plan->splitMax;
+  auto &iterationShape = plan->iterationShape;
 
   auto rewriter = IRRewriter(op.getContext());
   rewriter.setInsertionPoint(op);
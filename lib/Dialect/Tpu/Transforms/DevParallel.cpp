@@ -307,6 +307,22 @@ public:
     auto mOp = getOperation();
     auto mainFunc = module::getMainFuncOp(mOp);
     auto mode = module::getMode();
+    if (parallel_mode == "pipeline") {
+      if (failed(distributePipeline(mOp, num_device))) {
+        signalPassFailure();
+      }
+      return;
+    } else if (parallel_mode == "data") {
+      if (failed(distributeBatch(mOp, num_device))) {
+        signalPassFailure();
+      }
+      return;
+    } else if (parallel_mode != "tensor") {
+      mOp.emitError() << "unknown dev-parallel mode '" << parallel_mode
+                      << "', expected tensor, pipeline or data";
+      signalPassFailure();
+      return;
+    }
     if (num_device > 1) {
       if (mode == module::Mode::F16 || mode == module::Mode::BF16) {
         module::applyPatternOnce<MatMulSliceMerge3>(mOp);
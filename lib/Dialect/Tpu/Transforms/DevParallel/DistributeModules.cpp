@@ -7,6 +7,9 @@
 //
 //===----------------------------------------------------------------------===//
 #include "tpu_mlir/Dialect/Tpu/Transforms/DevParallel/Distribute.h"
+#include "tpu_mlir/Backend/Arch.h"
+#include <limits>
+#include <numeric>
 
 namespace tpu_mlir {
 namespace tpu {
@@ -591,7 +594,7 @@ static void updateFuncIONames(ModuleOp m) {
   });
 }
 
-void distributeModules(ModuleOp m, int64_t num_device) {
+static void setNetIONames(ModuleOp m) {
   auto main = module::getMainFuncOp(m);
   std::vector<StringRef> input_names;
   std::vector<StringRef> output_names;
@@ -605,18 +608,61 @@ void distributeModules(ModuleOp m, int64_t num_device) {
   }
   module::setInputs(input_names);
   module::setOutputs(output_names);
-  if (num_device == 1) {
-    distributeToOneModule(m);
-    return;
-  }
+}
 
-  // sort Opeartions
+static void sortOperations(ModuleOp m) {
   auto ctx = m.getContext();
   for (auto func : m.getOps<FuncOp>()) {
     RewritePatternSet patterns(ctx);
     patterns.add<OpReorderPattern>(ctx);
     applyPatternsAndFoldGreedily(func, std::move(patterns));
   }
+}
+
+// turn every sub function into a sub module, ordered by step and device
+static void buildSubModules(ModuleOp m) {
+  updateFuncIONames(m);
+
+  // each function create one module
+  module::applyPatternOnce<Function2Module>(m);
+  // remove main, and functions
+  auto ops = m.getOps<FuncOp>();
+  std::vector<FuncOp> funcs(ops.begin(), ops.end());
+  for (auto f : funcs) {
+    f.erase();
+  }
+  // make moudle order to be step by step and device by device
+  auto subs = m.getOps<ModuleOp>();
+  std::vector<ModuleOp> modules(subs.begin(), subs.end());
+  if (modules.size() <= 1) {
+    return;
+  }
+
+  for (auto s : modules) {
+    sortOperations(s);
+  }
+
+  std::sort(modules.begin(), modules.end(), [](ModuleOp a, ModuleOp b) {
+    int64_t a_devid, a_step, b_devid, b_step;
+    module::getSubModuleId(a, a_devid, a_step);
+    module::getSubModuleId(b, b_devid, b_step);
+    return a_step < b_step || (a_step == b_step && a_devid < b_devid);
+  });
+  for (int i = 1; i < modules.size(); i++) {
+    modules[i]->moveAfter(modules[i - 1]);
+  }
+}
+
+void distributeModules(ModuleOp m, int64_t num_device) {
+  auto main = module::getMainFuncOp(m);
+  setNetIONames(m);
+  if (num_device == 1) {
+    distributeToOneModule(m);
+    return;
+  }
+
+  // sort Opeartions
+  sortOperations(m);
 
   std::shared_ptr<SubFunction> subf = nullptr;
   bool in_distribution = false;
@@ -654,40 +700,443 @@ void distributeModules(ModuleOp m, int64_t num_device) {
     subf = nullptr;
   }
 
-  updateFuncIONames(m);
+  buildSubModules(m);
+}
 
-  // each function create one module
-  module::applyPatternOnce<Function2Module>(m);
-  // remove main, and functions
-  auto ops = m.getOps<FuncOp>();
-  std::vector<FuncOp> funcs(ops.begin(), ops.end());
-  for (auto f : funcs) {
-    f.erase();
+// Rough cycle of one op on one device, the TIU part counts MACs on all NPU
+// lanes, the GDMA part counts activations and weights moved. Only used to
+// compare stages with each other.
+static int64_t estimateOpCycle(Operation *op) {
+  // Bytes per cycle of GDMA, read and write together.
+  const int64_t gdma_bytes_per_cycle = 16;
+  int64_t npu_num = std::max<int64_t>(backend::Arch::NPU_NUM, 1);
+  int64_t bytes = 0;
+  for (auto opd : op->getOperands()) {
+    if (!module::isNone(opd)) {
+      bytes += module::getBytes(opd);
+    }
   }
-  // make moudle order to be step by step and device by device
-  auto subs = m.getOps<ModuleOp>();
-  std::vector<ModuleOp> modules(subs.begin(), subs.end());
-  if (modules.size() <= 1) {
-    return;
+  int64_t out_elems = 0;
+  double dtype_bytes = 1;
+  for (auto v : op->getResults()) {
+    if (module::isNone(v)) {
+      continue;
+    }
+    bytes += module::getBytes(v);
+    out_elems += module::getNumElements(v);
+    dtype_bytes = module::getDtypeSize(v);
   }
-
-  for (auto s : modules) {
-    for (auto func : s.getOps<FuncOp>()) {
-      RewritePatternSet patterns(ctx);
-      patterns.add<OpReorderPattern>(ctx);
-      applyPatternsAndFoldGreedily(func, std::move(patterns));
+  // MACs per output element
+  int64_t reduce = 1;
+  if (isa<tpu::Conv2DOp, tpu::Conv3DOp, tpu::DeconvOp>(op)) {
+    auto oshape = module::getShape(op->getResult(0));
+    if (oshape.size() > 1 && oshape[1] > 0) {
+      reduce = module::getNumElements(op->getOperand(1)) / oshape[1];
+    }
+  } else if (isa<tpu::MatMulOp, tpu::A16MatMulOp>(op)) {
+    auto ishape = module::getShape(op->getOperand(0));
+    if (!ishape.empty()) {
+      reduce = ishape.back();
     }
   }
+  int64_t eu_num =
+      std::max<int64_t>(backend::Arch::eu_num(std::max(dtype_bytes, 1.0)), 1);
+  int64_t tiu = ceiling_func(out_elems * std::max<int64_t>(reduce, 1),
+                             npu_num * eu_num);
+  return tiu + bytes / gdma_bytes_per_cycle;
+}
 
-  std::sort(modules.begin(), modules.end(), [](ModuleOp a, ModuleOp b) {
-    int64_t a_devid, a_step, b_devid, b_step;
-    module::getSubModuleId(a, a_devid, a_step);
-    module::getSubModuleId(b, b_devid, b_step);
-    return a_step < b_step || (a_step == b_step && a_devid < b_devid);
+// :pipeline stages:
+// Cut ops (in topological order) into num_stage contiguous stages. A stage
+// holds the weights it reads and the activations it produces, a weight read by
+// several stages is held by each of them. Stage memory is capped to twice its
+// even share, or to the smallest cap that can be cut at all, then the cycle of
+// the slowest stage is minimized under that cap. Both limits are binary
+// searched, a stage is cut greedily once it would exceed one of them, or when
+// every remaining op must open a stage of its own. Returns the first op index
+// of each stage.
+static std::vector<size_t> getPipelineCuts(ArrayRef<Operation *> ops,
+                                           int64_t num_stage) {
+  std::vector<int64_t> cycles, out_bytes;
+  std::vector<llvm::SmallVector<std::pair<Value, int64_t>>> weights;
+  llvm::DenseSet<Value> all_weights;
+  int64_t total_mem = 0;
+  for (auto op : ops) {
+    cycles.push_back(estimateOpCycle(op));
+    int64_t bytes = 0;
+    for (auto v : op->getResults()) {
+      if (!module::isNone(v)) {
+        bytes += module::getBytes(v);
+      }
+    }
+    out_bytes.push_back(bytes);
+    total_mem += bytes;
+    auto &w_list = weights.emplace_back();
+    for (auto opd : op->getOperands()) {
+      if (!opd.getDefiningOp<top::WeightOp>() ||
+          llvm::any_of(w_list, [&](auto &w) { return w.first == opd; })) {
+        continue;
+      }
+      w_list.push_back({opd, module::getBytes(opd)});
+      if (all_weights.insert(opd).second) {
+        total_mem += w_list.back().second;
+      }
+    }
+  }
+  auto stages = [&](int64_t cycle_limit, int64_t mem_limit,
+                    std::vector<size_t> *cuts) {
+    int64_t count = 1, cycle = 0, mem = 0;
+    llvm::DenseSet<Value> held;
+    if (cuts) {
+      cuts->assign(1, 0);
+    }
+    for (size_t i = 0; i < ops.size(); ++i) {
+      int64_t op_mem = out_bytes[i];
+      for (auto &[w, bytes] : weights[i]) {
+        op_mem += held.contains(w) ? 0 : bytes;
+      }
+      bool must_cut = count < num_stage &&
+                      (int64_t)(ops.size() - i) == num_stage - count;
+      if (i > 0 && (cycle + cycles[i] > cycle_limit ||
+                    mem + op_mem > mem_limit || must_cut)) {
+        if (cuts) {
+          cuts->push_back(i);
+        }
+        count++;
+        cycle = 0;
+        mem = 0;
+        held.clear();
+        op_mem = out_bytes[i];
+        for (auto &w : weights[i]) {
+          op_mem += w.second;
+        }
+      }
+      cycle += cycles[i];
+      mem += op_mem;
+      for (auto &w : weights[i]) {
+        held.insert(w.first);
+      }
+    }
+    return count;
+  };
+  auto search = [&](int64_t lo, int64_t hi, auto fits) {
+    while (lo < hi) {
+      int64_t mid = lo + (hi - lo) / 2;
+      if (fits(mid)) {
+        hi = mid;
+      } else {
+        lo = mid + 1;
+      }
+    }
+    return lo;
+  };
+  const int64_t no_limit = std::numeric_limits<int64_t>::max();
+  int64_t max_op_mem = 0;
+  for (size_t i = 0; i < ops.size(); ++i) {
+    int64_t op_mem = out_bytes[i];
+    for (auto &w : weights[i]) {
+      op_mem += w.second;
+    }
+    max_op_mem = std::max(max_op_mem, op_mem);
+  }
+  // the smallest cap any cut can meet
+  int64_t min_mem = search(max_op_mem, total_mem, [&](int64_t limit) {
+    return stages(no_limit, limit, nullptr) <= num_stage;
   });
-  for (int i = 1; i < modules.size(); i++) {
-    modules[i]->moveAfter(modules[i - 1]);
+  int64_t mem_cap =
+      std::max<int64_t>(min_mem, 2 * ceiling_func(total_mem, num_stage));
+  int64_t cycle_limit =
+      search(*std::max_element(cycles.begin(), cycles.end()),
+             std::accumulate(cycles.begin(), cycles.end(), (int64_t)0),
+             [&](int64_t limit) {
+               return stages(limit, mem_cap, nullptr) <= num_stage;
+             });
+  std::vector<size_t> cuts;
+  stages(cycle_limit, mem_cap, &cuts);
+  return cuts;
+}
+
+LogicalResult distributePipeline(ModuleOp m, int64_t num_device) {
+  auto main = module::getMainFuncOp(m);
+  auto isStageOp = [](Operation *op) {
+    return !isa<top::InputOp, top::WeightOp, top::NoneOp, func::ReturnOp>(op);
+  };
+  // only top level ops, regions move with their parent
+  std::vector<Operation *> ops;
+  for (auto &op : main.front()) {
+    if (isStageOp(&op)) {
+      ops.push_back(&op);
+    }
+  }
+  if (num_device == 1) {
+    // a single stage, the only device runs the whole net
+    distributeModules(m, 1);
+    return success();
+  }
+  if ((int64_t)ops.size() < num_device) {
+    return m.emitError() << "pipeline mode needs at least one op per device, "
+                         << "got " << ops.size() << " ops for " << num_device
+                         << " devices";
+  }
+  setNetIONames(m);
+  sortOperations(m);
+  // ops may be moved by sorting, collect them again
+  ops.clear();
+  for (auto &op : main.front()) {
+    if (isStageOp(&op)) {
+      ops.push_back(&op);
+    }
+  }
+  auto cuts = getPipelineCuts(ops, num_device);
+  cuts.push_back(ops.size());
+  // a stage only owns the weights moved into it, and stages run on different
+  // devices, so a weight read by several stages is cloned into each of the
+  // later ones and every device holds its own copy
+  llvm::DenseMap<Operation *, size_t> weight_stage;
+  for (size_t i = 0; i + 1 < cuts.size(); ++i) {
+    llvm::DenseMap<Value, Value> mapper;
+    auto suffix = "stage" + std::to_string(i);
+    for (size_t j = cuts[i]; j < cuts[i + 1]; ++j) {
+      for (auto [idx, opd] : llvm::enumerate(ops[j]->getOperands())) {
+        auto w_op = opd.getDefiningOp<top::WeightOp>();
+        if (!w_op) {
+          continue;
+        }
+        auto it = weight_stage.try_emplace(w_op, i).first;
+        if (it->second == i) {
+          continue;
+        }
+        if (mapper.find(opd) == mapper.end()) {
+          auto new_w = w_op.clone(suffix);
+          new_w.getDefiningOp()->setAttrs(w_op->getAttrs());
+          mapper[opd] = new_w;
+        }
+        ops[j]->setOperand(idx, mapper[opd]);
+      }
+    }
+  }
+  // stage i runs on device i at step i; tensors crossing a cut become the
+  // outputs of one stage and the inputs of the next, the runtime passes them
+  // between devices like the io of any other sub net. There is no
+  // micro-batching: each stage runs the whole batch, so one inference keeps a
+  // single device busy at a time, and stages only overlap when the runtime
+  // feeds successive inferences.
+  for (size_t i = 0; i + 1 < cuts.size(); ++i) {
+    auto subf = std::make_shared<SubFunction>(i, i);
+    for (size_t j = cuts[i]; j < cuts[i + 1]; ++j) {
+      insert_subop(subf, ops[j]);
+    }
+    buildSubFunction(subf, m);
+  }
+  buildSubModules(m);
+  return success();
+}
+
+// An op can run on part of the batch if batch stays on dim 0 of all its
+// activations and nothing mixes samples.
+static bool isBatchIndependent(Operation *op, int64_t batch) {
+  if (op->getNumRegions() > 0) {
+    return false;
+  }
+  for (auto v : op->getOperands()) {
+    if (module::isNone(v) || module::isWeight(v)) {
+      continue;
+    }
+    auto shape = module::getShape(v);
+    if (shape.empty() || shape[0] != batch) {
+      return false;
+    }
+  }
+  for (auto v : op->getResults()) {
+    auto shape = module::getShape(v);
+    if (shape.empty() || shape[0] != batch) {
+      return false;
+    }
+  }
+  if (isa<tpu::ReshapeOp>(op)) {
+    return true;
+  }
+  if (auto softmax = dyn_cast<tpu::SoftmaxOp>(op)) {
+    return softmax.getAxis() != 0;
+  }
+  if (auto concat = dyn_cast<tpu::ConcatOp>(op)) {
+    return concat.getAxis() != 0;
+  }
+  if (auto layer_norm = dyn_cast<tpu::LayerNormOp>(op)) {
+    return layer_norm.getAxis() != 0;
+  }
+  auto map_op = dyn_cast<IndexingMapsInterface>(op);
+  if (!map_op) {
+    return false;
+  }
+  auto indexMap = map_op.getIndexingMaps();
+  if (!indexMap || indexMap.empty()) {
+    return false;
+  }
+  // dim 0 of the iteration space must be the batch of all activations
+  auto batch_expr = getAffineDimExpr(0, op->getContext());
+  for (auto [i, attr] : llvm::enumerate(indexMap)) {
+    auto map = cast<AffineMapAttr>(attr).getValue();
+    if (i < op->getNumOperands()) {
+      auto opd = op->getOperand(i);
+      if (module::isNone(opd) || module::isWeight(opd)) {
+        continue;
+      }
+    }
+    if (map.getNumResults() == 0 || map.getResult(0) != batch_expr) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// :data parallel:
+// Every device runs the whole net on batch / num_device samples. Inputs are
+// sliced and outputs are concatenated on batch by the runtime; the device
+// tensors are named "<name>_<device>" like the ones split by tensor parallel.
+// Each device holds its own clone of the weights, codegen writes one coeff
+// binary for devices whose coeff is the same.
+LogicalResult distributeBatch(ModuleOp m, int64_t num_device) {
+  auto main = module::getMainFuncOp(m);
+  if (num_device == 1) {
+    distributeModules(m, 1);
+    return success();
+  }
+  std::vector<top::InputOp> inputs(main.getOps<top::InputOp>().begin(),
+                                   main.getOps<top::InputOp>().end());
+  int64_t batch = 0;
+  if (!inputs.empty()) {
+    auto shape = module::getShape(inputs[0].getOutput());
+    batch = shape.empty() ? 0 : shape[0];
+  }
+  bool same_batch = batch > 0 && batch % num_device == 0;
+  for (auto in : inputs) {
+    auto shape = module::getShape(in.getOutput());
+    same_batch &= !shape.empty() && shape[0] == batch;
+  }
+  if (!same_batch) {
+    return m.emitError() << "data parallel mode needs all inputs to share a "
+                         << "batch divisible by " << num_device << " devices";
+  }
+  std::vector<Operation *> ops;
+  for (auto &op : main.front()) {
+    if (isa<top::InputOp, top::WeightOp, top::NoneOp, func::ReturnOp>(op)) {
+      continue;
+    }
+    if (!isBatchIndependent(&op, batch)) {
+      return op.emitError() << "data parallel mode can not run this op on "
+                            << "part of the batch";
+    }
+    ops.push_back(&op);
+  }
+  if (ops.empty()) {
+    return m.emitError() << "data parallel mode found no op to distribute";
+  }
+  setNetIONames(m);
+  module::setBatchParallel(true);
+
+  OpBuilder builder(m.getContext());
+  auto retOp = cast<func::ReturnOp>(main.front().getTerminator());
+  auto none = module::getNoneOp(ops[0]);
+  int64_t sub_batch = batch / num_device;
+  std::vector<std::shared_ptr<SubFunction>> subf_list;
+  std::vector<std::vector<Value>> outputs(retOp.getNumOperands());
+  for (int64_t i = 0; i < num_device; ++i) {
+    auto suffix = std::to_string(i);
+    llvm::DenseMap<Value, Value> mapper;
+    for (auto in : inputs) {
+      auto v = in.getOutput();
+      auto shape = module::getShape(v);
+      std::vector<int64_t> offset_v(shape.size(), 0);
+      std::vector<int64_t> step_v(shape.size(), 1);
+      std::vector<int64_t> end_v = shape;
+      offset_v[0] = i * sub_batch;
+      end_v[0] = (i + 1) * sub_batch;
+      std::vector<NamedAttribute> attrs;
+      attrs.push_back(
+          builder.getNamedAttr("offset", builder.getI64ArrayAttr(offset_v)));
+      attrs.push_back(
+          builder.getNamedAttr("steps", builder.getI64ArrayAttr(step_v)));
+      attrs.push_back(
+          builder.getNamedAttr("ends", builder.getI64ArrayAttr(end_v)));
+      attrs.push_back(
+          builder.getNamedAttr("axis", builder.getI64IntegerAttr(0)));
+      builder.setInsertionPoint(retOp);
+      auto slice = builder.create<tpu::SliceOp>(
+          module::getLocLike(v, suffix), v.getType(),
+          ValueRange{v, none, none, none, none}, attrs);
+      std::vector<int64_t> new_shape = shape;
+      new_shape[0] = sub_batch;
+      module::setShape(slice.getOutput(), new_shape);
+      mapper[v] = slice.getOutput();
+    }
+    auto subf = std::make_shared<SubFunction>(i, 0);
+    for (auto op : ops) {
+      builder.setInsertionPoint(retOp);
+      auto new_op = builder.clone(*op);
+      for (auto [idx, opd] : llvm::enumerate(op->getOperands())) {
+        auto w_op = opd.getDefiningOp<top::WeightOp>();
+        if (w_op && mapper.find(opd) == mapper.end()) {
+          // each device holds its own copy, so that weight reorder of one
+          // device does not touch the others; codegen shares equal coeffs
+          auto new_w = w_op.clone(suffix);
+          new_w.getDefiningOp()->setAttrs(w_op->getAttrs());
+          mapper[opd] = new_w;
+        }
+        auto it = mapper.find(opd);
+        if (it != mapper.end()) {
+          new_op->setOperand(idx, it->second);
+        }
+      }
+      for (auto [r, new_r] :
+           llvm::zip(op->getResults(), new_op->getResults())) {
+        std::vector<int64_t> new_shape = module::getShape(r);
+        new_shape[0] = sub_batch;
+        module::setShape(new_r, new_shape);
+        mapper[r] = new_r;
+      }
+      module::setLocSuffix(new_op, suffix);
+      insert_subop(subf, new_op);
+    }
+    for (auto [idx, v] : llvm::enumerate(retOp.getOperands())) {
+      outputs[idx].push_back(mapper[v]);
+    }
+    subf_list.push_back(subf);
+  }
+  // the runtime concatenates the device outputs on batch, like the outputs
+  // of tensor parallel ended to concat; operands are ordered device by device
+  std::vector<Value> end_inputs;
+  std::vector<Type> end_types;
+  std::vector<Location> end_locs;
+  for (int64_t i = 0; i < num_device; ++i) {
+    for (auto &device_outputs : outputs) {
+      end_inputs.push_back(device_outputs[i]);
+    }
+  }
+  for (auto v : retOp.getOperands()) {
+    end_types.push_back(v.getType());
+    end_locs.push_back(module::getLoc(v));
+  }
+  std::vector<int64_t> end_methods(retOp.getNumOperands(),
+                                   (int64_t)DevEndMethod::EndToConcat);
+  std::vector<NamedAttribute> attrs;
+  attrs.push_back(builder.getNamedAttr(
+      "pattern", tpu::DevPatternAttr::get(m.getContext(),
+                                          tpu::DevPattern::BatchParallel)));
+  attrs.push_back(builder.getNamedAttr(
+      "end_methods", builder.getI64ArrayAttr(llvm::ArrayRef(end_methods))));
+  builder.setInsertionPoint(retOp);
+  auto end = builder.create<tpu::DevEndOp>(
+      FusedLoc::get(m.getContext(), end_locs), end_types, end_inputs, attrs);
+  retOp->setOperands(end.getOutputs());
+  for (auto it = ops.rbegin(); it != ops.rend(); ++it) {
+    (*it)->erase();
+  }
+  for (auto subf : subf_list) {
+    buildSubFunction(subf, m);
   }
+  buildSubModules(m);
+  return success();
 }
 
 } // namespace tpu
@@ -0,0 +1,155 @@
+//===----------------------------------------------------------------------===//
+//
+// Copyright (C) 2022 Sophgo Technologies Inc.  All rights reserved.
+//
+// TPU-MLIR is licensed under the 2-Clause BSD License except for the
+// third-party components.
+//
+//===----------------------------------------------------------------------===//
+
+#include "tpu_mlir/Support/A16MatMulFunc.h"
+#include "tpu_mlir/Support/MathUtils.h"
+#include "omp.h"
+#include <algorithm>
+
+namespace tpu_mlir {
+
+// output columns of one parallel unit, and depth of one dequantized tile
+static constexpr int64_t BLOCK_N = 64;
+static constexpr int64_t BLOCK_K = 256;
+
+A16MatMulFunc::A16MatMulFunc(const a16_matmul_attr_t &attr,
+                             const float *weight, const float *scale,
+                             const float *zp)
+    : attr(attr) {
+  if (attr.bits != 4 && attr.bits != 8) {
+    llvm_unreachable("A16MatMul only supports int4 and int8 weight");
+  }
+  rows = attr.w_transpose ? attr.N : attr.K;
+  cols = attr.w_transpose ? attr.K : attr.N;
+  if (attr.group_size != 0 && cols % attr.group_size != 0) {
+    llvm_unreachable("invalid q_group_size");
+  }
+  const int64_t num = rows * cols;
+  packed.resize(attr.bits == 4 ? num / 2 : num);
+  for (size_t i = 0; i < packed.size(); ++i) {
+    packed[i] = (uint8_t)(int32_t)weight[i];
+  }
+  // int8 is quantized symmetrically
+  const int64_t num_param = attr.group_size ? num / attr.group_size : rows;
+  this->scale.assign(scale, scale + num_param);
+  if (zp != nullptr && attr.bits == 4) {
+    this->zp.assign(zp, zp + num_param);
+  } else {
+    this->zp.assign(num_param, 0.0f);
+  }
+  threads = omp_get_max_threads();
+  ws_size = BLOCK_K * BLOCK_N;
+}
+
+float *A16MatMulFunc::get_workspace(float *scratch) {
+  if (scratch != nullptr) {
+    return scratch;
+  }
+  workspace.resize(workspace_size());
+  return workspace.data();
+}
+
+// w[i * stride] = dequantized weight of stored row r and column c0 + i. The
+// scale and zero point only change at group boundaries, and int4 values are
+// unpacked a byte at a time.
+void A16MatMulFunc::dequant_row(int64_t r, int64_t c0, int64_t cb, float *w,
+                                int64_t stride) const {
+  const int64_t base = r * cols;
+  for (int64_t c = c0; c < c0 + cb;) {
+    int64_t pi = r, seg_end = c0 + cb;
+    if (attr.group_size) {
+      pi = (base + c) / attr.group_size;
+      seg_end = std::min(seg_end, (pi + 1) * attr.group_size - base);
+    }
+    const float s = scale[pi], z = zp[pi];
+    float *dst = w + (c - c0) * stride;
+    int64_t idx = base + c;
+    const int64_t end = base + seg_end;
+    if (attr.bits == 4) {
+      if (idx & 1) {
+        *dst = ((packed[idx / 2] >> 4) - z) * s;
+        dst += stride;
+        ++idx;
+      }
+      for (; idx + 1 < end; idx += 2, dst += 2 * stride) {
+        const uint8_t byte = packed[idx / 2];
+        dst[0] = ((byte & 0x0F) - z) * s;
+        dst[stride] = ((byte >> 4) - z) * s;
+      }
+      if (idx < end) {
+        *dst = ((packed[idx / 2] & 0x0F) - z) * s;
+      }
+    } else if (attr.sign) {
+      for (; idx < end; ++idx, dst += stride) {
+        *dst = ((int8_t)packed[idx] - z) * s;
+      }
+    } else {
+      for (; idx < end; ++idx, dst += stride) {
+        *dst = (packed[idx] - z) * s;
+      }
+    }
+    c = seg_end;
+  }
+}
+
+// w[kk][nn] = dequantized weight of k0 + kk and n0 + nn, rows of BLOCK_N
+void A16MatMulFunc::dequant_tile(int64_t k0, int64_t kb, int64_t n0,
+                                 int64_t nb, float *w) {
+  if (attr.w_transpose) {
+    // a stored row is a column of the tile
+    for (int64_t nn = 0; nn < nb; ++nn) {
+      dequant_row(n0 + nn, k0, kb, w + nn, BLOCK_N);
+    }
+  } else {
+    for (int64_t kk = 0; kk < kb; ++kk) {
+      dequant_row(k0 + kk, n0, nb, w + kk * BLOCK_N, 1);
+    }
+  }
+}
+
+void A16MatMulFunc::run(const float *input, const float *bias, float *output,
+                        float *scratch) {
+  float *wsp = get_workspace(scratch);
+  const int64_t M = attr.M, K = attr.K, N = attr.N;
+  const int64_t n_blocks = (N + BLOCK_N - 1) / BLOCK_N;
+  // a unit owns its columns of the output, so the tiles are dequantized once
+  // per call whatever M is
+#pragma omp parallel for num_threads(threads) schedule(static, omp_schedule(n_blocks))
+  for (int64_t u = 0; u < n_blocks; ++u) {
+    float *w = wsp + omp_get_thread_num() * ws_size;
+    const int64_t n0 = u * BLOCK_N;
+    const int64_t nb = std::min(BLOCK_N, N - n0);
+    for (int64_t m = 0; m < M; ++m) {
+      float *y = output + m * N + n0;
+      if (bias) {
+        std::copy(bias + n0, bias + n0 + nb, y);
+      } else {
+        std::fill(y, y + nb, 0.0f);
+      }
+    }
+    for (int64_t k0 = 0; k0 < K; k0 += BLOCK_K) {
+      const int64_t kb = std::min(BLOCK_K, K - k0);
+      dequant_tile(k0, kb, n0, nb, w);
+      for (int64_t m = 0; m < M; ++m) {
+        const float *x = input + m * K + k0;
+        float *y = output + m * N + n0;
+        for (int64_t kk = 0; kk < kb; ++kk) {
+          const float a = x[kk];
+          const float *w_row = w + kk * BLOCK_N;
+#pragma omp simd
+          for (int64_t nn = 0; nn < nb; ++nn) {
+            y[nn] += a * w_row[nn];
+          }
+        }
+      }
+    }
+  }
+}
+
+} // namespace tpu_mlir
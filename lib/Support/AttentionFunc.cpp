@@ -0,0 +1,247 @@
+//===----------------------------------------------------------------------===//
+//
+// Copyright (C) 2022 Sophgo Technologies Inc.  All rights reserved.
+//
+// TPU-MLIR is licensed under the 2-Clause BSD License except for the
+// third-party components.
+//
+//===----------------------------------------------------------------------===//
+
+#include "tpu_mlir/Support/AttentionFunc.h"
+#include "tpu_mlir/Support/Float16.h"
+#include "tpu_mlir/Support/MathUtils.h"
+#include "omp.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace tpu_mlir {
+
+// queries of one tile, and keys of one block of scores
+static constexpr int64_t BLOCK_Q = 16;
+static constexpr int64_t BLOCK_K = 64;
+static const float NEG_INF = -std::numeric_limits<float>::infinity();
+
+AttentionFunc::AttentionFunc(const attention_attr_t &attr) : attr(attr) {
+  if (attr.kv_heads <= 0 || attr.q_heads % attr.kv_heads != 0) {
+    llvm_unreachable("q heads should be a multiple of kv heads");
+  }
+  if (this->attr.kv_batch_stride == 0) {
+    this->attr.kv_batch_stride = attr.M_k * attr.kv_heads * attr.d;
+  }
+  threads = omp_get_max_threads();
+  ws_size = BLOCK_Q * BLOCK_K + BLOCK_Q * attr.d + 2 * BLOCK_Q;
+  workspace.resize(ws_size * threads);
+}
+
+int64_t AttentionFunc::key_limit(int64_t i) const {
+  if (!attr.causal) {
+    return attr.M_k;
+  }
+  return std::max<int64_t>(0, std::min(attr.M_k, attr.M_k - attr.M_q + i + 1));
+}
+
+// s[r][c] for query q0 + r and key k0 + c, -inf for keys out of sight. In int8
+// mode the score is requantized and masked as the lowering.
+void AttentionFunc::scores(int64_t b, int64_t h, int64_t q0, int64_t rows,
+                           int64_t k0, int64_t cols, const float *mask,
+                           float *s) {
+  const int64_t d = attr.d;
+  const int64_t kvh = h / (attr.q_heads / attr.kv_heads);
+  const float *mask_b =
+      mask == nullptr ? nullptr : mask + b * attr.mask_batch_stride;
+  for (int64_t r = 0; r < rows; ++r) {
+    const int64_t i = q0 + r;
+    const int64_t lim = key_limit(i);
+    const float *q_row = p_q + ((b * attr.M_q + i) * attr.q_heads + h) * d;
+    float *s_row = s + r * BLOCK_K;
+    for (int64_t c = 0; c < cols; ++c) {
+      const int64_t j = k0 + c;
+      if (j >= lim) {
+        s_row[c] = NEG_INF;
+        continue;
+      }
+      const float *k_row =
+          p_k + b * attr.kv_batch_stride + (j * attr.kv_heads + kvh) * d;
+      float dot = 0;
+#pragma omp simd reduction(+ : dot)
+      for (int64_t e = 0; e < d; ++e) {
+        dot += q_row[e] * k_row[e];
+      }
+      if (attr.mode == ATTN_INT8) {
+        int64_t v = RightShiftRound((int64_t)dot * attr.s_mul, attr.s_shift,
+                                    ROUNDING_HALF_AWAY_FROM_ZERO);
+        float x = to_int8(v + attr.s_zp);
+        if (mask_b) {
+          x = to_int8(x - (float)(mask_b[j] != 0) * 255.f);
+        }
+        s_row[c] = x;
+      } else {
+        s_row[c] = dot * attr.scale + (mask_b ? mask_b[j] : 0.f);
+      }
+    }
+  }
+}
+
+void AttentionFunc::run_online(int64_t b, int64_t h, int64_t q0, int64_t rows,
+                               const float *mask, float *ws) {
+  const int64_t d = attr.d;
+  const int64_t kvh = h / (attr.q_heads / attr.kv_heads);
+  float *s = ws;
+  float *acc = s + BLOCK_Q * BLOCK_K;
+  float *m = acc + BLOCK_Q * d;
+  float *l = m + BLOCK_Q;
+  std::fill(acc, acc + rows * d, 0.0f);
+  std::fill(m, m + rows, NEG_INF);
+  std::fill(l, l + rows, 0.0f);
+  const int64_t lim = key_limit(q0 + rows - 1);
+  for (int64_t k0 = 0; k0 < lim; k0 += BLOCK_K) {
+    const int64_t cols = std::min(BLOCK_K, lim - k0);
+    scores(b, h, q0, rows, k0, cols, mask, s);
+    for (int64_t r = 0; r < rows; ++r) {
+      float *s_row = s + r * BLOCK_K;
+      float *acc_r = acc + r * d;
+      float bm = NEG_INF;
+      for (int64_t c = 0; c < cols; ++c) {
+        bm = std::max(bm, s_row[c]);
+      }
+      if (bm == NEG_INF) {
+        continue;
+      }
+      const float m_new = std::max(m[r], bm);
+      const float corr = std::exp(m[r] - m_new);
+      l[r] *= corr;
+#pragma omp simd
+      for (int64_t e = 0; e < d; ++e) {
+        acc_r[e] *= corr;
+      }
+      for (int64_t c = 0; c < cols; ++c) {
+        const float p = std::exp(s_row[c] - m_new);
+        if (p == 0) {
+          continue;
+        }
+        l[r] += p;
+        const float *v_row = p_v + b * attr.kv_batch_stride +
+                             ((k0 + c) * attr.kv_heads + kvh) * d;
+#pragma omp simd
+        for (int64_t e = 0; e < d; ++e) {
+          acc_r[e] += p * v_row[e];
+        }
+      }
+      m[r] = m_new;
+    }
+  }
+  for (int64_t r = 0; r < rows; ++r) {
+    float *o_row = p_o + ((b * attr.M_q + q0 + r) * attr.q_heads + h) * d;
+    const float f = l[r] == 0 ? 0 : 1.0f / l[r];
+#pragma omp simd
+    for (int64_t e = 0; e < d; ++e) {
+      o_row[e] = acc[r * d + e] * f;
+    }
+  }
+}
+
+void AttentionFunc::run_two_pass(int64_t b, int64_t h, int64_t q0,
+                                 int64_t rows, const float *mask,
+                                 const float *table, float *ws) {
+  const int64_t d = attr.d;
+  const int64_t kvh = h / (attr.q_heads / attr.kv_heads);
+  const bool is_int8 = attr.mode == ATTN_INT8;
+  float *s = ws;
+  float *acc = s + BLOCK_Q * BLOCK_K;
+  float *m = acc + BLOCK_Q * d;
+  float *l = m + BLOCK_Q;
+  std::fill(m, m + rows, NEG_INF);
+  std::fill(l, l + rows, 0.0f);
+  const int64_t lim = key_limit(q0 + rows - 1);
+  // max and sum of each row, the int8 table already takes 127 as the max
+  for (int64_t k0 = 0; k0 < lim; k0 += BLOCK_K) {
+    const int64_t cols = std::min(BLOCK_K, lim - k0);
+    scores(b, h, q0, rows, k0, cols, mask, s);
+    for (int64_t r = 0; r < rows; ++r) {
+      float *s_row = s + r * BLOCK_K;
+      for (int64_t c = 0; c < cols; ++c) {
+        if (s_row[c] == NEG_INF) {
+          continue;
+        }
+        if (is_int8) {
+          l[r] += table[to_uint8(127 - s_row[c])];
+        } else if (s_row[c] > m[r]) {
+          l[r] = l[r] * std::exp(m[r] - s_row[c]) + 1;
+          m[r] = s_row[c];
+        } else {
+          l[r] += std::exp(s_row[c] - m[r]);
+        }
+      }
+    }
+  }
+  // normalized probabilities, rounded before they meet v
+  std::fill(acc, acc + rows * d, 0.0f);
+  for (int64_t k0 = 0; k0 < lim; k0 += BLOCK_K) {
+    const int64_t cols = std::min(BLOCK_K, lim - k0);
+    scores(b, h, q0, rows, k0, cols, mask, s);
+    for (int64_t r = 0; r < rows; ++r) {
+      float *s_row = s + r * BLOCK_K;
+      float *acc_r = acc + r * d;
+      for (int64_t c = 0; c < cols; ++c) {
+        if (s_row[c] == NEG_INF) {
+          continue;
+        }
+        float p;
+        if (is_int8) {
+          float prob = table[to_uint8(127 - s_row[c])] / (l[r] * attr.scale);
+          int prob_rnd = static_cast<int32_t>(std::round(prob));
+          p = to_uint8(prob_rnd + attr.p_zp);
+        } else {
+          p = std::exp(s_row[c] - m[r]) / l[r];
+          p = attr.mode == ATTN_F16 ? F16(p) : BF16(p);
+        }
+        const float *v_row = p_v + b * attr.kv_batch_stride +
+                             ((k0 + c) * attr.kv_heads + kvh) * d;
+#pragma omp simd
+        for (int64_t e = 0; e < d; ++e) {
+          acc_r[e] += p * v_row[e];
+        }
+      }
+    }
+  }
+  for (int64_t r = 0; r < rows; ++r) {
+    float *o_row = p_o + ((b * attr.M_q + q0 + r) * attr.q_heads + h) * d;
+    for (int64_t e = 0; e < d; ++e) {
+      const float a = acc[r * d + e];
+      if (is_int8) {
+        int64_t v = RightShiftRound((int64_t)a * attr.o_mul, attr.o_shift,
+                                    ROUNDING_HALF_AWAY_FROM_ZERO);
+        o_row[e] = to_int8(v + attr.o_zp);
+      } else {
+        o_row[e] = attr.mode == ATTN_F16 ? F16(a) : BF16(a);
+      }
+    }
+  }
+}
+
+void AttentionFunc::run(const float *q, const float *k, const float *v,
+                        const float *mask, const float *table, float *o) {
+  p_q = q;
+  p_k = k;
+  p_v = v;
+  p_o = o;
+  const int64_t q_blocks = (attr.M_q + BLOCK_Q - 1) / BLOCK_Q;
+  const int64_t units = attr.batch * attr.q_heads * q_blocks;
+  // causal tiles differ in cost
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1)
+  for (int64_t u = 0; u < units; ++u) {
+    float *ws = workspace.data() + omp_get_thread_num() * ws_size;
+    const int64_t q0 = (u % q_blocks) * BLOCK_Q;
+    const int64_t h = u / q_blocks % attr.q_heads;
+    const int64_t b = u / q_blocks / attr.q_heads;
+    const int64_t rows = std::min(BLOCK_Q, attr.M_q - q0);
+    if (attr.mode == ATTN_F32) {
+      run_online(b, h, q0, rows, mask, ws);
+    } else {
+      run_two_pass(b, h, q0, rows, mask, table, ws);
+    }
+  }
+}
+
+} // namespace tpu_mlir
@@ -18,22 +18,43 @@ Conv::Conv() {
   eng_stream = dnnl::stream(eng);
   memset(&_attr, 0, sizeof(conv_attr_t));
   backw_init = false;
+  padded_size = 0;
 }
 
 Conv::~Conv() {}
 
+// dilated and padded input, 0 if dnnl reads the input in place
+int64_t Conv::workspace_size(const conv_attr_t &attr) {
+  int64_t id = attr.id, ih = attr.ih, iw = attr.iw;
+  bool need_dilate = false;
+  if (attr.ins_h || attr.ins_w) {
+    ih = (attr.ih - 1) * (attr.ins_h + 1) + 1;
+    iw = (attr.iw - 1) * (attr.ins_w + 1) + 1;
+    need_dilate = true;
+  }
+  if (attr.pad_value != 0 && (attr.pdf > 0 || attr.pdb > 0 || attr.pht > 0 ||
+                              attr.phb > 0 || attr.pwl > 0 || attr.pwr > 0)) {
+    id += attr.pdf + attr.pdb;
+    ih += attr.pht + attr.phb;
+    iw += attr.pwl + attr.pwr;
+    need_dilate = true;
+  }
+  return need_dilate ? attr.n * attr.ic * id * ih * iw : 0;
+}
+
 void Conv::activation_init(float *input, conv_attr_t &attr) {
   origin_input = input;
   memcpy(&_attr, &attr, sizeof(conv_attr_t));
-  src_shape = {attr.n, attr.ic, attr.id, attr.ih, attr.iw};
   assert(!attr.ins_d);
-  bool need_dilate = false;
+  padded_size = workspace_size(attr);
+  src_shape = {attr.n, attr.ic, attr.id, attr.ih, attr.iw};
+  p_input = input;
+  if (padded_size == 0) {
+    return;
+  }
   if (attr.ins_h || attr.ins_w) {
-    int64_t ih_after = (attr.ih - 1) * (attr.ins_h + 1) + 1;
-    int64_t iw_after = (attr.iw - 1) * (attr.ins_w + 1) + 1;
-    src_shape[3] = ih_after;
-    src_shape[4] = iw_after;
-    need_dilate = true;
+    src_shape[3] = (attr.ih - 1) * (attr.ins_h + 1) + 1;
+    src_shape[4] = (attr.iw - 1) * (attr.ins_w + 1) + 1;
     attr.ins_h = 0;
     attr.ins_w = 0;
   }
@@ -42,19 +63,10 @@ void Conv::activation_init(float *input, conv_attr_t &attr) {
     src_shape[2] += attr.pdf + attr.pdb;
     src_shape[3] += attr.pht + attr.phb;
     src_shape[4] += attr.pwl + attr.pwr;
-
-    need_dilate = true;
     attr.pdf = attr.pdb = attr.pht = attr.phb = attr.pwl = attr.pwr = 0;
   }
-  if (need_dilate) {
-    int input_padded_size = src_shape[0] * src_shape[1] * src_shape[2] *
-                            src_shape[3] * src_shape[4];
-    input_after_pad = std::make_shared<std::vector<float>>(input_padded_size);
-    p_input = input_after_pad->data();
-  } else {
-    src_shape = {attr.n, attr.ic, attr.id, attr.ih, attr.iw};
-    p_input = input;
-  }
+  // bound by run
+  p_input = nullptr;
 }
 
 void Conv::filter_init(float *weight, conv_attr_t &attr) {
@@ -231,17 +243,25 @@ void Conv::backward_weights_setup() {
   return;
 }
 
-void Conv::run() {
-  if (input_after_pad) {
+void Conv::run(float *workspace) {
+  if (padded_size > 0) {
+    if (workspace == nullptr) {
+      if (!input_after_pad || (int64_t)input_after_pad->size() < padded_size) {
+        input_after_pad = std::make_shared<std::vector<float>>(padded_size);
+      }
+      workspace = input_after_pad->data();
+    }
+    p_input = workspace;
+    src_mem.set_data_handle(p_input);
     if (_attr.pad_value) {
-      dilate_tensor(input_after_pad->data(), origin_input, _attr.n, _attr.ic,
-                    _attr.id, _attr.ih, _attr.iw, _attr.pdf, _attr.pdb,
-                    _attr.pht, _attr.phb, _attr.pwl, _attr.pwr, _attr.pad_value,
+      dilate_tensor(p_input, origin_input, _attr.n, _attr.ic, _attr.id,
+                    _attr.ih, _attr.iw, _attr.pdf, _attr.pdb, _attr.pht,
+                    _attr.phb, _attr.pwl, _attr.pwr, _attr.pad_value,
                     _attr.ins_h, _attr.ins_w, 0);
     } else {
-      dilate_tensor(input_after_pad->data(), origin_input, _attr.n, _attr.ic,
-                    _attr.id, _attr.ih, _attr.iw, 0, 0, 0, 0, 0, 0, 0,
-                    _attr.ins_h, _attr.ins_w, 0);
+      dilate_tensor(p_input, origin_input, _attr.n, _attr.ic, _attr.id,
+                    _attr.ih, _attr.iw, 0, 0, 0, 0, 0, 0, 0, _attr.ins_h,
+                    _attr.ins_w, 0);
     }
   }
 
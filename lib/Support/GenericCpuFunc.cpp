@@ -11,7 +11,6 @@
 #include "tpu_mlir/Backend/BM168x/BM168x.h"
 
 #include "tpu_mlir/Support/DeformConv2D.h"
-#include <queue>
 
 using namespace tpu_mlir::backend;
 namespace tpu_mlir {
@@ -340,7 +339,7 @@ static inline float _sigmoid(float x, bool fast) {
 static inline float _softmax(float *probs, float *data, int input_stride,
                              int num_of_class, int *max_cls, bool fast) {
   // assert(num_of_class == 80);
-  float x[num_of_class];
+  llvm::SmallVector<float, 128> x(num_of_class);
   float max_x = -INFINITY;
   float min_x = INFINITY;
   for (int i = 0; i < num_of_class; i++) {
@@ -353,7 +352,7 @@ static inline float _softmax(float *probs, float *data, int input_stride,
     }
   }
 #define t (-100.0f)
-  float exp_x[num_of_class];
+  llvm::SmallVector<float, 128> exp_x(num_of_class);
   float sum = 0;
   for (int i = 0; i < num_of_class; i++) {
     x[i] = x[i] - max_x;
@@ -416,10 +415,10 @@ static void process_feature(detection *det, int *det_idx, float *feature,
         continue;
       }
       hit++;
-      float box_class_probs[num_of_class];
+      llvm::SmallVector<float, 128> box_class_probs(num_of_class);
       int box_max_cls = -1;
       float box_max_prob =
-          _softmax(box_class_probs,
+          _softmax(box_class_probs.data(),
                    &feature[GET_INDEX(i, j, CLS_INDEX, num_cell, num_of_class)],
                    num_cell, num_of_class, &box_max_cls, false);
       float box_max_score = box_confidence * box_max_prob;
@@ -527,29 +526,49 @@ static float box_iou(box a, box b) {
   return box_intersection(a, b) / box_union(a, b);
 }
 
-static void nms(detection *det, int num, float nms_threshold) {
+// Indices of dets grouped by class, each group in the original order. NMS
+// only compares dets of the same class, so the groups are independent and
+// give the same result as one pass over all dets.
+template <typename ClsFunc>
+static std::vector<std::vector<int>> group_by_class(int num, ClsFunc cls_of) {
+  std::map<int, std::vector<int>> groups;
   for (int i = 0; i < num; i++) {
-    if (det[i].score == 0) {
-      // erased already
-      continue;
-    }
-    for (int j = i + 1; j < num; j++) {
-      if (det[j].score == 0) {
+    groups[cls_of(i)].push_back(i);
+  }
+  std::vector<std::vector<int>> result;
+  result.reserve(groups.size());
+  for (auto &g : groups) {
+    result.push_back(std::move(g.second));
+  }
+  return result;
+}
+
+static void nms(detection *det, int num, float nms_threshold) {
+  auto groups = group_by_class(num, [&](int i) { return det[i].cls; });
+#pragma omp parallel for schedule(dynamic)
+  for (int g = 0; g < (int)groups.size(); g++) {
+    auto &index = groups[g];
+    for (size_t a = 0; a < index.size(); a++) {
+      auto &det_i = det[index[a]];
+      if (det_i.score == 0) {
         // erased already
         continue;
       }
-      if (det[i].cls != det[j].cls) {
-        // not the same class
-        continue;
-      }
-      float iou = box_iou(det[i].bbox, det[j].bbox);
-      assert(iou <= 1.0f);
-      if (iou > nms_threshold) {
-        // overlapped, select one to erase
-        if (det[i].score < det[j].score) {
-          det[i].score = 0;
-        } else {
-          det[j].score = 0;
+      for (size_t b = a + 1; b < index.size(); b++) {
+        auto &det_j = det[index[b]];
+        if (det_j.score == 0) {
+          // erased already
+          continue;
+        }
+        float iou = box_iou(det_i.bbox, det_j.bbox);
+        assert(iou <= 1.0f);
+        if (iou > nms_threshold) {
+          // overlapped, select one to erase
+          if (det_i.score < det_j.score) {
+            det_i.score = 0;
+          } else {
+            det_j.score = 0;
+          }
         }
       }
     }
@@ -661,6 +680,13 @@ void DetectionOutputFunc::invoke() {
         all_conf_scores[i];
     std::map<int, std::vector<std::pair<float, int>>> indices;
     int num_det = 0;
+    // NMS of each class is independent, collect them and run in parallel
+    struct NmsTask {
+      const std::vector<BBox_l> *bboxes;
+      const std::vector<std::pair<float, int>> *scores;
+      std::vector<std::pair<float, int>> *indices;
+    };
+    std::vector<NmsTask> tasks;
     for (int c = 0; c < param_.num_classes; ++c) {
       if (c == param_.background_label_id) {
         // Ignore background class.
@@ -679,10 +705,16 @@ void DetectionOutputFunc::invoke() {
       const std::vector<BBox_l> &bboxes = decode_bboxes.find(label)->second;
       const std::vector<std::pair<float, int>> &aa =
           conf_scores.find(c)->second;
-      ApplyNMSFast_opt(bboxes, aa, param_.confidence_threshold,
-                       param_.nms_threshold, eta, param_.top_k, &(indices[c]));
-
-      num_det += indices[c].size();
+      tasks.push_back({&bboxes, &aa, &(indices[c])});
+    }
+#pragma omp parallel for schedule(dynamic)
+    for (int t = 0; t < (int)tasks.size(); ++t) {
+      ApplyNMSFast_opt(*tasks[t].bboxes, *tasks[t].scores,
+                       param_.confidence_threshold, param_.nms_threshold, eta,
+                       param_.top_k, tasks[t].indices);
+    }
+    for (auto &task : tasks) {
+      num_det += task.indices->size();
     }
 
     if (param_.keep_top_k > -1 && num_det > param_.keep_top_k) {
@@ -947,10 +979,21 @@ anchor_box_transform_inv(float img_width, float img_height,
 static void anchor_box_nms(std::vector<std::vector<float>> &pred_boxes,
                            std::vector<float> &confidence,
                            float nms_threshold) {
-  for (size_t i = 0; i < pred_boxes.size() - 1; i++) {
+  // mark the erased boxes and compact once at the end, erasing them one by
+  // one from the vectors costs O(n) each time. Boxes are visited in the same
+  // order as erasing them in place.
+  size_t num = pred_boxes.size();
+  std::vector<char> erased(num, 0);
+  for (size_t i = 0; i < num; i++) {
+    if (erased[i]) {
+      continue;
+    }
     float s1 = (pred_boxes[i][2] - pred_boxes[i][0] + 1) *
                (pred_boxes[i][3] - pred_boxes[i][1] + 1);
-    for (size_t j = i + 1; j < pred_boxes.size(); j++) {
+    for (size_t j = i + 1; j < num; j++) {
+      if (erased[j]) {
+        continue;
+      }
       float s2 = (pred_boxes[j][2] - pred_boxes[j][0] + 1) *
                  (pred_boxes[j][3] - pred_boxes[j][1] + 1);
 
@@ -965,19 +1008,28 @@ static void anchor_box_nms(std::vector<std::vector<float>> &pred_boxes,
         float IOU = width * height / (s1 + s2 - width * height);
         if (IOU > nms_threshold) {
           if (confidence[i] >= confidence[j]) {
-            pred_boxes.erase(pred_boxes.begin() + j);
-            confidence.erase(confidence.begin() + j);
-            j--;
+            erased[j] = 1;
           } else {
-            pred_boxes.erase(pred_boxes.begin() + i);
-            confidence.erase(confidence.begin() + i);
-            i--;
+            erased[i] = 1;
             break;
           }
         }
       }
     }
   }
+  size_t kept = 0;
+  for (size_t i = 0; i < num; i++) {
+    if (erased[i]) {
+      continue;
+    }
+    if (kept != i) {
+      pred_boxes[kept] = std::move(pred_boxes[i]);
+      confidence[kept] = confidence[i];
+    }
+    kept++;
+  }
+  pred_boxes.resize(kept);
+  confidence.resize(kept);
 }
 
 ProposalFunc::ProposalFunc(ProposalParam &param) : param_(param) {
@@ -1342,43 +1394,46 @@ static void bbox_transform_inv(const float *boxes, const float *deltas,
 }
 
 static void nms(detections *dets, int num, float nms_threshold) {
-  for (int i = 0; i < num; i++) {
-    if (dets[i].score == 0) {
-      // erased already
-      continue;
-    }
-
-    float s1 = (dets[i].bbox.x2 - dets[i].bbox.x1 + 1) *
-               (dets[i].bbox.y2 - dets[i].bbox.y1 + 1);
-    for (int j = i + 1; j < num; j++) {
-      if (dets[j].score == 0) {
+  auto groups = group_by_class(num, [&](int i) { return dets[i].cls; });
+#pragma omp parallel for schedule(dynamic)
+  for (int g = 0; g < (int)groups.size(); g++) {
+    auto &index = groups[g];
+    for (size_t a = 0; a < index.size(); a++) {
+      auto &det_i = dets[index[a]];
+      if (det_i.score == 0) {
         // erased already
         continue;
       }
-      if (dets[i].cls != dets[j].cls) {
-        // not the same class
-        continue;
-      }
-
-      float s2 = (dets[j].bbox.x2 - dets[j].bbox.x1 + 1) *
-                 (dets[j].bbox.y2 - dets[j].bbox.y1 + 1);
 
-      float x1 = std::max(dets[i].bbox.x1, dets[j].bbox.x1);
-      float y1 = std::max(dets[i].bbox.y1, dets[j].bbox.y1);
-      float x2 = std::min(dets[i].bbox.x2, dets[j].bbox.x2);
-      float y2 = std::min(dets[i].bbox.y2, dets[j].bbox.y2);
+      float s1 = (det_i.bbox.x2 - det_i.bbox.x1 + 1) *
+                 (det_i.bbox.y2 - det_i.bbox.y1 + 1);
+      for (size_t b = a + 1; b < index.size(); b++) {
+        auto &det_j = dets[index[b]];
+        if (det_j.score == 0) {
+          // erased already
+          continue;
+        }
 
-      float width = x2 - x1;
-      float height = y2 - y1;
-      if (width > 0 && height > 0) {
-        float iou = width * height / (s1 + s2 - width * height);
-        assert(iou <= 1.0f);
-        if (iou > nms_threshold) {
-          // overlapped, select one to erase
-          if (dets[i].score < dets[j].score) {
-            dets[i].score = 0;
-          } else {
-            dets[j].score = 0;
+        float s2 = (det_j.bbox.x2 - det_j.bbox.x1 + 1) *
+                   (det_j.bbox.y2 - det_j.bbox.y1 + 1);
+
+        float x1 = std::max(det_i.bbox.x1, det_j.bbox.x1);
+        float y1 = std::max(det_i.bbox.y1, det_j.bbox.y1);
+        float x2 = std::min(det_i.bbox.x2, det_j.bbox.x2);
+        float y2 = std::min(det_i.bbox.y2, det_j.bbox.y2);
+
+        float width = x2 - x1;
+        float height = y2 - y1;
+        if (width > 0 && height > 0) {
+          float iou = width * height / (s1 + s2 - width * height);
+          assert(iou <= 1.0f);
+          if (iou > nms_threshold) {
+            // overlapped, select one to erase
+            if (det_i.score < det_j.score) {
+              det_i.score = 0;
+            } else {
+              det_j.score = 0;
+            }
           }
         }
       }
@@ -1614,44 +1669,59 @@ template <typename Dtype>
 void ApplyNms_opt(std::vector<PredictionResult> &boxes, std::vector<int> &idxes,
                   Dtype threshold, int agnostic_nms = 0) {
   int bbox_cnt = (int)boxes.size();
-  // init the map
-  uint32_t map[bbox_cnt / 32 + 1];
-  memset(map, 0xFF, sizeof(map));
-
-  for (int i = 0; i < bbox_cnt - 1; ++i) {
-    // skip the dropped bbox
-    if (!(map[i / 32] & (1 << (i % 32))))
-      continue;
-
-    for (int j = i + 1; j < bbox_cnt; ++j) {
+  // Only boxes of the same class get a real IoU, the others (and all of
+  // them with agnostic_nms) count as 0. With a positive threshold a 0 IoU
+  // never drops a box, so the classes are independent and run on their own.
+  std::vector<std::vector<int>> groups;
+  if (!(threshold > 0)) {
+    groups = group_by_class(bbox_cnt, [](int i) { return 0; });
+  } else if (agnostic_nms == 0) {
+    groups = group_by_class(bbox_cnt,
+                            [&](int i) { return boxes[i].classType; });
+  }
+  std::vector<char> keep(bbox_cnt, 1);
+#pragma omp parallel for schedule(dynamic)
+  for (int g = 0; g < (int)groups.size(); ++g) {
+    auto &index = groups[g];
+    int num = (int)index.size();
+    for (int a = 0; a < num - 1; ++a) {
+      int i = index[a];
       // skip the dropped bbox
-      if (!(map[j / 32] & (1 << (j % 32))))
+      if (!keep[i])
         continue;
 
-      box Bbox1, Bbox2;
+      box Bbox1;
       Bbox1.x = boxes[i].x;
       Bbox1.y = boxes[i].y;
       Bbox1.w = boxes[i].w;
       Bbox1.h = boxes[i].h;
-      Bbox2.x = boxes[j].x;
-      Bbox2.y = boxes[j].y;
-      Bbox2.w = boxes[j].w;
-      Bbox2.h = boxes[j].h;
-
-      Dtype iou;
-      if (agnostic_nms == 0 && boxes[i].classType == boxes[j].classType) {
-        iou = box_iou(Bbox1, Bbox2);
-      } else {
-        iou = (Dtype)0;
-      }
-      if (iou >= threshold) {
-        map[j / 32] &= ~(1 << (j % 32));
+      for (int b = a + 1; b < num; ++b) {
+        int j = index[b];
+        // skip the dropped bbox
+        if (!keep[j])
+          continue;
+
+        box Bbox2;
+        Bbox2.x = boxes[j].x;
+        Bbox2.y = boxes[j].y;
+        Bbox2.w = boxes[j].w;
+        Bbox2.h = boxes[j].h;
+
+        Dtype iou;
+        if (agnostic_nms == 0 && boxes[i].classType == boxes[j].classType) {
+          iou = box_iou(Bbox1, Bbox2);
+        } else {
+          iou = (Dtype)0;
+        }
+        if (iou >= threshold) {
+          keep[j] = 0;
+        }
       }
     }
   }
 
   for (int i = 0; i < bbox_cnt; ++i) {
-    if (map[i / 32] & (1 << (i % 32))) {
+    if (keep[i]) {
       idxes.push_back(i);
     }
   }
@@ -2064,61 +2134,104 @@ int NmsFunc::invoke() {
   struct Candidate {
     int box_index;
     float score;
-    int begin_index;
   };
-  //align with tpu algorithm
-  auto cmp = [](const Candidate i, const Candidate j) {
+  // align with tpu algorithm: higher score first, lower box index on a tie
+  auto cmp = [](const Candidate &i, const Candidate &j) {
     if (i.score != j.score)
-      return i.score < j.score;
-    else {
-      return i.box_index > j.box_index;
+      return i.score > j.score;
+    return i.box_index < j.box_index;
+  };
+  // boxes in SoA layout, corners and area computed as in NmsFunc::iou
+  struct Boxes {
+    std::vector<float> ymin, xmin, ymax, xmax, area;
+    void resize(size_t n) {
+      ymin.resize(n);
+      xmin.resize(n);
+      ymax.resize(n);
+      xmax.resize(n);
+      area.resize(n);
     }
   };
-
-  int num_selected_indices = 0;
+  std::vector<Boxes> batch_boxes(batch_num);
   for (int n = 0; n < batch_num; ++n) {
-    for (int c = 0; c < num_class; ++c) {
-      const int score_offset = (n * num_class + c) * num_boxes;
-      const int box_offset = (n * num_boxes * 4);
-      std::priority_queue<Candidate, std::deque<Candidate>, decltype(cmp)>
-          candicate_prior_queue(cmp);
-      for (int i = 0; i < num_boxes; ++i) {
-        if (score[score_offset + i] > score_threshold) {
-          candicate_prior_queue.emplace(
-              Candidate({i, score[score_offset + i], 0}));
-        }
+    auto &b = batch_boxes[n];
+    b.resize(num_boxes);
+    const float *box_n = box + n * num_boxes * 4;
+    for (int i = 0; i < num_boxes; ++i) {
+      const float *box_i = box_n + i * 4;
+      b.ymax[i] = (box_i[0] > box_i[2]) ? box_i[0] : box_i[2];
+      b.ymin[i] = (box_i[0] < box_i[2]) ? box_i[0] : box_i[2];
+      b.xmax[i] = (box_i[1] > box_i[3]) ? box_i[1] : box_i[3];
+      b.xmin[i] = (box_i[1] < box_i[3]) ? box_i[1] : box_i[3];
+      b.area[i] = (b.ymax[i] - b.ymin[i]) * (b.xmax[i] - b.xmin[i]);
+    }
+  }
+
+  std::vector<std::vector<int>> selected(batch_num * num_class);
+#pragma omp parallel for schedule(dynamic)
+  for (int nc = 0; nc < batch_num * num_class; ++nc) {
+    const int n = nc / num_class;
+    const float *score_nc = score + nc * num_boxes;
+    auto &b = batch_boxes[n];
+    std::vector<Candidate> candidates;
+    for (int i = 0; i < num_boxes; ++i) {
+      if (score_nc[i] > score_threshold) {
+        candidates.push_back({i, score_nc[i]});
+      }
+    }
+    std::sort(candidates.begin(), candidates.end(), cmp);
+
+    std::vector<int> &selected_index = selected[nc];
+    // the kept boxes, packed so the IoU loop below vectorizes
+    Boxes kept;
+    size_t num_kept = 0;
+    kept.resize(candidates.size());
+    for (auto &cand : candidates) {
+      if (selected_index.size() >= (size_t)max_output_size) {
+        break;
       }
-
-      std::vector<int> selected_index;
-      Candidate next_cand;
-      float iou;
-      while (selected_index.size() < max_output_size &&
-             (!candicate_prior_queue.empty())) {
-        next_cand = candicate_prior_queue.top();
-        candicate_prior_queue.pop();
-
-        bool selected = true;
-        for (int i = static_cast<int>(selected_index.size()) - 1; i >= 0; --i) {
-          iou = NmsFunc::iou((box + box_offset), next_cand.box_index,
-                             selected_index[i]);
-          if ((iou > iou_threshold) && iou != 0.f) {
-            selected = false;
-            break;
-          }
-        }
-
-        if (selected == true) {
-          selected_index.push_back(next_cand.box_index);
+      const int i = cand.box_index;
+      const float ymin_i = b.ymin[i], xmin_i = b.xmin[i];
+      const float ymax_i = b.ymax[i], xmax_i = b.xmax[i];
+      const float area_i = b.area[i];
+      int suppressed = 0;
+      if (area_i > 0.f) {
+        for (size_t k = 0; k < num_kept; ++k) {
+          const float ymax_inter = (ymax_i < kept.ymax[k]) ? ymax_i : kept.ymax[k];
+          const float ymin_inter = (ymin_i > kept.ymin[k]) ? ymin_i : kept.ymin[k];
+          const float y_inter =
+              (ymax_inter > ymin_inter) ? (ymax_inter - ymin_inter) : 0;
+          const float xmax_inter = (xmax_i < kept.xmax[k]) ? xmax_i : kept.xmax[k];
+          const float xmin_inter = (xmin_i > kept.xmin[k]) ? xmin_i : kept.xmin[k];
+          const float x_inter =
+              (xmax_inter > xmin_inter) ? (xmax_inter - xmin_inter) : 0;
+          const float area_inter = y_inter * x_inter;
+          const float iou = area_inter / (area_i + kept.area[k] - area_inter);
+          // a box without area never suppresses, same as NmsFunc::iou
+          suppressed |= (kept.area[k] > 0.f) & (iou > iou_threshold) &
+                        (iou != 0.f);
         }
       }
-      int *output =
-          reinterpret_cast<int *>(param_.output) + (num_selected_indices * 3);
-      for (int i = 0; i < selected_index.size(); i++) {
-        output[i * 3] = n;
-        output[i * 3 + 1] = c;
-        output[i * 3 + 2] = selected_index[i];
+      if (!suppressed) {
+        selected_index.push_back(i);
+        kept.ymin[num_kept] = ymin_i;
+        kept.xmin[num_kept] = xmin_i;
+        kept.ymax[num_kept] = ymax_i;
+        kept.xmax[num_kept] = xmax_i;
+        kept.area[num_kept] = area_i;
+        num_kept++;
       }
-      num_selected_indices += static_cast<int>(selected_index.size());
+    }
+  }
+
+  int num_selected_indices = 0;
+  int *output = reinterpret_cast<int *>(param_.output);
+  for (int nc = 0; nc < batch_num * num_class; ++nc) {
+    for (int index : selected[nc]) {
+      output[num_selected_indices * 3] = nc / num_class;
+      output[num_selected_indices * 3 + 1] = nc % num_class;
+      output[num_selected_indices * 3 + 2] = index;
+      num_selected_indices++;
     }
   }
   return num_selected_indices * 3;
@@ -1226,6 +1226,18 @@ bool permute_reset(const std::vector<int64_t> &shape,
   return true;
 }
 
+bool is_concat_in_place(const std::vector<float *> &inputs,
+                        const float *output, mlir::ValueRange values) {
+  int64_t offset = 0;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    if (inputs[i] != output + offset) {
+      return false;
+    }
+    offset += module::getNumElements(values[i]);
+  }
+  return true;
+}
+
 template <typename T>
 void function_permute(T *from, T *to, const std::vector<int64_t> &shape,
                       const std::vector<int64_t> &order) {
@@ -1480,6 +1492,84 @@ int getBcastIndex(int out_index, std::vector<int64_t> &output_shape,
   return input_index;
 }
 
+bcast_plan_t make_bcast_plan(const std::vector<int64_t> &out_shape,
+                             const std::vector<std::vector<int64_t>> &in_shapes) {
+  const int num = in_shapes.size();
+  const int dims = out_shape.size();
+  const int64_t out_num =
+      std::accumulate(out_shape.begin(), out_shape.end(), (int64_t)1,
+                      std::multiplies<int64_t>());
+  // an input of the same size is read as is, even if reshaped
+  std::vector<bool> full(num);
+  for (int k = 0; k < num; ++k) {
+    full[k] = std::accumulate(in_shapes[k].begin(), in_shapes[k].end(),
+                              (int64_t)1,
+                              std::multiplies<int64_t>()) == out_num;
+  }
+  // merged dims, and whether each input is broadcast along them
+  std::vector<int64_t> merged;
+  std::vector<std::vector<bool>> bcast;
+  for (int d = 0; d < dims; ++d) {
+    if (out_shape[d] == 1) {
+      continue;
+    }
+    std::vector<bool> pattern(num);
+    for (int k = 0; k < num; ++k) {
+      if (full[k]) {
+        continue;
+      }
+      auto &shape = in_shapes[k];
+      int pad = dims - (int)shape.size();
+      int64_t size = d < pad ? 1 : shape[d - pad];
+      if (size != 1 && size != out_shape[d]) {
+        llvm_unreachable("shapes can't be broadcast");
+      }
+      pattern[k] = size == 1;
+    }
+    if (!bcast.empty() && bcast.back() == pattern) {
+      merged.back() *= out_shape[d];
+    } else {
+      merged.push_back(out_shape[d]);
+      bcast.push_back(pattern);
+    }
+  }
+  if (merged.empty()) {
+    merged.push_back(1);
+    bcast.emplace_back(num, false);
+  }
+
+  bcast_plan_t plan;
+  const int outer_dims = merged.size() - 1;
+  plan.inner = merged.back();
+  plan.outer_shape.assign(merged.begin(), merged.end() - 1);
+  plan.rows = std::accumulate(plan.outer_shape.begin(), plan.outer_shape.end(),
+                              (int64_t)1, std::multiplies<int64_t>());
+  plan.outer_stride.assign(num, std::vector<int64_t>(outer_dims, 0));
+  plan.inner_step.assign(num, 0);
+  for (int k = 0; k < num; ++k) {
+    int64_t stride = 1;
+    if (!bcast.back()[k]) {
+      plan.inner_step[k] = 1;
+      stride = plan.inner;
+    }
+    for (int d = outer_dims - 1; d >= 0; --d) {
+      if (!bcast[d][k]) {
+        plan.outer_stride[k][d] = stride;
+        stride *= merged[d];
+      }
+    }
+  }
+  // split the rows when there are too few of them to feed all threads
+  plan.block = plan.inner;
+  int threads = omp_get_max_threads();
+  if (plan.rows < threads) {
+    int64_t parts = (threads + plan.rows - 1) / plan.rows;
+    plan.block = std::min(
+        plan.inner, std::max<int64_t>((plan.inner + parts - 1) / parts, 4096));
+  }
+  return plan;
+}
+
 bool is_all_int8(const std::vector<float> &data, float scale, bool sign) {
   if (sign == false) {
     // all uint8 ?
@@ -0,0 +1,192 @@
+//===----------------------------------------------------------------------===//
+//
+// Copyright (C) 2022 Sophgo Technologies Inc.  All rights reserved.
+//
+// TPU-MLIR is licensed under the 2-Clause BSD License except for the
+// third-party components.
+//
+//===----------------------------------------------------------------------===//
+
+#include "tpu_mlir/Support/MixPrecision.h"
+#include "omp.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <set>
+
+#define DEBUG_TYPE "mix_precision"
+
+namespace tpu_mlir {
+
+double cos_sim(const float *a, const float *b, int64_t num) {
+  double dot = 0, norm_a = 0, norm_b = 0;
+#pragma omp simd reduction(+ : dot, norm_a, norm_b)
+  for (int64_t i = 0; i < num; i++) {
+    dot += (double)a[i] * b[i];
+    norm_a += (double)a[i] * a[i];
+    norm_b += (double)b[i] * b[i];
+  }
+  double denom = std::sqrt(norm_a) * std::sqrt(norm_b);
+  double cos = denom == 0 ? 0 : dot / denom;
+  return 0.5 + 0.5 * cos;
+}
+
+double sqnr(const float *raw, const float *dequant, int64_t num) {
+  if (num == 0) {
+    return std::numeric_limits<double>::infinity();
+  }
+  double sum_raw = 0, sum_noise = 0;
+#pragma omp simd reduction(+ : sum_raw, sum_noise)
+  for (int64_t i = 0; i < num; i++) {
+    sum_raw += raw[i];
+    sum_noise += (double)raw[i] - dequant[i];
+  }
+  double avg_raw = sum_raw / num, avg_noise = sum_noise / num;
+  double var_raw = 0, var_noise = 0;
+#pragma omp simd reduction(+ : var_raw, var_noise)
+  for (int64_t i = 0; i < num; i++) {
+    double r = raw[i] - avg_raw;
+    double n = (double)raw[i] - dequant[i] - avg_noise;
+    var_raw += r * r;
+    var_noise += n * n;
+  }
+  if (var_noise == 0) {
+    return std::numeric_limits<double>::infinity();
+  }
+  return 10 * std::log10(var_raw / var_noise);
+}
+
+MixPrecSearcher::MixPrecSearcher(ModuleInterpreter &ref,
+                                 ModuleInterpreter &quant)
+    : ref(ref), quant(quant), cos_loss_sum(0), sqnr_loss_sum(0), samples(0) {
+  if (ref.input_names.size() != quant.input_names.size()) {
+    llvm_unreachable("modules have different inputs");
+  }
+  // activations sharing a buffer are overwritten before they are compared
+  using mem_mode_t = ModuleInterpreter::mem_mode_t;
+  if (ref.get_mem_mode() == mem_mode_t::ALL_TENSOR_IN_REUSED_MEM ||
+      quant.get_mem_mode() == mem_mode_t::ALL_TENSOR_IN_REUSED_MEM) {
+    llvm_unreachable("MixPrecSearcher does not support reused memory");
+  }
+  for (auto &name : quant.all_tensor_names) {
+    const float *a, *b;
+    size_t size_a, size_b;
+    if (ref.getTensorView(name, a, size_a) &&
+        quant.getTensorView(name, b, size_b) && size_a == size_b) {
+      layers.push_back(name);
+    }
+  }
+  cos_sum.assign(layers.size(), 0);
+  // outputs are paired by position, their names may differ after lowering
+  compare_ref = ref.output_names;
+  compare_quant = quant.output_names;
+  compare_rates.assign(compare_ref.size(), 1.0f);
+}
+
+void MixPrecSearcher::set_compare_layers(const std::vector<std::string> &names,
+                                         const std::vector<float> &rates) {
+  compare_ref = names;
+  compare_quant = names;
+  compare_rates = rates;
+  compare_rates.resize(names.size(), 1.0f);
+}
+
+void MixPrecSearcher::run(const std::vector<const float *> &inputs,
+                          const std::vector<size_t> &sizes) {
+  if (inputs.size() != ref.input_names.size() ||
+      inputs.size() != sizes.size()) {
+    llvm_unreachable("input number mismatch");
+  }
+  for (size_t i = 0; i < inputs.size(); i++) {
+    ref.setTensor(ref.input_names[i], inputs[i], sizes[i] * sizeof(float));
+    quant.setTensor(quant.input_names[i], inputs[i], sizes[i] * sizeof(float));
+  }
+  ref.invoke();
+  quant.invoke();
+
+  // float expressed values of both modules are in memory now
+  int64_t num = layers.size();
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int64_t i = 0; i < num; i++) {
+    const float *a, *b;
+    size_t size;
+    ref.getTensorView(layers[i], a, size);
+    quant.getTensorView(layers[i], b, size);
+    cos_sum[i] += cos_sim(a, b, size);
+  }
+
+  double cos_loss = 0, sqnr_loss = 0, rate_sum = 0;
+  int64_t cnt = 0;
+  for (size_t i = 0; i < compare_ref.size() && i < compare_quant.size(); i++) {
+    const float *a, *b;
+    size_t size_a, size_b;
+    if (!ref.getTensorView(compare_ref[i], a, size_a) ||
+        !quant.getTensorView(compare_quant[i], b, size_b) || size_a != size_b) {
+      llvm::errs() << "Calc loss fail: " << compare_ref[i] << " vs "
+                   << compare_quant[i] << "\n";
+      llvm_unreachable("compare layer mismatch");
+    }
+    rate_sum += compare_rates[i];
+    cos_loss += compare_rates[i] * cos_sim(a, b, size_a);
+    auto loss = sqnr(a, b, size_a);
+    if (!std::isinf(loss)) {
+      sqnr_loss += -loss * size_a * compare_rates[i];
+      cnt += size_a;
+    }
+  }
+  cos_loss_sum += cos_loss / rate_sum;
+  if (cnt == 0) {
+    sqnr_loss_sum += -std::numeric_limits<double>::infinity();
+  } else {
+    sqnr_loss_sum += sqnr_loss / rate_sum / cnt;
+  }
+  samples++;
+  LLVM_DEBUG(llvm::dbgs() << "sample " << samples << ", cos loss: "
+                          << cos_loss / rate_sum << "\n");
+}
+
+std::vector<std::pair<std::string, double>>
+MixPrecSearcher::layer_cos() const {
+  std::vector<std::pair<std::string, double>> result;
+  for (size_t i = 0; i < layers.size(); i++) {
+    result.emplace_back(layers[i], samples ? cos_sum[i] / samples : 0);
+  }
+  return result;
+}
+
+double MixPrecSearcher::outputs_loss(const std::string &type) const {
+  if (samples == 0) {
+    return 0;
+  }
+  if (type == "cos") {
+    return cos_loss_sum / samples;
+  } else if (type == "sqnr") {
+    return sqnr_loss_sum / samples;
+  }
+  llvm_unreachable("loss type should be cos or sqnr");
+}
+
+std::vector<std::string>
+MixPrecSearcher::search(double min_cos, int64_t max_num,
+                        const std::vector<std::string> &candidates) const {
+  auto all = layer_cos();
+  if (!candidates.empty()) {
+    std::set<std::string> names(candidates.begin(), candidates.end());
+    all.erase(std::remove_if(all.begin(), all.end(),
+                             [&](auto &l) { return !names.count(l.first); }),
+              all.end());
+  }
+  std::stable_sort(all.begin(), all.end(), [](auto &a, auto &b) {
+    return a.second < b.second;
+  });
+  std::vector<std::string> result;
+  for (auto &l : all) {
+    if (l.second >= min_cos || (int64_t)result.size() >= max_num) {
+      break;
+    }
+    result.push_back(l.first);
+  }
+  return result;
+}
+
+} // namespace tpu_mlir
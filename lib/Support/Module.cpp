@@ -20,6 +20,7 @@ struct Attr {
   static constexpr llvm::StringRef FLOPS = "module.FLOPs";
   static constexpr llvm::StringRef CORES = "module.cores";
   static constexpr llvm::StringRef DEVICES = "module.devices";
+  static constexpr llvm::StringRef BATCH_PARALLEL = "module.batch_parallel";
   static constexpr llvm::StringRef COEFF_ADDR = "module.coeff_addr";
   static constexpr llvm::StringRef COEFF_SIZE = "module.coeff_size";
   static constexpr llvm::StringRef NEURON_ADDR = "module.neuron_addr";
@@ -888,6 +889,17 @@ void setDeviceNum(int64_t device_num) {
   m->setAttr(Attr::DEVICES, Builder(ctx).getI64IntegerAttr(device_num));
 }
 
+bool isBatchParallel() {
+  if (auto batch_parallel = m->getAttrOfType<BoolAttr>(Attr::BATCH_PARALLEL)) {
+    return batch_parallel.getValue();
+  }
+  return false;
+}
+
+void setBatchParallel(bool batch_parallel) {
+  m->setAttr(Attr::BATCH_PARALLEL, Builder(ctx).getBoolAttr(batch_parallel));
+}
+
 int64_t getCoeffAddr(ModuleOp s) {
   return s->getAttrOfType<IntegerAttr>(Attr::COEFF_ADDR).getInt();
 }
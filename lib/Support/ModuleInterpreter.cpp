@@ -9,10 +9,13 @@
 
 #include "tpu_mlir/Support/ModuleInterpreter.h"
 #include "progressbar.hpp"
+#include "tpu_mlir/Support/Float16.h"
 #include "tpu_mlir/Support/Float8.h"
 #include "tpu_mlir/Support/GmemAllocator.h"
 #include "tpu_mlir/Support/MathUtils.h"
 #include <algorithm>
+#include <numeric>
+#include <sstream>
 #define DEBUG_TYPE "interpreter"
 
 static const int64_t MAX_COUNT_LIMIT = 0x100000000ll;
@@ -26,6 +29,10 @@ ModuleInterpreter::ModuleInterpreter(ModuleOp module) : module(module) {
   }
   mem_mode = mem_mode_t::ALL_TENSOR_IN_MEM;
   total_count = 0;
+  plan_valid = false;
+  kv_position = 0;
+  default_quant = fake_quant_t::NONE;
+  fake_quant_ready = true;
   for (auto func : module.getOps<FuncOp>()) {
     // alloce buffer for all value
     func.walk([&](InferenceInterface op) {
@@ -81,6 +88,529 @@ void ModuleInterpreter::allocate_resources() {
     allocate_tensor_in_reused_mem();
     break;
   }
+  allocate_workspace();
+  build_plan();
+}
+
+// Scratch of the ops. Only one op runs at a time, so its scratch is dead once
+// the op returns and all of them share the arena from its start.
+void ModuleInterpreter::allocate_workspace() {
+  int64_t size = 0;
+  for (auto &it : inference_map) {
+    size = std::max(size, it.second->workspace_size);
+  }
+  workspace.assign(size, 0.0f);
+  for (auto &it : inference_map) {
+    it.second->workspace =
+        it.second->workspace_size > 0 ? workspace.data() : nullptr;
+  }
+  LLVM_DEBUG(llvm::dbgs() << "workspace size: "
+                          << size * sizeof(float) / 1024 << " KB\n");
+}
+
+// for ops initialized on the fly, the arena grows if they need more
+void ModuleInterpreter::bind_workspace(InferenceParameter &p) {
+  if (p.workspace_size > (int64_t)workspace.size()) {
+    workspace.clear();
+    workspace.shrink_to_fit();
+    workspace.resize(p.workspace_size);
+    for (auto &it : inference_map) {
+      if (it.second->workspace_size > 0) {
+        it.second->workspace = workspace.data();
+      }
+    }
+  }
+  p.workspace = p.workspace_size > 0 ? workspace.data() : nullptr;
+}
+
+// Flatten the module into a list of steps, so that invoke need not walk the
+// IR and look up names for each op. Modules with control flow (If/Loop) or
+// ops allocated on the fly keep walking the IR.
+void ModuleInterpreter::build_plan() {
+  plan.clear();
+  plan_index.clear();
+  tensor_ids.clear();
+  buffer_readers.clear();
+  for (size_t i = 0; i < all_tensor_names.size(); i++) {
+    tensor_ids.emplace(all_tensor_names[i], i);
+  }
+  plan_valid = mem_mode == mem_mode_t::ALL_TENSOR_IN_MEM ||
+               mem_mode == mem_mode_t::ALL_TENSOR_IN_REUSED_MEM;
+  // reused mem overwrites dead activations, nothing can be kept
+  plan_memo = mem_mode == mem_mode_t::ALL_TENSOR_IN_MEM;
+  llvm::DenseMap<Operation *, int64_t> op_steps;
+  for (auto func : module.getOps<FuncOp>()) {
+    if (!plan_valid) {
+      break;
+    }
+    func.walk<WalkOrder::PreOrder>([&](Operation *op) {
+      if (isa<func::FuncOp>(op)) {
+        return WalkResult::advance();
+      }
+      if (op->getNumRegions() > 0) {
+        plan_valid = false;
+        return WalkResult::interrupt();
+      }
+      if (auto in_op = dyn_cast<top::InputOp>(op)) {
+        auto name = module::getName(in_op.getOutput()).str();
+        op_steps[op] = plan.size();
+        plan.push_back({InferenceInterface(), nullptr, name, {}, {}});
+      } else if (auto infer_op = dyn_cast<InferenceInterface>(op)) {
+        std::string name;
+        if (op->getLoc().isa<NameLoc>() || op->getLoc().isa<FusedLoc>()) {
+          name = module::getName(op).str();
+        }
+        auto it = inference_map.find(name);
+        if (it == inference_map.end()) {
+          plan_valid = false;
+          return WalkResult::interrupt();
+        }
+        if (!name.empty()) {
+          plan_index.emplace(name, plan.size());
+        }
+        op_steps[op] = plan.size();
+        plan.push_back({infer_op, it->second.get(), name, {}, {}});
+      }
+      return WalkResult::advance();
+    });
+  }
+  if (!plan_valid) {
+    plan.clear();
+    plan_index.clear();
+    LLVM_DEBUG(llvm::dbgs() << "plan: walk the IR\n");
+    return;
+  }
+
+  // dependencies, by value for producers and by buffer for users, as
+  // no-mem ops like Reshape share the buffer of their input
+  auto buffer_of = [&](Value v) -> const std::vector<float> * {
+    if (module::isNone(v) || !v.getDefiningOp()) {
+      return nullptr;
+    }
+    auto it = mem_map.find(module::getName(v).str());
+    return it == mem_map.end() ? nullptr : it->second.get();
+  };
+  tensor_producer.assign(all_tensor_names.size(), -1);
+  for (size_t i = 0; i < plan.size(); i++) {
+    auto &step = plan[i];
+    if (!step.infer) {
+      auto it = tensor_ids.find(step.name);
+      if (it != tensor_ids.end()) {
+        tensor_producer[it->second] = i;
+      }
+      continue;
+    }
+    for (auto opd : step.infer->getOperands()) {
+      auto def = opd.getDefiningOp();
+      auto it = def ? op_steps.find(def) : op_steps.end();
+      if (it != op_steps.end()) {
+        step.producers.push_back(it->second);
+      }
+      auto buffer = buffer_of(opd);
+      if (plan_memo && buffer) {
+        auto &readers = buffer_readers[buffer];
+        if (readers.empty() || readers.back() != (int64_t)i) {
+          readers.push_back(i);
+        }
+      }
+    }
+    for (auto r : step.infer->getResults()) {
+      if (module::isNone(r) || module::getNumElements(r) == 0) {
+        continue;
+      }
+      auto it = tensor_ids.find(module::getName(r).str());
+      if (it != tensor_ids.end()) {
+        tensor_producer[it->second] = i;
+      }
+    }
+  }
+  for (size_t i = 0; plan_memo && i < plan.size(); i++) {
+    auto &step = plan[i];
+    std::vector<Value> results;
+    if (step.infer) {
+      results.assign(step.infer->result_begin(), step.infer->result_end());
+    } else {
+      results.push_back(value_map.at(step.name));
+    }
+    for (auto r : results) {
+      auto buffer = buffer_of(r);
+      if (!buffer || !buffer_readers.count(buffer)) {
+        continue;
+      }
+      for (auto u : buffer_readers[buffer]) {
+        if (u > (int64_t)i) {
+          step.users.push_back(u);
+        }
+      }
+    }
+    std::sort(step.users.begin(), step.users.end());
+    step.users.erase(std::unique(step.users.begin(), step.users.end()),
+                     step.users.end());
+  }
+  // nothing has been computed yet
+  plan_dirty.assign(plan.size(), 1);
+  LLVM_DEBUG(llvm::dbgs() << "plan: " << plan.size() << " steps\n");
+}
+
+void ModuleInterpreter::run_step(int64_t idx, bool has_hooks) {
+  auto &step = plan[idx];
+  if (has_hooks) {
+    call_before_hook(step.name);
+  }
+  if (step.infer) {
+    LLVM_DEBUG(llvm::dbgs() << "compute: '" << step.name << "'\n");
+    if (failed(step.infer.inference(*step.param))) {
+      step.infer.dump();
+      llvm_unreachable("invoke failed!!");
+    }
+    if (step.quant != fake_quant_t::NONE) {
+      fake_quant_step(idx);
+    }
+  }
+  if (has_hooks) {
+    call_after_hook(step.name);
+  }
+  plan_dirty[idx] = 0;
+  for (auto u : step.users) {
+    plan_dirty[u] = 1;
+  }
+}
+
+void ModuleInterpreter::run_plan(size_t begin, size_t end, bool with_input,
+                                 bool show_bar, bool only_dirty) {
+  if (!fake_quant_ready) {
+    resolve_fake_quant();
+  }
+  bool has_hooks = !before_hooks.empty() || !after_hooks.empty();
+  std::unique_ptr<progressbar> bar;
+  if (show_bar) {
+    bar = std::make_unique<progressbar>(num_infer_op);
+  }
+  for (size_t i = begin; i < end; i++) {
+    auto &step = plan[i];
+    if (!step.infer && !with_input) {
+      continue;
+    }
+    if (bar && step.infer) {
+      bar->update();
+    }
+    if (only_dirty && !plan_dirty[i]) {
+      continue;
+    }
+    run_step(i, has_hooks);
+  }
+}
+
+// the readers of a tensor written from outside have to be recomputed
+void ModuleInterpreter::mark_tensor_dirty(const std::string &name) {
+  if (!plan_valid) {
+    return;
+  }
+  auto it = buffer_readers.find(mem_map.at(name).get());
+  if (it == buffer_readers.end()) {
+    return;
+  }
+  for (auto r : it->second) {
+    plan_dirty[r] = 1;
+  }
+}
+
+void ModuleInterpreter::set_calibration_table(const std::string &filename) {
+  std::ifstream infile(filename);
+  if (!infile) {
+    llvm::errs() << "Can't open " << filename << "\n";
+    llvm_unreachable("can't open calibration table file!");
+  }
+  cali_th.clear();
+  cali_th_f8.clear();
+  // "name threshold min max" lines, the int8 block comes first, then the
+  // blocks marked by #weight_scale, #int4_th and fp8 comments
+  auto *block = &cali_th;
+  std::string line;
+  while (std::getline(infile, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty()) {
+      continue;
+    }
+    if (line[0] == '#') {
+      if (line.find("#tpu-mlir-fp8") != std::string::npos ||
+          line.find("mqbench-fp8") != std::string::npos) {
+        block = &cali_th_f8;
+      } else if (line.find("#weight_scale") != std::string::npos ||
+                 line.find("#int4_th") != std::string::npos) {
+        block = nullptr;
+      }
+      continue;
+    }
+    std::istringstream iss(line);
+    std::string name;
+    double th, min, max;
+    if (block && (iss >> name >> th >> min >> max)) {
+      (*block)[name] = th;
+    }
+  }
+  fake_quant_ready = false;
+}
+
+ModuleInterpreter::fake_quant_t
+ModuleInterpreter::parse_quant_mode(const std::string &mode) {
+  auto m = StringRef(mode).upper();
+  if (m == "F32" || m == "NONE") {
+    return fake_quant_t::NONE;
+  } else if (m == "INT8") {
+    return fake_quant_t::INT8;
+  } else if (m == "F16") {
+    return fake_quant_t::F16;
+  } else if (m == "BF16") {
+    return fake_quant_t::BF16;
+  } else if (m == "F8E4M3" || m == "F8") {
+    return fake_quant_t::F8E4M3;
+  }
+  llvm::errs() << "Unknown quant mode: " << mode << "\n";
+  llvm_unreachable("quant mode should be F32/INT8/F16/BF16/F8E4M3");
+}
+
+void ModuleInterpreter::set_quant_mode(const std::string &mode) {
+  if (!module::isState(module::State::TOP_F32) || !plan_valid) {
+    llvm_unreachable("virtual lowering needs a flat top mlir in memory");
+  }
+  default_quant = parse_quant_mode(mode);
+  fake_quant_ready = false;
+}
+
+void ModuleInterpreter::set_op_quant_mode(const std::string &op_name,
+                                          const std::string &mode) {
+  if (!module::isState(module::State::TOP_F32) || !plan_valid) {
+    llvm_unreachable("virtual lowering needs a flat top mlir in memory");
+  }
+  op_quant[op_name] = parse_quant_mode(mode);
+  fake_quant_ready = false;
+}
+
+void ModuleInterpreter::clear_quant_mode() {
+  default_quant = fake_quant_t::NONE;
+  op_quant.clear();
+  fake_quant_ready = false;
+}
+
+double ModuleInterpreter::quant_threshold(Value v, fake_quant_t mode) {
+  auto name = module::getName(v).str();
+  if (mode == fake_quant_t::F8E4M3 && cali_th_f8.count(name)) {
+    return cali_th_f8[name];
+  }
+  if (cali_th.count(name)) {
+    return cali_th[name];
+  }
+  if (module::isCalibratedType(v)) {
+    auto qtype = module::getCalibratedType(v);
+    return std::max(std::abs(qtype.getMin()), std::abs(qtype.getMax()));
+  }
+  // not calibrated
+  return -1;
+}
+
+// Resolve the mode and the result scales of each step, and fake quantize the
+// filters of INT8 Conv/MatMul. Other filters are restored from the backup.
+void ModuleInterpreter::resolve_fake_quant() {
+  fake_quant_ready = true;
+  // INT8 users of each filter, Conv quantizes it per channel and MatMul per
+  // tensor
+  struct filter_users_t {
+    bool conv = false;
+    bool matmul = false;
+  };
+  std::map<std::string, filter_users_t> weight_quant;
+  for (auto &step : plan) {
+    step.quant = fake_quant_t::NONE;
+    step.quant_scale.clear();
+    if (!step.infer || is_no_mem_op(step.infer.getOperation())) {
+      continue;
+    }
+    auto it = op_quant.find(step.name);
+    auto mode = it != op_quant.end() ? it->second : default_quant;
+    for (auto r : step.infer->getResults()) {
+      float scale = 0;
+      if (!module::isNone(r) && !module::getStorageType(r).isIntOrIndex()) {
+        if (mode == fake_quant_t::INT8 || mode == fake_quant_t::F8E4M3) {
+          double th = quant_threshold(r, mode);
+          if (th < 0) {
+            llvm::errs() << "Warning: " << module::getName(r)
+                         << " has no calibration threshold, it stays in "
+                            "float\n";
+            th = 0;
+          }
+          scale = th / (mode == fake_quant_t::INT8 ? 127.0 : get_f8e4m3_max());
+        } else {
+          scale = 1.0;
+        }
+      }
+      step.quant_scale.push_back(scale);
+    }
+    step.quant = mode;
+    if (isa<top::ConvOp, top::MatMulOp>(step.infer.getOperation()) &&
+        step.infer->getNumOperands() > 1 &&
+        isa_and_nonnull<top::WeightOp>(
+            step.infer->getOperand(1).getDefiningOp())) {
+      auto name = module::getName(step.infer->getOperand(1)).str();
+      auto &users = weight_quant[name];
+      if (mode == fake_quant_t::INT8) {
+        bool conv = isa<top::ConvOp>(step.infer.getOperation());
+        (conv ? users.conv : users.matmul) = true;
+      }
+    }
+  }
+  for (auto &it : weight_quant) {
+    auto &mem = *mem_map.at(it.first);
+    auto backup = weight_backup.find(it.first);
+    auto &users = it.second;
+    if (users.conv && users.matmul) {
+      llvm::errs() << "filter " << it.first
+                   << " is shared by INT8 Conv and MatMul\n";
+      llvm_unreachable("a filter is fake quantized per channel or per tensor");
+    }
+    if (!users.conv && !users.matmul) {
+      if (backup != weight_backup.end()) {
+        std::copy(backup->second.begin(), backup->second.end(), mem.begin());
+      }
+      continue;
+    }
+    if (backup == weight_backup.end()) {
+      backup = weight_backup.emplace(it.first, mem).first;
+    }
+    int64_t channel =
+        users.conv ? module::getShape(value_map.at(it.first))[0] : 1;
+    int64_t inner = mem.size() / channel;
+    auto &origin = backup->second;
+#pragma omp parallel for schedule(static, omp_schedule(channel))
+    for (int64_t c = 0; c < channel; c++) {
+      float max_abs = 0;
+      for (int64_t i = c * inner; i < (c + 1) * inner; i++) {
+        max_abs = std::max(max_abs, std::abs(origin[i]));
+      }
+      float scale = max_abs / 127.0f;
+      for (int64_t i = c * inner; i < (c + 1) * inner; i++) {
+        mem[i] = scale == 0 ? 0 : to_int8(origin[i] / scale) * scale;
+      }
+    }
+  }
+  // cached activations were computed in the old modes
+  std::fill(plan_dirty.begin(), plan_dirty.end(), 1);
+}
+
+void ModuleInterpreter::fake_quant_step(int64_t idx) {
+  auto &step = plan[idx];
+  for (size_t k = 0; k < step.quant_scale.size(); k++) {
+    float *p = step.param->outputs[k];
+    float scale = step.quant_scale[k];
+    if (p == nullptr || scale == 0) {
+      continue;
+    }
+    int64_t num = module::getNumElements(step.infer->getResult(k));
+    switch (step.quant) {
+    case fake_quant_t::INT8:
+#pragma omp parallel for schedule(static, omp_schedule(num))
+      for (int64_t i = 0; i < num; i++) {
+        p[i] = to_int8(p[i] / scale) * scale;
+      }
+      break;
+    case fake_quant_t::F16:
+      F16(p, p, num);
+      break;
+    case fake_quant_t::BF16:
+      BF16(p, p, num);
+      break;
+    case fake_quant_t::F8E4M3:
+#pragma omp parallel for schedule(static, omp_schedule(num))
+      for (int64_t i = 0; i < num; i++) {
+        p[i] = F8E4M3(p[i], scale, true) * scale;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+// Storage of the values in reused mem, a value lies at `offset` of the
+// storage of its parent. Values that own their storage have no entry.
+typedef std::map<ValueInfo, std::pair<ValueInfo, int64_t>> storage_map_t;
+
+static ValueInfo storage_root(const storage_map_t &storage, ValueInfo v,
+                              int64_t &offset) {
+  offset = 0;
+  for (auto it = storage.find(v); it != storage.end(); it = storage.find(v)) {
+    offset += it->second.second;
+    v = it->second.first;
+  }
+  return v;
+}
+
+// operand whose storage an elementwise op can write its result over, each
+// element is read before the same element of the result is written
+static int inplace_operand(Operation *op) {
+  if (isa<top::ReluOp, top::SigmoidOp, top::SiLUOp, top::GELUOp, top::TanhOp,
+          top::MulConstOp, top::AddConstOp, tpu::ActiveOp, tpu::LutOp,
+          tpu::AddConstOp>(op)) {
+    return 0;
+  }
+  // oneDNN binary runs in place on its first source
+  if (auto add = dyn_cast<top::AddOp>(op)) {
+    return add.getInputs().size() == 2 ? 0 : -1;
+  }
+  if (isa<top::MulOp>(op)) {
+    return 0;
+  }
+  if (auto sub = dyn_cast<top::SubOp>(op)) {
+    return sub.getIsReverse() ? 1 : 0;
+  }
+  return -1;
+}
+
+// offsets of the inputs in the output of a concat that only copies them,
+// with outer dims of 1 each input is a contiguous part of the output
+static bool concat_offsets(Operation *op, std::vector<int64_t> &offsets) {
+  int64_t axis;
+  if (auto concat = dyn_cast<top::ConcatOp>(op)) {
+    if (concat.getDoRelu()) {
+      return false;
+    }
+    axis = concat.getAxis();
+  } else if (auto concat = dyn_cast<tpu::ConcatOp>(op)) {
+    if (concat.getDoRelu()) {
+      return false;
+    }
+    if (module::isCV18xx() && module::isUniformQuantized(concat.getOutput())) {
+      auto num = concat.getInputs().size();
+      auto multiplier_v = module::getI64Array(concat.getMultipliers(), num, 1);
+      auto rshift_v = module::getI64Array(concat.getRshifts(), num, 0);
+      for (size_t i = 0; i < num; ++i) {
+        if (multiplier_v->at(i) != 1 || rshift_v->at(i) != 0) {
+          return false;
+        }
+      }
+    }
+    axis = concat.getAxis();
+  } else {
+    return false;
+  }
+  auto shape = module::getShape(op->getResult(0));
+  if (axis < 0) {
+    axis += shape.size();
+  }
+  for (int64_t i = 0; i < axis; ++i) {
+    if (shape[i] != 1) {
+      return false;
+    }
+  }
+  offsets.clear();
+  int64_t offset = 0;
+  for (auto opd : op->getOperands()) {
+    offsets.push_back(offset);
+    offset += module::getNumElements(opd);
+  }
+  return true;
 }
 
 void ModuleInterpreter::allocate_tensor_in_reused_mem() {
@@ -157,7 +687,6 @@ void ModuleInterpreter::allocate_tensor_in_reused_mem() {
           ValueInfo v_info(infer_op, index);
           TensorLive v_live(index, ops_loc[infer_op], ops_loc[infer_op],
                             module::getNumElements(v));
-          common_ops.emplace_back(v_info);
           liveRange[v_info] = v_live;
 
           for (auto successor_op : v.getUsers()) {
@@ -175,23 +704,128 @@ void ModuleInterpreter::allocate_tensor_in_reused_mem() {
       }
     }
   }
+  // Views share the storage of their input, elementwise ops write over an
+  // input that dies with them, and the inputs of a concat are placed in its
+  // output, as BMAddressAssign does for the device. The live range of a
+  // storage is the union of the ranges of its values.
+  storage_map_t storage;
+  std::set<ValueInfo> pinned; // storages of the inputs, set from outside
+  auto value_info = [&](Value v, ValueInfo &info) {
+    auto def = v.getDefiningOp();
+    if (def == nullptr || module::isNone(v)) {
+      return false;
+    }
+    info = ValueInfo(def, v.cast<OpResult>().getResultNumber());
+    return liveRange.count(info) > 0;
+  };
+  auto root_of = [&](ValueInfo v) {
+    int64_t offset;
+    return storage_root(storage, v, offset);
+  };
+  auto same = [](const ValueInfo &a, const ValueInfo &b) {
+    return a.op == b.op && a.index == b.index;
+  };
+  // `v` owns its storage, which moves to `offset` of the storage of `to`
+  auto share = [&](ValueInfo v, ValueInfo to, int64_t offset) {
+    int64_t base;
+    auto root = storage_root(storage, to, base);
+    storage[v] = std::make_pair(root, base + offset);
+    auto &live = liveRange[root];
+    live.start = std::min(live.start, liveRange[v].start);
+    live.end = std::max(live.end, liveRange[v].end);
+  };
+  for (Operation *op : infer_ops) {
+    if (isa<top::InputOp>(op)) {
+      pinned.insert(ValueInfo(op, 0));
+      continue;
+    }
+    ValueInfo out, in;
+    if (isa<ReturnOp>(op) || op->getNumResults() != 1 ||
+        !value_info(op->getResult(0), out)) {
+      continue;
+    }
+    if (is_no_mem_op(op)) {
+      if (value_info(op->getOperand(0), in)) {
+        share(out, in, 0);
+      }
+      continue;
+    }
+    int idx = inplace_operand(op);
+    if (idx >= 0) {
+      if (!value_info(op->getOperand(idx), in) ||
+          liveRange[in].tensor_size != liveRange[out].tensor_size) {
+        continue;
+      }
+      auto root = root_of(in);
+      // no later reader, and no other operand in the same storage
+      bool dying =
+          !pinned.count(root) && liveRange[root].end == ops_loc[op] + 1;
+      for (int i = 0; dying && i < (int)op->getNumOperands(); ++i) {
+        ValueInfo other;
+        if (i != idx && value_info(op->getOperand(i), other) &&
+            same(root_of(other), root)) {
+          dying = false;
+        }
+      }
+      if (dying) {
+        share(out, in, 0);
+      }
+      continue;
+    }
+    std::vector<int64_t> offsets;
+    if (!concat_offsets(op, offsets)) {
+      continue;
+    }
+    // each input has to fill a storage of its own
+    std::vector<ValueInfo> roots;
+    for (auto opd : op->getOperands()) {
+      int64_t offset;
+      if (!value_info(opd, in)) {
+        break;
+      }
+      auto root = storage_root(storage, in, offset);
+      bool placeable = offset == 0 && !pinned.count(root) &&
+                       liveRange[root].tensor_size == liveRange[in].tensor_size;
+      for (auto &r : roots) {
+        placeable &= !same(r, root);
+      }
+      if (!placeable) {
+        break;
+      }
+      roots.push_back(root);
+    }
+    if (roots.size() != op->getNumOperands()) {
+      continue;
+    }
+    for (size_t i = 0; i < roots.size(); ++i) {
+      share(roots[i], out, offsets[i]);
+    }
+  }
+  // in program order, liveRange is ordered by op address which changes from
+  // run to run, and so would the addresses of values live at the same time
+  for (Operation *infer_op : infer_ops) {
+    for (auto v : infer_op->getResults()) {
+      ValueInfo v_info(infer_op, v.getResultNumber());
+      if (liveRange.count(v_info) && !storage.count(v_info)) {
+        common_ops.emplace_back(v_info);
+      }
+    }
+  }
   if (!common_ops.empty()) {
     GmemAllocator::sortOpByLiveStart(common_ops, liveRange);
     GmemAllocator allocator(gaddrMap, alignment);
     gmemUsed = allocator.assignGaddr(common_ops, liveRange, true, start_addr);
     std::cout << "reused mem is " << gmemUsed << ", all mem is " << total_count
+              << ", " << storage.size() << " tensors share storage"
               << std::endl;
   }
   auto gMem = std::make_shared<std::vector<float>>(gmemUsed);
-  // float* ptr = gMem->data();
-  for (auto pair : gaddrMap) {
-    auto name = vNameMap[pair.first];
-    auto memLoc = pair.second;
-    auto size = liveRange[pair.first].tensor_size;
-    mem_map[name] = gMem;
-    activation_offset[name] = std::make_pair(memLoc, size);
-    // std::cout << name << " start_addr " << ptr << " cur_addr " << (float
-    // *)(mem_map[name]->data()) - ptr << std::endl;
+  for (auto &it : vNameMap) {
+    int64_t offset;
+    auto root = storage_root(storage, it.first, offset);
+    mem_map[it.second] = gMem;
+    activation_offset[it.second] = std::make_pair(
+        gaddrMap[root] + offset, liveRange[it.first].tensor_size);
   }
   for (Operation *op : infer_ops) {
     if (auto infer_op = llvm::dyn_cast<InferenceInterface>(op)) {
@@ -609,7 +1243,11 @@ void ModuleInterpreter::invoke(bool express_type) {
   switch (mem_mode) {
   case mem_mode_t::ALL_TENSOR_IN_MEM:
   case mem_mode_t::ALL_TENSOR_IN_REUSED_MEM:
-    invoke_all_in_mem(express_type);
+    if (plan_valid) {
+      invoke_plan(express_type);
+    } else {
+      invoke_all_in_mem(express_type);
+    }
     break;
   case mem_mode_t::PART_TENSOR_IN_MEM:
   case mem_mode_t::PART_SMALL_TENSOR_IN_MEM:
@@ -622,6 +1260,15 @@ void ModuleInterpreter::invoke(bool express_type) {
   }
 }
 
+void ModuleInterpreter::invoke_plan(bool express_type) {
+  module::init(module);
+  run_plan(0, plan.size(), true, true);
+  llvm::errs() << "\n";
+  if (express_type && module::isState(module::State::TPU_LOWERED)) {
+    express_all_in_mem();
+  }
+}
+
 void ModuleInterpreter::invoke_all_in_mem(bool express_type) {
   module::init(module);
   progressbar bar(num_infer_op);
@@ -984,23 +1631,38 @@ void ModuleInterpreter::invoke_all_in_mem(bool express_type) {
   }
   llvm::errs() << "\n";
   if (express_type && module::isState(module::State::TPU_LOWERED)) {
-    for (auto &name : all_tensor_names) {
-      auto value = value_map.at(name);
-      if (is_no_mem_op(value.getDefiningOp())) {
-        continue;
-      }
-      auto mem = mem_map.at(name);
-      if (module::isUniformQuantized(value)) {
-        auto qtype = module::getUniformQuantizedType(value);
-        for (auto &data : *mem) {
-          data = (data - (float)qtype.getZeroPoint()) * (float)qtype.getScale();
-        }
-      } else if (module::isCalibratedType(value) &&
-                 module::getStorageType(value).isFloat8E4M3FN()) {
-        auto qtype = module::getCalibratedType(value);
-        for (auto &data : *mem)
-          data = (data * qtype.getMax() / get_f8e4m3_max());
+    express_all_in_mem();
+  }
+}
+
+void ModuleInterpreter::express_all_in_mem() {
+  for (auto &name : all_tensor_names) {
+    auto value = value_map.at(name);
+    if (is_no_mem_op(value.getDefiningOp())) {
+      continue;
+    }
+    // kv caches stay in the storage type for the next decode step
+    if (std::any_of(kv_caches.begin(), kv_caches.end(),
+                    [&](const kv_cache_t &kv) { return kv.past == name; })) {
+      continue;
+    }
+    auto mem = mem_map.at(name);
+    if (module::isUniformQuantized(value)) {
+      auto qtype = module::getUniformQuantizedType(value);
+      for (auto &data : *mem) {
+        data = (data - (float)qtype.getZeroPoint()) * (float)qtype.getScale();
       }
+    } else if (module::isCalibratedType(value) &&
+               module::getStorageType(value).isFloat8E4M3FN()) {
+      auto qtype = module::getCalibratedType(value);
+      for (auto &data : *mem)
+        data = (data * qtype.getMax() / get_f8e4m3_max());
+    } else {
+      continue;
+    }
+    // the buffer no longer holds the storage type, compute it again
+    if (plan_valid && tensor_producer[tensor_ids.at(name)] >= 0) {
+      plan_dirty[tensor_producer[tensor_ids.at(name)]] = 1;
     }
   }
 }
@@ -1078,6 +1740,7 @@ void ModuleInterpreter::invoke_to_disk(const std::string &filename,
         infer_op.dump();
         llvm_unreachable("init failed!!");
       }
+      bind_workspace(p);
       LLVM_DEBUG(llvm::dbgs() << "compute: '" << infer_op << "'\n");
       if (failed(infer_op.inference(p))) {
         infer_op.dump();
@@ -1163,6 +1826,7 @@ void ModuleInterpreter::invoke_part_in_mem(bool express_type) {
           infer_op.dump();
           llvm_unreachable("init failed!!");
         }
+        bind_workspace(p);
         LLVM_DEBUG(llvm::dbgs() << "compute: '" << infer_op << "'\n");
         if (failed(infer_op.inference(p))) {
           infer_op.dump();
@@ -1203,6 +1867,13 @@ void ModuleInterpreter::invoke_part_in_mem(bool express_type) {
 std::shared_ptr<std::vector<float>>
 ModuleInterpreter::invoke_at(const std::string op_name) {
   module::init(module);
+  if (plan_valid) {
+    auto it = plan_index.find(op_name);
+    if (it != plan_index.end()) {
+      run_plan(it->second, it->second + 1, false, false);
+      return getTensor(op_name);
+    }
+  }
   if (value_map.find(op_name) == value_map.end()) {
     llvm::errs() << "Can't find op:" << op_name << "\n";
     llvm_unreachable("invoke_at op_name error");
@@ -1224,8 +1895,52 @@ ModuleInterpreter::invoke_at(const std::string op_name) {
   return getTensor(op_name);
 }
 
+std::shared_ptr<std::vector<float>>
+ModuleInterpreter::invoke_to(const std::string &op_name) {
+  module::init(module);
+  if (!plan_valid) {
+    invoke(false);
+    return getTensor(op_name);
+  }
+  auto it = plan_index.find(op_name);
+  if (it == plan_index.end()) {
+    llvm::errs() << "Can't find op:" << op_name << "\n";
+    llvm_unreachable("invoke_to op_name error");
+  }
+  // backward cone of the target, producers always come first in the plan
+  int64_t target = it->second;
+  std::vector<uint8_t> in_cone(target + 1, 0);
+  in_cone[target] = 1;
+  for (int64_t i = target; i >= 0; i--) {
+    if (in_cone[i]) {
+      for (auto p : plan[i].producers) {
+        in_cone[p] = 1;
+      }
+    }
+  }
+  if (!fake_quant_ready) {
+    resolve_fake_quant();
+  }
+  bool has_hooks = !before_hooks.empty() || !after_hooks.empty();
+  for (int64_t i = 0; i <= target; i++) {
+    if (in_cone[i] && plan[i].infer && (!plan_memo || plan_dirty[i])) {
+      run_step(i, has_hooks);
+    }
+  }
+  return getTensor(op_name);
+}
+
 void ModuleInterpreter::invoke_from(const std::string op_name) {
   module::init(module);
+  if (plan_valid) {
+    auto it = plan_index.find(op_name);
+    if (it != plan_index.end()) {
+      // only the forward cone is dirty when activations are kept
+      plan_dirty[it->second] = 1;
+      run_plan(it->second, plan.size(), false, false, plan_memo);
+    }
+    return;
+  }
   bool start_run = false;
   for (auto func : module.getOps<FuncOp>()) {
     func.walk([&](InferenceInterface infer_op) {
@@ -1246,6 +1961,108 @@ void ModuleInterpreter::invoke_from(const std::string op_name) {
   }
 }
 
+void ModuleInterpreter::decode_init(const std::vector<std::string> &past,
+                                    const std::vector<std::string> &present,
+                                    int64_t axis) {
+  if (!plan_valid || !plan_memo) {
+    llvm_unreachable("decode needs a flat module in ALL_TENSOR_IN_MEM mode");
+  }
+  if (past.size() != present.size() || past.empty()) {
+    llvm_unreachable("past and present should be paired");
+  }
+  kv_caches.clear();
+  for (size_t i = 0; i < past.size(); i++) {
+    if (std::find(input_names.begin(), input_names.end(), past[i]) ==
+            input_names.end() ||
+        !mem_map.count(present[i])) {
+      llvm::errs() << "Bad kv pair: " << past[i] << ", " << present[i]
+                   << "\n";
+      llvm_unreachable("past should be an input, present a tensor in mem");
+    }
+    auto past_shape = getTensorShape(past[i]);
+    auto present_shape = getTensorShape(present[i]);
+    int64_t dims = past_shape.size();
+    int64_t ax = axis < 0 ? axis + dims : axis;
+    bool same = ax >= 0 && ax < dims && (int64_t)present_shape.size() == dims;
+    for (int64_t d = 0; same && d < dims; d++) {
+      same = d == ax || past_shape[d] == present_shape[d];
+    }
+    if (!same) {
+      llvm::errs() << "Bad kv pair: " << past[i] << ", " << present[i]
+                   << "\n";
+      llvm_unreachable("past and present should differ only along axis");
+    }
+    kv_cache_t kv;
+    kv.past = past[i];
+    kv.present = present[i];
+    kv.outer = std::accumulate(past_shape.begin(), past_shape.begin() + ax,
+                               (int64_t)1, std::multiplies<int64_t>());
+    kv.inner = std::accumulate(past_shape.begin() + ax + 1, past_shape.end(),
+                               (int64_t)1, std::multiplies<int64_t>());
+    kv.capacity = past_shape[ax];
+    kv.present_len = present_shape[ax];
+    // concatenated caches end with the new tokens
+    kv.new_len = kv.present_len > kv.capacity ? kv.present_len - kv.capacity
+                                              : kv.present_len;
+    if (kv.new_len > kv.capacity ||
+        (!kv_caches.empty() && kv.new_len != kv_caches[0].new_len)) {
+      llvm_unreachable("kv caches should take the same tokens each step");
+    }
+    kv_caches.push_back(kv);
+  }
+  decode_reset();
+}
+
+void ModuleInterpreter::decode_reset() {
+  kv_position = 0;
+  for (auto &kv : kv_caches) {
+    auto &mem = *mem_map.at(kv.past);
+    std::fill(mem.begin(), mem.end(), 0.0f);
+    mark_tensor_dirty(kv.past);
+  }
+}
+
+bool ModuleInterpreter::decode_full() const {
+  for (auto &kv : kv_caches) {
+    if (kv_position + kv.new_len > kv.capacity) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ModuleInterpreter::decode_step(bool express_type) {
+  if (kv_caches.empty()) {
+    llvm_unreachable("decode_init first");
+  }
+  // the graph takes slot i of the cache as token i, so it can not wrap
+  if (decode_full()) {
+    llvm::errs() << "kv caches are full at position " << kv_position << "\n";
+    llvm_unreachable("decode past the capacity of the kv caches");
+  }
+  module::init(module);
+  // only what the new inputs and the last appended tokens reach
+  run_plan(0, plan.size(), true, false, true);
+  for (auto &kv : kv_caches) {
+    const float *src = mem_map.at(kv.present)->data();
+    float *dst = mem_map.at(kv.past)->data();
+    int64_t first = kv.present_len - kv.new_len;
+#pragma omp parallel for schedule(static, omp_schedule(kv.outer))
+    for (int64_t o = 0; o < kv.outer; o++) {
+      for (int64_t t = 0; t < kv.new_len; t++) {
+        int64_t slot = kv_position + t;
+        std::copy_n(src + (o * kv.present_len + first + t) * kv.inner,
+                    kv.inner, dst + (o * kv.capacity + slot) * kv.inner);
+      }
+    }
+    mark_tensor_dirty(kv.past);
+  }
+  kv_position += kv_caches[0].new_len;
+  if (express_type && module::isState(module::State::TPU_LOWERED)) {
+    express_all_in_mem();
+  }
+}
+
 // this function is specific for learning weight calibration, returns the
 // gradent of weight in conv input is the grd of dst, and returns the gradent of
 // weight
@@ -1312,9 +2129,7 @@ void ModuleInterpreter::setTensor(const std::string &name, const void *data,
     llvm::errs() << "Can't find op name: " << name << "\n";
     llvm_unreachable("Error, setTensor failed");
   }
-  bool is_activation =
-      std::find(all_tensor_names.begin(), all_tensor_names.end(), name) !=
-      all_tensor_names.end();
+  bool is_activation = tensor_ids.count(name) > 0;
   auto act = it->second;
   auto tensor_size =
       (mem_mode == mem_mode_t::ALL_TENSOR_IN_REUSED_MEM && is_activation)
@@ -1351,6 +2166,7 @@ void ModuleInterpreter::setTensor(const std::string &name, const void *data,
   } else {
     memcpy(act->data() + offset, data, size);
   }
+  mark_tensor_dirty(name);
 }
 
 bool ModuleInterpreter::hasTensorMem(const std::string &name) {
@@ -1368,9 +2184,7 @@ ModuleInterpreter::getTensor(const std::string &name, bool express_type) {
     llvm::errs() << "Can't find op name: " << name << "\n";
     llvm_unreachable("Error, getTensor failed");
   }
-  bool is_activation =
-      std::find(all_tensor_names.begin(), all_tensor_names.end(), name) !=
-      all_tensor_names.end();
+  bool is_activation = tensor_ids.count(name) > 0;
   auto act = it->second;
   auto tensor_size =
       (mem_mode == mem_mode_t::ALL_TENSOR_IN_REUSED_MEM && is_activation)
@@ -1425,6 +2239,23 @@ ModuleInterpreter::getTensor(const std::string &name, bool express_type) {
   return std::move(tmp);
 }
 
+bool ModuleInterpreter::getTensorView(const std::string &name,
+                                      const float *&data, size_t &size) {
+  auto it = mem_map.find(name);
+  if (it == mem_map.end() || it->second.use_count() == 0) {
+    return false;
+  }
+  data = it->second->data();
+  size = it->second->size();
+  auto offset = activation_offset.find(name);
+  if (mem_mode == mem_mode_t::ALL_TENSOR_IN_REUSED_MEM &&
+      offset != activation_offset.end() && tensor_ids.count(name)) {
+    data += offset->second.first;
+    size = offset->second.second;
+  }
+  return true;
+}
+
 bool ModuleInterpreter::getTensorQuantInfo(const std::string name,
                                            std::string &dtype, float &scale,
                                            int &zp) {
@@ -1520,12 +2351,12 @@ ModuleInterpreter::getTensorShape(const std::string &name) {
   return it->second.getType().cast<RankedTensorType>().getShape();
 }
 
-void ModuleInterpreter::call_before_hook(std::string layer_name) {
+void ModuleInterpreter::call_before_hook(const std::string &layer_name) {
   for (auto hook : before_hooks) {
     hook->run(layer_name);
   }
 }
-void ModuleInterpreter::call_after_hook(std::string layer_name) {
+void ModuleInterpreter::call_after_hook(const std::string &layer_name) {
   for (auto hook : after_hooks) {
     hook->run(layer_name);
   }
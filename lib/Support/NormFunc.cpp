@@ -0,0 +1,273 @@
+//===----------------------------------------------------------------------===//
+//
+// Copyright (C) 2022 Sophgo Technologies Inc.  All rights reserved.
+//
+// TPU-MLIR is licensed under the 2-Clause BSD License except for the
+// third-party components.
+//
+//===----------------------------------------------------------------------===//
+
+#include "tpu_mlir/Support/NormFunc.h"
+#include "tpu_mlir/Support/LutFunc.h"
+#include "omp.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace tpu_mlir {
+
+// elements of a contiguous row sharing one running max
+static constexpr int64_t ROW_BLOCK = 256;
+// inner elements of a strided unit, one vector of avx512
+static constexpr int64_t INNER_BLOCK = 16;
+
+SoftmaxFunc::SoftmaxFunc(int64_t outer, int64_t channel, int64_t inner,
+                         float scale, bool log, norm_round_t round)
+    : outer(outer), channel(channel), inner(inner), scale(scale), log(log),
+      round_mode(round) {
+  block = std::min(inner, INNER_BLOCK);
+  threads = omp_get_max_threads();
+  int64_t row_ws = (channel + ROW_BLOCK - 1) / ROW_BLOCK;
+  int64_t lut_ws = 2 * block + 2 * channel * block;
+  ws_size = std::max(row_ws, lut_ws);
+}
+
+float *SoftmaxFunc::get_workspace(float *scratch) {
+  if (scratch != nullptr) {
+    return scratch;
+  }
+  workspace.resize(workspace_size());
+  return workspace.data();
+}
+
+void SoftmaxFunc::round(float *y, int64_t len) {
+  if (round_mode == ROUND_BF16) {
+    for (int64_t j = 0; j < len; ++j) {
+      y[j] = BF16(y[j]);
+    }
+  } else if (round_mode == ROUND_F16) {
+    for (int64_t j = 0; j < len; ++j) {
+      y[j] = F16(y[j]);
+    }
+  }
+}
+
+void SoftmaxFunc::run_row(const float *x, float *y, float *ws) {
+  const float neg_inf = -std::numeric_limits<float>::infinity();
+  const int64_t nb = (channel + ROW_BLOCK - 1) / ROW_BLOCK;
+  float *bmax = ws;
+  float m = neg_inf, s = 0;
+  for (int64_t b = 0; b < nb; ++b) {
+    const float *xb = x + b * ROW_BLOCK;
+    float *yb = y + b * ROW_BLOCK;
+    const int64_t len = std::min(ROW_BLOCK, channel - b * ROW_BLOCK);
+    float bm = neg_inf;
+#pragma omp simd reduction(max : bm)
+    for (int64_t j = 0; j < len; ++j) {
+      bm = std::max(bm, xb[j]);
+    }
+    bmax[b] = bm;
+    if (bm == neg_inf) {
+      std::fill(yb, yb + len, 0.0f);
+      continue;
+    }
+    float bs = 0;
+#pragma omp simd reduction(+ : bs)
+    for (int64_t j = 0; j < len; ++j) {
+      yb[j] = std::exp((xb[j] - bm) * scale);
+      bs += yb[j];
+    }
+    if (bm > m) {
+      s = s * std::exp((m - bm) * scale) + bs;
+      m = bm;
+    } else {
+      s += bs * std::exp((bm - m) * scale);
+    }
+  }
+  if (log) {
+    const float log_s = std::log(s);
+#pragma omp simd
+    for (int64_t j = 0; j < channel; ++j) {
+      y[j] = (x[j] - m) * scale - log_s;
+    }
+  } else {
+    for (int64_t b = 0; b < nb; ++b) {
+      float *yb = y + b * ROW_BLOCK;
+      const int64_t len = std::min(ROW_BLOCK, channel - b * ROW_BLOCK);
+      const float f = std::exp((bmax[b] - m) * scale) / s;
+#pragma omp simd
+      for (int64_t j = 0; j < len; ++j) {
+        yb[j] *= f;
+      }
+    }
+  }
+  round(y, channel);
+}
+
+void SoftmaxFunc::run_strided(const float *x, float *y, int64_t len,
+                              float *ws) {
+  float *mx = ws, *sum = ws + block;
+  std::copy(x, x + len, mx);
+  std::fill(sum, sum + len, 0.0f);
+  for (int64_t j = 1; j < channel; ++j) {
+    const float *xj = x + j * inner;
+#pragma omp simd
+    for (int64_t k = 0; k < len; ++k) {
+      mx[k] = std::max(mx[k], xj[k]);
+    }
+  }
+  for (int64_t j = 0; j < channel; ++j) {
+    const float *xj = x + j * inner;
+    float *yj = y + j * inner;
+#pragma omp simd
+    for (int64_t k = 0; k < len; ++k) {
+      yj[k] = std::exp((xj[k] - mx[k]) * scale);
+      sum[k] += yj[k];
+    }
+  }
+  for (int64_t j = 0; j < channel; ++j) {
+    const float *xj = x + j * inner;
+    float *yj = y + j * inner;
+    if (log) {
+#pragma omp simd
+      for (int64_t k = 0; k < len; ++k) {
+        yj[k] = (xj[k] - mx[k]) * scale - std::log(sum[k]);
+      }
+    } else {
+#pragma omp simd
+      for (int64_t k = 0; k < len; ++k) {
+        yj[k] /= sum[k];
+      }
+    }
+    round(yj, len);
+  }
+}
+
+void SoftmaxFunc::run(const float *input, float *output, float *scratch) {
+  float *wsp = get_workspace(scratch);
+  if (inner == 1) {
+#pragma omp parallel for num_threads(threads) schedule(static, omp_schedule(outer))
+    for (int64_t i = 0; i < outer; ++i) {
+      float *ws = wsp + omp_get_thread_num() * ws_size;
+      run_row(input + i * channel, output + i * channel, ws);
+    }
+    return;
+  }
+  const int64_t blocks = (inner + block - 1) / block;
+  const int64_t units = outer * blocks;
+#pragma omp parallel for num_threads(threads) schedule(static, omp_schedule(units))
+  for (int64_t u = 0; u < units; ++u) {
+    float *ws = wsp + omp_get_thread_num() * ws_size;
+    const int64_t k0 = (u % blocks) * block;
+    const int64_t offset = u / blocks * channel * inner + k0;
+    run_strided(input + offset, output + offset, std::min(block, inner - k0),
+                ws);
+  }
+}
+
+void SoftmaxFunc::run_bf16_lut(const float *input, float *output,
+                               float *exp_table, float *exp_slope,
+                               float *mantissa_exp, float *mantissa_table,
+                               float *scratch) {
+  float *wsp = get_workspace(scratch);
+  const int64_t blocks = (inner + block - 1) / block;
+  const int64_t units = outer * blocks;
+  const float const_val = BF16(BF16(1.0 * channel) / channel);
+  const std::string method = log ? "log" : "mantissa";
+#pragma omp parallel for num_threads(threads) schedule(static, omp_schedule(units))
+  for (int64_t u = 0; u < units; ++u) {
+    float *mx = wsp + omp_get_thread_num() * ws_size;
+    const int64_t k0 = (u % blocks) * block;
+    const int64_t len = std::min(block, inner - k0);
+    const int64_t offset = u / blocks * channel * inner + k0;
+    const float *x = input + offset;
+    float *y = output + offset;
+    float *sum = mx + block;
+    float *sub = sum + block;
+    float *ex = sub + channel * len;
+    std::copy(x, x + len, mx);
+    for (int64_t j = 1; j < channel; ++j) {
+      for (int64_t k = 0; k < len; ++k) {
+        mx[k] = std::max(mx[k], x[j * inner + k]);
+      }
+    }
+    for (int64_t j = 0; j < channel; ++j) {
+      for (int64_t k = 0; k < len; ++k) {
+        sub[j * len + k] = BF16(x[j * inner + k] - mx[k]);
+      }
+    }
+    bf16_lut_slope(sub, ex, channel * len, exp_table, exp_slope,
+                   -EXP_BF16_LUT_RANGE, EXP_BF16_LUT_RANGE);
+    std::fill(sum, sum + len, 0.0f);
+    for (int64_t j = 0; j < channel; ++j) {
+      for (int64_t k = 0; k < len; ++k) {
+        sum[k] += ex[j * len + k] * const_val;
+      }
+    }
+    for (int64_t k = 0; k < len; ++k) {
+      sum[k] = BF16(sum[k]);
+    }
+    bf16_lut_mantissa(sum, sum, len, mantissa_exp, mantissa_table, method);
+    for (int64_t j = 0; j < channel; ++j) {
+      float *yj = y + j * inner;
+      for (int64_t k = 0; k < len; ++k) {
+        yj[k] = log ? sub[j * len + k] - sum[k] : ex[j * len + k] * sum[k];
+      }
+      round(yj, len);
+    }
+  }
+}
+
+void layer_norm_f32(const float *x, float *y, const float *weight,
+                    const float *bias, int64_t num, float eps) {
+  // double keeps E[x^2] - E[x]^2 away from cancellation for float data
+  double sum = 0, sum_sq = 0;
+#pragma omp simd reduction(+ : sum, sum_sq)
+  for (int64_t j = 0; j < num; ++j) {
+    sum += x[j];
+    sum_sq += (double)x[j] * x[j];
+  }
+  const double mean_d = sum / num;
+  const double var = std::max(sum_sq / num - mean_d * mean_d, 0.0);
+  const float mean = mean_d;
+  const float rstd = 1.0 / std::sqrt(var + eps);
+  if (weight && bias) {
+#pragma omp simd
+    for (int64_t j = 0; j < num; ++j) {
+      y[j] = (x[j] - mean) * rstd * weight[j] + bias[j];
+    }
+  } else if (weight) {
+#pragma omp simd
+    for (int64_t j = 0; j < num; ++j) {
+      y[j] = (x[j] - mean) * rstd * weight[j];
+    }
+  } else {
+#pragma omp simd
+    for (int64_t j = 0; j < num; ++j) {
+      y[j] = (x[j] - mean) * rstd + (bias ? bias[j] : 0.0f);
+    }
+  }
+}
+
+void rms_norm_f32(const float *x, float *y, const float *gamma, int64_t num,
+                  float eps) {
+  double sum_sq = 0;
+#pragma omp simd reduction(+ : sum_sq)
+  for (int64_t j = 0; j < num; ++j) {
+    sum_sq += (double)x[j] * x[j];
+  }
+  const float rrms = 1.0 / std::sqrt(sum_sq / num + eps);
+  if (gamma) {
+#pragma omp simd
+    for (int64_t j = 0; j < num; ++j) {
+      y[j] = x[j] * rrms * gamma[j];
+    }
+  } else {
+#pragma omp simd
+    for (int64_t j = 0; j < num; ++j) {
+      y[j] = x[j] * rrms;
+    }
+  }
+}
+
+} // namespace tpu_mlir
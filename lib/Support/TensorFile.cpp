@@ -344,6 +344,17 @@ std::unique_ptr<std::vector<T>> TensorFile::readTensor(llvm::StringRef name,
   return data;
 }
 
+LogicalResult TensorFile::peekTensorBytes(llvm::StringRef name,
+                                          llvm::ArrayRef<uint8_t> &bytes) {
+  auto it = map.find(name.str());
+  if (it == map.end() || it->second.fortran_order) {
+    return failure();
+  }
+  auto &holder = *it->second.data_holder;
+  bytes = llvm::ArrayRef<uint8_t>((const uint8_t *)holder.data(), holder.size());
+  return success();
+}
+
 /// delete a tensor from file
 /// if the name is not found, return failure()
 LogicalResult TensorFile::deleteTensor(const llvm::StringRef name) {
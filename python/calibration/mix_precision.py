@@ -820,6 +820,52 @@ class MixPrecSearcher:
                                          global_compare_layers, layers_rate, all_pre_layers, all_int8_cos)
         self.print_log_info(layer_cos_list, fp_layer_list, all_int8_cos, outputs_cos, t0)
 
+    def run_native(self, model, float_model, global_compare_layers, layers_rate):
+        searcher = pymlir.mix_searcher(float_model.module, model.module)
+        if global_compare_layers is not None:
+            searcher.set_compare_layers(global_compare_layers, layers_rate)
+        for idx in range(self.num_sample):
+            searcher.run([v[0] for v in self.ref_activations[idx].values()])
+        return searcher
+
+    def run_fast(self):
+        # rank layers by their cos in the all int8 model, computed in pymlir,
+        # and set the worst ones to float at once
+        if self.post_process_path:
+            self.logger.print_info('post_process is not supported in fast mode')
+            return self.run()
+        t0 = time.time()
+        global_compare_layers, layers_rate, all_pre_layers = self.extract_global_layers()
+        float_model = MixQuantModel(self.fp32_mlir, self.chip)
+        int8_model = MixQuantModel(self.fp32_mlir, self.chip, self.calib_table)
+        searcher = self.run_native(int8_model, float_model, global_compare_layers, layers_rate)
+        all_int8_cos = searcher.outputs_loss()
+        int8_model.clean()
+        if all_int8_cos > self.args.expected_cos:
+            float_model.clean()
+            self.logger.print_info(
+                f'job success, current int8 cos:{all_int8_cos} is higher than expected_cos:{self.args.expected_cos},no need for mix precsion')
+            exit(0)
+        candidates = [
+            op.name for op in self.parser.ops if op.type not in SKIP_OPERATION and (
+                all_pre_layers is None or op.name in all_pre_layers)
+        ]
+        candidate_set = set(candidates)
+        layer_cos_list = [l for l in searcher.layer_cos() if l[0] in candidate_set]
+        max_fp32_layer_num = len(self.parser.get_op_name_list()) // 4
+        fp_layer_list = searcher.search(self.args.min_layer_cos, max_fp32_layer_num, candidates)
+        del searcher
+        outputs_cos = all_int8_cos
+        if len(fp_layer_list) > 0:
+            mix_table = self._gen_mix_table(fp_layer_list)
+            mix_model = MixQuantModel(self.fp32_mlir, self.chip, self.calib_table, mix_table,
+                                      self.args.fp_type)
+            outputs_cos = self.run_native(mix_model, float_model, global_compare_layers,
+                                          layers_rate).outputs_loss()
+            mix_model.clean()
+        float_model.clean()
+        self.print_log_info(layer_cos_list, fp_layer_list, all_int8_cos, outputs_cos, t0)
+
     def run_bias_correction(self):
         self.logger.print_info("run_bias_correction start")
         t0 = time.time()
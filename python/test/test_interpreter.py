@@ -0,0 +1,325 @@
+#!/usr/bin/env python3
+# Copyright (C) 2022 Sophgo Technologies Inc.  All rights reserved.
+#
+# TPU-MLIR is licensed under the 2-Clause BSD License except for the
+# third-party components.
+#
+# ==============================================================================
+
+import numpy as np
+import os, sys
+import traceback
+import pymlir
+
+MODULE_ATTRS = ('module.FLOPs = 0 : i64, module.asymmetric = false, module.chip = "ALL", '
+                'module.cores = 1 : i64, module.devices = 1 : i64, module.mode = "F32", '
+                'module.platform = "ONNX", module.state = "TOP_F32", '
+                'module.weight_file = "{}_top_f32_all_weight.npz"')
+
+
+def top_mlir(name: str, args: str, rets: str, body: str):
+    return ('module @{} attributes {{{}}} {{\n'
+            '  func.func @main({}) -> ({}) {{\n'
+            '{}'
+            '  }} loc(unknown)\n'
+            '}} loc(unknown)\n').format(name, MODULE_ATTRS.format(name), args, rets, body)
+
+
+class INTERPRETER_TESTER(object):
+    # This class is built for testing the ModuleInterpreter through pymlir.
+    def __init__(self, chip: str = "bm1684x"):
+        self.test_function = {
+            #############################
+            # Interpreter Test Case, Alphabetically
+            #############################
+            "AddBroadcast": self.test_AddBroadcast,
+            "ConcatInputRead": self.test_ConcatInputRead,
+            "Decode": self.test_Decode,
+            "DirtyRerun": self.test_DirtyRerun,
+            "FakeQuant": self.test_FakeQuant,
+            "NestedConcat": self.test_NestedConcat,
+            "ReshapeInplace": self.test_ReshapeInplace,
+        }
+        self.chip = chip.lower()
+
+    def test_single(self, case: str):
+        np.random.seed(0)
+        print("Test: {}".format(case))
+        if case in self.test_function:
+            self.test_function[case](case)
+            print("====== TEST {} Success ======".format(case))
+        else:
+            raise RuntimeError("case [{}] is not exist".format(case))
+
+    def load(self, case: str, mlir: str, mem_mode: str = "value_mem"):
+        mlir_file = "{}.mlir".format(case)
+        with open(mlir_file, "w") as f:
+            f.write(mlir)
+        # decode and dirty reruns keep activations, not in reused mem
+        pymlir.set_mem_mode(mem_mode)
+        module = pymlir.module()
+        module.load(mlir_file)
+        return module
+
+    def compare_mem_modes(self, case: str, mlir: str, inputs: dict, expects: dict):
+        # tensors sharing storage in reused mem must give the value_mem results
+        for mem_mode in ["value_mem", "reused_mem"]:
+            module = self.load(case, mlir, mem_mode)
+            for name, data in inputs.items():
+                module.set_tensor(name, data)
+            module.invoke()
+            for name, expect in expects.items():
+                if not np.allclose(module.get_tensor(name), expect, atol=1e-5):
+                    raise RuntimeError("{} of {} differs from the reference".format(
+                        name, mem_mode))
+
+    def test_AddBroadcast(self, case_name):
+        # o1 = 2 * b + 3 * x, o2 = o1 + 2 * b, b broadcasts over dim 1
+        body = (
+            '    %0 = "top.Input"(%arg0) : (tensor<1x4x8xf32>) -> tensor<1x4x8xf32> loc("x")\n'
+            '    %1 = "top.Input"(%arg1) : (tensor<1x1x8xf32>) -> tensor<1x1x8xf32> loc("b")\n'
+            '    %2 = "top.MulConst"(%0) {const_val = 3.000000e+00 : f64} : (tensor<1x4x8xf32>) -> tensor<1x4x8xf32> loc("xm")\n'
+            '    %3 = "top.MulConst"(%1) {const_val = 2.000000e+00 : f64} : (tensor<1x1x8xf32>) -> tensor<1x1x8xf32> loc("bm")\n'
+            '    %4 = "top.Add"(%3, %2) : (tensor<1x1x8xf32>, tensor<1x4x8xf32>) -> tensor<1x4x8xf32> loc("o1")\n'
+            '    %5 = "top.Add"(%4, %3) : (tensor<1x4x8xf32>, tensor<1x1x8xf32>) -> tensor<1x4x8xf32> loc("o2")\n'
+            '    return %5 : tensor<1x4x8xf32> loc(unknown)\n')
+        mlir = top_mlir(case_name, "%arg0: tensor<1x4x8xf32>, %arg1: tensor<1x1x8xf32>",
+                        "tensor<1x4x8xf32>", body)
+        x = np.random.randn(1, 4, 8).astype(np.float32)
+        b = np.random.randn(1, 1, 8).astype(np.float32)
+        self.compare_mem_modes(case_name, mlir, {"x": x, "b": b}, {"o2": 4 * b + 3 * x})
+
+    def test_ConcatInputRead(self, case_name):
+        # c = concat(2 * a, 3 * b), 2 * a is read again after the concat
+        body = (
+            '    %0 = "top.Input"(%arg0) : (tensor<1x4xf32>) -> tensor<1x4xf32> loc("a")\n'
+            '    %1 = "top.Input"(%arg1) : (tensor<1x4xf32>) -> tensor<1x4xf32> loc("b")\n'
+            '    %2 = "top.MulConst"(%0) {const_val = 2.000000e+00 : f64} : (tensor<1x4xf32>) -> tensor<1x4xf32> loc("a2")\n'
+            '    %3 = "top.MulConst"(%1) {const_val = 3.000000e+00 : f64} : (tensor<1x4xf32>) -> tensor<1x4xf32> loc("b3")\n'
+            '    %4 = "top.Concat"(%2, %3) {axis = 1 : si32} : (tensor<1x4xf32>, tensor<1x4xf32>) -> tensor<1x8xf32> loc("c")\n'
+            '    %5 = "top.MulConst"(%4) {const_val = 5.000000e+00 : f64} : (tensor<1x8xf32>) -> tensor<1x8xf32> loc("c5")\n'
+            '    %6 = "top.AddConst"(%2) {const_val = 1.000000e+00 : f64} : (tensor<1x4xf32>) -> tensor<1x4xf32> loc("a3")\n'
+            '    return %5, %6 : tensor<1x8xf32>, tensor<1x4xf32> loc(unknown)\n')
+        mlir = top_mlir(case_name, "%arg0: tensor<1x4xf32>, %arg1: tensor<1x4xf32>",
+                        "tensor<1x8xf32>, tensor<1x4xf32>", body)
+        a = np.random.randn(1, 4).astype(np.float32)
+        b = np.random.randn(1, 4).astype(np.float32)
+        c5 = 5 * np.concatenate([2 * a, 3 * b], axis=1)
+        self.compare_mem_modes(case_name, mlir, {"a": a, "b": b}, {"c5": c5, "a3": 2 * a + 1})
+
+    def test_Decode(self, case_name):
+        # y = sum(concat(past_k, 2 * x)) + x, the cache takes 2 * x each step
+        capacity, dim, steps = 8, 4, 5
+        body = (
+            '    %0 = "top.Input"(%arg0) : (tensor<1x1x{D}xf32>) -> tensor<1x1x{D}xf32> loc("x")\n'
+            '    %1 = "top.Input"(%arg1) : (tensor<1x{C}x{D}xf32>) -> tensor<1x{C}x{D}xf32> loc("past_k")\n'
+            '    %2 = "top.MulConst"(%0) {{const_val = 2.000000e+00 : f64}} : (tensor<1x1x{D}xf32>) -> tensor<1x1x{D}xf32> loc("k")\n'
+            '    %3 = "top.Concat"(%1, %2) {{axis = 1 : si32}} : (tensor<1x{C}x{D}xf32>, tensor<1x1x{D}xf32>) -> tensor<1x{C1}x{D}xf32> loc("present_k")\n'
+            '    %4 = "top.Reduce"(%3) {{axes = [1], keepdims = true, mode = "ReduceSum"}} : (tensor<1x{C1}x{D}xf32>) -> tensor<1x1x{D}xf32> loc("s")\n'
+            '    %5 = "top.Add"(%4, %0) : (tensor<1x1x{D}xf32>, tensor<1x1x{D}xf32>) -> tensor<1x1x{D}xf32> loc("y")\n'
+            '    return %5 : tensor<1x1x{D}xf32> loc(unknown)\n').format(C=capacity,
+                                                                      C1=capacity + 1,
+                                                                      D=dim)
+        mlir = top_mlir(case_name,
+                        "%arg0: tensor<1x1x{D}xf32>, %arg1: tensor<1x{C}x{D}xf32>".format(
+                            C=capacity, D=dim), "tensor<1x1x{}xf32>".format(dim), body)
+        decoder = self.load(case_name, mlir)
+        decoder.decode_init(["past_k"], ["present_k"], 1)
+        tokens = np.random.randn(steps, 1, 1, dim).astype(np.float32)
+        for t in range(steps):
+            decoder.set_tensor("x", tokens[t])
+            decoder.decode_step()
+            y = decoder.get_tensor("y").copy()
+            # the same step with the whole cache given at once
+            full = self.load(case_name, mlir)
+            past = np.zeros((1, capacity, dim), dtype=np.float32)
+            past[0, :t] = 2 * tokens[:t, 0, 0]
+            full.set_tensor("x", tokens[t])
+            full.set_tensor("past_k", past)
+            full.invoke()
+            if not np.allclose(y, full.get_tensor("y"), atol=1e-5):
+                raise RuntimeError("decode step {} differs from a full invoke".format(t))
+        if decoder.decode_position != steps:
+            raise RuntimeError("decode position {} != {}".format(decoder.decode_position, steps))
+        cache = np.zeros((1, capacity, dim), dtype=np.float32)
+        cache[0, :steps] = 2 * tokens[:, 0, 0]
+        if not np.allclose(decoder.get_tensor("past_k"), cache, atol=1e-5):
+            raise RuntimeError("kv cache is not filled in token order")
+        # a step past the capacity is an error, not a wrap around
+        for t in range(steps, capacity):
+            decoder.set_tensor("x", tokens[0])
+            decoder.decode_step()
+        try:
+            decoder.decode_step()
+        except RuntimeError:
+            pass
+        else:
+            raise RuntimeError("decode past the capacity should fail")
+        decoder.decode_reset()
+        if decoder.decode_position != 0:
+            raise RuntimeError("decode_reset should go back to position 0")
+
+    def test_DirtyRerun(self, case_name):
+        # out = 3 * a + 2 * (b + 1), setting a only dirties ya and out
+        body = (
+            '    %0 = "top.Input"(%arg0) : (tensor<1x4xf32>) -> tensor<1x4xf32> loc("a")\n'
+            '    %1 = "top.Input"(%arg1) : (tensor<1x4xf32>) -> tensor<1x4xf32> loc("b")\n'
+            '    %2 = "top.MulConst"(%0) {const_val = 3.000000e+00 : f64} : (tensor<1x4xf32>) -> tensor<1x4xf32> loc("ya")\n'
+            '    %3 = "top.AddConst"(%1) {const_val = 1.000000e+00 : f64} : (tensor<1x4xf32>) -> tensor<1x4xf32> loc("yb")\n'
+            '    %4 = "top.MulConst"(%3) {const_val = 2.000000e+00 : f64} : (tensor<1x4xf32>) -> tensor<1x4xf32> loc("yb2")\n'
+            '    %5 = "top.Add"(%2, %4) : (tensor<1x4xf32>, tensor<1x4xf32>) -> tensor<1x4xf32> loc("out")\n'
+            '    return %5 : tensor<1x4xf32> loc(unknown)\n')
+        mlir = top_mlir(case_name, "%arg0: tensor<1x4xf32>, %arg1: tensor<1x4xf32>",
+                        "tensor<1x4xf32>", body)
+        a = np.random.randn(1, 4).astype(np.float32)
+        b = np.random.randn(1, 4).astype(np.float32)
+        module = self.load(case_name, mlir)
+        module.set_tensor("a", a)
+        module.set_tensor("b", b)
+        module.invoke()
+        ran = []
+        module.after_invoke(lambda name: ran.append(name))
+
+        def rerun(expect: set, run):
+            ran.clear()
+            run()
+            if set(ran) != expect or len(ran) != len(expect):
+                raise RuntimeError("rerun {}, expect {}".format(ran, sorted(expect)))
+
+        # nothing changed, nothing to run
+        rerun(set(), lambda: module.invoke_to("out"))
+        a = np.random.randn(1, 4).astype(np.float32)
+        module.set_tensor("a", a)
+        rerun({"ya", "out"}, lambda: module.invoke_to("out"))
+        out = module.get_tensor("out").copy()
+        b = np.random.randn(1, 4).astype(np.float32)
+        module.set_tensor("b", b)
+        rerun({"yb", "yb2"}, lambda: module.invoke_to("yb2"))
+        rerun({"out"}, lambda: module.invoke_to("out"))
+        out_b = module.get_tensor("out").copy()
+        module.clear_hooks()
+        # the same inputs with every step run
+        full = self.load(case_name, mlir)
+        full.set_tensor("a", a)
+        full.set_tensor("b", b)
+        full.invoke()
+        if not np.allclose(out_b, full.get_tensor("out"), atol=1e-5):
+            raise RuntimeError("dirty reruns differ from a full invoke")
+        if np.allclose(out, out_b, atol=1e-5):
+            raise RuntimeError("setting b did not change out")
+
+    def test_FakeQuant(self, case_name):
+        # y = 3 * x + 1, run with virtual INT8 and BF16 lowering
+        body = (
+            '    %0 = "top.Input"(%arg0) : (tensor<1x16xf32>) -> tensor<1x16xf32> loc("x")\n'
+            '    %1 = "top.MulConst"(%0) {const_val = 3.000000e+00 : f64} : (tensor<1x16xf32>) -> tensor<1x16xf32> loc("m")\n'
+            '    %2 = "top.AddConst"(%1) {const_val = 1.000000e+00 : f64} : (tensor<1x16xf32>) -> tensor<1x16xf32> loc("y")\n'
+            '    return %2 : tensor<1x16xf32> loc(unknown)\n')
+        mlir = top_mlir(case_name, "%arg0: tensor<1x16xf32>", "tensor<1x16xf32>", body)
+        cali_table = "{}_cali_table".format(case_name)
+        with open(cali_table, "w") as f:
+            f.write("# name threshold min max\nm 4.0 -4.0 4.0\ny 5.0 -5.0 5.0\n")
+        x = np.random.randn(1, 16).astype(np.float32)
+
+        def int8(v, th):
+            scale = np.float32(th / 127.0)
+            q = v / scale
+            q = np.clip(np.sign(q) * np.floor(np.abs(q) + 0.5), -128, 127)
+            return (q * scale).astype(np.float32)
+
+        def bf16(v):
+            u = v.astype(np.float32).view(np.uint32).astype(np.uint64)
+            u = (u + 0x7FFF + ((u >> 16) & 1)) & 0xFFFF0000
+            return u.astype(np.uint32).view(np.float32)
+
+        module = self.load(case_name, mlir)
+        module.set_calibration_table(cali_table)
+        module.set_tensor("x", x)
+        module.set_quant_mode("INT8")
+        module.invoke()
+        y = int8(int8(3 * x, 4.0) + 1, 5.0)
+        if not np.allclose(module.get_tensor("y"), y, atol=1e-5):
+            raise RuntimeError("virtual INT8 differs from fake quant by hand")
+        module.clear_quant_mode()
+        module.set_op_quant_mode("y", "BF16")
+        module.invoke()
+        if not np.allclose(module.get_tensor("y"), bf16(3 * x + 1), atol=1e-5):
+            raise RuntimeError("virtual BF16 of y differs from fake quant by hand")
+
+
+        # out = 3 * concat(concat(2 * a, 2 * b), 2 * c)
+        body = (
+            '    %0 = "top.Input"(%arg0) : (tensor<1x4xf32>) -> tensor<1x4xf32> loc("a")\n'
+            '    %1 = "top.Input"(%arg1) : (tensor<1x4xf32>) -> tensor<1x4xf32> loc("b")\n'
+            '    %2 = "top.Input"(%arg2) : (tensor<1x4xf32>) -> tensor<1x4xf32> loc("c")\n'
+            '    %3 = "top.MulConst"(%0) {const_val = 2.000000e+00 : f64} : (tensor<1x4xf32>) -> tensor<1x4xf32> loc("a2")\n'
+            '    %4 = "top.MulConst"(%1) {const_val = 2.000000e+00 : f64} : (tensor<1x4xf32>) -> tensor<1x4xf32> loc("b2")\n'
+            '    %5 = "top.Concat"(%3, %4) {axis = 1 : si32} : (tensor<1x4xf32>, tensor<1x4xf32>) -> tensor<1x8xf32> loc("ab")\n'
+            '    %6 = "top.MulConst"(%2) {const_val = 2.000000e+00 : f64} : (tensor<1x4xf32>) -> tensor<1x4xf32> loc("c2")\n'
+            '    %7 = "top.Concat"(%5, %6) {axis = 1 : si32} : (tensor<1x8xf32>, tensor<1x4xf32>) -> tensor<1x12xf32> loc("abc")\n'
+            '    %8 = "top.MulConst"(%7) {const_val = 3.000000e+00 : f64} : (tensor<1x12xf32>) -> tensor<1x12xf32> loc("out")\n'
+            '    return %8 : tensor<1x12xf32> loc(unknown)\n')
+        mlir = top_mlir(case_name,
+                        "%arg0: tensor<1x4xf32>, %arg1: tensor<1x4xf32>, %arg2: tensor<1x4xf32>",
+                        "tensor<1x12xf32>", body)
+        a, b, c = [np.random.randn(1, 4).astype(np.float32) for _ in range(3)]
+        out = 6 * np.concatenate([a, b, c], axis=1)
+        self.compare_mem_modes(case_name, mlir, {"a": a, "b": b, "c": c}, {"out": out})
+
+    def test_ReshapeInplace(self, case_name):
+        # y = relu(reshape(2 * x)), the reshape view is read again by out
+        body = (
+            '    %0 = "top.Input"(%arg0) : (tensor<1x4x8xf32>) -> tensor<1x4x8xf32> loc("x")\n'
+            '    %1 = "top.MulConst"(%0) {const_val = 2.000000e+00 : f64} : (tensor<1x4x8xf32>) -> tensor<1x4x8xf32> loc("m")\n'
+            '    %2 = "top.Reshape"(%1) {shape = [1, 32]} : (tensor<1x4x8xf32>) -> tensor<1x32xf32> loc("r")\n'
+            '    %3 = "top.Relu"(%2) : (tensor<1x32xf32>) -> tensor<1x32xf32> loc("y")\n'
+            '    %4 = "top.Add"(%3, %2) : (tensor<1x32xf32>, tensor<1x32xf32>) -> tensor<1x32xf32> loc("out")\n'
+            '    return %4 : tensor<1x32xf32> loc(unknown)\n')
+        mlir = top_mlir(case_name, "%arg0: tensor<1x4x8xf32>", "tensor<1x32xf32>", body)
+        x = np.random.randn(1, 4, 8).astype(np.float32)
+        r = 2 * x.reshape(1, 32)
+        self.compare_mem_modes(case_name, mlir, {"x": x}, {"out": np.maximum(r, 0) + r})
+
+
+def test_all(tester: INTERPRETER_TESTER):
+    error_cases = []
+    success_cases = []
+    for case in tester.test_function:
+        try:
+            tester.test_single(case)
+            success_cases.append(case)
+        except:
+            traceback.print_exc()
+            error_cases.append(case)
+    print("Success: {}".format(success_cases))
+    print("Failure: {}".format(error_cases))
+    if error_cases:
+        print("====== test_interpreter.py --chip {} TEST Failed ======".format(tester.chip))
+    else:
+        print("====== test_interpreter.py --chip {} TEST Success ======".format(tester.chip))
+    return error_cases
+
+
+if __name__ == "__main__":
+    import argparse
+    parser = argparse.ArgumentParser()
+    # yapf: disable
+    parser.add_argument("--chip", default="bm1684x", type=str,
+                        choices=['bm1684x'], help="chip platform name")
+    parser.add_argument("--case", default="all", type=str, help="test one case, if all, then test all cases")
+    parser.add_argument("--show_all", action="store_true", help='show all cases')
+    # yapf: enable
+    args = parser.parse_args()
+    tester = INTERPRETER_TESTER(args.chip)
+    if args.show_all:
+        print("====== Show All Cases ============")
+        for case in tester.test_function:
+            print(case)
+        exit(0)
+    dir = "interpreter_test_{}".format(args.chip)
+    os.makedirs(dir, exist_ok=True)
+    os.chdir(dir)
+    if args.case == "" or args.case.lower() == "all":
+        test_all(tester)
+    else:
+        tester.test_single(args.case)
@@ -59,6 +59,9 @@ class DeployTool:
         self.mlir_file = args.mlir
         self.chip = args.chip
         self.includeWeight = args.includeWeight
+        self.cpu_backend = args.cpu_backend
+        self.cpu_tile_size = args.cpu_tile_size
+        self.cpu_parallel = args.cpu_parallel
         self.excepts = args.excepts
         self.tolerance = args.tolerance
         self.test_input = args.test_input
@@ -71,6 +74,7 @@ class DeployTool:
         self.quant_output_list = args.quant_output_list
         self.quantize_table = args.quantize_table
         self.embed_debug_info = args.debug
+        self.codegen_cache_dir = args.codegen_cache_dir
         self.model = args.model
         self.ref_npz = args.test_reference
         self.customization_format = args.customization_format
@@ -87,6 +91,7 @@ class DeployTool:
         self.ignore_f16_overflow = args.ignore_f16_overflow
         self.num_device = args.num_device
         self.num_core = args.num_core
+        self.dev_parallel = args.dev_parallel
         self.correctness = "0.99,0.90"
         if self.quantize_table:
             self.correctness = "0.99,0.85"
@@ -111,9 +116,14 @@ class DeployTool:
 
     def lowering(self):
         if self.chip == 'cpu':
-            top_to_tosa(self.mlir_file, "tmp_tosa.mlir", self.includeWeight)
+            if self.cpu_backend == "linalg":
+                # the linalg backend needs weights in the object file
+                top_to_linalg(self.mlir_file, "tmp_tosa.mlir", True)
+                self.tosa_mlir = "{}_linalg.mlir".format(self.prefix)
+            else:
+                top_to_tosa(self.mlir_file, "tmp_tosa.mlir", self.includeWeight)
+                self.tosa_mlir = "{}_tosa.mlir".format(self.prefix)
             # replace func name from "main" to "model"
-            self.tosa_mlir = "{}_tosa.mlir".format(self.prefix)
             with open("tmp_tosa.mlir", "r", encoding="utf-8") as file:
                 content = file.read()
             content = content.replace("main", "model")
@@ -227,13 +237,18 @@ class DeployTool:
 
     def build_model(self):
         if self.chip == 'cpu':
-            tosa_to_llvm(self.tosa_mlir, self.model)
+            if self.cpu_backend == "linalg":
+                linalg_to_llvm(self.tosa_mlir, self.model, self.cpu_tile_size,
+                               self.cpu_parallel)
+            else:
+                tosa_to_llvm(self.tosa_mlir, self.model)
         else:
             mlir_to_model(self.tpu_mlir, self.model, self.final_mlir, self.dynamic,
                           self.quant_input, self.quant_output, self.quant_input_list,
                           self.quant_output_list, self.disable_layer_group, self.opt,
                           self.merge_weight, self.op_divide,
-                          self.embed_debug_info, self.model_version)
+                          self.embed_debug_info, self.model_version, self.dev_parallel,
+                          self.codegen_cache_dir)
             if not self.skip_validation and self.do_validate and self.cache_tool.do_model_validate(self.model, self.model_npz):
                 tool.validate_model()
 
@@ -275,6 +290,16 @@ if __name__ == '__main__':
     # tosa includeWeight
     parser.add_argument("--includeWeight", action='store_true',
                         help="include weight in tosa.mlir")
+    # cpu backend
+    parser.add_argument("--cpu_backend", default="tosa", type=str.lower,
+                        choices=["tosa", "linalg"],
+                        help="lowering path for chip cpu, linalg adds tile-and-fuse, "
+                        "vectorization and parallel loops")
+    parser.add_argument("--cpu_tile_size", default=32, type=int,
+                        help="tile size of the linalg cpu backend, 0 disables tiling")
+    parser.add_argument("--cpu_parallel", default="none", type=str.lower,
+                        choices=["async", "omp", "none"],
+                        help="parallel runtime of the linalg cpu backend")
     # fuse preprocess
     parser.add_argument("--fuse_preprocess", action='store_true',
                         help="add tpu preprocesses (mean/scale/channel_swap) in the front of model")
@@ -311,8 +336,14 @@ if __name__ == '__main__':
                         help="The number of devices to run for distributed computation.")
     parser.add_argument("--num_core", default=1, type=int,
                         help="The number of TPU cores used for parallel computation.")
+    parser.add_argument("--dev_parallel", default="tensor", type=str.lower,
+                        choices=["tensor", "pipeline", "data"],
+                        help="how to distribute the model when num_device > 1; tensor: split large matmul/attention, pipeline: one stage per device, data: split the batch")
     parser.add_argument("--debug", action='store_true', help='to keep all intermediate files for debug')
     parser.add_argument("--cache_skip", action='store_true', help='skip checking the correctness when generate same mlir and bmodel.')
+    parser.add_argument("--codegen_cache_dir", default="", type=str,
+                        help="reuse the commands of unchanged subnets cached in this directory, "
+                        "for compiling the same model repeatedly")
     parser.add_argument("--skip_validation", action='store_true', help='skip checking the correctness of bmodel.')
     parser.add_argument("--merge_weight", action="store_true", default=False,
                         help="merge weights into one weight binary with previous generated cvimodel")
@@ -13,44 +13,46 @@ import numpy as np
 from utils.mlir_shell import *
 
 
+def write_capi_inputs(data, filename: str):
+    # int64 num, then per input: int64 rank, int64 shape[rank], float data[]
+    with open(filename, "wb") as f:
+        np.array([len(data.files)], dtype=np.int64).tofile(f)
+        for name in data.files:
+            x = np.ascontiguousarray(data[name], dtype=np.float32)
+            print("Shape of input {}: {}".format(name, x.shape))
+            np.array([x.ndim] + list(x.shape), dtype=np.int64).tofile(f)
+            x.tofile(f)
+
+
 if __name__ == '__main__':
     parser = argparse.ArgumentParser()
     parser.add_argument("--input", required=True, help="input npz file")
     parser.add_argument("--model", type=str, required=True,
                         help="CPU object file , .o")
-    # TODO: Requiring users to specify this argument is quite unreasonable
-    #parser.add_argument("--output_size", required=True, help="size of the output tensor")
-    parser.add_argument("--output_shape", required=True, help="shape of the output tensor")
+    parser.add_argument("--output_shape", required=True,
+                        help="shapes of the output tensors, like 1x1000,1x4")
+    parser.add_argument("--backend", default="tosa", choices=["tosa", "linalg"],
+                        help="lowering path used to build the model")
+    parser.add_argument("--parallel", default="none", choices=["async", "omp", "none"],
+                        help="parallel runtime used to build the model")
+    parser.add_argument("--output", default="inference_result.npz", help="output npz file")
     args = parser.parse_args()
 
     # prepare input for c_interface
     data = np.load(args.input)
-    f = open("data_for_capi.txt", "w")
-    # TODO: Currently, only cases with one input of 4-D considered 
-    data_input = data[data.files[0]]
-    input_shape = data_input.shape
-    print("Shape of input data:", input_shape)
-    print("Generating data_for_capi.txt ...")
-    f.write("%ld\n" %input_shape[0])
-    f.write("%ld\n" %input_shape[1])
-    f.write("%ld\n" %input_shape[2])
-    f.write("%ld\n" %input_shape[3])
-    data_size = input_shape[0] * input_shape[1] * input_shape[2] * input_shape[3]
-    f.write("%ld\n" %data_size)
-    for i in range(input_shape[0]):
-        for j in range(input_shape[1]):
-            for k in range(input_shape[2]):
-                for t in range(input_shape[3]):
-                    f.write("%f\n" %data_input[i][j][k][t])
-    f.close()
-    print("Successfully generate data_for_capi.txt!")
-    # inference_result.txt will be generated
-    output_shape = args.output_shape.replace("x", "*")
-    #output_size = 1
-    #for i in output_shape:
-    #    output_size = output_size * eval(i)
-    model_inference_cpu(args.model, eval(output_shape))
-
-
-
-    
\ No newline at end of file
+    print("Generating data_for_capi.bin ...")
+    write_capi_inputs(data, "data_for_capi.bin")
+    print("Successfully generate data_for_capi.bin!")
+    output_shapes = [[int(d) for d in shape.split("x")]
+                     for shape in args.output_shape.split(",")]
+    # inference_result.bin will be generated
+    model_inference_cpu(args.model, output_shapes, args.backend, args.parallel)
+    result = np.fromfile("inference_result.bin", dtype=np.float32)
+    outputs = {}
+    offset = 0
+    for i, shape in enumerate(output_shapes):
+        size = int(np.prod(shape))
+        outputs["output_{}".format(i)] = result[offset:offset + size].reshape(shape)
+        offset += size
+    np.savez(args.output, **outputs)
+    print("Results are saved in {}".format(args.output))
@@ -44,11 +44,15 @@ if __name__ == '__main__':
     parser.add_argument('-o', '--quantize_table', required=True,
                         help='output searched bf16 layer table')
     parser.add_argument('--debug_cmd', type=str, default='', help='debug cmd')
+    parser.add_argument('--fast', action='store_true',
+                        help='rank layers by their cos in the int8 model natively, and set the worst to float at once')
 
     # yapf: enable
     args = parser.parse_args()
     searcher = MixPrecSearcher(args)
     if 'run_bias_correction' in args.debug_cmd:
         searcher.run_bias_correction()
+    elif args.fast:
+        searcher.run_fast()
     else:
         searcher.run()
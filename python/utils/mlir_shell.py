@@ -118,7 +118,9 @@ def mlir_to_model(tpu_mlir: str,
                   merge_weight: bool = False,
                   op_divide: bool = False,
                   embed_debug_info: bool = False,
-                  model_version: str = ""):
+                  model_version: str = "",
+                  dev_parallel: str = "tensor",
+                  codegen_cache_dir: str = ""):
     # generate final mlir
     strip_io_quant_param = '--strip-io-quant="quant_input={} quant_output={} quant_input_list={} quant_output_list={}"'.format(
         quant_input, quant_output, quant_input_list, quant_output_list)
@@ -130,7 +132,7 @@ def mlir_to_model(tpu_mlir: str,
     #address_assign_param = '--address-assign="reuse_addr=false"'
     if merge_weight:
         address_assign_param = '--address-assign="merge_weight=true weight_map_file=_weight_map.csv"'
-    distribute_param = f"--dev-parallel"
+    distribute_param = f'--dev-parallel="mode={dev_parallel}"'
     parallel_param = f"--core-parallel"
 
     op_divide_param = ""
@@ -157,8 +159,9 @@ def mlir_to_model(tpu_mlir: str,
     _os_system(cmd)
 
     # codegen based on final mlir
+    cache_param = f" cache_dir={codegen_cache_dir}" if codegen_cache_dir else ""
     codegen_param = (
-        f'--codegen="model_file={model} embed_debug_info={str(embed_debug_info).lower()} model_version={str(model_version).lower()}"'
+        f'--codegen="model_file={model} embed_debug_info={str(embed_debug_info).lower()} model_version={str(model_version).lower()}{cache_param}"'
     )
     cmd = [
         "tpuc-opt",
@@ -231,27 +234,108 @@ def tosa_to_llvm(tosa_mlir: str,
     ])
     _os_system(cmd)
 
+# TOPTOLINALG
+def top_to_linalg(top_mlir: str,
+                  linalg_mlir: str,
+                  includeWeight: bool = True):
+    cmd = ["tpuc-opt", top_mlir]
+    lower_param = "--convert-top-to-linalg=\"includeWeight="
+    if includeWeight:
+        lower_param += "True\""
+    else:
+        lower_param += "False\""
+    cmd.extend([
+        lower_param,
+        "--canonicalize",
+        "-o",
+        linalg_mlir
+    ])
+    _os_system(cmd)
+
+# LINALGTOLLVMIR
+# tile_size: tile size of fusion roots, 0 disables tile-and-fuse
+# parallel: "none", "omp" or "async" (libmlir_async_runtime)
+# Buffers are not shared between tensors: allocations are only hoisted out of
+# loops, and the ones up to 4KB are moved to the stack. Results are copied into
+# caller provided buffers.
+def linalg_to_llvmir(linalg_mlir: str,
+                     llfile: str,
+                     tile_size: int = 32,
+                     parallel: str = "none"):
+    fuse = "mlir-opt {} --linalg-fuse-elementwise-ops --canonicalize ".format(linalg_mlir)
+    if tile_size > 0:
+        fused_mlir = linalg_mlir[:-len(".mlir")] + "_fused.mlir" \
+            if linalg_mlir.endswith(".mlir") else linalg_mlir + "_fused"
+        _os_system([fuse, "-o", fused_mlir])
+        fuse = "tpuc-opt {} --codegen-tile-and-fuse-greedily=\"tile-size={}\" --cse ".format(
+            fused_mlir, tile_size)
+    if parallel == "async":
+        parallel_param = ("async-parallel-for{async-dispatch=true}, async-to-async-runtime, "
+                          "func.func(async-runtime-ref-counting, async-runtime-ref-counting-opt), "
+                          "convert-async-to-llvm, ")
+    elif parallel == "omp":
+        parallel_param = "convert-scf-to-openmp, "
+    else:
+        parallel_param = ""
+    lower_param = (
+        "--pass-pipeline=\"builtin.module("
+        "one-shot-bufferize{bufferize-function-boundaries function-boundary-type-conversion=identity-layout-map}, "
+        "buffer-results-to-out-params, "
+        "func.func(buffer-hoisting, buffer-loop-hoisting, promote-buffers-to-stack{max-alloc-size-in-bytes=4096}), "
+        "func.func(buffer-deallocation), "
+        "func.func(canonicalize, convert-linalg-to-affine-loops, affine-loop-invariant-code-motion, affine-scalrep, "
+        "affine-super-vectorize{virtual-vector-size=8 vectorize-reductions=true}, affine-parallelize{max-nested=1}, "
+        "lower-affine, canonicalize), "
+        + parallel_param +
+        "func.func(llvm-request-c-wrappers), "
+        "convert-scf-to-cf, convert-openmp-to-llvm, convert-vector-to-llvm, expand-strided-metadata, lower-affine, "
+        "finalize-memref-to-llvm, convert-math-to-llvm, convert-math-to-libm, convert-arith-to-llvm, "
+        "convert-func-to-llvm, convert-cf-to-llvm, canonicalize, reconcile-unrealized-casts)\" ")
+    cmd = [fuse, "| mlir-opt", lower_param, "| mlir-translate --mlir-to-llvmir", "-o", llfile]
+    _os_system(cmd)
+
+# LINALGTOObj
+def linalg_to_llvm(linalg_mlir: str,
+                   objfile: str,
+                   tile_size: int = 32,
+                   parallel: str = "none"):
+    llfile = objfile[:-len(".o")] + ".ll" if objfile.endswith(".o") else objfile + ".ll"
+    linalg_to_llvmir(linalg_mlir, llfile, tile_size, parallel)
+    cmd = ["llc -O3 -mtriple=x86_64-unknown-linux-gnu --filetype=obj", llfile, "-o", objfile]
+    _os_system(cmd)
+
 # Model inference on CPU
+# backend: "tosa" models return their single result, "linalg" models write
+# results into caller provided buffers
 def model_inference_cpu(objfile: str,
-                        output_size: str):
+                        output_shapes: list,
+                        backend: str = "tosa",
+                        parallel: str = "none"):
     # generate executable file: a.out
     print("Generating executable file a.out ...")
     ccompiler = "clang"
-    cfile = "/workspace/tpu-mlir/capi/runtime_cpu.c"
-    model = objfile
-    lib1 = "/workspace/tpu-mlir/capi/lib/libmlir_c_runner_utils.so.17git"
-    lib2 = "/workspace/tpu-mlir/capi/lib/libmlir_runner_utils.so.17git"
-    lib3 = "/workspace/tpu-mlir/capi/lib/libmlir_float16_utils.so.17git"
-    lib4 = "-lm"
-    cflag = "-fPIC"
-    cmd = [ccompiler, cfile, model, lib1, lib2, lib3, lib4, cflag]
+    capi = "/workspace/tpu-mlir/capi"
+    cmd = [ccompiler, "-O2", "-fPIC", "-I" + capi, capi + "/runtime_cpu.c", objfile]
+    if backend == "tosa":
+        cmd.append("-DTPU_CPU_RESULT_RETURNED")
+    cmd.extend([
+        capi + "/lib/libmlir_c_runner_utils.so.17git",
+        capi + "/lib/libmlir_runner_utils.so.17git",
+        capi + "/lib/libmlir_float16_utils.so.17git"
+    ])
+    if parallel == "async":
+        cmd.append(capi + "/lib/libmlir_async_runtime.so.17git")
+    elif parallel == "omp":
+        cmd.append("-fopenmp")
+    cmd.append("-lm")
     _os_system(cmd)
     print("Successfully generate executable file a.out!")
     # execute model inference
     print("Runing ...")
-    cmd1 = ["./a.out", output_size]
+    cmd1 = ["./a.out", "data_for_capi.bin", "inference_result.bin"]
+    cmd1.extend(["x".join(str(d) for d in shape) for shape in output_shapes])
     _os_system(cmd1)
-    print("Inference ends successfully! Results are saved in inference_result.txt.")
+    print("Inference ends successfully! Results are saved in inference_result.bin.")
 
 # Extra tool: delete file in current directory
 def delete_file(file: str):
@@ -18,6 +18,7 @@ import test_tpulang
 import test_torch
 import test_tflite
 import test_onnx
+import test_interpreter
 import argparse
 import logging
 from utils.mlir_shell import _os_system_log
@@ -62,6 +63,7 @@ class MAIN_ENTRY(object):
             "tflite":   (test_tflite.TFLITE_IR_TESTER,   test_tflite.test_all, ["bm1684x", "bm1688"]),
             "torch":    (test_torch.TORCH_IR_TESTER,     test_torch.test_all,  ["bm1684", "bm1684x", "bm1688", "cv183x"]),
             "tpulang":  (test_tpulang.TPULANG_IR_TESTER, test_tpulang.test_all, ["bm1684x"]),
+            "interpreter": (test_interpreter.INTERPRETER_TESTER, test_interpreter.test_all, ["bm1684x"]),
         }
         # yapf: enable
         self.test_set = {
@@ -119,7 +121,7 @@ class MAIN_ENTRY(object):
         case_name = f"{op_source}_test_{chip}"
         os.makedirs(case_name, exist_ok=True)
         os.chdir(dir)
-        if op_source == "tflite" or op_source == "tpulang":
+        if op_source in ("tflite", "tpulang", "interpreter"):
             tester = tester(chip=chip)
         else:
             tester = tester(chip=chip, simple=self.is_basic)
@@ -0,0 +1,59 @@
+// RUN: tpuc-test %s --ISel | FileCheck %s
+// RUN: tpuc-test %s --ISel --codegen-tile-and-fuse-greedily --cse | FileCheck %s --check-prefix=TILE
+
+// A small matmul fits in local memory, it is annotated but not tiled.
+// CHECK-LABEL: func.func @matmul
+// CHECK: linalg.matmul
+// CHECK-SAME: sg2260.cycle = {{[0-9]+}} : i64
+// CHECK-SAME: sg2260.isel = "{{[^"]+}}"
+func.func @matmul(%a: tensor<64x64xf32>, %b: tensor<64x64xf32>) -> tensor<64x64xf32> {
+  %zero = arith.constant 0.0 : f32
+  %init = tensor.empty() : tensor<64x64xf32>
+  %fill = linalg.fill ins(%zero : f32) outs(%init : tensor<64x64xf32>) -> tensor<64x64xf32>
+  %mm = linalg.matmul ins(%a, %b : tensor<64x64xf32>, tensor<64x64xf32>)
+                      outs(%fill : tensor<64x64xf32>) -> tensor<64x64xf32>
+  return %mm : tensor<64x64xf32>
+}
+
+// Both ops overflow local memory and have to be tiled. The product is read
+// twice by the sum, so it can not be recomputed in the tiles of the sum.
+// CHECK-LABEL: func.func @no_fuse
+// CHECK: linalg.generic
+// CHECK-SAME: __linalg_no_fuse__, __linalg_tiling__ = array<i64:
+// CHECK-SAME: sg2260.cycle = {{[0-9]+}} : i64
+// CHECK-SAME: sg2260.isel = "{{[^"]+}}"
+// CHECK: arith.mulf
+// CHECK: linalg.generic
+// CHECK-SAME: __linalg_no_fuse__, __linalg_tiling__ = array<i64:
+// CHECK-SAME: sg2260.cycle = {{[0-9]+}} : i64
+// CHECK-SAME: sg2260.isel = "{{[^"]+}}"
+// CHECK: arith.addf
+
+// The sum is tiled over the product, which stays in its own loops.
+// TILE-LABEL: func.func @no_fuse
+// TILE: %[[MUL:[0-9]+]] = scf.for
+// TILE: arith.mulf
+// TILE: scf.for
+// TILE-NOT: arith.mulf
+// TILE: tensor.extract_slice %[[MUL]]
+// TILE-NOT: arith.mulf
+// TILE: arith.addf
+// TILE-NOT: __linalg_no_fuse__
+func.func @no_fuse(%a: tensor<2048x2048xf32>, %b: tensor<2048x2048xf32>) -> tensor<2048x2048xf32> {
+  %init = tensor.empty() : tensor<2048x2048xf32>
+  %mul = linalg.generic {indexing_maps = [affine_map<(d0, d1) -> (d0, d1)>, affine_map<(d0, d1) -> (d0, d1)>, affine_map<(d0, d1) -> (d0, d1)>],
+                         iterator_types = ["parallel", "parallel"]}
+      ins(%a, %b : tensor<2048x2048xf32>, tensor<2048x2048xf32>) outs(%init : tensor<2048x2048xf32>) {
+  ^bb0(%x: f32, %y: f32, %out: f32):
+    %0 = arith.mulf %x, %y : f32
+    linalg.yield %0 : f32
+  } -> tensor<2048x2048xf32>
+  %add = linalg.generic {indexing_maps = [affine_map<(d0, d1) -> (d0, d1)>, affine_map<(d0, d1) -> (d0, d1)>, affine_map<(d0, d1) -> (d0, d1)>],
+                         iterator_types = ["parallel", "parallel"]}
+      ins(%mul, %mul : tensor<2048x2048xf32>, tensor<2048x2048xf32>) outs(%init : tensor<2048x2048xf32>) {
+  ^bb0(%x: f32, %y: f32, %out: f32):
+    %0 = arith.addf %x, %y : f32
+    linalg.yield %0 : f32
+  } -> tensor<2048x2048xf32>
+  return %add : tensor<2048x2048xf32>
+}
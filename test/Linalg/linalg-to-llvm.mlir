@@ -0,0 +1,23 @@
+// RUN: rm -rf %t && mkdir -p %t && cd %t
+// RUN: cd %t && python3 -c "from mlir_shell import top_to_linalg, linalg_to_llvmir; top_to_linalg('%s', 'net_linalg.mlir'); linalg_to_llvmir('net_linalg.mlir', 'net.ll')"
+// RUN: FileCheck %s --input-file=%t/net.ll
+
+// A small Top net lowered like model_deploy --cpu_backend linalg does. The
+// result is written to a caller buffer, the 1KB temporaries live on the stack.
+// CHECK:           define void @main(
+// CHECK-NOT:       @malloc
+// CHECK:           define void @_mlir_ciface_main(
+#loc = loc(unknown)
+module @AddMul attributes {module.FLOPs = 512 : i64, module.asymmetric = false, module.chip = "ALL", module.cores = 1 : i64, module.devices = 1 : i64, module.mode = "F32", module.platform = "ONNX", module.state = "TOP_F32", module.weight_file = "addmul_top_f32_all_weight.npz"} {
+  func.func @main(%arg0: tensor<1x4x8x8xf32> loc(unknown), %arg1: tensor<1x4x8x8xf32> loc(unknown)) -> tensor<1x4x8x8xf32> {
+    %0 = "top.Input"(%arg0) : (tensor<1x4x8x8xf32>) -> tensor<1x4x8x8xf32> loc(#loc1)
+    %1 = "top.Input"(%arg1) : (tensor<1x4x8x8xf32>) -> tensor<1x4x8x8xf32> loc(#loc2)
+    %2 = "top.Add"(%0, %1) : (tensor<1x4x8x8xf32>, tensor<1x4x8x8xf32>) -> tensor<1x4x8x8xf32> loc(#loc3)
+    %3 = "top.Mul"(%2, %0) : (tensor<1x4x8x8xf32>, tensor<1x4x8x8xf32>) -> tensor<1x4x8x8xf32> loc(#loc4)
+    return %3 : tensor<1x4x8x8xf32> loc(#loc)
+  } loc(#loc)
+} loc(#loc)
+#loc1 = loc("a")
+#loc2 = loc("b")
+#loc3 = loc("s")
+#loc4 = loc("y")
@@ -0,0 +1,22 @@
+// RUN: tpuc-test %s --codegen-tile-and-fuse-greedily="tile-size=32" --cse | FileCheck %s
+
+// CHECK-LABEL: func.func @matmul_relu
+// CHECK: scf.for
+// CHECK: scf.for
+// CHECK: linalg.matmul
+// CHECK: linalg.generic
+func.func @matmul_relu(%a: tensor<128x256xf32>, %b: tensor<256x64xf32>) -> tensor<128x64xf32> {
+  %zero = arith.constant 0.0 : f32
+  %init = tensor.empty() : tensor<128x64xf32>
+  %fill = linalg.fill ins(%zero : f32) outs(%init : tensor<128x64xf32>) -> tensor<128x64xf32>
+  %mm = linalg.matmul ins(%a, %b : tensor<128x256xf32>, tensor<256x64xf32>)
+                      outs(%fill : tensor<128x64xf32>) -> tensor<128x64xf32>
+  %relu = linalg.generic {indexing_maps = [affine_map<(d0, d1) -> (d0, d1)>, affine_map<(d0, d1) -> (d0, d1)>],
+                          iterator_types = ["parallel", "parallel"]}
+      ins(%mm : tensor<128x64xf32>) outs(%init : tensor<128x64xf32>) {
+  ^bb0(%in: f32, %out: f32):
+    %0 = arith.maxf %in, %zero : f32
+    linalg.yield %0 : f32
+  } -> tensor<128x64xf32>
+  return %relu : tensor<128x64xf32>
+}
@@ -0,0 +1,27 @@
+// RUN: rm -rf %t.cache
+// RUN: env SOURCE_DATE_EPOCH=0 tpuc-opt %s --codegen="model_file=%t.0.bmodel embed_debug_info=false cache_dir=%t.cache" -o %t.0.mlir
+// RUN: ls %t.cache | FileCheck %s
+// RUN: env SOURCE_DATE_EPOCH=0 tpuc-opt %s --codegen="model_file=%t.1.bmodel embed_debug_info=false cache_dir=%t.cache" -o %t.1.mlir
+// RUN: cmp %t.0.bmodel %t.1.bmodel
+
+// the first build stores the commands of the subnet, the second one reuses
+// them and must give the same bmodel
+// CHECK:           {{[0-9a-f]+}}.cmd
+#loc = loc(unknown)
+module @AddConst attributes {module.FLOPs = 16384 : i64, module.asymmetric = false, module.chip = "bm1688", module.cores = 1 : i64, module.devices = 1 : i64, module.inputs = ["in_0"], module.mode = "F32", module.outputs = ["y1"], module.platform = "ONNX", module.state = "TPU_ADDRESSED", module.weight_file = "addconst_tpu_addressed_bm1688_f32_weight.npz"} {
+  module @AddConst attributes {module.coeff_addr = 4294967296 : i64, module.coeff_size = 0 : i64, module.device_id = 0 : i64, module.neuron_addr = 4294967296 : i64, module.neuron_size = 98304 : i64, module.step = 0 : i64} {
+    func.func @main(%arg0: tensor<1x8x32x32xf32> loc(unknown)) -> tensor<1x8x32x32xf32, 4295000064 : i64> {
+      %0 = "top.Input"(%arg0) : (tensor<1x8x32x32xf32>) -> tensor<1x8x32x32xf32, 4294967296 : i64> loc(#loc1)
+      %1 = call @subfunc_0(%0) : (tensor<1x8x32x32xf32, 4294967296 : i64>) -> tensor<1x8x32x32xf32, 4295000064 : i64> loc(#loc)
+      return %1 : tensor<1x8x32x32xf32, 4295000064 : i64> loc(#loc)
+    } loc(#loc)
+    func.func @subfunc_0(%arg0: tensor<1x8x32x32xf32, 4294967296 : i64> loc(unknown)) -> tensor<1x8x32x32xf32, 4295000064 : i64> attributes {id = 0 : i64, mode = #tpu<run_mode TPU_STATIC>, next_index = array<i32: -1>} {
+      %0 = "tpu.AddConst"(%arg0) {const_val = 1.000000e+00 : f64, do_relu = false, f8_scale = 1.000000e+00 : f64, multiplier = 1 : si32, relu_limit = -1.000000e+00 : f64, rshift = 0 : si32} : (tensor<1x8x32x32xf32, 4294967296 : i64>) -> tensor<1x8x32x32xf32, 4295032832 : i64> loc(#loc2)
+      %1 = "tpu.AddConst"(%0) {const_val = 2.000000e+00 : f64, do_relu = false, f8_scale = 1.000000e+00 : f64, multiplier = 1 : si32, relu_limit = -1.000000e+00 : f64, rshift = 0 : si32} : (tensor<1x8x32x32xf32, 4295032832 : i64>) -> tensor<1x8x32x32xf32, 4295000064 : i64> loc(#loc3)
+      return %1 : tensor<1x8x32x32xf32, 4295000064 : i64> loc(#loc)
+    } loc(#loc)
+  } loc(#loc)
+} loc(#loc)
+#loc1 = loc("in_0")
+#loc2 = loc("y0")
+#loc3 = loc("y1")
@@ -0,0 +1,22 @@
+// RUN: tpuc-opt --dev-parallel="mode=data" %s | FileCheck %s
+
+// CHECK-LABEL:     module @AddConst_0_0 attributes {module.device_id = 0 : i64, module.step = 0 : i64}
+// CHECK:           "top.Input"(%arg0) : (tensor<2x8x32x32xf32>) -> tensor<2x8x32x32xf32> loc(#[[IN0:.*]])
+// CHECK:           "tpu.AddConst"{{.*}} -> tensor<2x8x32x32xf32> loc(#[[Y0:.*]])
+// CHECK-LABEL:     module @AddConst_0_1 attributes {module.device_id = 1 : i64, module.step = 0 : i64}
+// CHECK:           "top.Input"(%arg0) : (tensor<2x8x32x32xf32>) -> tensor<2x8x32x32xf32> loc(#[[IN1:.*]])
+// CHECK:           "tpu.AddConst"{{.*}} -> tensor<2x8x32x32xf32> loc(#[[Y1:.*]])
+// CHECK-DAG:       #[[IN0]] = loc("in_0_0")
+// CHECK-DAG:       #[[Y0]] = loc("y_0")
+// CHECK-DAG:       #[[IN1]] = loc("in_0_1")
+// CHECK-DAG:       #[[Y1]] = loc("y_1")
+#loc = loc(unknown)
+module @AddConst attributes {module.FLOPs = 32768 : i64, module.asymmetric = false, module.chip = "bm1688", module.cores = 1 : i64, module.devices = 2 : i64, module.mode = "F32", module.platform = "ONNX", module.state = "TPU_LOWERED", module.w8a16_linear = false, module.weight_file = "addconst_tpu_lowered_bm1688_f32_weight.npz"} {
+  func.func @main(%arg0: tensor<4x8x32x32xf32> loc(unknown)) -> tensor<4x8x32x32xf32> {
+    %0 = "top.Input"(%arg0) : (tensor<4x8x32x32xf32>) -> tensor<4x8x32x32xf32> loc(#loc1)
+    %1 = "tpu.AddConst"(%0) {const_val = 3.000000e+00 : f64, do_relu = false, f8_scale = 1.000000e+00 : f64, multiplier = 1 : si32, relu_limit = -1.000000e+00 : f64, rshift = 0 : si32} : (tensor<4x8x32x32xf32>) -> tensor<4x8x32x32xf32> loc(#loc2)
+    return %1 : tensor<4x8x32x32xf32> loc(#loc)
+  } loc(#loc)
+} loc(#loc)
+#loc1 = loc("in_0")
+#loc2 = loc("y")
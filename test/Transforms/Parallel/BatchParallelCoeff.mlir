@@ -0,0 +1,18 @@
+// RUN: rm -rf %t && mkdir -p %t && cd %t && python3 -c "import numpy as np; np.savez('batch_coeff_weight.npz', w=np.arange(8192, dtype=np.float32).reshape(1, 8, 32, 32))"
+// RUN: cd %t && tpuc-opt %s --dev-parallel="mode=data" --weight-reorder --subnet-divide="dynamic=false" --address-assign -o final.mlir
+// RUN: cd %t && tpuc-opt final.mlir --codegen="model_file=net.bmodel embed_debug_info=false" -o /dev/null
+// RUN: cd %t && python3 -c "import numpy as np; n = open('net.bmodel', 'rb').read().count(np.arange(8192, dtype=np.float32).tobytes()); assert n == 1, n"
+
+// Both devices hold a clone of w, the bmodel keeps one copy of their coeff.
+#loc = loc(unknown)
+module @BatchCoeff attributes {module.FLOPs = 32768 : i64, module.asymmetric = false, module.chip = "bm1688", module.cores = 1 : i64, module.devices = 2 : i64, module.mode = "F32", module.platform = "ONNX", module.state = "TPU_LOWERED", module.w8a16_linear = false, module.weight_file = "batch_coeff_weight.npz"} {
+  func.func @main(%arg0: tensor<4x8x32x32xf32> loc(unknown)) -> tensor<4x8x32x32xf32> {
+    %0 = "top.Input"(%arg0) : (tensor<4x8x32x32xf32>) -> tensor<4x8x32x32xf32> loc(#loc1)
+    %1 = "top.Weight"() : () -> tensor<1x8x32x32xf32> loc(#loc2)
+    %2 = "tpu.Add"(%0, %1) {do_relu = false, relu_limit = -1.000000e+00 : f64} : (tensor<4x8x32x32xf32>, tensor<1x8x32x32xf32>) -> tensor<4x8x32x32xf32> loc(#loc3)
+    return %2 : tensor<4x8x32x32xf32> loc(#loc)
+  } loc(#loc)
+} loc(#loc)
+#loc1 = loc("in_0")
+#loc2 = loc("w")
+#loc3 = loc("y")
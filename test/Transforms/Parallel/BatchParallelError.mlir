@@ -0,0 +1,15 @@
+// RUN: not tpuc-opt --dev-parallel="mode=data" %s 2>&1 | FileCheck %s
+
+// A batch of 3 can not be split to 2 devices, the pass fails instead of
+// running the whole batch on one device.
+// CHECK:           error: data parallel mode needs all inputs to share a batch divisible by 2 devices
+#loc = loc(unknown)
+module @AddConst attributes {module.FLOPs = 24576 : i64, module.asymmetric = false, module.chip = "bm1688", module.cores = 1 : i64, module.devices = 2 : i64, module.mode = "F32", module.platform = "ONNX", module.state = "TPU_LOWERED", module.w8a16_linear = false, module.weight_file = "addconst_tpu_lowered_bm1688_f32_weight.npz"} {
+  func.func @main(%arg0: tensor<3x8x32x32xf32> loc(unknown)) -> tensor<3x8x32x32xf32> {
+    %0 = "top.Input"(%arg0) : (tensor<3x8x32x32xf32>) -> tensor<3x8x32x32xf32> loc(#loc1)
+    %1 = "tpu.AddConst"(%0) {const_val = 3.000000e+00 : f64, do_relu = false, f8_scale = 1.000000e+00 : f64, multiplier = 1 : si32, relu_limit = -1.000000e+00 : f64, rshift = 0 : si32} : (tensor<3x8x32x32xf32>) -> tensor<3x8x32x32xf32> loc(#loc2)
+    return %1 : tensor<3x8x32x32xf32> loc(#loc)
+  } loc(#loc)
+} loc(#loc)
+#loc1 = loc("in_0")
+#loc2 = loc("y")
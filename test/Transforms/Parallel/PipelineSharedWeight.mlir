@@ -0,0 +1,35 @@
+// RUN: rm -rf %t && mkdir -p %t && cd %t && python3 -c "import numpy as np; np.savez('pipeline_shared_weight.npz', w=np.ones((1, 8, 1, 1), np.float32))"
+// RUN: cd %t && tpuc-opt --dev-parallel="mode=pipeline" %s | FileCheck %s
+
+// A weight read by both stages is held by each device, the later stage reads
+// a clone of it.
+// CHECK-LABEL:     module @SharedWeight_0_0 attributes {module.device_id = 0 : i64, module.step = 0 : i64}
+// CHECK:           %[[W0:.*]] = "top.Weight"() : () -> tensor<1x8x1x1xf32> loc(#[[W0_LOC:.*]])
+// CHECK:           "tpu.Add"(%{{.*}}, %[[W0]])
+// CHECK:           "tpu.AddConst"
+// CHECK-NOT:       "tpu.Add
+// CHECK-LABEL:     module @SharedWeight_1_1 attributes {module.device_id = 1 : i64, module.step = 1 : i64}
+// CHECK:           "tpu.AddConst"
+// CHECK:           %[[W1:.*]] = "top.Weight"() : () -> tensor<1x8x1x1xf32> loc(#[[W1_LOC:.*]])
+// CHECK:           "tpu.Add"(%{{.*}}, %[[W1]])
+// CHECK-NOT:       "tpu.Add
+// CHECK-DAG:       #[[W0_LOC]] = loc("w")
+// CHECK-DAG:       #[[W1_LOC]] = loc("w_stage1")
+#loc = loc(unknown)
+module @SharedWeight attributes {module.FLOPs = 131072 : i64, module.asymmetric = false, module.chip = "bm1688", module.cores = 1 : i64, module.devices = 2 : i64, module.mode = "F32", module.platform = "ONNX", module.state = "TPU_LOWERED", module.w8a16_linear = false, module.weight_file = "pipeline_shared_weight.npz"} {
+  func.func @main(%arg0: tensor<4x8x32x32xf32> loc(unknown)) -> tensor<4x8x32x32xf32> {
+    %0 = "top.Input"(%arg0) : (tensor<4x8x32x32xf32>) -> tensor<4x8x32x32xf32> loc(#loc1)
+    %1 = "top.Weight"() : () -> tensor<1x8x1x1xf32> loc(#loc2)
+    %2 = "tpu.Add"(%0, %1) {do_relu = false, relu_limit = -1.000000e+00 : f64} : (tensor<4x8x32x32xf32>, tensor<1x8x1x1xf32>) -> tensor<4x8x32x32xf32> loc(#loc3)
+    %3 = "tpu.AddConst"(%2) {const_val = 1.000000e+00 : f64, do_relu = false, f8_scale = 1.000000e+00 : f64, multiplier = 1 : si32, relu_limit = -1.000000e+00 : f64, rshift = 0 : si32} : (tensor<4x8x32x32xf32>) -> tensor<4x8x32x32xf32> loc(#loc4)
+    %4 = "tpu.AddConst"(%3) {const_val = 2.000000e+00 : f64, do_relu = false, f8_scale = 1.000000e+00 : f64, multiplier = 1 : si32, relu_limit = -1.000000e+00 : f64, rshift = 0 : si32} : (tensor<4x8x32x32xf32>) -> tensor<4x8x32x32xf32> loc(#loc5)
+    %5 = "tpu.Add"(%4, %1) {do_relu = false, relu_limit = -1.000000e+00 : f64} : (tensor<4x8x32x32xf32>, tensor<1x8x1x1xf32>) -> tensor<4x8x32x32xf32> loc(#loc6)
+    return %5 : tensor<4x8x32x32xf32> loc(#loc)
+  } loc(#loc)
+} loc(#loc)
+#loc1 = loc("in_0")
+#loc2 = loc("w")
+#loc3 = loc("y0")
+#loc4 = loc("y1")
+#loc5 = loc("y2")
+#loc6 = loc("y3")
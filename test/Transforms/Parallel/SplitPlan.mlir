@@ -0,0 +1,39 @@
+// RUN: tpuc-opt --core-parallel -split-input-file %s | FileCheck %s
+
+// Splitting C halves the bytes of each core, it beats one batch per core.
+#loc = loc(unknown)
+module @AddConst attributes {module.FLOPs = 49152 : i64, module.asymmetric = false, module.chip = "sg2260", module.cores = 8 : i64, module.mode = "F32", module.platform = "ONNX", module.state = "TPU_LOWERED", module.w8a16_linear = false, module.weight_file = "addconst_tpu_lowered_sg2260_f32_weight.npz"} {
+  func.func @main(%arg0: tensor<3x64x16x16xf32> loc(unknown)) -> tensor<3x64x16x16xf32> {
+    %0 = "top.Input"(%arg0) : (tensor<3x64x16x16xf32>) -> tensor<3x64x16x16xf32> loc(#loc1)
+    %1 = "tpu.AddConst"(%0) {const_val = 3.000000e+00 : f64, do_relu = false, f8_scale = 1.000000e+00 : f64, multiplier = 1 : si32, relu_limit = -1.000000e+00 : f64, rshift = 0 : si32} : (tensor<3x64x16x16xf32>) -> tensor<3x64x16x16xf32> loc(#loc2)
+    return %1 : tensor<3x64x16x16xf32> loc(#loc)
+  } loc(#loc)
+} loc(#loc)
+#loc1 = loc("in_0")
+#loc2 = loc("y")
+
+// CHECK-LABEL:     "tpu.CoreParallel"(%0) ({
+// CHECK:           %[[SPLIT:.*]]:6 = "tpu.Split"(%0) : (tensor<3x64x16x16xf32>) -> (tensor<1x32x16x16xf32>, tensor<1x32x16x16xf32>, tensor<1x32x16x16xf32>, tensor<1x32x16x16xf32>, tensor<1x32x16x16xf32>, tensor<1x32x16x16xf32>) loc({{.*}})
+// CHECK-COUNT-6:   "tpu.AddConst"(%[[SPLIT]]#{{[0-5]}}) {{{.*}}} : (tensor<1x32x16x16xf32>) -> tensor<1x32x16x16xf32> loc({{.*}})
+// CHECK:           %[[JOIN:.*]] = "tpu.Join"({{.*}}) : ({{.*}}) -> tensor<3x64x16x16xf32> loc({{.*}})
+// CHECK:           "tpu.Yield"(%[[JOIN]]) : (tensor<3x64x16x16xf32>) -> () loc({{.*}})
+// CHECK:             }) : (tensor<3x64x16x16xf32>) -> tensor<3x64x16x16xf32> loc({{.*}})
+
+// -----
+
+// No slice is cheaper than the whole tensor, it stays on a single core.
+#loc = loc(unknown)
+module @AddConstTiny attributes {module.FLOPs = 2 : i64, module.asymmetric = false, module.chip = "bm1688", module.cores = 2 : i64, module.mode = "F32", module.platform = "ONNX", module.state = "TPU_LOWERED", module.w8a16_linear = false, module.weight_file = "addconsttiny_tpu_lowered_bm1688_f32_weight.npz"} {
+  func.func @main(%arg0: tensor<1x2x1x1xf32> loc(unknown)) -> tensor<1x2x1x1xf32> {
+    %0 = "top.Input"(%arg0) : (tensor<1x2x1x1xf32>) -> tensor<1x2x1x1xf32> loc(#loc1)
+    %1 = "tpu.AddConst"(%0) {const_val = 3.000000e+00 : f64, do_relu = false, f8_scale = 1.000000e+00 : f64, multiplier = 1 : si32, relu_limit = -1.000000e+00 : f64, rshift = 0 : si32} : (tensor<1x2x1x1xf32>) -> tensor<1x2x1x1xf32> loc(#loc2)
+    return %1 : tensor<1x2x1x1xf32> loc(#loc)
+  } loc(#loc)
+} loc(#loc)
+#loc1 = loc("in_0")
+#loc2 = loc("y")
+
+// CHECK-LABEL:     module @AddConstTiny
+// CHECK-NOT:       "tpu.CoreParallel"
+// CHECK:           "tpu.AddConst"(%0) {{{.*}}} : (tensor<1x2x1x1xf32>) -> tensor<1x2x1x1xf32> loc({{.*}})
+// CHECK-NOT:       "tpu.Split"
@@ -11,8 +11,10 @@
 #include <fstream>
 #include <unistd.h>
 #include <iostream>
+#include <map>
 #include <set>
 #include <string>
+#include <tuple>
 #include <vector>
 #include <sys/stat.h>
 #include "tpu_mlir/Builder/BM168x/bmodel.hpp"
@@ -140,10 +142,7 @@ void bm_show(const string &filename, bool all) {
   if (!kernel_module) {
     cout << "no kernel_module" << endl;
   } else {
-    auto module_binary = kernel_module->binary();
-    size_t module_size = module_binary->size();
-    std::unique_ptr<uint8_t[]> binary(new uint8_t[module_size]);
-    model_ctx.read_binary(module_binary, binary.get());
+    size_t module_size = kernel_module->binary()->size();
     cout << "kernel_module name: " << kernel_module->file_name()->c_str()
          << endl;
     cout << "kernel_module size: " << module_size << endl;
@@ -185,6 +184,18 @@ void bm_show(const string &filename, bool all) {
       if (subnet != NULL && subnet->size() > 1) {
         cout << "subnet number: " << subnet->size() << endl;
       }
+      auto coeff = net_param->coeff_mem();
+      if (coeff != NULL && coeff->binary_coeff() != NULL && i > 0) {
+        for (uint32_t j = 0; j < i; j++) {
+          auto pre_coeff = parameter->Get(j)->coeff_mem();
+          if (pre_coeff != NULL && pre_coeff->binary_coeff() != NULL &&
+              pre_coeff->binary_coeff()->start() ==
+                  coeff->binary_coeff()->start()) {
+            cout << "coeff shared with stage " << j << endl;
+            break;
+          }
+        }
+      }
       show(parameter->Get(i), is_dynamic);
     }
   }
@@ -271,6 +282,36 @@ void bm_show_dynamic(const string &filename) {
   }
 }
 
+// binary of a source bmodel: model_ctx, start, size
+typedef tuple<ModelCtx *, uint64_t, uint64_t> BINARY_SRC_T;
+// binaries read out of unmapped bmodels, kept until model_gen is saved
+static map<BINARY_SRC_T, shared_ptr<vector<uint8_t>>> g_binary_holder;
+// binaries known to be the same as an earlier one, such as coeffs of stages
+static map<BINARY_SRC_T, BINARY_SRC_T> g_binary_alias;
+
+// add binary of model_ctx to model_gen, the data is written from the
+// source bmodel when model_gen is saved
+static Binary copy_binary(ModelGen &model_gen, ModelCtx &model_ctx,
+                          const Binary *binary) {
+  BINARY_SRC_T src(&model_ctx, binary->start(), binary->size());
+  auto iter = g_binary_alias.find(src);
+  if (iter != g_binary_alias.end()) {
+    src = iter->second;
+  }
+  auto src_ctx = get<0>(src);
+  Binary src_binary(get<1>(src), get<2>(src));
+  auto data = src_ctx->binary_data(&src_binary);
+  if (data == NULL) {
+    auto &holder = g_binary_holder[src];
+    if (holder == NULL) {
+      holder = make_shared<vector<uint8_t>>(src_binary.size());
+      src_ctx->read_binary(&src_binary, holder->data());
+    }
+    data = holder->data();
+  }
+  return model_gen.WriteBinaryRef(src_binary.size(), data);
+}
+
 // update binary data when copy one net to new flatbuffers
 // it's a little complicated, using reflection of flatbuffers
 static void update_table(Table *table, const StructDef *struct_def,
@@ -285,11 +326,8 @@ static void update_table(Table *table, const StructDef *struct_def,
       if (next_def->fixed) {
         if (next_def->name == "Binary") {
           auto binary = table->GetStruct<Binary *>(fd->value.offset);
-          uint8_t *data = new uint8_t[binary->size()];
-          model_ctx.read_binary(binary, data);
-          auto new_binary = model_gen.WriteBinary(binary->size(), data);
+          auto new_binary = copy_binary(model_gen, model_ctx, binary);
           binary->mutate_start(new_binary.start());
-          delete[] data;
         }
       } else {
         auto next_pointer = table->GetPointer<void *>(fd->value.offset);
@@ -312,11 +350,8 @@ static void update_table(Table *table, const StructDef *struct_def,
                next_id++) {
             auto next_pointer = vector_pointer->GetMutableObject(next_id);
             auto binary = reinterpret_cast<Binary *>(next_pointer);
-            uint8_t *data = new uint8_t[binary->size()];
-            model_ctx.read_binary(binary, data);
-            auto new_binary = model_gen.WriteBinary(binary->size(), data);
+            auto new_binary = copy_binary(model_gen, model_ctx, binary);
             binary->mutate_start(new_binary.start());
-            delete[] data;
           }
         }
         break;
@@ -383,7 +418,7 @@ void bm_extract(const string &filename) {
       continue;
     }
     for (uint32_t idx = 0; idx < net->parameter()->size(); idx++) {
-      ModelGen model_gen(model_ctx.header().binary_size);
+      ModelGen model_gen(0);
       auto &builder = model_gen.Builder();
       auto parameter = net->parameter()->Get(idx);
       auto netT = parameter->UnPack();
@@ -406,9 +441,9 @@ void bm_extract(const string &filename) {
 typedef struct {
   uint32_t net_idx;
   uint32_t stage_idx;
-  char *input;
+  uint64_t input_offset;
   size_t input_size;
-  char *output;
+  uint64_t output_offset;
   size_t output_size;
 } NET_INDEX_T;
 
@@ -439,14 +474,28 @@ static size_t tensor_bytes(const Vector<Offset<Tensor>> *tensor) {
   return size;
 }
 
+// only record where the reference data is, it's copied when writing
 static void read_input_output_ref(const NetParameter *param, ifstream &fin_ref,
                                   ifstream &fout_ref, NET_INDEX_T *net_idx) {
   net_idx->input_size = tensor_bytes(param->input_tensor());
   net_idx->output_size = tensor_bytes(param->output_tensor());
-  net_idx->input = new char[net_idx->input_size];
-  net_idx->output = new char[net_idx->output_size];
-  fin_ref.read(net_idx->input, net_idx->input_size);
-  fout_ref.read(net_idx->output, net_idx->output_size);
+  net_idx->input_offset = fin_ref.tellg();
+  net_idx->output_offset = fout_ref.tellg();
+  fin_ref.seekg(net_idx->input_size, ios::cur);
+  fout_ref.seekg(net_idx->output_size, ios::cur);
+}
+
+static void copy_stream(ifstream &fin, uint64_t offset, size_t size,
+                        ofstream &fout) {
+  const size_t chunk_size = 0x1000000;
+  vector<char> buffer(std::min(size, chunk_size));
+  fin.seekg(offset, ios::beg);
+  while (size > 0) {
+    size_t len = std::min(size, chunk_size);
+    fin.read(buffer.data(), len);
+    fout.write(buffer.data(), len);
+    size -= len;
+  }
 }
 
 static bool write_input_output_ref(vector<shared_ptr<MODEL_CTX_T>> &model_vec,
@@ -454,10 +503,10 @@ static bool write_input_output_ref(vector<shared_ptr<MODEL_CTX_T>> &model_vec,
   for (auto &model_info : model_vec) {
     for (auto &net_index : model_info->net_index_v) {
       if (net_index->net_idx == net_idx && net_index->stage_idx == stage_idx) {
-        g_input_ref->write(net_index->input, net_index->input_size);
-        g_output_ref->write(net_index->output, net_index->output_size);
-        delete[] net_index->input;
-        delete[] net_index->output;
+        copy_stream(model_info->input_f, net_index->input_offset,
+                    net_index->input_size, *g_input_ref);
+        copy_stream(model_info->output_f, net_index->output_offset,
+                    net_index->output_size, *g_output_ref);
         return true;
       }
     }
@@ -480,9 +529,41 @@ static void write_input_output_ref(vector<shared_ptr<MODEL_CTX_T>> &model_vec) {
   }
 }
 
+// coeffs with the same check code are stored once, shared by all stages.
+// each stage keeps its own CoeffMem address, the runtime loads coeffs of
+// the same check code once and relocates them for each stage
+static void share_same_coeff(vector<shared_ptr<MODEL_CTX_T>> &model_vec) {
+  map<pair<string, uint64_t>, BINARY_SRC_T> coeff_map;
+  for (auto &model_info : model_vec) {
+    auto model_ctx = model_info->model_ctx.get();
+    auto nets = model_ctx->model()->net();
+    for (uint32_t net_idx = 0; net_idx < nets->size(); net_idx++) {
+      auto params = nets->Get(net_idx)->parameter();
+      if (params == NULL) {
+        continue;
+      }
+      for (uint32_t idx = 0; idx < params->size(); idx++) {
+        auto coeff = params->Get(idx)->coeff_mem();
+        if (coeff == NULL || coeff->check_code() == NULL ||
+            coeff->binary_coeff() == NULL) {
+          continue;
+        }
+        auto binary = coeff->binary_coeff();
+        BINARY_SRC_T src(model_ctx, binary->start(), binary->size());
+        string code(coeff->check_code()->begin(), coeff->check_code()->end());
+        auto iter = coeff_map.emplace(make_pair(code, binary->size()), src);
+        if (!iter.second && iter.first->second != src) {
+          g_binary_alias[src] = iter.first->second;
+        }
+      }
+    }
+  }
+}
+
 static void combine_bmodels(ModelGen &model_gen,
                             vector<shared_ptr<MODEL_CTX_T>> &model_vec,
                             bool is_dir = false) {
+  share_same_coeff(model_vec);
   model_gen.AddChip(model_vec[0]->model_ctx->model()->chip()->str());
   auto &builder = model_gen.Builder();
   bool kernel_load = false;
@@ -496,14 +577,11 @@ static void combine_bmodels(ModelGen &model_gen,
     if (kernel_load == false) {
       auto km = model->kernel_module();
       if (km) {
-        auto binary = km->binary();
-        uint8_t *data = new uint8_t[binary->size()];
-        model_info->model_ctx->read_binary(binary, data);
-        auto new_binary = model_gen.WriteBinary(binary->size(), data);
+        auto new_binary =
+            copy_binary(model_gen, *model_info->model_ctx, km->binary());
         auto filename = km->file_name()->str();
         model_gen.AddKernelModule(filename, new_binary);
         kernel_load = true;
-        delete[] data;
       }
     }
     for (uint32_t net_idx = 0; net_idx < model->net()->size(); net_idx++) {
@@ -625,7 +703,7 @@ void bm_combine_bmodels(int argc, char **argv, bool is_dir = false) {
     model_vec.push_back(model_info);
   }
   prepare_output(ofile, is_dir);
-  ModelGen model_gen;
+  ModelGen model_gen(0);
   combine_bmodels(model_gen, model_vec, is_dir);
   model_gen.Save(ofile);
   cout << "Success: combined to [" << ofile << "]." << endl;
@@ -662,11 +740,15 @@ void bm_dump_binary(int argc, char **argv) {
   if (!ofile) {
     FATAL("save file[%s] failed\n", argv[5]);
   }
-  uint8_t *data = new uint8_t[size];
   Binary binary(start, size);
-  model.read_binary(&binary, data);
-  ofile.write((char *)data, size);
+  auto data = model.binary_data(&binary);
+  if (data != NULL) {
+    ofile.write((const char *)data, size);
+  } else {
+    vector<uint8_t> buffer(size);
+    model.read_binary(&binary, buffer.data());
+    ofile.write((char *)buffer.data(), size);
+  }
   ofile.close();
-  delete[] data;
   printf("save file[%s] success\n", argv[5]);
 }
@@ -210,9 +210,14 @@ static void dump_kernel_module(int argc, char **argv) {
     if (!ofile) {
       FATAL("save file[%s] failed\n", save_name.c_str());
     }
-    std::unique_ptr<uint8_t> binary(new uint8_t[binary_size]);
-    model_ctx.read_binary(module_binary, binary.get());
-    ofile.write((char*)binary.get(), binary_size);
+    auto data = model_ctx.binary_data(module_binary);
+    if (data != NULL) {
+      ofile.write((const char *)data, binary_size);
+    } else {
+      std::unique_ptr<uint8_t[]> binary(new uint8_t[binary_size]);
+      model_ctx.read_binary(module_binary, binary.get());
+      ofile.write((char *)binary.get(), binary_size);
+    }
     cout << "Success: dump kernel_module to [" << save_name << "]." << endl;
     ofile.close();
   } else {
@@ -12,6 +12,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "tpu_mlir/InitAll.h"
+#include "tpu-mlir/Transforms/Passes.h"
 #include "mlir/Tools/mlir-opt/MlirOptMain.h"
 using namespace mlir;
 
@@ -21,9 +22,13 @@ const std::string PluginPostPass[] = {"--deinit", "--mlir-print-debuginfo"};
 
 int main(int argc, char **argv) {
   tpu_mlir::registerAllPasses();
+  // tile-and-fuse of the linalg cpu backend
+  tpu_mlir::registerTileAndFuseGreedilyPass();
 
   DialectRegistry registry;
   tpu_mlir::registerAllDialects(registry);
+  tpu_mlir::registerDepencyDialect(registry);
+  tpu_mlir::registerCodegenInterfaces(registry);
   if (argc <= 2) {
     return asMainReturnCode(MlirOptMain(
         argc, argv, "TPU MLIR module optimizer driver\n", registry));
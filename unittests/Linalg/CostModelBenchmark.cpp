@@ -0,0 +1,115 @@
+//===-- CostModelBenchmark.cpp - SG2260 tiling choices -------------------===//
+//
+// Copyright (C) 2022 Sophgo Technologies Inc.  All rights reserved.
+//
+// TPU-MLIR is licensed under the 2-Clause BSD License except for the
+// third-party components.
+//
+//===----------------------------------------------------------------------===//
+//
+// Report the estimated cycles of every SG2260 instruction, tile size and
+// fusion choice for representative conv/matmul shapes.
+//
+//===----------------------------------------------------------------------===//
+
+#include "tpu-mlir/Transforms/Benefit.h"
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/Linalg/IR/Linalg.h"
+#include "mlir/Dialect/Tensor/IR/Tensor.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/Parser/Parser.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "gtest/gtest.h"
+
+using namespace mlir;
+using namespace tpu_mlir;
+
+static void benchmark(StringRef name, StringRef source, size_t top = 5) {
+  DialectRegistry registry;
+  registry.insert<arith::ArithDialect, func::FuncDialect,
+                  linalg::LinalgDialect, tensor::TensorDialect>();
+  MLIRContext context(registry);
+  auto module = parseSourceString<ModuleOp>(source, &context);
+  ASSERT_TRUE(module);
+
+  CostModelSearch search(&context);
+  module->walk([&](linalg::LinalgOp op) {
+    if (isa<linalg::FillOp>(op.getOperation()))
+      return;
+    auto choices = search.enumerate(op);
+    llvm::outs() << llvm::formatv("{0}: {1} -> {2} choices\n", name,
+                                  op->getName(), choices.size());
+    EXPECT_FALSE(choices.empty());
+    for (size_t i = 1; i < choices.size(); ++i)
+      EXPECT_LE(choices[i - 1].cycle, choices[i].cycle);
+    for (auto &choice : ArrayRef<ISelChoice>(choices).take_front(top)) {
+      llvm::outs() << "  ";
+      choice.dump(llvm::outs());
+    }
+  });
+}
+
+TEST(CostModelBenchmark, MatMul) {
+  benchmark("matmul 128x512x256", R"mlir(
+    func.func @f(%a: tensor<128x512xf32>, %b: tensor<512x256xf32>,
+                 %c: tensor<128x256xf32>) -> tensor<128x256xf32> {
+      %0 = linalg.matmul ins(%a, %b : tensor<128x512xf32>, tensor<512x256xf32>)
+                         outs(%c : tensor<128x256xf32>) -> tensor<128x256xf32>
+      return %0 : tensor<128x256xf32>
+    })mlir");
+  benchmark("matmul 1024x1024x1024", R"mlir(
+    func.func @f(%a: tensor<1024x1024xf32>, %b: tensor<1024x1024xf32>,
+                 %c: tensor<1024x1024xf32>) -> tensor<1024x1024xf32> {
+      %0 = linalg.matmul ins(%a, %b : tensor<1024x1024xf32>, tensor<1024x1024xf32>)
+                         outs(%c : tensor<1024x1024xf32>) -> tensor<1024x1024xf32>
+      return %0 : tensor<1024x1024xf32>
+    })mlir");
+}
+
+TEST(CostModelBenchmark, Conv) {
+  benchmark("conv1x1 1x64x56x56 -> 128", R"mlir(
+    func.func @f(%x: tensor<1x64x56x56xf32>, %w: tensor<128x64x1x1xf32>,
+                 %y: tensor<1x128x56x56xf32>) -> tensor<1x128x56x56xf32> {
+      %0 = linalg.conv_2d_nchw_fchw
+             {dilations = dense<1> : tensor<2xi64>, strides = dense<1> : tensor<2xi64>}
+             ins(%x, %w : tensor<1x64x56x56xf32>, tensor<128x64x1x1xf32>)
+             outs(%y : tensor<1x128x56x56xf32>) -> tensor<1x128x56x56xf32>
+      return %0 : tensor<1x128x56x56xf32>
+    })mlir");
+  benchmark("conv3x3 1x64x58x58 -> 64", R"mlir(
+    func.func @f(%x: tensor<1x64x58x58xf32>, %w: tensor<64x64x3x3xf32>,
+                 %y: tensor<1x64x56x56xf32>) -> tensor<1x64x56x56xf32> {
+      %0 = linalg.conv_2d_nchw_fchw
+             {dilations = dense<1> : tensor<2xi64>, strides = dense<1> : tensor<2xi64>}
+             ins(%x, %w : tensor<1x64x58x58xf32>, tensor<64x64x3x3xf32>)
+             outs(%y : tensor<1x64x56x56xf32>) -> tensor<1x64x56x56xf32>
+      return %0 : tensor<1x64x56x56xf32>
+    })mlir");
+}
+
+TEST(CostModelBenchmark, FusedElementwise) {
+  // the add producer is either recomputed per tile or written back
+  benchmark("add + max 1x128x64x64", R"mlir(
+    #map = affine_map<(d0, d1, d2, d3) -> (d0, d1, d2, d3)>
+    func.func @f(%a: tensor<1x128x64x64xf32>, %b: tensor<1x128x64x64xf32>,
+                 %c: tensor<1x128x64x64xf32>) -> tensor<1x128x64x64xf32> {
+      %0 = linalg.generic {indexing_maps = [#map, #map, #map],
+                           iterator_types = ["parallel", "parallel", "parallel", "parallel"]}
+             ins(%a, %b : tensor<1x128x64x64xf32>, tensor<1x128x64x64xf32>)
+             outs(%c : tensor<1x128x64x64xf32>) {
+      ^bb0(%x: f32, %y: f32, %z: f32):
+        %s = arith.addf %x, %y : f32
+        linalg.yield %s : f32
+      } -> tensor<1x128x64x64xf32>
+      %1 = linalg.generic {indexing_maps = [#map, #map, #map],
+                           iterator_types = ["parallel", "parallel", "parallel", "parallel"]}
+             ins(%0, %b : tensor<1x128x64x64xf32>, tensor<1x128x64x64xf32>)
+             outs(%c : tensor<1x128x64x64xf32>) {
+      ^bb0(%x: f32, %y: f32, %z: f32):
+        %m = arith.maxf %x, %y : f32
+        linalg.yield %m : f32
+      } -> tensor<1x128x64x64xf32>
+      return %1 : tensor<1x128x64x64xf32>
+    })mlir");
+}
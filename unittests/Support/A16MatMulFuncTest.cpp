@@ -0,0 +1,155 @@
+//===----------------------------------------------------------------------===//
+//
+// Copyright (C) 2022 Sophgo Technologies Inc.  All rights reserved.
+//
+// TPU-MLIR is licensed under the 2-Clause BSD License except for the
+// third-party components.
+//
+//===----------------------------------------------------------------------===//
+
+#include "tpu_mlir/Support/A16MatMulFunc.h"
+#include "gtest/gtest.h"
+#include <random>
+
+using namespace tpu_mlir;
+
+static a16_matmul_attr_t make_attr(int64_t M, int64_t K, int64_t N,
+                                   int64_t bits, bool sign, bool w_transpose,
+                                   int64_t group_size) {
+  a16_matmul_attr_t attr = {};
+  attr.M = M;
+  attr.K = K;
+  attr.N = N;
+  attr.bits = bits;
+  attr.sign = sign;
+  attr.w_transpose = w_transpose;
+  attr.group_size = group_size;
+  return attr;
+}
+
+static std::vector<float> random_data(size_t size, float lo, float hi,
+                                      std::mt19937 &gen) {
+  std::uniform_real_distribution<float> dist(lo, hi);
+  std::vector<float> data(size);
+  for (auto &x : data) {
+    x = dist(gen);
+  }
+  return data;
+}
+
+// random quantized values of the stored weight, in storage order
+static std::vector<int> random_q(const a16_matmul_attr_t &attr,
+                                 std::mt19937 &gen) {
+  int lo = 0, hi = 15;
+  if (attr.bits == 8) {
+    lo = attr.sign ? -128 : 0;
+    hi = attr.sign ? 127 : 255;
+  }
+  std::uniform_int_distribution<int> dist(lo, hi);
+  std::vector<int> q(attr.K * attr.N);
+  for (auto &x : q) {
+    x = dist(gen);
+  }
+  return q;
+}
+
+// the weight operand of A16MatMul, one byte value per float
+static std::vector<float> pack(const a16_matmul_attr_t &attr,
+                               const std::vector<int> &q) {
+  if (attr.bits == 8) {
+    return std::vector<float>(q.begin(), q.end());
+  }
+  std::vector<float> packed(q.size() / 2);
+  for (size_t i = 0; i < packed.size(); ++i) {
+    packed[i] = q[2 * i] | (q[2 * i + 1] << 4);
+  }
+  return packed;
+}
+
+// dequantizes the whole weight to [K, N], then multiplies
+static std::vector<float> naive_a16_matmul(const a16_matmul_attr_t &attr,
+                                           const float *x,
+                                           const std::vector<int> &q,
+                                           const float *scale, const float *zp,
+                                           const float *bias) {
+  const int64_t K = attr.K, N = attr.N;
+  const int64_t cols = attr.w_transpose ? K : N;
+  std::vector<float> w(K * N);
+  for (int64_t k = 0; k < K; ++k) {
+    for (int64_t n = 0; n < N; ++n) {
+      const int64_t r = attr.w_transpose ? n : k;
+      const int64_t idx = r * cols + (attr.w_transpose ? k : n);
+      const int64_t pi = attr.group_size ? idx / attr.group_size : r;
+      w[k * N + n] = (q[idx] - (zp ? zp[pi] : 0.0f)) * scale[pi];
+    }
+  }
+  std::vector<float> y(attr.M * N);
+  for (int64_t m = 0; m < attr.M; ++m) {
+    for (int64_t n = 0; n < N; ++n) {
+      double acc = bias ? bias[n] : 0;
+      for (int64_t k = 0; k < K; ++k) {
+        acc += x[m * K + k] * w[k * N + n];
+      }
+      y[m * N + n] = acc;
+    }
+  }
+  return y;
+}
+
+static void check(const a16_matmul_attr_t &attr, bool with_zp, bool with_bias,
+                  unsigned seed) {
+  std::mt19937 gen(seed);
+  const int64_t rows = attr.w_transpose ? attr.N : attr.K;
+  const int64_t num_param =
+      attr.group_size ? attr.K * attr.N / attr.group_size : rows;
+  auto x = random_data(attr.M * attr.K, -1.0f, 1.0f, gen);
+  auto q = random_q(attr, gen);
+  auto scale = random_data(num_param, 0.001f, 0.02f, gen);
+  std::vector<float> zp;
+  if (with_zp) {
+    std::uniform_int_distribution<int> dist(0, 15);
+    for (int64_t i = 0; i < num_param; ++i) {
+      zp.push_back(dist(gen));
+    }
+  }
+  auto bias = random_data(attr.N, -1.0f, 1.0f, gen);
+  const float *zp_ptr = with_zp ? zp.data() : nullptr;
+  const float *bias_ptr = with_bias ? bias.data() : nullptr;
+  auto weight = pack(attr, q);
+  A16MatMulFunc func(attr, weight.data(), scale.data(), zp_ptr);
+  std::vector<float> y(attr.M * attr.N);
+  func.run(x.data(), bias_ptr, y.data());
+  auto ref = naive_a16_matmul(attr, x.data(), q, scale.data(), zp_ptr,
+                              bias_ptr);
+  for (size_t i = 0; i < y.size(); ++i) {
+    EXPECT_NEAR(y[i], ref[i], 1e-3) << "at " << i;
+  }
+  // again through a caller's workspace, which must not change the result
+  std::vector<float> scratch(func.workspace_size());
+  std::vector<float> y2(y.size());
+  func.run(x.data(), bias_ptr, y2.data(), scratch.data());
+  EXPECT_EQ(y, y2);
+}
+
+// [N, K] weight grouped along K, K spans two tiles and N two column blocks
+TEST(A16MatMulFunc, Int4GroupTranspose) {
+  check(make_attr(3, 320, 70, 4, false, true, 64), true, true, 0);
+}
+
+// [K, N] weight grouped along N, groups smaller than a column block
+TEST(A16MatMulFunc, Int4GroupNoTranspose) {
+  check(make_attr(2, 40, 96, 4, false, false, 16), true, false, 1);
+}
+
+// an odd row length, so every other row starts at a high nibble
+TEST(A16MatMulFunc, Int4PerChannelOddRow) {
+  check(make_attr(2, 6, 33, 4, false, false, 0), true, true, 2);
+}
+
+TEST(A16MatMulFunc, Int8SignedPerChannel) {
+  check(make_attr(4, 300, 130, 8, true, true, 0), false, true, 3);
+}
+
+TEST(A16MatMulFunc, Int8UnsignedGroup) {
+  check(make_attr(2, 20, 140, 8, false, false, 20), false, false, 4);
+}
@@ -0,0 +1,151 @@
+//===----------------------------------------------------------------------===//
+//
+// Copyright (C) 2022 Sophgo Technologies Inc.  All rights reserved.
+//
+// TPU-MLIR is licensed under the 2-Clause BSD License except for the
+// third-party components.
+//
+//===----------------------------------------------------------------------===//
+
+#include "tpu_mlir/Support/AttentionFunc.h"
+#include "gtest/gtest.h"
+#include <cmath>
+#include <limits>
+#include <random>
+
+using namespace tpu_mlir;
+
+static attention_attr_t f32_attr(int64_t batch, int64_t q_heads,
+                                 int64_t kv_heads, int64_t M_q, int64_t M_k,
+                                 int64_t d) {
+  attention_attr_t attr = {};
+  attr.batch = batch;
+  attr.q_heads = q_heads;
+  attr.kv_heads = kv_heads;
+  attr.M_q = M_q;
+  attr.M_k = M_k;
+  attr.d = d;
+  attr.scale = 1.0f / std::sqrt((float)d);
+  attr.mode = ATTN_F32;
+  return attr;
+}
+
+static std::vector<float> random_data(size_t size, std::mt19937 &gen) {
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  std::vector<float> data(size);
+  for (auto &x : data) {
+    x = dist(gen);
+  }
+  return data;
+}
+
+// one query at a time over the whole score row
+static std::vector<float> naive_attention(const attention_attr_t &attr,
+                                          const float *q, const float *k,
+                                          const float *v, const float *mask) {
+  const int64_t d = attr.d;
+  const int64_t kv_stride = attr.kv_batch_stride
+                                ? attr.kv_batch_stride
+                                : attr.M_k * attr.kv_heads * d;
+  std::vector<float> o(attr.batch * attr.M_q * attr.q_heads * d);
+  std::vector<double> s(attr.M_k);
+  for (int64_t b = 0; b < attr.batch; ++b) {
+    for (int64_t h = 0; h < attr.q_heads; ++h) {
+      const int64_t kvh = h / (attr.q_heads / attr.kv_heads);
+      for (int64_t i = 0; i < attr.M_q; ++i) {
+        const float *q_row = q + ((b * attr.M_q + i) * attr.q_heads + h) * d;
+        int64_t keys = attr.causal ? attr.M_k - attr.M_q + i + 1 : attr.M_k;
+        double max = -std::numeric_limits<double>::infinity();
+        for (int64_t j = 0; j < keys; ++j) {
+          const float *k_row =
+              k + b * kv_stride + (j * attr.kv_heads + kvh) * d;
+          double dot = 0;
+          for (int64_t e = 0; e < d; ++e) {
+            dot += q_row[e] * k_row[e];
+          }
+          s[j] = dot * attr.scale +
+                 (mask ? mask[b * attr.mask_batch_stride + j] : 0);
+          max = std::max(max, s[j]);
+        }
+        double sum = 0;
+        for (int64_t j = 0; j < keys; ++j) {
+          s[j] = std::exp(s[j] - max);
+          sum += s[j];
+        }
+        float *o_row = o.data() + ((b * attr.M_q + i) * attr.q_heads + h) * d;
+        for (int64_t e = 0; e < d; ++e) {
+          double acc = 0;
+          for (int64_t j = 0; j < keys; ++j) {
+            acc += s[j] * v[b * kv_stride + (j * attr.kv_heads + kvh) * d + e];
+          }
+          o_row[e] = acc / sum;
+        }
+      }
+    }
+  }
+  return o;
+}
+
+static void expect_near(const std::vector<float> &out,
+                        const std::vector<float> &ref) {
+  ASSERT_EQ(out.size(), ref.size());
+  for (size_t i = 0; i < out.size(); ++i) {
+    EXPECT_NEAR(out[i], ref[i], 1e-4) << "at " << i;
+  }
+}
+
+// queries and keys span several tiles, the new tokens are the last M_q keys
+TEST(AttentionFunc, Causal) {
+  std::mt19937 gen(0);
+  auto attr = f32_attr(1, 2, 2, 20, 70, 8);
+  attr.causal = true;
+  auto q = random_data(attr.M_q * attr.q_heads * attr.d, gen);
+  auto k = random_data(attr.M_k * attr.kv_heads * attr.d, gen);
+  auto v = random_data(attr.M_k * attr.kv_heads * attr.d, gen);
+  std::vector<float> o(q.size());
+  AttentionFunc(attr).run(q.data(), k.data(), v.data(), nullptr, nullptr,
+                          o.data());
+  expect_near(o, naive_attention(attr, q.data(), k.data(), v.data(), nullptr));
+}
+
+// two query heads share each kv head, with a mask shared by batches
+TEST(AttentionFunc, GroupedKVHeads) {
+  std::mt19937 gen(1);
+  auto attr = f32_attr(2, 4, 2, 5, 33, 16);
+  auto q = random_data(attr.batch * attr.M_q * attr.q_heads * attr.d, gen);
+  auto k = random_data(attr.batch * attr.M_k * attr.kv_heads * attr.d, gen);
+  auto v = random_data(attr.batch * attr.M_k * attr.kv_heads * attr.d, gen);
+  auto mask = random_data(attr.M_k, gen);
+  std::vector<float> o(q.size());
+  AttentionFunc(attr).run(q.data(), k.data(), v.data(), mask.data(), nullptr,
+                          o.data());
+  expect_near(o, naive_attention(attr, q.data(), k.data(), v.data(),
+                                 mask.data()));
+}
+
+// k and v are read in place from a kv cache with room for more tokens, the
+// slots past M_k are never read
+TEST(AttentionFunc, StridedKVBatch) {
+  std::mt19937 gen(2);
+  const int64_t capacity = 48;
+  auto attr = f32_attr(2, 2, 1, 3, 40, 8);
+  attr.causal = true;
+  attr.kv_batch_stride = capacity * attr.kv_heads * attr.d;
+  attr.mask_batch_stride = attr.M_k;
+  auto q = random_data(attr.batch * attr.M_q * attr.q_heads * attr.d, gen);
+  auto k = random_data(attr.batch * attr.kv_batch_stride, gen);
+  auto v = random_data(attr.batch * attr.kv_batch_stride, gen);
+  for (int64_t b = 0; b < attr.batch; ++b) {
+    for (int64_t i = attr.M_k * attr.kv_heads * attr.d;
+         i < attr.kv_batch_stride; ++i) {
+      k[b * attr.kv_batch_stride + i] = std::nanf("");
+      v[b * attr.kv_batch_stride + i] = std::nanf("");
+    }
+  }
+  auto mask = random_data(attr.batch * attr.M_k, gen);
+  std::vector<float> o(q.size());
+  AttentionFunc(attr).run(q.data(), k.data(), v.data(), mask.data(), nullptr,
+                          o.data());
+  expect_near(o, naive_attention(attr, q.data(), k.data(), v.data(),
+                                 mask.data()));
+}